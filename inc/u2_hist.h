@@ -0,0 +1,144 @@
+/*
+ * u2_hist: fixed-memory log-linear latency histogram (HDR-style).
+ *
+ * values below 2^U2_HIST_SUB_BITS get a bucket each; above that every power
+ * of two is split into 2^(U2_HIST_SUB_BITS - 1) linear buckets, i.e. reported
+ * values are within 1/64 (~1.6%) of the recorded ones. unit-agnostic: callers
+ * record cycles or nanoseconds as they see fit.
+ *
+ * Author(s)
+ *   azq    @qzan9    anzhongqi@ncic.ac.cn
+ */
+
+#ifndef __U2_HIST_H__
+#define __U2_HIST_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#define U2_HIST_SUB_BITS        (7)
+#define U2_HIST_SUB             (1 << U2_HIST_SUB_BITS)
+#define U2_HIST_HALF            (U2_HIST_SUB / 2)
+#define U2_HIST_BUCKETS         (U2_HIST_SUB + (64 - U2_HIST_SUB_BITS) * U2_HIST_HALF)
+
+struct u2_hist {
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	uint64_t sum;
+	uint64_t bucket[U2_HIST_BUCKETS];
+};
+
+static inline void
+u2_hist_init(struct u2_hist *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min = UINT64_MAX;
+}
+
+static inline uint32_t
+u2_hist_index(uint64_t v)
+{
+	uint32_t shift;
+
+	if (v < U2_HIST_SUB) {
+		return v;
+	}
+
+	shift = 63 - __builtin_clzll(v) - U2_HIST_SUB_BITS + 1;
+	return U2_HIST_SUB + (shift - 1) * U2_HIST_HALF + ((v >> shift) - U2_HIST_HALF);
+}
+
+/*
+ * highest value that lands in bucket idx.
+ */
+static inline uint64_t
+u2_hist_highest(uint32_t idx)
+{
+	uint32_t shift;
+	uint64_t sub;
+
+	if (idx < U2_HIST_SUB) {
+		return idx;
+	}
+
+	shift = (idx - U2_HIST_SUB) / U2_HIST_HALF + 1;
+	sub = (idx - U2_HIST_SUB) % U2_HIST_HALF + U2_HIST_HALF;
+	return ((sub + 1) << shift) - 1;    // wraps to UINT64_MAX for the very last bucket.
+}
+
+static inline void
+u2_hist_record(struct u2_hist *h, uint64_t v)
+{
+	h->bucket[u2_hist_index(v)]++;
+	h->count++;
+	h->sum += v;
+	if (v < h->min) {
+		h->min = v;
+	}
+	if (v > h->max) {
+		h->max = v;
+	}
+}
+
+static inline void
+u2_hist_merge(struct u2_hist *dst, const struct u2_hist *src)
+{
+	uint32_t i;
+
+	if (!src->count) {
+		return;
+	}
+
+	for (i = 0; i < U2_HIST_BUCKETS; i++) {
+		dst->bucket[i] += src->bucket[i];
+	}
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->min < dst->min) {
+		dst->min = src->min;
+	}
+	if (src->max > dst->max) {
+		dst->max = src->max;
+	}
+}
+
+/*
+ * value at percentile pct (0 - 100], clamped to the recorded [min, max].
+ */
+static inline uint64_t
+u2_hist_value_at(const struct u2_hist *h, double pct)
+{
+	uint64_t target, seen, v;
+	double rank;
+	uint32_t i;
+
+	if (!h->count) {
+		return 0;
+	}
+
+	rank = h->count * pct / 100.0;
+	target = (uint64_t)rank;
+	if (target < rank || target < 1) {    // ceil(), at least the first value.
+		target++;
+	}
+
+	seen = 0;
+	for (i = 0; i < U2_HIST_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if (seen >= target) {
+			break;
+		}
+	}
+
+	v = i < U2_HIST_BUCKETS ? u2_hist_highest(i) : h->max;
+	return v > h->max ? h->max : (v < h->min ? h->min : v);
+}
+
+static inline uint64_t
+u2_hist_mean(const struct u2_hist *h)
+{
+	return h->count ? h->sum / h->count : 0;
+}
+
+#endif /* __U2_HIST_H__ */
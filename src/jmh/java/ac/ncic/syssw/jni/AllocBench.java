@@ -0,0 +1,50 @@
+/*
+ * Copyleft 2016, AZQ. All rites reversed.
+ */
+
+package ac.ncic.syssw.jni;
+
+import java.nio.ByteBuffer;
+import java.util.concurrent.TimeUnit;
+
+import org.openjdk.jmh.annotations.Benchmark;
+import org.openjdk.jmh.annotations.BenchmarkMode;
+import org.openjdk.jmh.annotations.Fork;
+import org.openjdk.jmh.annotations.Measurement;
+import org.openjdk.jmh.annotations.Mode;
+import org.openjdk.jmh.annotations.OutputTimeUnit;
+import org.openjdk.jmh.annotations.Param;
+import org.openjdk.jmh.annotations.Scope;
+import org.openjdk.jmh.annotations.State;
+import org.openjdk.jmh.annotations.Warmup;
+
+/**
+ * cost of getting an I/O buffer: hugepage alloc + free, served by the size-class buffer pool, against
+ * ByteBuffer.allocateDirect(), whose release is left to the GC.
+ */
+@BenchmarkMode(Mode.AverageTime)
+@OutputTimeUnit(TimeUnit.NANOSECONDS)
+@Warmup(iterations = 3, time = 1)
+@Measurement(iterations = 5, time = 1)
+@Fork(1)
+public class AllocBench {
+
+	@State(Scope.Thread)
+	public static class Sizes {
+
+		@Param({"4096", "131072", "2097152"})
+		public int size;
+	}
+
+	@Benchmark
+	public ByteBuffer hugepage(NvmeDevice device, Sizes sizes) {
+		ByteBuffer buffer = JniNvme.allocateHugepageMemory(sizes.size);
+		JniNvme.freeHugepageMemory(buffer);
+		return buffer;
+	}
+
+	@Benchmark
+	public ByteBuffer allocateDirect(Sizes sizes) {
+		return ByteBuffer.allocateDirect(sizes.size);
+	}
+}
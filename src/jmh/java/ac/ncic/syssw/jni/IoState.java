@@ -0,0 +1,32 @@
+/*
+ * Copyleft 2016, AZQ. All rites reversed.
+ */
+
+package ac.ncic.syssw.jni;
+
+/**
+ * per-thread I/O bookkeeping shared by the benchmark states: ioSize-aligned random offsets within span.
+ */
+abstract class IoState {
+
+	int ioSize;
+	long ios;
+	long seed;
+
+	void span(int ioSize, long span) {
+		this.ioSize = ioSize;
+		this.ios = span / ioSize;
+		this.seed = System.nanoTime() ^ Thread.currentThread().getId() * 0x9e3779b97f4a7c15L | 1;
+		if (ios == 0) {
+			throw new IllegalStateException("I/O size " + ioSize + " exceeds " + span);
+		}
+	}
+
+	// xorshift64*, cheap enough not to show up next to the I/O.
+	long nextOffset() {
+		seed ^= seed >>> 12;
+		seed ^= seed << 25;
+		seed ^= seed >>> 27;
+		return ((seed * 0x2545f4914f6cdd1dL) >>> 1) % ios * ioSize;
+	}
+}
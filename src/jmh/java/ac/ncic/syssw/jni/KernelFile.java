@@ -0,0 +1,54 @@
+/*
+ * Copyleft 2016, AZQ. All rites reversed.
+ */
+
+package ac.ncic.syssw.jni;
+
+import java.io.IOException;
+import java.nio.MappedByteBuffer;
+import java.nio.channels.FileChannel;
+import java.nio.file.Paths;
+import java.nio.file.StandardOpenOption;
+
+import org.openjdk.jmh.annotations.Level;
+import org.openjdk.jmh.annotations.Scope;
+import org.openjdk.jmh.annotations.Setup;
+import org.openjdk.jmh.annotations.State;
+import org.openjdk.jmh.annotations.TearDown;
+
+/**
+ * the kernel path to compare against: -Djninvme.file (a preallocated file, or a block device together with
+ * -Djninvme.file.size; defaults to -Djninvme.path) through FileChannel and a MappedByteBuffer over its first 2GB.
+ *
+ * java 8 can not open O_DIRECT, so these go through the page cache.
+ */
+@State(Scope.Benchmark)
+public class KernelFile {
+
+	public FileChannel channel;
+	public MappedByteBuffer mapped;
+	public long size;
+	public int mappedSize;
+
+	@Setup(Level.Trial)
+	public void setUp() throws IOException {
+		String path = System.getProperty("jninvme.file", System.getProperty("jninvme.path"));
+		if (path == null) {
+			throw new IllegalStateException("-Djninvme.file not set");
+		}
+
+		channel = FileChannel.open(Paths.get(path), StandardOpenOption.READ, StandardOpenOption.WRITE);
+		size = Long.getLong("jninvme.file.size", channel.size());    // fstat() says 0 for block devices.
+		if (size < 4096) {
+			throw new IllegalStateException(path + ": unknown size, set -Djninvme.file.size");
+		}
+
+		mappedSize = (int) Math.min(size, Integer.MAX_VALUE) & ~4095;
+		mapped = channel.map(FileChannel.MapMode.READ_WRITE, 0, mappedSize);
+	}
+
+	@TearDown(Level.Trial)
+	public void tearDown() throws IOException {
+		channel.close();
+	}
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyleft 2016, AZQ. All rites reversed.
+ */
+
+package ac.ncic.syssw.jni;
+
+import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.util.concurrent.TimeUnit;
+
+import org.openjdk.jmh.annotations.Benchmark;
+import org.openjdk.jmh.annotations.BenchmarkMode;
+import org.openjdk.jmh.annotations.Fork;
+import org.openjdk.jmh.annotations.Level;
+import org.openjdk.jmh.annotations.Measurement;
+import org.openjdk.jmh.annotations.Mode;
+import org.openjdk.jmh.annotations.OutputTimeUnit;
+import org.openjdk.jmh.annotations.Param;
+import org.openjdk.jmh.annotations.Scope;
+import org.openjdk.jmh.annotations.Setup;
+import org.openjdk.jmh.annotations.State;
+import org.openjdk.jmh.annotations.TearDown;
+import org.openjdk.jmh.annotations.Threads;
+import org.openjdk.jmh.annotations.Warmup;
+
+/**
+ * QD1 random I/O latency: one synchronous request at a time, sampled per call so the JSON carries percentiles.
+ *
+ * the write benchmarks overwrite random blocks of the device/file.
+ */
+@BenchmarkMode(Mode.SampleTime)
+@OutputTimeUnit(TimeUnit.MICROSECONDS)
+@Warmup(iterations = 3, time = 2)
+@Measurement(iterations = 5, time = 2)
+@Threads(1)
+@Fork(1)
+public class LatencyBench {
+
+	@State(Scope.Thread)
+	public static class NvmeIo extends IoState {
+
+		@Param({"4096", "65536", "1048576"})
+		public int size;
+
+		ByteBuffer buffer;
+
+		@Setup(Level.Trial)
+		public void setUp(NvmeDevice device) {
+			span(size, device.size);
+			buffer = JniNvme.allocateHugepageMemory(size);
+		}
+
+		@TearDown(Level.Trial)
+		public void tearDown() {
+			JniNvme.freeHugepageMemory(buffer);
+		}
+	}
+
+	@State(Scope.Thread)
+	public static class FileIo extends IoState {
+
+		@Param({"4096", "65536", "1048576"})
+		public int size;
+
+		ByteBuffer buffer;
+
+		@Setup(Level.Trial)
+		public void setUp(KernelFile file) {
+			span(size, file.size);
+			buffer = ByteBuffer.allocateDirect(size);
+		}
+	}
+
+	@State(Scope.Thread)
+	public static class MappedIo extends IoState {
+
+		@Param({"4096", "65536", "1048576"})
+		public int size;
+
+		ByteBuffer buffer;
+		ByteBuffer mapped;
+
+		@Setup(Level.Trial)
+		public void setUp(KernelFile file) {
+			span(size, file.mappedSize);
+			buffer = ByteBuffer.allocateDirect(size);
+			mapped = file.mapped.duplicate();
+		}
+	}
+
+	@Benchmark
+	public void nvmeRead(NvmeIo io) {
+		JniNvme.nvmeRead(io.buffer, io.nextOffset(), io.ioSize);
+	}
+
+	@Benchmark
+	public void nvmeWrite(NvmeIo io) {
+		JniNvme.nvmeWrite(io.buffer, io.nextOffset(), io.ioSize);
+	}
+
+	@Benchmark
+	public int fileChannelRead(KernelFile file, FileIo io) throws IOException {
+		io.buffer.clear();
+		return file.channel.read(io.buffer, io.nextOffset());
+	}
+
+	@Benchmark
+	public int fileChannelWrite(KernelFile file, FileIo io) throws IOException {
+		io.buffer.clear();
+		return file.channel.write(io.buffer, io.nextOffset());
+	}
+
+	// a "read" out of the mapping is a copy into a direct buffer, page faults included.
+	@Benchmark
+	public ByteBuffer mappedRead(MappedIo io) {
+		int offset = (int) io.nextOffset();
+		io.mapped.limit(offset + io.ioSize).position(offset);
+		io.buffer.clear();
+		return io.buffer.put(io.mapped);
+	}
+
+	@Benchmark
+	public ByteBuffer mappedWrite(MappedIo io) {
+		int offset = (int) io.nextOffset();
+		io.mapped.limit(offset + io.ioSize).position(offset);
+		io.buffer.clear();
+		return io.mapped.put(io.buffer);
+	}
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyleft 2016, AZQ. All rites reversed.
+ */
+
+package ac.ncic.syssw.jni;
+
+import java.io.File;
+import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.file.Files;
+import java.nio.file.Paths;
+import java.util.concurrent.TimeUnit;
+
+import org.openjdk.jmh.annotations.Benchmark;
+import org.openjdk.jmh.annotations.BenchmarkMode;
+import org.openjdk.jmh.annotations.Fork;
+import org.openjdk.jmh.annotations.Level;
+import org.openjdk.jmh.annotations.Measurement;
+import org.openjdk.jmh.annotations.Mode;
+import org.openjdk.jmh.annotations.OutputTimeUnit;
+import org.openjdk.jmh.annotations.Param;
+import org.openjdk.jmh.annotations.Scope;
+import org.openjdk.jmh.annotations.Setup;
+import org.openjdk.jmh.annotations.State;
+import org.openjdk.jmh.annotations.TearDown;
+import org.openjdk.jmh.annotations.Threads;
+import org.openjdk.jmh.annotations.Warmup;
+
+/**
+ * QD1 random I/O latency with the calling thread and its buffer on the NUMA node of controller 0 ("local") or on
+ * another one ("remote"), sampled per call. pollers and the buffer pool stay where libjninvme put them.
+ *
+ * on a single-node machine, or where the device's node is unknown, both placements are the same.
+ * the write benchmark overwrites random blocks of the device/file.
+ */
+@BenchmarkMode(Mode.SampleTime)
+@OutputTimeUnit(TimeUnit.MICROSECONDS)
+@Warmup(iterations = 3, time = 2)
+@Measurement(iterations = 5, time = 2)
+@Threads(1)
+@Fork(1)
+public class NumaBench {
+
+	@State(Scope.Thread)
+	public static class NvmeIo extends IoState {
+
+		@Param({"local", "remote"})
+		public String placement;
+
+		@Param({"4096", "131072"})
+		public int size;
+
+		ByteBuffer buffer;
+
+		@Setup(Level.Trial)
+		public void setUp(NvmeDevice device) {
+			span(size, device.size);
+			int local = JniNvme.nvmeGetNumaNode(0);
+			int node = "local".equals(placement) ? local : otherNode(local);
+			if (node < 0 || node == local && !"local".equals(placement)) {
+				System.err.println("no " + placement + " NUMA node for controller 0 (node " + local + ")");
+			}
+			if (node >= 0) {
+				JniNvme.nvmeBindNode(node);
+			}
+			buffer = JniNvme.allocateHugepageMemory(size, false, node);
+		}
+
+		@TearDown(Level.Trial)
+		public void tearDown() {
+			JniNvme.freeHugepageMemory(buffer);
+			JniNvme.nvmeBindNode(-1);
+		}
+
+		// the first node with CPUs other than node, or node itself.
+		static int otherNode(int node) {
+			String[] entries = new File("/sys/devices/system/node").list();
+			if (node < 0 || entries == null) {
+				return node;
+			}
+			for (String entry : entries) {
+				if (!entry.matches("node[0-9]+")) {
+					continue;
+				}
+				int other = Integer.parseInt(entry.substring(4));
+				if (other != node && hasCpus(entry)) {
+					return other;
+				}
+			}
+			return node;
+		}
+
+		// memory-only nodes have an empty cpulist.
+		static boolean hasCpus(String entry) {
+			try {
+				return !new String(Files.readAllBytes(Paths.get("/sys/devices/system/node", entry, "cpulist"))).trim().isEmpty();
+			} catch (IOException e) {
+				return false;
+			}
+		}
+	}
+
+	@Benchmark
+	public void nvmeRead(NvmeIo io) {
+		JniNvme.nvmeRead(io.buffer, io.nextOffset(), io.ioSize);
+	}
+
+	@Benchmark
+	public void nvmeWrite(NvmeIo io) {
+		JniNvme.nvmeWrite(io.buffer, io.nextOffset(), io.ioSize);
+	}
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyleft 2016, AZQ. All rites reversed.
+ */
+
+package ac.ncic.syssw.jni;
+
+import org.openjdk.jmh.annotations.Level;
+import org.openjdk.jmh.annotations.Scope;
+import org.openjdk.jmh.annotations.Setup;
+import org.openjdk.jmh.annotations.State;
+import org.openjdk.jmh.annotations.TearDown;
+
+/**
+ * one JniNvme instance per fork, shared by all benchmark threads; backend picked as in RunJniNvme
+ * (-Djninvme.backend/path/sqpoll).
+ */
+@State(Scope.Benchmark)
+public class NvmeDevice {
+
+	public long size;
+
+	@Setup(Level.Trial)
+	public void setUp() {
+		RunJniNvme.initialize();
+		size = JniNvme.nvmeGetSize();
+	}
+
+	@TearDown(Level.Trial)
+	public void tearDown() {
+		JniNvme.nvmeFinalize();
+	}
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyleft 2016, AZQ. All rites reversed.
+ */
+
+package ac.ncic.syssw.jni;
+
+import java.nio.ByteBuffer;
+import java.util.concurrent.TimeUnit;
+
+import org.openjdk.jmh.annotations.Benchmark;
+import org.openjdk.jmh.annotations.BenchmarkMode;
+import org.openjdk.jmh.annotations.Fork;
+import org.openjdk.jmh.annotations.Group;
+import org.openjdk.jmh.annotations.GroupThreads;
+import org.openjdk.jmh.annotations.Level;
+import org.openjdk.jmh.annotations.Measurement;
+import org.openjdk.jmh.annotations.Mode;
+import org.openjdk.jmh.annotations.OutputTimeUnit;
+import org.openjdk.jmh.annotations.Param;
+import org.openjdk.jmh.annotations.Scope;
+import org.openjdk.jmh.annotations.Setup;
+import org.openjdk.jmh.annotations.State;
+import org.openjdk.jmh.annotations.TearDown;
+import org.openjdk.jmh.annotations.Warmup;
+
+/**
+ * mixed load: one thread doing QD1 4KB random reads next to BULK threads writing large blocks, sampled per call.
+ * with prioritized, the reader runs at PRIO_HIGH and the writers at PRIO_LOW, otherwise everything is PRIO_NORMAL;
+ * compare the reader's p99 between the two (-Djninvme.wrr=true for the device's arbitration where it has it).
+ *
+ * the writers overwrite random blocks of the device/file.
+ */
+@BenchmarkMode(Mode.SampleTime)
+@OutputTimeUnit(TimeUnit.MICROSECONDS)
+@Warmup(iterations = 3, time = 2)
+@Measurement(iterations = 5, time = 2)
+@Fork(1)
+public class PriorityBench {
+
+	public static final int BULK = 3;
+
+	@State(Scope.Group)
+	public static class Mix {
+
+		@Param({"false", "true"})
+		public boolean prioritized;
+
+		@Param({"1048576"})
+		public int bulkSize;
+	}
+
+	@State(Scope.Thread)
+	public static class Foreground extends IoState {
+
+		ByteBuffer buffer;
+
+		@Setup(Level.Trial)
+		public void setUp(NvmeDevice device, Mix mix) {
+			span(4096, device.size);
+			buffer = JniNvme.allocateHugepageMemory(4096);
+			JniNvme.nvmeSetPriority(mix.prioritized ? JniNvme.PRIO_HIGH : JniNvme.PRIO_NORMAL);
+		}
+
+		@TearDown(Level.Trial)
+		public void tearDown() {
+			JniNvme.nvmeSetPriority(JniNvme.PRIO_NORMAL);
+			JniNvme.freeHugepageMemory(buffer);
+		}
+	}
+
+	@State(Scope.Thread)
+	public static class Background extends IoState {
+
+		ByteBuffer buffer;
+
+		@Setup(Level.Trial)
+		public void setUp(NvmeDevice device, Mix mix) {
+			span(mix.bulkSize, device.size);
+			buffer = JniNvme.allocateHugepageMemory(mix.bulkSize);
+			JniNvme.nvmeSetPriority(mix.prioritized ? JniNvme.PRIO_LOW : JniNvme.PRIO_NORMAL);
+		}
+
+		@TearDown(Level.Trial)
+		public void tearDown() {
+			JniNvme.nvmeSetPriority(JniNvme.PRIO_NORMAL);
+			JniNvme.freeHugepageMemory(buffer);
+		}
+	}
+
+	@Benchmark
+	@Group("mixed")
+	@GroupThreads(1)
+	public void read(Foreground io) {
+		JniNvme.nvmeRead(io.buffer, io.nextOffset(), io.ioSize);
+	}
+
+	@Benchmark
+	@Group("mixed")
+	@GroupThreads(BULK)
+	public void write(Background io) {
+		JniNvme.nvmeWrite(io.buffer, io.nextOffset(), io.ioSize);
+	}
+}
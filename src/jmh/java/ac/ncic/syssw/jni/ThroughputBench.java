@@ -0,0 +1,158 @@
+/*
+ * Copyleft 2016, AZQ. All rites reversed.
+ */
+
+package ac.ncic.syssw.jni;
+
+import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.util.concurrent.TimeUnit;
+
+import org.openjdk.jmh.annotations.Benchmark;
+import org.openjdk.jmh.annotations.BenchmarkMode;
+import org.openjdk.jmh.annotations.Fork;
+import org.openjdk.jmh.annotations.Level;
+import org.openjdk.jmh.annotations.Measurement;
+import org.openjdk.jmh.annotations.Mode;
+import org.openjdk.jmh.annotations.OperationsPerInvocation;
+import org.openjdk.jmh.annotations.OutputTimeUnit;
+import org.openjdk.jmh.annotations.Param;
+import org.openjdk.jmh.annotations.Scope;
+import org.openjdk.jmh.annotations.Setup;
+import org.openjdk.jmh.annotations.State;
+import org.openjdk.jmh.annotations.TearDown;
+import org.openjdk.jmh.annotations.Threads;
+import org.openjdk.jmh.annotations.Warmup;
+
+/**
+ * random read IOPS: DEPTH requests in flight from one thread (batched or async), or THREADS threads at QD1 each.
+ *
+ * scores are I/Os per second; override the thread count with -t.
+ */
+@BenchmarkMode(Mode.Throughput)
+@OutputTimeUnit(TimeUnit.SECONDS)
+@Warmup(iterations = 3, time = 2)
+@Measurement(iterations = 5, time = 2)
+@Fork(1)
+public class ThroughputBench {
+
+	public static final int DEPTH   = 32;
+	public static final int THREADS = 4;
+
+	@State(Scope.Thread)
+	public static class NvmeIo extends IoState {
+
+		@Param({"4096", "131072"})
+		public int size;
+
+		ByteBuffer[] buffers;
+		long[] addresses;
+		long[] tokens;
+		int[] status;
+		NvmeBatch batch;
+
+		@Setup(Level.Trial)
+		public void setUp(NvmeDevice device) {
+			span(size, device.size);
+			buffers = new ByteBuffer[DEPTH];
+			addresses = new long[DEPTH];
+			for (int i = 0; i < DEPTH; i++) {
+				buffers[i] = JniNvme.allocateHugepageMemory(size);
+				addresses[i] = JniNvme.getBufferAddress(buffers[i]);
+			}
+			tokens = new long[DEPTH];
+			status = new int[DEPTH];
+			batch = new NvmeBatch(DEPTH);
+		}
+
+		@TearDown(Level.Trial)
+		public void tearDown() {
+			for (ByteBuffer buffer : buffers) {
+				JniNvme.freeHugepageMemory(buffer);
+			}
+		}
+	}
+
+	@State(Scope.Thread)
+	public static class FileIo extends IoState {
+
+		@Param({"4096", "131072"})
+		public int size;
+
+		ByteBuffer buffer;
+		ByteBuffer mapped;
+
+		@Setup(Level.Trial)
+		public void setUp(KernelFile file) {
+			span(size, file.mappedSize);    // same span for both, so the page cache sees the same working set.
+			buffer = ByteBuffer.allocateDirect(size);
+			mapped = file.mapped.duplicate();
+		}
+	}
+
+	@Benchmark
+	@OperationsPerInvocation(DEPTH)
+	public int nvmeBatch(NvmeIo io) {
+		io.batch.clear();
+		for (int i = 0; i < DEPTH; i++) {
+			io.batch.read(io.addresses[i], io.nextOffset(), io.ioSize);
+		}
+		return io.batch.submit();
+	}
+
+	@Benchmark
+	@OperationsPerInvocation(DEPTH)
+	public int nvmeAsync(NvmeIo io) {
+		int pending = 0;
+		int failed = 0;
+		int n;
+
+		for (int i = 0; i < DEPTH; i++) {
+			while (JniNvme.nvmeReadAsync(io.addresses[i], io.nextOffset(), io.ioSize) < 0) {
+				n = JniNvme.nvmePoll(io.tokens, io.status);
+				failed += failures(io.status, n);
+				pending -= n;
+			}
+			pending++;
+		}
+		while (pending > 0) {
+			n = JniNvme.nvmePoll(io.tokens, io.status);
+			failed += failures(io.status, n);
+			pending -= n;
+		}
+
+		return failed;
+	}
+
+	@Benchmark
+	@Threads(THREADS)
+	public void nvmeThreaded(NvmeIo io) {
+		JniNvme.nvmeRead(io.buffers[0], io.nextOffset(), io.ioSize);
+	}
+
+	@Benchmark
+	@Threads(THREADS)
+	public int fileChannelThreaded(KernelFile file, FileIo io) throws IOException {
+		io.buffer.clear();
+		return file.channel.read(io.buffer, io.nextOffset());
+	}
+
+	@Benchmark
+	@Threads(THREADS)
+	public ByteBuffer mappedThreaded(FileIo io) {
+		int offset = (int) io.nextOffset();
+		io.mapped.limit(offset + io.ioSize).position(offset);
+		io.buffer.clear();
+		return io.buffer.put(io.mapped);
+	}
+
+	private static int failures(int[] status, int n) {
+		int failed = 0;
+		for (int i = 0; i < n; i++) {
+			if (status[i] != 0) {
+				failed++;
+			}
+		}
+		return failed;
+	}
+}
@@ -7,6 +7,9 @@
 
 #ifdef __GNUC__
 #	define _SVID_SOURCE
+#	ifndef _GNU_SOURCE
+#		define _GNU_SOURCE
+#	endif
 #endif /* __GNUC__ */
 
 #include <stdio.h>
@@ -14,39 +17,420 @@
 #include <string.h>
 #include <inttypes.h>
 #include <stddef.h>
+#include <errno.h>
 
 #include <unistd.h>
-
-#include <rte_config.h>
-#include <rte_malloc.h>
-#include <rte_mempool.h>
-
-#include <spdk/nvme.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include <jni.h>
 
-#define U2_REQUEST_POOL_SIZE    (1024)
-#define U2_REQUEST_CACHE_SIZE   (0)
-#define U2_REQUEST_PRIVATE_SIZE (0)
+#include <u2_hist.h>
+
+#include "jninvme.h"
 
-#define U2_NAMESPACE_ID         (1)
 #define U2_BUFFER_ALIGN         (0x200)
 
-static struct spdk_nvme_ctrlr *u2_ctrlr;
+#define U2_IO_DEPTH_DEFAULT     (128)
+#define U2_IO_DEPTH_MAX         (4096)
+#define U2_IO_SYNC_SLOTS        (1)      // request slots async I/O and readahead leave to the thread's sync calls.
+
+#define U2_QPAIR_MAX_DEFAULT    (8)
+#define U2_QPAIR_MAX            (128)
+
+#define U2_REACTOR_MAX          (16)
+#define U2_REACTOR_CTX_MAX      (256)
+#define U2_REACTOR_SPIN_NS      (20000)
+
+#define U2_SHM_SQ_TAIL          (0)      // shared rings: Java-owned index ...
+#define U2_SHM_SQ_HEAD          (64)     // ... native-owned ...
+#define U2_SHM_CQ_TAIL          (128)
+#define U2_SHM_CQ_HEAD          (192)
+#define U2_SHM_HEADER           (256)    // ... each on its own cache line, then the entries.
+
+#define U2_RA_CHUNK             (128 << 10)    // readahead segment: one command.
+#define U2_RA_SEGS              (32)           // max. segments ahead of a stream, i.e. 4MB.
+#define U2_RA_TRIGGER           (2)            // sequential reads in a row that make a stream.
+#define U2_RA_GEN_SHIFT         (20)           // write generations per 1MB region ...
+#define U2_RA_GENS              (4096)         // ... hashed into that many counters.
+
+#define U2_RMW_LOCKS            (64)           // unaligned writes: partial sectors hashed into that many locks.
+
+#define U2_WB_EXTENTS           (8)            // write-back staging: disjoint extents at a time.
+
+#define U2_STRIPE_DEFAULT       (128 << 10)    // striping unit across devices.
+#define U2_NAMESPACE_DEFAULT    (1)            // the one each controller adds to the global volume.
+#define U2_HANDLE_MAX           (64)           // nvmeOpen()ed namespaces at a time.
+
+#define U2_PRIO_LOW_INFLIGHT    (4)            // host-side arbitration: low-priority requests in flight ...
+#define U2_PRIO_IDLE_NS         (1000000)      // ... while other I/O went out that recently (noted ...
+#define U2_PRIO_BUSY_NS         (100000)       // ... at most that often); none is held back ...
+#define U2_PRIO_WAIT_NS         (10000000)     // ... longer than that.
+
+#define U2_RATE_BURST_NS        (10000000)     // handle rate limits: budget that may be used up at once ...
+#define U2_RATE_SPIN_NS         (50000)        // ... and how close to their turn throttled requests sleep.
+
+#define U2_TOKEN(gen, slot)     (((uint64_t)(gen) << 32) | (uint32_t)(slot))
+
+#define U2_OP_READ              (0)
+#define U2_OP_WRITE             (1)
+#define U2_STATUS_PENDING       (INT32_MIN)
+
+#define U2_POOL_SHIFT_MIN       (9)     // 512B
+#define U2_POOL_SHIFT_MAX       (22)    // 4MB
+#define U2_POOL_CLASSES         (U2_POOL_SHIFT_MAX - U2_POOL_SHIFT_MIN + 1)
+#define U2_POOL_SLAB_SIZE       (16 << 20)
+#define U2_POOL_PREALLOC        (64 << 20)
+#define U2_POOL_CACHE_SIZE      (32)
+#define U2_POOL_CACHE_BYTES     (8 << 20)
+#define U2_POOL_PAGE_SIZE       (4096)
+
+#define U2_POOL_STAT_HITS       (0)
+#define U2_POOL_STAT_MISSES     (1)
+#define U2_POOL_STAT_OVERSIZE   (2)
+#define U2_POOL_STAT_IN_USE     (3)
+#define U2_POOL_STAT_RESERVED   (4)
+#define U2_POOL_STATS           (5)
+
+#define U2_LAT_STAT_COUNT       (0)
+#define U2_LAT_STAT_MIN         (1)
+#define U2_LAT_STAT_MAX         (2)
+#define U2_LAT_STAT_MEAN        (3)
+#define U2_LAT_STAT_P50         (4)
+#define U2_LAT_STAT_P90         (5)
+#define U2_LAT_STAT_P99         (6)
+#define U2_LAT_STAT_P999        (7)
+#define U2_LAT_STAT_P9999       (8)
+#define U2_LAT_STATS            (9)
+
+#define U2_IO_STAT_READS        (0)
+#define U2_IO_STAT_WRITES       (1)
+#define U2_IO_STAT_FLUSHES      (2)
+#define U2_IO_STAT_READ_BYTES   (3)
+#define U2_IO_STAT_WRITE_BYTES  (4)
+#define U2_IO_STAT_SUBMIT_FAILS (5)
+#define U2_IO_STAT_SUBMIT_CYCLES (6)   // in submission, or staging for the poller in reactor mode.
+#define U2_IO_STAT_WAIT_CYCLES  (7)    // polling or parked for completions.
+#define U2_IO_STAT_WAITS        (8)
+#define U2_IO_STAT_INFLIGHT_MAX (9)
+#define U2_IO_STAT_PRIO_CYCLES  (10)   // low-priority requests held back by host-side arbitration.
+#define U2_IO_COUNTERS          (11)   // kept per context; the rest is computed.
+#define U2_IO_STAT_INFLIGHT     (11)
+#define U2_IO_STAT_CONTEXTS     (12)
+#define U2_IO_STAT_CYCLES_HZ    (13)
+#define U2_IO_STATS             (14)
+
+#define U2_RATE_STAT_IOPS       (0)    // limits, 0: none.
+#define U2_RATE_STAT_BPS        (1)
+#define U2_RATE_STAT_IOS        (2)    // requests that went through the buckets ...
+#define U2_RATE_STAT_BYTES      (3)
+#define U2_RATE_STAT_THROTTLED  (4)    // ... those of them that had to wait ...
+#define U2_RATE_STAT_THROTTLE_NS (5)   // ... and for how long, in all.
+#define U2_RATE_STAT_BACKLOG_NS (6)    // budget committed beyond now, either bucket.
+#define U2_RATE_STATS           (7)
+
+/*
+ * packed I/O descriptor for nvmeSubmitBatch(), native byte order. status is
+ * written back in place: 0, NVMe (SCT << 8 | SC), or -errno if the entry was
+ * never submitted. tag is scratch space for the native side.
+ */
+struct u2_batch_desc {
+	uint64_t buf;
+	uint64_t offset;
+	uint32_t size;
+	uint16_t opcode;
+	uint16_t flags;
+	int32_t status;
+	uint32_t tag;
+};
+
+/*
+ * backend queues are not thread-safe: a private channel is only ever touched
+ * by its owner thread, the shared one (threads beyond the qpair bound) is locked.
+ */
+struct u2_channel {
+	void *qpair;
+	uint32_t shared;
+	pthread_mutex_t lock;
+};
+
+/*
+ * IOPS and bandwidth limits of a handle, as token buckets kept in virtual time
+ * (GCRA): tat[] is when either bucket would be full again, given what has been
+ * admitted so far. a request moves it on by its cost and goes once no more
+ * than U2_RATE_BURST_NS of it lie ahead of now. that is one CAS per bucket on
+ * submission, with no lock nor timer to refill them, and requests get their
+ * turns in the order they came in.
+ */
+struct u2_rate {
+	uint64_t iops;          // 0: no limit.
+	uint64_t bps;
+	uint64_t tat[2];        // ops, bytes.
+	uint64_t ios;
+	uint64_t bytes;
+	uint64_t throttled;
+	uint64_t throttle_ns;
+} __attribute__((aligned(64)));
+
+/*
+ * a namespace opened on its own (nvmeOpen()): a single-device volume with its
+ * own per-thread channels, bounded by u2_qpair_max like the global ones. no
+ * cache, readahead, write-back nor reactor in between.
+ */
+struct u2_handle {
+	struct u2_volume vol;
+	struct u2_channel shared;
+	uint32_t qpairs;    // private ones, under u2_contexts_lock.
+	uint32_t open;
+	struct u2_rate rate;
+};
+
+/*
+ * shared-memory ring entries (nvmeRingAttach()), native byte order: entries
+ * submission entries follow the header, then as many completion entries.
+ */
+struct u2_shm_sqe {
+	uint64_t buf;
+	uint64_t offset;
+	uint32_t size;
+	uint16_t opcode;
+	uint16_t flags;
+	uint64_t user_data;
+};
+
+struct u2_shm_cqe {
+	uint64_t user_data;
+	int32_t status;
+	uint32_t reserved;
+};
+
+/*
+ * readahead for one sequential stream: a ring of U2_RA_CHUNK segments read
+ * asynchronously into buf, consumed in order by nvmeRead()s that continue the
+ * stream. gen[] are the write generations of the first and last 1MB region a
+ * segment covers as of its submission.
+ */
+struct u2_ra_seg {
+	struct u2_request *req;
+	uint64_t offset;
+	uint64_t size;
+	uint32_t gen[2];
+};
+
+struct u2_ra {
+	uint8_t *buf;        // U2_RA_SEGS segments, allocated with the first stream.
+	uint64_t next;       // where the stream continues.
+	uint64_t issue;      // device offset of the next segment.
+	uint32_t seq;        // sequential reads in a row.
+	uint32_t window;     // segments to keep in flight or ready.
+	uint32_t head;       // oldest segment ...
+	uint32_t tail;       // ... and one past the newest, mod U2_RA_SEGS.
+	struct u2_ra_seg seg[U2_RA_SEGS];
+};
+
+/*
+ * a run of staged (not yet written) bytes, [start, end) on the device; free
+ * while start == end.
+ */
+struct u2_wb_extent {
+	uint8_t *buf;
+	uint64_t start;
+	uint64_t end;
+	uint64_t born_ns;    // first write staged.
+};
+
+struct u2_reactor;
+
+/*
+ * a context's I/O counters, written by the thread submitting on it (the poller
+ * for shared rings) and read racily by getIoStats(); on lines of their own.
+ */
+struct u2_io_stats {
+	int64_t c[U2_IO_COUNTERS];
+} __attribute__((aligned(64)));
+
+/*
+ * per-thread I/O state, created on first use. the request table is private to
+ * the thread even on the shared channel; completions may then come in on
+ * another thread (or a poller in reactor mode), hence the completion ring is
+ * single-producer/single-consumer and inflight is atomic.
+ */
+struct u2_context {
+	struct u2_channel *ch;
+	struct u2_channel own;
+	struct u2_context *next;
+
+	struct u2_request *reqs;
+	struct u2_request *parts;      // striped volumes: u2_vol.ndev per request ...
+	struct u2_sgl *part_sgls;      // ... and their sgls.
+	uint32_t *free_slots;
+	uint32_t free_count;
+	uint32_t depth;
+	uint32_t inflight;
+
+	uint32_t *cpl_ring;    // completed async slots not yet reaped by nvmePoll().
+	uint32_t cpl_head;     // owner side.
+	uint32_t cpl_tail;     // completion side.
+
+	struct u2_reactor *reactor;    // reactor mode: the poller our requests go through.
+	uint32_t *sq_ring;             // slots handed over to it.
+	uint32_t sq_head;              // poller side.
+	uint32_t sq_tail;              // owner side.
+	uint32_t wake_seq;             // bumped per completion; futex word for parked owners.
+	uint32_t woken_seq;            // poller side: wake_seq last checked for a parked owner.
+	uint32_t seen_seq;             // owner side: wake_seq last waited for.
+	uint32_t parked;
+	uint32_t detach;               // owner asks the poller to let go of the context ...
+	uint32_t detached;             // ... and the poller confirms.
+
+	uint8_t *shm;                  // shared rings: the Java side's buffer, NULL otherwise.
+	uint64_t *shm_user;            // user_data per request slot.
+	uint32_t shm_cq_tail;          // poller's copy.
+
+	struct u2_hist lat;    // submit-to-completion, ns.
+
+	struct u2_ra ra;
 
-static uint32_t u2_ns_id;
-static struct spdk_nvme_ns *u2_ns;
+	struct u2_channel *hch[U2_HANDLE_MAX];    // per open handle, set up on first use ...
+	struct u2_channel hown[U2_HANDLE_MAX];    // ... with a private qpair if there was one left.
+	uint32_t nhandles;                        // hch[] high-water mark.
+
+	uint32_t prio;    // U2_PRIO_*, of the private qpairs as well.
+
+	struct u2_io_stats io;
+};
+
+/*
+ * reactor mode: pinned native poller threads own the qpairs. a thread's context
+ * is attached to one of them and hands requests over through its SPSC slot
+ * ring; the poller submits them in batches, reaps completions and wakes up
+ * owners that got tired of spinning. ctxs[] is filled under u2_contexts_lock
+ * and emptied by the poller itself.
+ */
+struct u2_reactor {
+	void *qpair;
+	pthread_t thread;
+	int32_t core;
+	uint32_t stop;
+	uint32_t nctx;    // high-water mark of ctxs[].
+	struct u2_context *ctxs[U2_REACTOR_CTX_MAX];
+} __attribute__((aligned(64)));
+
+/*
+ * hugepage buffer pool: power-of-two size classes carved out of large slabs,
+ * a locked free list per class and a small per-thread cache in front of it.
+ * freed buffers are never handed back to the backend until nvmeFinalize().
+ */
+struct u2_pool_slab {
+	struct u2_pool_slab *next;
+	uint8_t *base;
+	uint64_t used;
+};
+
+struct u2_pool_class {
+	pthread_spinlock_t lock;
+	void *free;    // intrusive list, linked through the first word of each buffer.
+};
+
+/*
+ * slabs and free lists per NUMA node: arena 0 is on the volume's node (or
+ * wherever the backend puts it), and the only one thread caches hold buffers
+ * of; arena 1 + n is on node n, for buffers asked for there.
+ */
+struct u2_pool_arena {
+	struct u2_pool_class classes[U2_POOL_CLASSES];
+	struct u2_pool_slab *slabs;    // newest first ...
+	struct u2_pool_slab *carve;    // ... and the one being carved: those before it are used up.
+	int node;
+};
+
+struct u2_pool_cache {
+	void *buf[U2_POOL_CLASSES][U2_POOL_CACHE_SIZE];
+	uint32_t count[U2_POOL_CLASSES];
+	int64_t stats[U2_POOL_STAT_RESERVED];
+	struct u2_pool_cache *next;
+	uint32_t registered;
+	uint32_t epoch;
+};
+
+static const struct u2_backend *u2_backends[] = { &u2_spdk_backend, &u2_uring_backend, };
+
+static const struct u2_backend *u2_be = &u2_spdk_backend;
+static struct u2_backend_opts u2_be_opts;
+
+static struct u2_volume u2_vol;
+static uint64_t u2_stripe_bytes = U2_STRIPE_DEFAULT;
+
+static uint32_t u2_ndev;                             // the backend's, for nvmeOpen().
+static struct u2_handle u2_handles[U2_HANDLE_MAX];    // open/close under u2_contexts_lock.
 
 static uint32_t u2_ns_sector;
 static uint64_t u2_ns_size;
 
-static struct spdk_nvme_qpair *u2_qpair;
+static void *u2_qpair;
+
+static uint32_t u2_io_depth = U2_IO_DEPTH_DEFAULT;
+static uint32_t u2_unaligned;
+static pthread_mutex_t u2_rmw_locks[U2_RMW_LOCKS] = { [0 ... U2_RMW_LOCKS - 1] = PTHREAD_MUTEX_INITIALIZER };
+static uint64_t u2_cache_bytes;    // block cache budget, 0: off.
+static uint32_t u2_cached;
+static uint64_t u2_ra_bytes;    // readahead window limit, 0: off.
+static uint32_t u2_ra_segs;     // the same in segments, as fits the I/O depth.
+static uint32_t u2_ra_gens[U2_RA_GENS];
+
+static uint64_t u2_wb_bytes;       // extent size, i.e. the largest merged write; 0: off.
+static uint64_t u2_wb_age_ns;      // staged data older than that is written back, 0: never.
+static struct u2_wb_extent u2_wb[U2_WB_EXTENTS];
+static uint32_t u2_wb_used;        // extents holding data; peeked at without the lock.
+static int32_t u2_wb_error;        // status of the first failed write back: its data is gone, so it sticks.
+static pthread_mutex_t u2_wb_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t u2_wb_thread;
+static uint32_t u2_wb_stop;
+static uint32_t u2_wb_on;
+static uint32_t u2_qpair_max = U2_QPAIR_MAX_DEFAULT;
+static uint32_t u2_qpair_count;
 
-static uint32_t io_one;
-static uint32_t io_depth;
+static uint32_t u2_prio_weighted;                         // ask devices for weighted round robin.
+static uint32_t u2_prio_low_max = U2_PRIO_LOW_INFLIGHT;   // host-side limit, 0: none.
+static uint32_t u2_prio_low_inflight;                    // low-priority requests held against it.
+static uint64_t u2_prio_busy_ns;                          // last non-low submission, roughly.
 
-struct rte_mempool *request_mempool;
-static char *ealargs[] = { "jninvme", "-c 0x100", "-n 1", };
+static struct u2_channel u2_shared;
+
+static struct u2_reactor u2_reactors[U2_REACTOR_MAX];
+static uint32_t u2_reactor_count;             // pollers, 0: callers poll themselves.
+static int32_t u2_reactor_core = -1;          // first core to pin pollers to, -1: unpinned.
+static uint64_t u2_reactor_spin_ns = U2_REACTOR_SPIN_NS;
+static uint32_t u2_reactor_next;              // round-robin attach, under u2_contexts_lock.
+
+static struct u2_context *u2_contexts;    // all live contexts, for nvmeFinalize().
+static pthread_mutex_t u2_contexts_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t u2_contexts_key;
+static uint32_t u2_epoch;                 // bumped on nvmeFinalize() to invalidate u2_self.
+static struct u2_hist u2_lat_retired;     // from exited threads, under u2_contexts_lock.
+static int64_t u2_io_retired[U2_IO_COUNTERS];    // likewise.
+static uint64_t u2_cycles_base;           // u2_cycles() and ...
+static uint64_t u2_cycles_base_ns;        // ... u2_now_ns() on nvmeInitialize(), for the cycle rate.
+
+static __thread struct u2_context *u2_self;
+static __thread uint32_t u2_self_epoch;
+
+static uint64_t u2_pool_prealloc = U2_POOL_PREALLOC;
+static struct u2_pool_arena u2_pool_arenas[1 + U2_NODE_MAX];
+static uint32_t u2_pool_away;    // slabs in other arenas than 0.
+static uint64_t u2_pool_reserved;
+static pthread_mutex_t u2_pool_lock = PTHREAD_MUTEX_INITIALIZER;    // slabs and the cache list.
+static struct u2_pool_cache *u2_pool_caches;
+static int64_t u2_pool_stats[U2_POOL_STAT_RESERVED];                  // from exited threads.
+static pthread_key_t u2_pool_key;
+
+static __thread struct u2_pool_cache u2_pool_tls;
+
+static int  u2_wb_init(void);    // with the I/O paths, further down.
+static void u2_wb_fini(void);
 
 #ifdef __cplusplus
 extern "C" {
@@ -58,11 +442,91 @@ JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *, void *);
 JNIEXPORT void JNICALL nvmeInitialize(JNIEnv *, jobject);
 JNIEXPORT void JNICALL nvmeFinalize  (JNIEnv *, jobject);
 
+JNIEXPORT void JNICALL nvmeSetBackend   (JNIEnv *, jobject, jstring, jstring, jint);
+JNIEXPORT void JNICALL nvmeSetIoDepth   (JNIEnv *, jobject, jint);
+JNIEXPORT void JNICALL nvmeSetQueuePairs(JNIEnv *, jobject, jint);
+JNIEXPORT void JNICALL nvmeSetUnaligned (JNIEnv *, jobject, jboolean);
+JNIEXPORT void JNICALL nvmeSetReactor   (JNIEnv *, jobject, jint, jint, jlong);
+JNIEXPORT void JNICALL nvmeSetCache     (JNIEnv *, jobject, jlong);
+JNIEXPORT void JNICALL nvmeSetReadahead (JNIEnv *, jobject, jlong);
+JNIEXPORT void JNICALL nvmeSetWriteBuffer(JNIEnv *, jobject, jlong, jlong);
+JNIEXPORT void JNICALL nvmeSetStripe    (JNIEnv *, jobject, jlong);
+JNIEXPORT void JNICALL nvmeSetArbitration(JNIEnv *, jobject, jboolean, jint);
+JNIEXPORT void JNICALL nvmeSetPriority  (JNIEnv *, jobject, jint);
+
+JNIEXPORT jlong JNICALL nvmeGetSize      (JNIEnv *, jobject);
+JNIEXPORT jint  JNICALL nvmeGetSectorSize(JNIEnv *, jobject);
+
 JNIEXPORT void JNICALL nvmeWrite(JNIEnv *, jobject, jobject, jlong, jlong);
 JNIEXPORT void JNICALL nvmeRead (JNIEnv *, jobject, jobject, jlong, jlong);
 
-JNIEXPORT jobject JNICALL allocateHugepageMemory(JNIEnv *, jobject, jlong);
-JNIEXPORT void    JNICALL     freeHugepageMemory(JNIEnv *, jobject, jobject);
+JNIEXPORT jint JNICALL nvmeFlush  (JNIEnv *, jobject);
+JNIEXPORT jint JNICALL nvmeBarrier(JNIEnv *, jobject);
+
+JNIEXPORT void JNICALL nvmeWritev(JNIEnv *, jobject, jobjectArray, jlongArray, jlong);
+JNIEXPORT void JNICALL nvmeReadv (JNIEnv *, jobject, jobjectArray, jlongArray, jlong);
+
+JNIEXPORT jlong JNICALL nvmeWriteAsync(JNIEnv *, jobject, jlong, jlong, jlong);
+JNIEXPORT jlong JNICALL nvmeReadAsync (JNIEnv *, jobject, jlong, jlong, jlong);
+JNIEXPORT jint  JNICALL nvmePoll      (JNIEnv *, jobject, jlongArray, jintArray);
+
+JNIEXPORT jint JNICALL nvmeSubmitBatch(JNIEnv *, jobject, jobject, jint);
+
+JNIEXPORT jlong JNICALL nvmeOpen            (JNIEnv *, jobject, jint, jint);
+JNIEXPORT void  JNICALL nvmeClose           (JNIEnv *, jobject, jlong);
+JNIEXPORT jlong JNICALL nvmeGetSizeNs       (JNIEnv *, jobject, jlong);
+JNIEXPORT jint  JNICALL nvmeGetSectorSizeNs (JNIEnv *, jobject, jlong);
+JNIEXPORT void  JNICALL nvmeWriteNs         (JNIEnv *, jobject, jlong, jobject, jlong, jlong);
+JNIEXPORT void  JNICALL nvmeReadNs          (JNIEnv *, jobject, jlong, jobject, jlong, jlong);
+JNIEXPORT jlong JNICALL nvmeWriteAsyncNs    (JNIEnv *, jobject, jlong, jlong, jlong, jlong);
+JNIEXPORT jlong JNICALL nvmeReadAsyncNs     (JNIEnv *, jobject, jlong, jlong, jlong, jlong);
+JNIEXPORT jint  JNICALL nvmeBarrierNs       (JNIEnv *, jobject, jlong);
+JNIEXPORT void  JNICALL nvmeSetRateLimit    (JNIEnv *, jobject, jlong, jlong, jlong);
+JNIEXPORT jlongArray JNICALL getRateStats   (JNIEnv *, jobject, jlong);
+
+JNIEXPORT jlong JNICALL nvmeRingAttach(JNIEnv *, jobject, jobject, jint);
+JNIEXPORT void  JNICALL nvmeRingDetach(JNIEnv *, jobject, jlong);
+JNIEXPORT void  JNICALL nvmeRingWait  (JNIEnv *, jobject, jlong);
+
+JNIEXPORT jlong      JNICALL nvmeKvOpen  (JNIEnv *, jobject, jlong, jlong, jboolean);
+JNIEXPORT void       JNICALL nvmeKvClose (JNIEnv *, jobject, jlong);
+JNIEXPORT jint       JNICALL nvmeKvPut   (JNIEnv *, jobject, jlong, jobject, jint, jobject, jint);
+JNIEXPORT jint       JNICALL nvmeKvGet   (JNIEnv *, jobject, jlong, jobject, jint, jobject);
+JNIEXPORT jint       JNICALL nvmeKvDelete(JNIEnv *, jobject, jlong, jobject, jint);
+JNIEXPORT jint       JNICALL nvmeKvSync  (JNIEnv *, jobject, jlong);
+JNIEXPORT jlongArray JNICALL getKvStats  (JNIEnv *, jobject, jlong);
+
+JNIEXPORT jlong      JNICALL nvmeWalOpen    (JNIEnv *, jobject, jlong, jlong, jboolean);
+JNIEXPORT void       JNICALL nvmeWalClose   (JNIEnv *, jobject, jlong);
+JNIEXPORT jlong      JNICALL nvmeWalAppend  (JNIEnv *, jobject, jlong, jobject, jint);
+JNIEXPORT jlong      JNICALL nvmeWalAwait   (JNIEnv *, jobject, jlong, jlong, jlong);
+JNIEXPORT jint       JNICALL nvmeWalTruncate(JNIEnv *, jobject, jlong, jlong);
+JNIEXPORT jint       JNICALL nvmeWalReplay  (JNIEnv *, jobject, jlong, jobject);
+JNIEXPORT jlongArray JNICALL getWalStats    (JNIEnv *, jobject, jlong);
+
+JNIEXPORT jint       JNICALL nvmeTelemetryStart(JNIEnv *, jobject, jint, jstring);
+JNIEXPORT void       JNICALL nvmeTelemetryStop (JNIEnv *, jobject);
+JNIEXPORT jlongArray JNICALL getTelemetry      (JNIEnv *, jobject, jint);
+JNIEXPORT jstring    JNICALL getTelemetryJson  (JNIEnv *, jobject, jint);
+
+JNIEXPORT jlong JNICALL getBufferAddress(JNIEnv *, jobject, jobject);
+
+JNIEXPORT void JNICALL nvmeSetBufferPool(JNIEnv *, jobject, jlong);
+
+JNIEXPORT jint JNICALL nvmeGetNumaNode(JNIEnv *, jobject, jint);
+JNIEXPORT jint JNICALL nvmeBindNode   (JNIEnv *, jobject, jint);
+
+JNIEXPORT jobject    JNICALL allocateHugepageMemory    (JNIEnv *, jobject, jlong);
+JNIEXPORT jobject    JNICALL allocateHugepageMemoryZero(JNIEnv *, jobject, jlong, jboolean);
+JNIEXPORT jobject    JNICALL allocateHugepageMemoryNode(JNIEnv *, jobject, jlong, jboolean, jint);
+JNIEXPORT void       JNICALL     freeHugepageMemory    (JNIEnv *, jobject, jobject);
+JNIEXPORT jlongArray JNICALL getBufferPoolStats        (JNIEnv *, jobject);
+
+JNIEXPORT jlongArray JNICALL getLatencyStats  (JNIEnv *, jobject);
+JNIEXPORT jlongArray JNICALL getCacheStats    (JNIEnv *, jobject);
+JNIEXPORT void       JNICALL resetLatencyStats(JNIEnv *, jobject);
+JNIEXPORT jlongArray JNICALL getIoStats       (JNIEnv *, jobject);
+JNIEXPORT void       JNICALL resetIoStats     (JNIEnv *, jobject);
 
 #ifdef __cplusplus
 }
@@ -71,10 +535,75 @@ JNIEXPORT void    JNICALL     freeHugepageMemory(JNIEnv *, jobject, jobject);
 static const JNINativeMethod methods[] = {
 	{ "nvmeInitialize",         "()V",                         (void *)nvmeInitialize         },
 	{ "nvmeFinalize",           "()V",                         (void *)nvmeFinalize           },
+	{ "nvmeSetBackend",         "(Ljava/lang/String;Ljava/lang/String;I)V", (void *)nvmeSetBackend },
+	{ "nvmeSetIoDepth",         "(I)V",                        (void *)nvmeSetIoDepth         },
+	{ "nvmeSetQueuePairs",      "(I)V",                        (void *)nvmeSetQueuePairs      },
+	{ "nvmeSetUnaligned",       "(Z)V",                        (void *)nvmeSetUnaligned       },
+	{ "nvmeSetReactor",         "(IIJ)V",                      (void *)nvmeSetReactor         },
+	{ "nvmeSetCache",           "(J)V",                        (void *)nvmeSetCache           },
+	{ "nvmeSetReadahead",       "(J)V",                        (void *)nvmeSetReadahead       },
+	{ "nvmeSetWriteBuffer",     "(JJ)V",                       (void *)nvmeSetWriteBuffer     },
+	{ "nvmeSetStripe",          "(J)V",                        (void *)nvmeSetStripe          },
+	{ "nvmeSetArbitration",     "(ZI)V",                       (void *)nvmeSetArbitration     },
+	{ "nvmeSetPriority",        "(I)V",                        (void *)nvmeSetPriority        },
+	{ "nvmeGetSize",            "()J",                         (void *)nvmeGetSize            },
+	{ "nvmeGetSectorSize",      "()I",                         (void *)nvmeGetSectorSize      },
 	{ "nvmeWrite",              "(Ljava/nio/ByteBuffer;JJ)V",  (void *)nvmeWrite              },
 	{ "nvmeRead",               "(Ljava/nio/ByteBuffer;JJ)V",  (void *)nvmeRead               },
+	{ "nvmeFlush",              "()I",                         (void *)nvmeFlush              },
+	{ "nvmeBarrier",            "()I",                         (void *)nvmeBarrier            },
+	{ "nvmeWritev",             "([Ljava/nio/ByteBuffer;[JJ)V", (void *)nvmeWritev            },
+	{ "nvmeReadv",              "([Ljava/nio/ByteBuffer;[JJ)V", (void *)nvmeReadv             },
+	{ "nvmeWriteAsync",         "(JJJ)J",                      (void *)nvmeWriteAsync         },
+	{ "nvmeReadAsync",          "(JJJ)J",                      (void *)nvmeReadAsync          },
+	{ "nvmePoll",               "([J[I)I",                     (void *)nvmePoll               },
+	{ "nvmeSubmitBatch",        "(Ljava/nio/ByteBuffer;I)I",   (void *)nvmeSubmitBatch        },
+	{ "nvmeOpen",               "(II)J",                       (void *)nvmeOpen               },
+	{ "nvmeClose",              "(J)V",                        (void *)nvmeClose              },
+	{ "nvmeGetSize",            "(J)J",                        (void *)nvmeGetSizeNs          },
+	{ "nvmeGetSectorSize",      "(J)I",                        (void *)nvmeGetSectorSizeNs    },
+	{ "nvmeWrite",              "(JLjava/nio/ByteBuffer;JJ)V", (void *)nvmeWriteNs            },
+	{ "nvmeRead",               "(JLjava/nio/ByteBuffer;JJ)V", (void *)nvmeReadNs             },
+	{ "nvmeWriteAsync",         "(JJJJ)J",                     (void *)nvmeWriteAsyncNs       },
+	{ "nvmeReadAsync",          "(JJJJ)J",                     (void *)nvmeReadAsyncNs        },
+	{ "nvmeBarrier",            "(J)I",                        (void *)nvmeBarrierNs          },
+	{ "nvmeSetRateLimit",       "(JJJ)V",                      (void *)nvmeSetRateLimit       },
+	{ "getRateStats",           "(J)[J",                       (void *)getRateStats           },
+	{ "nvmeRingAttach",         "(Ljava/nio/ByteBuffer;I)J",   (void *)nvmeRingAttach         },
+	{ "nvmeRingDetach",         "(J)V",                        (void *)nvmeRingDetach         },
+	{ "nvmeRingWait",           "(J)V",                        (void *)nvmeRingWait           },
+	{ "nvmeKvOpen",             "(JJZ)J",                      (void *)nvmeKvOpen             },
+	{ "nvmeKvClose",            "(J)V",                        (void *)nvmeKvClose            },
+	{ "nvmeKvPut",              "(JLjava/nio/ByteBuffer;ILjava/nio/ByteBuffer;I)I", (void *)nvmeKvPut },
+	{ "nvmeKvGet",              "(JLjava/nio/ByteBuffer;ILjava/nio/ByteBuffer;)I",  (void *)nvmeKvGet },
+	{ "nvmeKvDelete",           "(JLjava/nio/ByteBuffer;I)I",  (void *)nvmeKvDelete           },
+	{ "nvmeKvSync",             "(J)I",                        (void *)nvmeKvSync             },
+	{ "getKvStats",             "(J)[J",                       (void *)getKvStats             },
+	{ "nvmeWalOpen",            "(JJZ)J",                      (void *)nvmeWalOpen            },
+	{ "nvmeWalClose",           "(J)V",                        (void *)nvmeWalClose           },
+	{ "nvmeWalAppend",          "(JLjava/nio/ByteBuffer;I)J",  (void *)nvmeWalAppend          },
+	{ "nvmeWalAwait",           "(JJJ)J",                      (void *)nvmeWalAwait           },
+	{ "nvmeWalTruncate",        "(JJ)I",                       (void *)nvmeWalTruncate        },
+	{ "nvmeWalReplay",          "(JLjava/nio/ByteBuffer;)I",   (void *)nvmeWalReplay          },
+	{ "getWalStats",            "(J)[J",                       (void *)getWalStats            },
+	{ "nvmeTelemetryStart",     "(ILjava/lang/String;)I",      (void *)nvmeTelemetryStart     },
+	{ "nvmeTelemetryStop",      "()V",                         (void *)nvmeTelemetryStop      },
+	{ "getTelemetry",           "(I)[J",                       (void *)getTelemetry           },
+	{ "getTelemetryJson",       "(I)Ljava/lang/String;",       (void *)getTelemetryJson       },
+	{ "nvmeSetBufferPool",      "(J)V",                        (void *)nvmeSetBufferPool      },
+	{ "nvmeGetNumaNode",        "(I)I",                        (void *)nvmeGetNumaNode        },
+	{ "nvmeBindNode",           "(I)I",                        (void *)nvmeBindNode           },
 	{ "allocateHugepageMemory", "(J)Ljava/nio/ByteBuffer;",    (void *)allocateHugepageMemory },
+	{ "allocateHugepageMemory", "(JZ)Ljava/nio/ByteBuffer;",   (void *)allocateHugepageMemoryZero },
+	{ "allocateHugepageMemory", "(JZI)Ljava/nio/ByteBuffer;",  (void *)allocateHugepageMemoryNode },
 	{ "freeHugepageMemory",     "(Ljava/nio/ByteBuffer;)V",    (void *)freeHugepageMemory     },
+	{ "getBufferPoolStats",     "()[J",                        (void *)getBufferPoolStats     },
+	{ "getBufferAddress",       "(Ljava/nio/ByteBuffer;)J",    (void *)getBufferAddress       },
+	{ "getLatencyStats",        "()[J",                        (void *)getLatencyStats        },
+	{ "resetLatencyStats",      "()V",                         (void *)resetLatencyStats      },
+	{ "getIoStats",             "()[J",                        (void *)getIoStats             },
+	{ "resetIoStats",           "()V",                         (void *)resetIoStats           },
+	{ "getCacheStats",          "()[J",                        (void *)getCacheStats          },
 };
 
 JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *jvm, void *reserved)
@@ -102,176 +631,3611 @@ JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *jvm, void *reserved)
 //{
 //}
 
-static bool
-probe_cb(void *cb_ctx, struct spdk_pci_device *dev, struct spdk_nvme_ctrlr_opts *opts)
+static inline uint64_t
+u2_now_ns(void)
 {
-	if (u2_ctrlr) {
-		return false;
-	}
+	struct timespec ts;
 
-	if (spdk_pci_device_has_non_uio_driver(dev)) {
-		fprintf(stderr, "%04x:%02x:%02x.%02x: non-UIO/kernel driver detected!\n",
-		                spdk_pci_device_get_domain(dev),
-		                spdk_pci_device_get_bus(dev),
-		                spdk_pci_device_get_dev(dev),
-		                spdk_pci_device_get_func(dev));
-		return false;
-	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-	return true;
+/*
+ * the TSC where there is one: cheap enough for every submission and wait.
+ */
+static inline uint64_t
+u2_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	return u2_now_ns();
+#endif
 }
 
-static void
-attach_cb(void *cb_ctx, struct spdk_pci_device *dev, struct spdk_nvme_ctrlr *ctrlr, const struct spdk_nvme_ctrlr_opts *opts)
+static inline void
+u2_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+static inline void
+u2_io_count(struct u2_context *ctx, struct u2_request *req, int rc, uint64_t start)
 {
-	u2_ctrlr = ctrlr;
-	u2_ns = spdk_nvme_ctrlr_get_ns(u2_ctrlr, u2_ns_id);
-	u2_ns_sector = spdk_nvme_ns_get_sector_size(u2_ns);
-	u2_ns_size = spdk_nvme_ns_get_size(u2_ns);
-	u2_qpair = spdk_nvme_ctrlr_alloc_io_qpair(u2_ctrlr, 0);
+	int64_t *c = ctx->io.c;
+	uint32_t inflight;
+
+	if (rc) {
+		c[U2_IO_STAT_SUBMIT_FAILS]++;
+	} else if (req->is_flush) {
+		c[U2_IO_STAT_FLUSHES]++;
+	} else if (req->is_write) {
+		c[U2_IO_STAT_WRITES]++;
+		c[U2_IO_STAT_WRITE_BYTES] += req->bytes;
+	} else {
+		c[U2_IO_STAT_READS]++;
+		c[U2_IO_STAT_READ_BYTES] += req->bytes;
+	}
 
-	printf("attached to %04x:%02x:%02x.%02x!\n",
-	       spdk_pci_device_get_domain(dev),
-	       spdk_pci_device_get_bus(dev),
-	       spdk_pci_device_get_dev(dev),
-	       spdk_pci_device_get_func(dev));
+	inflight = __atomic_load_n(&ctx->inflight, __ATOMIC_RELAXED);
+	if (inflight > c[U2_IO_STAT_INFLIGHT_MAX]) {
+		c[U2_IO_STAT_INFLIGHT_MAX] = inflight;
+	}
+	c[U2_IO_STAT_SUBMIT_CYCLES] += u2_cycles() - start;
 }
 
-JNIEXPORT void JNICALL nvmeInitialize(JNIEnv *env, jobject thisObj)
+static inline void
+u2_io_count_wait(struct u2_context *ctx, uint64_t start)
 {
-	if (rte_eal_init(sizeof(ealargs) / sizeof(ealargs[0]), ealargs) < 0) {
-		fprintf(stderr, "failed to initialize EAL!\n");
-		exit(1);
+	ctx->io.c[U2_IO_STAT_WAIT_CYCLES] += u2_cycles() - start;
+	ctx->io.c[U2_IO_STAT_WAITS]++;
+}
+
+/*
+ * contexts are cache-line aligned for their counters.
+ */
+static struct u2_context *
+u2_context_alloc(void)
+{
+	void *ctx;
+
+	if (posix_memalign(&ctx, 64, sizeof(struct u2_context))) {
+		return NULL;
 	}
 
-	printf("\n========================================\n");
-	printf(  "  jni_nvme/jni_u2 - ict.ncic.syssw.ufo"    );
-	printf("\n========================================\n");
+	return memset(ctx, 0, sizeof(struct u2_context));
+}
 
-	u2_ctrlr = NULL;
-	u2_ns_id = U2_NAMESPACE_ID;
-	u2_ns = NULL;
+static int
+u2_context_init(struct u2_context *ctx, uint32_t depth)
+{
+	uint32_t i;
 
-	io_one = 0;
+	ctx->depth = depth;
 
-	request_mempool = rte_mempool_create("nvme_request",
-	                                     U2_REQUEST_POOL_SIZE, spdk_nvme_request_size(),
-	                                     U2_REQUEST_CACHE_SIZE, U2_REQUEST_PRIVATE_SIZE,
-	                                     NULL, NULL, NULL, NULL,
-	                                     SOCKET_ID_ANY, 0);
-	if (request_mempool == NULL) {
-		fprintf(stderr, "failed to create request pool!\n");
-		exit(1);
+	ctx->reqs = calloc(depth, sizeof(*ctx->reqs));
+	ctx->free_slots = calloc(depth, sizeof(*ctx->free_slots));
+	ctx->cpl_ring = calloc(depth, sizeof(*ctx->cpl_ring));
+	ctx->sq_ring = calloc(depth, sizeof(*ctx->sq_ring));
+	if (!ctx->reqs || !ctx->free_slots || !ctx->cpl_ring || !ctx->sq_ring) {
+		free(ctx->reqs);
+		free(ctx->free_slots);
+		free(ctx->cpl_ring);
+		free(ctx->sq_ring);
+		return 1;
 	}
 
-	if (spdk_nvme_probe(NULL, probe_cb, attach_cb)) {
-		fprintf(stderr, "failed to probe and attach to NVMe device!\n");
-		exit(1);
+	for (i = 0; i < depth; i++) {
+		ctx->reqs[i].ctx = ctx;
+		ctx->reqs[i].slot = i;
+		ctx->free_slots[i] = depth - 1 - i;
 	}
+	ctx->free_count = depth;
 
-	if (!u2_ctrlr) {
-		fprintf(stderr, "failed to probe a suitable controller!\n");
-		exit(1);
+	if (u2_vol.ndev > 1) {
+		ctx->parts = calloc(depth * u2_vol.ndev, sizeof(*ctx->parts));
+		ctx->part_sgls = calloc(depth * u2_vol.ndev, sizeof(*ctx->part_sgls));
+		if (!ctx->parts || !ctx->part_sgls) {
+			free(ctx->parts);
+			free(ctx->part_sgls);
+			free(ctx->reqs);
+			free(ctx->free_slots);
+			free(ctx->cpl_ring);
+			free(ctx->sq_ring);
+			return 1;
+		}
+
+		for (i = 0; i < depth * u2_vol.ndev; i++) {
+			ctx->parts[i].ctx = ctx;
+			ctx->parts[i].parent = &ctx->reqs[i / u2_vol.ndev];
+			ctx->parts[i].sgl = &ctx->part_sgls[i];
+		}
+		for (i = 0; i < depth; i++) {
+			ctx->reqs[i].parts = &ctx->parts[i * u2_vol.ndev];
+		}
 	}
 
-	if (!spdk_nvme_ns_is_active(u2_ns)) {
-		fprintf(stderr, "namespace %d is in-active!\n", u2_ns_id);
-		exit(1);
+	u2_hist_init(&ctx->lat);
+
+	return 0;
+}
+
+static struct u2_request *
+u2_request_get(struct u2_context *ctx, uint32_t is_async)
+{
+	struct u2_request *req;
+
+	if (!ctx->free_count) {
+		return NULL;
 	}
 
-	if (!u2_qpair) {
-		fprintf(stderr, "failed to allocate queue pair!\n");
-		exit(1);
+	req = &ctx->reqs[ctx->free_slots[--ctx->free_count]];
+	req->gen++;
+	req->sgl = NULL;
+	req->is_async = is_async;
+	req->is_flush = 0;
+	req->vol = &u2_vol;
+	req->prio_held = 0;
+	req->done = 0;
+	req->status = 0;
+
+	return req;
+}
+
+/*
+ * a slot kept past the call (async I/O until nvmePoll(), readahead until it is
+ * read): never one of the last U2_IO_SYNC_SLOTS, which synchronous I/O on the
+ * thread waits for.
+ */
+static struct u2_request *
+u2_request_hold(struct u2_context *ctx, uint32_t is_async)
+{
+	if (ctx->free_count <= U2_IO_SYNC_SLOTS) {
+		return NULL;
 	}
+
+	return u2_request_get(ctx, is_async);
 }
 
-JNIEXPORT void JNICALL nvmeFinalize(JNIEnv *env, jobject thisObj)
+static void
+u2_request_put(struct u2_context *ctx, struct u2_request *req)
 {
-	if (u2_qpair) {
-		spdk_nvme_ctrlr_free_io_qpair(u2_qpair);
+	ctx->free_slots[ctx->free_count++] = req->slot;
+}
+
+static inline void
+u2_channel_lock(struct u2_channel *ch)
+{
+	if (ch->shared) {
+		pthread_mutex_lock(&ch->lock);
 	}
+}
 
-	if (u2_ctrlr) {
-		spdk_nvme_detach(u2_ctrlr);
+static inline void
+u2_channel_unlock(struct u2_channel *ch)
+{
+	if (ch->shared) {
+		pthread_mutex_unlock(&ch->lock);
 	}
 }
 
-JNIEXPORT jobject JNICALL allocateHugepageMemory(JNIEnv *env, jobject thisObj, jlong size)
+static void
+u2_context_process_handles(struct u2_context *ctx)
 {
-	uint8_t *buf;
+	uint32_t h;
 
-	buf = rte_malloc(NULL, size, U2_BUFFER_ALIGN);
-	if (buf == NULL) {
-		fprintf(stderr, "failed to allocate hugepage memory!\n");
-		exit(1);
+	for (h = 0; h < ctx->nhandles; h++) {
+		if (ctx->hch[h]) {
+			u2_channel_lock(ctx->hch[h]);
+			u2_volume_process(ctx->hch[h]->qpair);
+			u2_channel_unlock(ctx->hch[h]);
+		}
 	}
-	memset(buf, 0x00, size);
+}
 
-	return (*env)->NewDirectByteBuffer(env, buf, (jlong)size);
+static inline void
+u2_context_process(struct u2_context *ctx)
+{
+	u2_channel_lock(ctx->ch);
+	u2_volume_process(ctx->ch->qpair);
+	u2_channel_unlock(ctx->ch);
+
+	if (ctx->nhandles) {
+		u2_context_process_handles(ctx);
+	}
 }
 
-JNIEXPORT void JNICALL freeHugepageMemory(JNIEnv *env, jobject thisObj, jobject buffer)
+/*
+ * reactor mode: the owner waits for the next completion of any of its requests,
+ * spinning for u2_reactor_spin_ns and then parking on wake_seq.
+ */
+static void
+u2_reactor_wait(struct u2_context *ctx)
 {
-	uint8_t *buf = (uint8_t *)(*env)->GetDirectBufferAddress(env, buffer);
+	uint64_t deadline = 0, now;
+	uint32_t seq, spins = 0;
+
+	while ((seq = __atomic_load_n(&ctx->wake_seq, __ATOMIC_ACQUIRE)) == ctx->seen_seq) {
+		if (++spins % 64) {
+			u2_cpu_relax();
+			continue;
+		}
+
+		now = u2_now_ns();
+		if (!deadline) {
+			deadline = now + u2_reactor_spin_ns;
+		}
+		if (now < deadline) {
+			continue;
+		}
+
+		__atomic_store_n(&ctx->parked, 1, __ATOMIC_SEQ_CST);    // pairs with the poller's check in u2_reactor_wake().
+		if (__atomic_load_n(&ctx->wake_seq, __ATOMIC_SEQ_CST) == ctx->seen_seq) {
+			syscall(SYS_futex, &ctx->wake_seq, FUTEX_WAIT_PRIVATE, ctx->seen_seq, NULL, NULL, 0);
+		}
+		__atomic_store_n(&ctx->parked, 0, __ATOMIC_RELAXED);
+	}
 
-	rte_free(buf);
+	ctx->seen_seq = seq;
 }
 
+/*
+ * drives the context's requests forward: polls its channel, or waits for its
+ * poller in reactor mode.
+ */
+static inline void
+u2_context_wait(struct u2_context *ctx)
+{
+	if (ctx->reactor && ctx->nhandles) {    // handle queues are ours to poll: no parking.
+		u2_context_process_handles(ctx);
+		u2_cpu_relax();
+	} else if (ctx->reactor) {
+		u2_reactor_wait(ctx);
+	} else {
+		u2_context_process(ctx);
+	}
+}
+
+/*
+ * host-side arbitration, unless the request goes to a qpair the device already
+ * arbitrates by priority (hw): a low-priority request waits while there are
+ * u2_prio_low_max of them in flight and other I/O went out within the last
+ * U2_PRIO_IDLE_NS, reaping the caller's own completions meanwhile, but never
+ * longer than U2_PRIO_WAIT_NS. other requests just note that they are around,
+ * on a line they rarely write to.
+ */
 static void
-u2_io_one_complete(void *cb_args, const struct spdk_nvme_cpl *completion)
+u2_prio_admit(struct u2_context *ctx, struct u2_request *req, int hw)
 {
-	io_one = 0;
+	uint64_t now = u2_now_ns(), start = 0, deadline = 0;
+	uint32_t n;
+
+	if (ctx->prio != U2_PRIO_LOW) {
+		if (now - __atomic_load_n(&u2_prio_busy_ns, __ATOMIC_RELAXED) > U2_PRIO_BUSY_NS) {
+			__atomic_store_n(&u2_prio_busy_ns, now, __ATOMIC_RELAXED);
+		}
+		return;
+	}
+	if (hw || !u2_prio_low_max) {
+		return;
+	}
+
+	n = __atomic_load_n(&u2_prio_low_inflight, __ATOMIC_RELAXED);
+	for (;;) {
+		if (n < u2_prio_low_max || now - __atomic_load_n(&u2_prio_busy_ns, __ATOMIC_RELAXED) > U2_PRIO_IDLE_NS ||
+		    (start && now > deadline)) {
+			if (__atomic_compare_exchange_n(&u2_prio_low_inflight, &n, n + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+				break;
+			}
+			continue;
+		}
+
+		if (!start) {
+			start = u2_cycles();
+			deadline = now + U2_PRIO_WAIT_NS;
+		}
+		if (__atomic_load_n(&ctx->inflight, __ATOMIC_ACQUIRE) && !(ctx->reactor && !ctx->nhandles)) {
+			u2_context_wait(ctx);
+		} else {
+			sched_yield();    // reactor mode: inflight drops after the wakeup, don't park on it.
+		}
+		now = u2_now_ns();
+		n = __atomic_load_n(&u2_prio_low_inflight, __ATOMIC_RELAXED);
+	}
+	req->prio_held = 1;
+
+	if (start) {
+		ctx->io.c[U2_IO_STAT_PRIO_CYCLES] += u2_cycles() - start;
+	}
 }
 
-JNIEXPORT void JNICALL nvmeWrite(JNIEnv *env, jobject thisObj, jobject buffer, jlong offset, jlong size)
+/*
+ * for a request that never went out after all.
+ */
+static inline void
+u2_prio_release(struct u2_request *req)
 {
-	uint8_t *buf;
-	uint64_t offset_in_blocks;
-	uint32_t size_in_blocks;
+	if (req->prio_held) {
+		req->prio_held = 0;
+		__atomic_fetch_sub(&u2_prio_low_inflight, 1, __ATOMIC_RELEASE);
+	}
+}
 
-	if (u2_ns_size < size) {
-		fprintf(stderr, "invalid I/O size %"PRId64"!\n", (int64_t)size);
-		exit(1);
+/*
+ * poller side: pushes the owner's staged requests into the qpair. a full
+ * backend queue leaves the rest for the next round.
+ */
+static void
+u2_reactor_drain(struct u2_reactor *r, struct u2_context *ctx)
+{
+	uint32_t tail = __atomic_load_n(&ctx->sq_tail, __ATOMIC_ACQUIRE);
+	struct u2_request *req;
+	int rc;
+
+	while (ctx->sq_head != tail) {
+		req = &ctx->reqs[ctx->sq_ring[ctx->sq_head % ctx->depth]];
+
+		rc = u2_volume_submit(r->qpair, req);
+		if (rc == -ENOMEM || rc == ENOMEM) {    // out of backend request slots.
+			break;
+		}
+
+		ctx->sq_head++;
+		if (rc) {
+			__atomic_fetch_add(&ctx->io.c[U2_IO_STAT_SUBMIT_FAILS], 1, __ATOMIC_RELAXED);
+			u2_request_complete(req, rc < 0 ? rc : -EIO);
+		}
 	}
+}
 
-	buf = (uint8_t *)(*env)->GetDirectBufferAddress(env, buffer);
-	offset_in_blocks = offset / u2_ns_sector;    // byte-address -> block-address: here is naive stupid wrong!!!
-	size_in_blocks = size / u2_ns_sector;
+#define U2_SHM_INDEX(ctx, off)  ((uint32_t *)((ctx)->shm + (off)))
 
-	if (spdk_nvme_ns_cmd_write(u2_ns, u2_qpair, buf, offset_in_blocks, size_in_blocks, u2_io_one_complete, NULL, 0)) {
-		fprintf(stderr, "failed to submit request!\n");
-		exit(1);
+static inline struct u2_shm_sqe *
+u2_shm_sqes(struct u2_context *ctx)
+{
+	return (struct u2_shm_sqe *)(ctx->shm + U2_SHM_HEADER);
+}
+
+static inline struct u2_shm_cqe *
+u2_shm_cqes(struct u2_context *ctx)
+{
+	return (struct u2_shm_cqe *)(ctx->shm + U2_SHM_HEADER + ctx->depth * sizeof(struct u2_shm_sqe));
+}
+
+/*
+ * poller side of a shared ring: takes submission entries as long as every one
+ * taken so far and not reaped by Java still fits in the completion ring, so
+ * neither the CQ nor the request table can overflow.
+ */
+static void
+u2_reactor_drain_shm(struct u2_reactor *r, struct u2_context *ctx)
+{
+	uint32_t tail = __atomic_load_n(U2_SHM_INDEX(ctx, U2_SHM_SQ_TAIL), __ATOMIC_ACQUIRE);
+	uint32_t cq_head = __atomic_load_n(U2_SHM_INDEX(ctx, U2_SHM_CQ_HEAD), __ATOMIC_ACQUIRE);
+	uint32_t head = ctx->sq_head;
+	struct u2_shm_sqe *sqe;
+	struct u2_request *req;
+	uint64_t start;
+	int rc;
+
+	while (head != tail && head - cq_head < ctx->depth) {
+		start = u2_cycles();
+		sqe = &u2_shm_sqes(ctx)[head % ctx->depth];
+		req = u2_request_get(ctx, 1);
+
+		ctx->shm_user[req->slot] = sqe->user_data;
+		req->submit_ns = u2_now_ns();
+		req->is_write = 0;
+		if (sqe->size == 0 || sqe->size > u2_ns_size || sqe->opcode > U2_OP_WRITE) {
+			__atomic_fetch_add(&ctx->inflight, 1, __ATOMIC_RELAXED);
+			u2_io_count(ctx, req, -EINVAL, start);
+			u2_request_complete(req, -EINVAL);
+			head++;
+			continue;
+		}
+
+		req->is_write = sqe->opcode == U2_OP_WRITE;
+		req->buf = (void *)(uintptr_t)sqe->buf;
+		req->lba = sqe->offset / u2_ns_sector;
+		req->nlb = sqe->size / u2_ns_sector;
+		req->bytes = (uint64_t)req->nlb * u2_ns_sector;
+		if (u2_cached && req->is_write) {
+			u2_cache_invalidate(sqe->offset, req->bytes);
+		}
+
+		__atomic_fetch_add(&ctx->inflight, 1, __ATOMIC_RELAXED);
+		rc = u2_volume_submit(r->qpair, req);
+		if (rc == -ENOMEM || rc == ENOMEM) {
+			__atomic_fetch_sub(&ctx->inflight, 1, __ATOMIC_RELAXED);
+			u2_request_put(ctx, req);
+			break;
+		}
+
+		head++;
+		u2_io_count(ctx, req, rc, start);
+		if (rc) {
+			u2_request_complete(req, rc < 0 ? rc : -EIO);
+		}
 	}
-	io_one = 1;
 
-	while (io_one) {
-		spdk_nvme_qpair_process_completions(u2_qpair, 0);
+	if (head != ctx->sq_head) {
+		ctx->sq_head = head;
+		__atomic_store_n(U2_SHM_INDEX(ctx, U2_SHM_SQ_HEAD), head, __ATOMIC_RELEASE);
 	}
 }
 
-JNIEXPORT void JNICALL nvmeRead(JNIEnv *env, jobject thisObj, jobject buffer, jlong offset, jlong size)
+/*
+ * moves finished requests of a shared ring into its CQ and lets Java know.
+ */
+static void
+u2_reactor_publish(struct u2_context *ctx)
 {
-	uint8_t *buf;
-	uint64_t offset_in_blocks;
-	uint32_t size_in_blocks;
+	uint32_t tail = __atomic_load_n(&ctx->cpl_tail, __ATOMIC_ACQUIRE);
+	struct u2_shm_cqe *cqe;
+	struct u2_request *req;
 
-	if (u2_ns_size < size) {
-		fprintf(stderr, "invalid I/O size %"PRId64"!\n", (int64_t)size);
-		exit(1);
+	if (ctx->cpl_head == tail) {
+		return;
 	}
 
-	buf = (uint8_t *)(*env)->GetDirectBufferAddress(env, buffer);
-	offset_in_blocks = offset / u2_ns_sector;    // byte-address -> block-address: here is naive stupid wrong!!!
-	size_in_blocks = size / u2_ns_sector;
+	while (ctx->cpl_head != tail) {
+		req = &ctx->reqs[ctx->cpl_ring[ctx->cpl_head++ % ctx->depth]];
 
-	if (spdk_nvme_ns_cmd_read(u2_ns, u2_qpair, buf, offset_in_blocks, size_in_blocks, u2_io_one_complete, NULL, 0)) {
-		fprintf(stderr, "failed to submit request!\n");
-		exit(1);
+		cqe = &u2_shm_cqes(ctx)[ctx->shm_cq_tail++ % ctx->depth];
+		cqe->user_data = ctx->shm_user[req->slot];
+		cqe->status = req->status;
+		u2_request_put(ctx, req);
+	}
+
+	__atomic_store_n(U2_SHM_INDEX(ctx, U2_SHM_CQ_TAIL), ctx->shm_cq_tail, __ATOMIC_RELEASE);
+	__atomic_fetch_add(&ctx->wake_seq, 1, __ATOMIC_SEQ_CST);    // only now: nvmeRingWait() waits for the CQ.
+}
+
+static void
+u2_reactor_wake(struct u2_context *ctx)
+{
+	uint32_t seq = __atomic_load_n(&ctx->wake_seq, __ATOMIC_SEQ_CST);
+
+	if (seq == ctx->woken_seq) {
+		return;
 	}
-	io_one = 1;
 
-	while (io_one) {
-		spdk_nvme_qpair_process_completions(u2_qpair, 0);
+	ctx->woken_seq = seq;
+	if (__atomic_load_n(&ctx->parked, __ATOMIC_SEQ_CST)) {
+		syscall(SYS_futex, &ctx->wake_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
 	}
 }
 
+/*
+ * the calling thread on the CPUs of a NUMA node, or on all of them again.
+ */
+static int
+u2_bind_node(int node)
+{
+	int list[CPU_SETSIZE];
+	cpu_set_t cpus;
+	int i, n;
+
+	CPU_ZERO(&cpus);
+	if (node < 0) {
+		for (i = 0; i < CPU_SETSIZE; i++) {
+			CPU_SET(i, &cpus);
+		}
+	} else {
+		n = u2_numa_cpus(node, list, CPU_SETSIZE);
+		if (n == 0) {
+			return -1;
+		}
+		for (i = 0; i < n; i++) {
+			CPU_SET(list[i], &cpus);
+		}
+	}
+
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) ? -1 : 0;
+}
+
+static void *
+u2_reactor_run(void *arg)
+{
+	struct u2_reactor *r = arg;
+	struct u2_context *ctx;
+	cpu_set_t cpus;
+	uint32_t i, n;
+
+	if (r->core >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(r->core, &cpus);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)) {
+			fprintf(stderr, "failed to pin poller to core %d!\n", r->core);
+		}
+	} else if (u2_vol.node >= 0 && u2_bind_node(u2_vol.node)) {    // unpinned, but next to the devices.
+		fprintf(stderr, "failed to bind poller to node %d!\n", u2_vol.node);
+	}
+
+	while (!__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE)) {
+		n = __atomic_load_n(&r->nctx, __ATOMIC_ACQUIRE);
+
+		for (i = 0; i < n; i++) {
+			ctx = __atomic_load_n(&r->ctxs[i], __ATOMIC_ACQUIRE);
+			if (ctx == NULL) {
+				continue;
+			}
+			if (__atomic_load_n(&ctx->detach, __ATOMIC_ACQUIRE)) {
+				if (__atomic_load_n(&ctx->inflight, __ATOMIC_ACQUIRE)) {    // shared ring still draining.
+					continue;
+				}
+				if (ctx->shm) {
+					u2_reactor_publish(ctx);
+				}
+				__atomic_store_n(&r->ctxs[i], NULL, __ATOMIC_RELAXED);
+				__atomic_store_n(&ctx->detached, 1, __ATOMIC_RELEASE);
+				continue;
+			}
+
+			if (ctx->shm) {
+				u2_reactor_drain_shm(r, ctx);
+			} else {
+				u2_reactor_drain(r, ctx);
+			}
+		}
+
+		if (u2_volume_process(r->qpair) <= 0) {
+			u2_cpu_relax();
+		}
+
+		for (i = 0; i < n; i++) {    // one wakeup per owner and round, however many completions.
+			if ((ctx = __atomic_load_n(&r->ctxs[i], __ATOMIC_ACQUIRE)) == NULL) {
+				continue;
+			}
+			if (ctx->shm) {
+				u2_reactor_publish(ctx);
+			}
+			u2_reactor_wake(ctx);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * puts ctx on the next poller with room left, under u2_contexts_lock.
+ */
+static int
+u2_reactor_attach(struct u2_context *ctx)
+{
+	struct u2_reactor *r;
+	uint32_t i, k;
+
+	for (k = 0; k < u2_reactor_count; k++) {
+		r = &u2_reactors[(u2_reactor_next + k) % u2_reactor_count];
+
+		for (i = 0; i < U2_REACTOR_CTX_MAX; i++) {
+			if (__atomic_load_n(&r->ctxs[i], __ATOMIC_ACQUIRE) == NULL) {
+				break;
+			}
+		}
+		if (i == U2_REACTOR_CTX_MAX) {
+			continue;
+		}
+
+		ctx->reactor = r;
+		__atomic_store_n(&r->ctxs[i], ctx, __ATOMIC_RELEASE);
+		if (i >= r->nctx) {
+			__atomic_store_n(&r->nctx, i + 1, __ATOMIC_RELEASE);
+		}
+
+		u2_reactor_next = (u2_reactor_next + k + 1) % u2_reactor_count;
+		return 0;
+	}
+
+	return -1;
+}
+
+/*
+ * ctx must have nothing in flight anymore.
+ */
+static void
+u2_reactor_detach(struct u2_context *ctx)
+{
+	__atomic_store_n(&ctx->detach, 1, __ATOMIC_RELEASE);
+	while (!__atomic_load_n(&ctx->detached, __ATOMIC_ACQUIRE)) {
+		sched_yield();
+	}
+	ctx->reactor = NULL;
+}
+
+static int
+u2_reactor_start(void)
+{
+	struct u2_reactor *r;
+	uint32_t i;
+
+	for (i = 0; i < u2_reactor_count; i++) {
+		r = &u2_reactors[i];
+		memset(r, 0, sizeof(*r));
+		r->core = u2_reactor_core < 0 ? -1 : u2_reactor_core + (int32_t)i;
+
+		r->qpair = u2_volume_qpair_alloc(&u2_vol, U2_PRIO_NORMAL);
+		if (r->qpair == NULL) {
+			return 1;
+		}
+		if (pthread_create(&r->thread, NULL, u2_reactor_run, r)) {
+			u2_volume_qpair_free(r->qpair);
+			r->qpair = NULL;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void
+u2_reactor_stop(void)
+{
+	struct u2_reactor *r;
+	uint32_t i;
+
+	for (i = 0; i < u2_reactor_count; i++) {
+		r = &u2_reactors[i];
+		if (r->qpair == NULL) {
+			continue;
+		}
+
+		__atomic_store_n(&r->stop, 1, __ATOMIC_RELEASE);
+		pthread_join(r->thread, NULL);
+
+		u2_volume_qpair_free(r->qpair);
+		r->qpair = NULL;
+	}
+}
+
+static void
+u2_io_merge(int64_t *to, const int64_t *from)
+{
+	uint32_t i;
+
+	for (i = 0; i < U2_IO_COUNTERS; i++) {
+		if (i == U2_IO_STAT_INFLIGHT_MAX) {
+			to[i] = from[i] > to[i] ? from[i] : to[i];
+		} else {
+			to[i] += from[i];
+		}
+	}
+}
+
+static void
+u2_context_fini(struct u2_context *ctx)
+{
+	uint32_t h;
+
+	while (__atomic_load_n(&ctx->inflight, __ATOMIC_ACQUIRE)) {
+		if (ctx->reactor) {    // not u2_reactor_wait(): inflight drops after the wakeup.
+			u2_context_process_handles(ctx);
+			sched_yield();
+		} else {
+			u2_context_process(ctx);
+		}
+	}
+
+	for (h = 0; h < ctx->nhandles; h++) {
+		if (ctx->hch[h] == &ctx->hown[h]) {
+			u2_volume_qpair_free(ctx->hown[h].qpair);
+			u2_handles[h].qpairs--;
+		}
+	}
+
+	if (ctx->reactor) {
+		u2_reactor_detach(ctx);
+	} else if (ctx->ch == &ctx->own) {
+		u2_volume_qpair_free(ctx->own.qpair);
+		u2_qpair_count--;
+	}
+
+	u2_hist_merge(&u2_lat_retired, &ctx->lat);
+	u2_io_merge(u2_io_retired, ctx->io.c);
+
+	if (ctx->ra.buf) {    // segments still unconsumed have completed: inflight is 0.
+		u2_be->dma_free(ctx->ra.buf);
+	}
+
+	free(ctx->reqs);
+	free(ctx->parts);
+	free(ctx->part_sgls);
+	free(ctx->free_slots);
+	free(ctx->cpl_ring);
+	free(ctx->sq_ring);
+	free(ctx->shm_user);
+	free(ctx);
+}
+
+static void
+u2_context_destroy(void *arg)
+{
+	struct u2_context *ctx = arg, **pp;
+
+	if (u2_self_epoch != u2_epoch) {    // already torn down by nvmeFinalize().
+		return;
+	}
+
+	pthread_mutex_lock(&u2_contexts_lock);
+	for (pp = &u2_contexts; *pp; pp = &(*pp)->next) {
+		if (*pp == ctx) {
+			*pp = ctx->next;
+			break;
+		}
+	}
+	u2_context_fini(ctx);
+	pthread_mutex_unlock(&u2_contexts_lock);
+
+	u2_self = NULL;
+}
+
+/*
+ * the calling thread's context: a poller in reactor mode, else a private qpair
+ * while there are fewer than u2_qpair_max of them, the shared one otherwise.
+ * released on thread exit.
+ */
+static struct u2_context *
+u2_context_get(void)
+{
+	struct u2_context *ctx;
+
+	if (u2_self && u2_self_epoch == u2_epoch) {
+		return u2_self;
+	}
+
+	ctx = u2_context_alloc();
+	if (ctx == NULL || u2_context_init(ctx, u2_io_depth)) {
+		fprintf(stderr, "failed to allocate request table!\n");
+		exit(1);
+	}
+
+	ctx->prio = U2_PRIO_NORMAL;
+
+	pthread_mutex_lock(&u2_contexts_lock);
+
+	ctx->ch = &u2_shared;
+	if (u2_reactor_count && !u2_reactor_attach(ctx)) {
+		ctx->ch = &ctx->own;    // never polled nor locked: the qpair is the poller's.
+	} else if (u2_qpair_count < u2_qpair_max) {
+		ctx->own.qpair = u2_volume_qpair_alloc(&u2_vol, ctx->prio);
+		if (ctx->own.qpair) {
+			ctx->ch = &ctx->own;
+			u2_qpair_count++;
+		}
+	}
+
+	ctx->next = u2_contexts;
+	u2_contexts = ctx;
+
+	pthread_mutex_unlock(&u2_contexts_lock);
+
+	u2_self = ctx;
+	u2_self_epoch = u2_epoch;
+	pthread_setspecific(u2_contexts_key, ctx);
+
+	return ctx;
+}
+
+static struct u2_handle *
+u2_handle_get(jlong handle)
+{
+	if (handle < 0 || handle >= U2_HANDLE_MAX || !u2_handles[handle].open) {
+		return NULL;
+	}
+
+	return &u2_handles[handle];
+}
+
+/*
+ * the calling thread's channel to handle h: a private qpair while the handle
+ * has fewer than u2_qpair_max of them, its shared one otherwise.
+ */
+static struct u2_channel *
+u2_handle_channel(struct u2_context *ctx, uint32_t h)
+{
+	struct u2_handle *hd = &u2_handles[h];
+
+	if (ctx->hch[h]) {
+		return ctx->hch[h];
+	}
+
+	pthread_mutex_lock(&u2_contexts_lock);
+
+	ctx->hch[h] = &hd->shared;
+	if (hd->qpairs < u2_qpair_max) {
+		ctx->hown[h].qpair = u2_volume_qpair_alloc(&hd->vol, ctx->prio);
+		if (ctx->hown[h].qpair) {
+			ctx->hch[h] = &ctx->hown[h];
+			hd->qpairs++;
+		}
+	}
+	if (ctx->nhandles <= h) {
+		ctx->nhandles = h + 1;
+	}
+
+	pthread_mutex_unlock(&u2_contexts_lock);
+
+	return ctx->hch[h];
+}
+
+/*
+ * under u2_contexts_lock, with no I/O in flight on the handle.
+ */
+static void
+u2_handle_close(struct u2_handle *hd)
+{
+	struct u2_context *ctx;
+	uint32_t h = hd - u2_handles;
+
+	for (ctx = u2_contexts; ctx; ctx = ctx->next) {
+		if (ctx->hch[h] == &ctx->hown[h]) {
+			u2_volume_qpair_free(ctx->hown[h].qpair);
+			ctx->hown[h].qpair = NULL;
+		}
+		ctx->hch[h] = NULL;
+	}
+
+	u2_volume_qpair_free(hd->shared.qpair);
+	pthread_mutex_destroy(&hd->shared.lock);
+	memset(hd, 0, sizeof(*hd));
+}
+
+/*
+ * moves a bucket on by cost, returns when the request may go.
+ */
+static inline uint64_t
+u2_rate_reserve(uint64_t *tat, uint64_t cost, uint64_t now)
+{
+	uint64_t t = __atomic_load_n(tat, __ATOMIC_RELAXED), base;
+
+	do {
+		base = t > now ? t : now;
+	} while (!__atomic_compare_exchange_n(tat, &t, base + cost, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	return base - now > U2_RATE_BURST_NS ? base - U2_RATE_BURST_NS : now;
+}
+
+/*
+ * over budget, the caller waits for its turn, reaping what it has in flight on
+ * the handle meanwhile.
+ */
+static void
+u2_rate_admit(struct u2_context *ctx, struct u2_channel *ch, struct u2_handle *hd, uint64_t size)
+{
+	struct u2_rate *rate = &hd->rate;
+	uint64_t iops = __atomic_load_n(&rate->iops, __ATOMIC_RELAXED);
+	uint64_t bps = __atomic_load_n(&rate->bps, __ATOMIC_RELAXED);
+	uint64_t now, go, t, left;
+	struct timespec ts;
+
+	if (!iops && !bps) {
+		return;
+	}
+
+	now = go = u2_now_ns();
+	if (iops) {
+		go = u2_rate_reserve(&rate->tat[0], 1000000000 / iops, now);
+	}
+	if (bps) {
+		t = u2_rate_reserve(&rate->tat[1], (uint64_t)((double)size * 1e9 / bps), now);
+		go = t > go ? t : go;
+	}
+	__atomic_fetch_add(&rate->ios, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&rate->bytes, size, __ATOMIC_RELAXED);
+	if (go == now) {
+		return;
+	}
+
+	while ((t = u2_now_ns()) < go) {
+		if (__atomic_load_n(&ctx->inflight, __ATOMIC_ACQUIRE)) {
+			u2_channel_lock(ch);
+			u2_volume_process(ch->qpair);
+			u2_channel_unlock(ch);
+		}
+		left = go - t;
+		if (left > U2_RATE_SPIN_NS) {
+			ts.tv_sec = (left - U2_RATE_SPIN_NS) / 1000000000;
+			ts.tv_nsec = (left - U2_RATE_SPIN_NS) % 1000000000;
+			nanosleep(&ts, NULL);
+		} else {
+			sched_yield();
+		}
+	}
+	__atomic_fetch_add(&rate->throttled, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&rate->throttle_ns, t - now, __ATOMIC_RELAXED);
+}
+
+static int
+u2_handle_submit(struct u2_context *ctx, struct u2_channel *ch, struct u2_handle *hd, struct u2_request *req,
+                 int is_write, void *buf, uint64_t offset, uint64_t size)
+{
+	uint64_t start;
+	int rc;
+
+	if (!req->is_flush) {
+		u2_rate_admit(ctx, ch, hd, size);
+	}
+	u2_prio_admit(ctx, req, ch == &ctx->hown[hd - u2_handles] && hd->vol.weighted);
+
+	req->vol = &hd->vol;
+	req->is_write = is_write;
+	req->buf = buf;
+	req->lba = offset / hd->vol.sector;
+	req->nlb = size / hd->vol.sector;
+	req->bytes = (uint64_t)req->nlb * hd->vol.sector;
+	req->submit_ns = u2_now_ns();
+	start = u2_cycles();
+
+	u2_channel_lock(ch);
+	rc = u2_volume_submit(ch->qpair, req);
+	if (!rc) {
+		__atomic_fetch_add(&ctx->inflight, 1, __ATOMIC_RELAXED);
+	}
+	u2_channel_unlock(ch);
+
+	if (rc) {
+		u2_prio_release(req);
+	}
+	u2_io_count(ctx, req, rc, start);
+
+	return rc;
+}
+
+static void
+u2_handle_wait(struct u2_context *ctx, struct u2_channel *ch, struct u2_request *req)
+{
+	uint64_t start = u2_cycles();
+
+	while (!__atomic_load_n(&req->done, __ATOMIC_ACQUIRE)) {
+		u2_channel_lock(ch);
+		u2_volume_process(ch->qpair);
+		u2_channel_unlock(ch);
+	}
+
+	u2_io_count_wait(ctx, start);
+}
+
+static inline int
+u2_handle_range(struct u2_handle *hd, jlong offset, jlong size)
+{
+	return size > 0 && offset >= 0 && (uint64_t)(offset + size) <= hd->vol.size &&
+	       !((offset | size) & (hd->vol.sector - 1));
+}
+
+static inline int
+u2_pool_class_of(uint64_t size)
+{
+	int shift = U2_POOL_SHIFT_MIN;
+
+	while ((1ULL << shift) < size) {
+		shift++;
+	}
+
+	return shift > U2_POOL_SHIFT_MAX ? -1 : shift - U2_POOL_SHIFT_MIN;
+}
+
+static inline uint64_t
+u2_pool_class_size(int cls)
+{
+	return 1ULL << (cls + U2_POOL_SHIFT_MIN);
+}
+
+static inline uint32_t
+u2_pool_cache_limit(int cls)
+{
+	uint64_t limit = U2_POOL_CACHE_BYTES / u2_pool_class_size(cls);
+
+	return limit < U2_POOL_CACHE_SIZE ? (limit ? limit : 1) : U2_POOL_CACHE_SIZE;
+}
+
+static inline struct u2_pool_arena *
+u2_pool_arena_of(int node)
+{
+	return node < 0 || node == u2_pool_arenas[0].node ? &u2_pool_arenas[0] : &u2_pool_arenas[1 + node];
+}
+
+static struct u2_pool_slab *
+u2_pool_slab_new(struct u2_pool_arena *arena, uint64_t size)
+{
+	struct u2_pool_slab *slab;
+
+	slab = calloc(1, sizeof(*slab));
+	if (slab == NULL) {
+		return NULL;
+	}
+
+	slab->base = u2_be->dma_alloc(size, U2_POOL_PAGE_SIZE, arena->node);
+	if (slab->base == NULL) {
+		free(slab);
+		return NULL;
+	}
+
+	slab->next = arena->slabs;
+	arena->slabs = slab;
+	u2_pool_reserved += size;
+	if (arena != &u2_pool_arenas[0]) {
+		__atomic_store_n(&u2_pool_away, 1, __ATOMIC_RELEASE);
+	}
+
+	return slab;
+}
+
+/*
+ * the arena of a buffer that isn't oversize; only searched beyond arena 0 once
+ * there are buffers elsewhere, which are few and long-lived.
+ */
+static struct u2_pool_arena *
+u2_pool_arena_find(void *buf)
+{
+	struct u2_pool_arena *arena = &u2_pool_arenas[0];
+	struct u2_pool_slab *slab;
+	uint32_t i;
+
+	if (!__atomic_load_n(&u2_pool_away, __ATOMIC_ACQUIRE)) {
+		return arena;
+	}
+
+	pthread_mutex_lock(&u2_pool_lock);
+	for (i = 1; i <= U2_NODE_MAX && arena == &u2_pool_arenas[0]; i++) {
+		for (slab = u2_pool_arenas[i].slabs; slab; slab = slab->next) {
+			if ((uint8_t *)buf >= slab->base && (uint8_t *)buf < slab->base + U2_POOL_SLAB_SIZE) {
+				arena = &u2_pool_arenas[i];
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&u2_pool_lock);
+
+	return arena;
+}
+
+/*
+ * carves up to n fresh buffers of class cls off the current slab, moving on to
+ * the older (reserved) ones and then to a new one as they run out. buffers are
+ * aligned to min(class size, page).
+ */
+static uint32_t
+u2_pool_carve(struct u2_pool_arena *arena, int cls, void **bufs, uint32_t n)
+{
+	uint64_t size = u2_pool_class_size(cls);
+	uint64_t align = size < U2_POOL_PAGE_SIZE ? size : U2_POOL_PAGE_SIZE;
+	struct u2_pool_slab *slab;
+	uint64_t off;
+	uint32_t i;
+
+	pthread_mutex_lock(&u2_pool_lock);
+	for (i = 0; i < n; i++) {
+		for (slab = arena->carve; slab; slab = slab->next) {
+			off = (slab->used + align - 1) & ~(align - 1);
+			if (off + size <= U2_POOL_SLAB_SIZE) {
+				break;
+			}
+		}
+		if (slab == NULL) {
+			if ((slab = u2_pool_slab_new(arena, U2_POOL_SLAB_SIZE)) == NULL) {
+				break;
+			}
+			off = 0;
+		}
+
+		arena->carve = slab;
+		bufs[i] = slab->base + off;
+		slab->used = off + size;
+	}
+	pthread_mutex_unlock(&u2_pool_lock);
+
+	return i;
+}
+
+static void
+u2_pool_cache_flush(struct u2_pool_cache *cache, int cls, uint32_t keep)
+{
+	struct u2_pool_class *pc = &u2_pool_arenas[0].classes[cls];
+
+	pthread_spin_lock(&pc->lock);
+	while (cache->count[cls] > keep) {
+		void *buf = cache->buf[cls][--cache->count[cls]];
+
+		*(void **)buf = pc->free;
+		pc->free = buf;
+	}
+	pthread_spin_unlock(&pc->lock);
+}
+
+static void
+u2_pool_cache_destroy(void *arg)
+{
+	struct u2_pool_cache *cache = arg, **pp;
+	int cls, i;
+
+	if (cache->epoch != u2_epoch) {    // pool already torn down by nvmeFinalize().
+		return;
+	}
+
+	for (cls = 0; cls < U2_POOL_CLASSES; cls++) {
+		u2_pool_cache_flush(cache, cls, 0);
+	}
+
+	pthread_mutex_lock(&u2_pool_lock);
+	for (pp = &u2_pool_caches; *pp; pp = &(*pp)->next) {
+		if (*pp == cache) {
+			*pp = cache->next;
+			break;
+		}
+	}
+	for (i = 0; i < U2_POOL_STAT_RESERVED; i++) {
+		u2_pool_stats[i] += cache->stats[i];
+	}
+	pthread_mutex_unlock(&u2_pool_lock);
+
+	memset(cache, 0, sizeof(*cache));
+}
+
+static struct u2_pool_cache *
+u2_pool_cache_get(void)
+{
+	struct u2_pool_cache *cache = &u2_pool_tls;
+
+	if (!cache->registered || cache->epoch != u2_epoch) {
+		memset(cache, 0, sizeof(*cache));
+		cache->epoch = u2_epoch;
+
+		pthread_mutex_lock(&u2_pool_lock);
+		cache->next = u2_pool_caches;
+		u2_pool_caches = cache;
+		pthread_mutex_unlock(&u2_pool_lock);
+
+		cache->registered = 1;
+		pthread_setspecific(u2_pool_key, cache);
+	}
+
+	return cache;
+}
+
+void *
+u2_pool_alloc(uint64_t size, int zero)
+{
+	struct u2_pool_cache *cache = u2_pool_cache_get();
+	struct u2_pool_class *pc;
+	int cls = u2_pool_class_of(size);
+	uint32_t want;
+	void *buf;
+
+	if (cls < 0) {    // beyond the largest class: straight from the backend.
+		buf = u2_be->dma_alloc(size, U2_POOL_PAGE_SIZE, u2_pool_arenas[0].node);
+		if (buf) {
+			if (zero) {
+				memset(buf, 0x00, size);
+			}
+			cache->stats[U2_POOL_STAT_OVERSIZE]++;
+			cache->stats[U2_POOL_STAT_IN_USE] += size;
+		}
+		return buf;
+	}
+
+	if (cache->count[cls] == 0) {
+		want = (u2_pool_cache_limit(cls) + 1) / 2;
+		pc = &u2_pool_arenas[0].classes[cls];
+
+		pthread_spin_lock(&pc->lock);
+		while (pc->free && cache->count[cls] < want) {
+			cache->buf[cls][cache->count[cls]++] = pc->free;
+			pc->free = *(void **)pc->free;
+		}
+		pthread_spin_unlock(&pc->lock);
+
+		if (cache->count[cls] == 0) {
+			if (u2_pool_carve(&u2_pool_arenas[0], cls, cache->buf[cls], 1) == 0) {
+				return NULL;
+			}
+			cache->count[cls] = 1;
+			cache->stats[U2_POOL_STAT_MISSES]++;
+		} else {
+			cache->stats[U2_POOL_STAT_HITS]++;
+		}
+	} else {
+		cache->stats[U2_POOL_STAT_HITS]++;
+	}
+
+	buf = cache->buf[cls][--cache->count[cls]];
+	cache->stats[U2_POOL_STAT_IN_USE] += u2_pool_class_size(cls);
+	if (zero) {
+		memset(buf, 0x00, size);
+	}
+
+	return buf;
+}
+
+/*
+ * a buffer on a given NUMA node (-1: the volume's), past the thread cache
+ * unless that is arena 0's.
+ */
+static void *
+u2_pool_alloc_node(uint64_t size, int zero, int node)
+{
+	struct u2_pool_cache *cache;
+	struct u2_pool_arena *arena = u2_pool_arena_of(node);
+	struct u2_pool_class *pc;
+	int cls = u2_pool_class_of(size);
+	void *buf;
+
+	if (arena == &u2_pool_arenas[0]) {
+		return u2_pool_alloc(size, zero);
+	}
+
+	cache = u2_pool_cache_get();
+	if (cls < 0) {
+		buf = u2_be->dma_alloc(size, U2_POOL_PAGE_SIZE, node);
+		if (buf) {
+			cache->stats[U2_POOL_STAT_OVERSIZE]++;
+			cache->stats[U2_POOL_STAT_IN_USE] += size;
+		}
+	} else {
+		pc = &arena->classes[cls];
+		pthread_spin_lock(&pc->lock);
+		buf = pc->free;
+		if (buf) {
+			pc->free = *(void **)buf;
+		}
+		pthread_spin_unlock(&pc->lock);
+
+		if (buf) {
+			cache->stats[U2_POOL_STAT_HITS]++;
+		} else if (u2_pool_carve(arena, cls, &buf, 1)) {
+			cache->stats[U2_POOL_STAT_MISSES]++;
+		} else {
+			return NULL;
+		}
+		cache->stats[U2_POOL_STAT_IN_USE] += u2_pool_class_size(cls);
+	}
+
+	if (buf && zero) {
+		memset(buf, 0x00, size);
+	}
+
+	return buf;
+}
+
+void
+u2_pool_free(void *buf, uint64_t size)
+{
+	struct u2_pool_cache *cache = u2_pool_cache_get();
+	struct u2_pool_arena *arena;
+	struct u2_pool_class *pc;
+	int cls = u2_pool_class_of(size);
+
+	if (cls < 0) {
+		cache->stats[U2_POOL_STAT_IN_USE] -= size;
+		u2_be->dma_free(buf);
+		return;
+	}
+
+	arena = u2_pool_arena_find(buf);
+	if (arena != &u2_pool_arenas[0]) {
+		pc = &arena->classes[cls];
+		pthread_spin_lock(&pc->lock);
+		*(void **)buf = pc->free;
+		pc->free = buf;
+		pthread_spin_unlock(&pc->lock);
+		cache->stats[U2_POOL_STAT_IN_USE] -= u2_pool_class_size(cls);
+		return;
+	}
+
+	if (cache->count[cls] == u2_pool_cache_limit(cls)) {
+		u2_pool_cache_flush(cache, cls, cache->count[cls] / 2);
+	}
+	cache->buf[cls][cache->count[cls]++] = buf;
+	cache->stats[U2_POOL_STAT_IN_USE] -= u2_pool_class_size(cls);
+}
+
+static int
+u2_pool_init(int node)
+{
+	uint64_t reserved;
+	int i, cls;
+
+	for (i = 0; i <= U2_NODE_MAX; i++) {
+		for (cls = 0; cls < U2_POOL_CLASSES; cls++) {
+			pthread_spin_init(&u2_pool_arenas[i].classes[cls].lock, PTHREAD_PROCESS_PRIVATE);
+			u2_pool_arenas[i].classes[cls].free = NULL;
+		}
+		u2_pool_arenas[i].slabs = NULL;
+		u2_pool_arenas[i].carve = NULL;
+		u2_pool_arenas[i].node = i ? i - 1 : node;
+	}
+	u2_pool_away = 0;
+
+	if (pthread_key_create(&u2_pool_key, u2_pool_cache_destroy)) {
+		return 1;
+	}
+
+	for (reserved = 0; reserved < u2_pool_prealloc; reserved += U2_POOL_SLAB_SIZE) {
+		if (u2_pool_slab_new(&u2_pool_arenas[0], U2_POOL_SLAB_SIZE) == NULL) {
+			return 1;
+		}
+	}
+	u2_pool_arenas[0].carve = u2_pool_arenas[0].slabs;
+
+	return 0;
+}
+
+static void
+u2_pool_fini(void)
+{
+	struct u2_pool_slab *slab;
+	struct u2_pool_cache *cache;
+	int i, cls;
+
+	pthread_mutex_lock(&u2_pool_lock);
+	for (cache = u2_pool_caches; cache; cache = cache->next) {    // buffers are gone with their slabs.
+		memset(cache->count, 0, sizeof(cache->count));
+	}
+	u2_pool_caches = NULL;
+	memset(u2_pool_stats, 0, sizeof(u2_pool_stats));
+	for (i = 0; i <= U2_NODE_MAX; i++) {
+		while ((slab = u2_pool_arenas[i].slabs) != NULL) {
+			u2_pool_arenas[i].slabs = slab->next;
+			u2_be->dma_free(slab->base);
+			free(slab);
+		}
+		u2_pool_arenas[i].carve = NULL;
+	}
+	u2_pool_away = 0;
+	u2_pool_reserved = 0;
+	pthread_mutex_unlock(&u2_pool_lock);
+
+	for (i = 0; i <= U2_NODE_MAX; i++) {
+		for (cls = 0; cls < U2_POOL_CLASSES; cls++) {
+			u2_pool_arenas[i].classes[cls].free = NULL;
+			pthread_spin_destroy(&u2_pool_arenas[i].classes[cls].lock);
+		}
+	}
+
+	pthread_key_delete(u2_pool_key);
+}
+
+/*
+ * the slabs reserved so far, for backends that pre-register I/O memory.
+ */
+int
+u2_pool_regions(struct iovec *iov, int max)
+{
+	struct u2_pool_slab *slab;
+	int i, n = 0;
+
+	pthread_mutex_lock(&u2_pool_lock);
+	for (i = 0; i <= U2_NODE_MAX; i++) {
+		for (slab = u2_pool_arenas[i].slabs; slab && n < max; slab = slab->next, n++) {
+			iov[n].iov_base = slab->base;
+			iov[n].iov_len = U2_POOL_SLAB_SIZE;
+		}
+	}
+	pthread_mutex_unlock(&u2_pool_lock);
+
+	return n;
+}
+
+JNIEXPORT void JNICALL nvmeSetBackend(JNIEnv *env, jobject thisObj, jstring name, jstring path, jint flags)
+{
+	const char *str;
+	size_t i;
+
+	str = (*env)->GetStringUTFChars(env, name, NULL);
+	for (i = 0; i < sizeof(u2_backends) / sizeof(u2_backends[0]); i++) {
+		if (!strcmp(str, u2_backends[i]->name)) {
+			break;
+		}
+	}
+	if (i == sizeof(u2_backends) / sizeof(u2_backends[0])) {
+		fprintf(stderr, "unknown backend %s!\n", str);
+		(*env)->ReleaseStringUTFChars(env, name, str);
+		return;
+	}
+	(*env)->ReleaseStringUTFChars(env, name, str);
+
+	u2_be = u2_backends[i];
+	u2_be_opts.flags = flags;
+
+	free((void *)u2_be_opts.path);
+	u2_be_opts.path = NULL;
+	if (path) {
+		str = (*env)->GetStringUTFChars(env, path, NULL);
+		u2_be_opts.path = strdup(str);
+		(*env)->ReleaseStringUTFChars(env, path, str);
+	}
+}
+
+JNIEXPORT void JNICALL nvmeSetIoDepth(JNIEnv *env, jobject thisObj, jint depth)
+{
+	if (depth <= U2_IO_SYNC_SLOTS || depth > U2_IO_DEPTH_MAX) {
+		fprintf(stderr, "invalid I/O depth %d!\n", depth);
+		return;
+	}
+
+	u2_io_depth = depth;
+}
+
+JNIEXPORT void JNICALL nvmeSetQueuePairs(JNIEnv *env, jobject thisObj, jint num)
+{
+	if (num < 0 || num > U2_QPAIR_MAX) {
+		fprintf(stderr, "invalid number of queue pairs %d!\n", num);
+		return;
+	}
+
+	u2_qpair_max = num;
+}
+
+JNIEXPORT void JNICALL nvmeSetUnaligned(JNIEnv *env, jobject thisObj, jboolean enable)
+{
+	u2_unaligned = enable;
+}
+
+JNIEXPORT void JNICALL nvmeSetReactor(JNIEnv *env, jobject thisObj, jint pollers, jint core, jlong spin_ns)
+{
+	if (pollers < 0 || pollers > U2_REACTOR_MAX || spin_ns < 0) {
+		fprintf(stderr, "invalid reactor setup %d/%"PRId64"!\n", pollers, (int64_t)spin_ns);
+		return;
+	}
+
+	u2_reactor_count = pollers;
+	u2_reactor_core = core < 0 ? -1 : core;
+	u2_reactor_spin_ns = spin_ns;
+}
+
+JNIEXPORT void JNICALL nvmeSetCache(JNIEnv *env, jobject thisObj, jlong size)
+{
+	if (size < 0) {
+		fprintf(stderr, "invalid cache size %"PRId64"!\n", (int64_t)size);
+		return;
+	}
+
+	u2_cache_bytes = size;
+}
+
+JNIEXPORT void JNICALL nvmeSetReadahead(JNIEnv *env, jobject thisObj, jlong size)
+{
+	if (size < 0) {
+		fprintf(stderr, "invalid readahead size %"PRId64"!\n", (int64_t)size);
+		return;
+	}
+
+	u2_ra_bytes = size;
+}
+
+JNIEXPORT void JNICALL nvmeSetWriteBuffer(JNIEnv *env, jobject thisObj, jlong size, jlong maxAgeUs)
+{
+	if (size < 0 || maxAgeUs < 0) {
+		fprintf(stderr, "invalid write buffer size %"PRId64"/age %"PRId64"!\n", (int64_t)size, (int64_t)maxAgeUs);
+		return;
+	}
+
+	u2_wb_bytes = size;
+	u2_wb_age_ns = maxAgeUs * 1000;
+}
+
+JNIEXPORT void JNICALL nvmeSetStripe(JNIEnv *env, jobject thisObj, jlong size)
+{
+	if (size <= 0 || size > UINT32_MAX) {
+		fprintf(stderr, "invalid stripe size %"PRId64"!\n", (int64_t)size);
+		return;
+	}
+
+	u2_stripe_bytes = size;
+}
+
+JNIEXPORT void JNICALL nvmeSetArbitration(JNIEnv *env, jobject thisObj, jboolean weighted, jint lowInflight)
+{
+	if (lowInflight < 0) {
+		fprintf(stderr, "invalid low-priority limit %d!\n", lowInflight);
+		return;
+	}
+
+	u2_prio_weighted = weighted;
+	u2_prio_low_max = lowInflight;
+}
+
+/*
+ * the calling thread's private qpairs are reallocated at the new priority,
+ * once its requests in flight have completed.
+ */
+JNIEXPORT void JNICALL nvmeSetPriority(JNIEnv *env, jobject thisObj, jint priority)
+{
+	struct u2_context *ctx;
+	struct u2_handle *hd;
+	uint32_t h;
+
+	if (priority < 0 || priority >= U2_PRIOS) {
+		fprintf(stderr, "invalid priority %d!\n", priority);
+		return;
+	}
+
+	ctx = u2_context_get();
+	if (ctx->prio == (uint32_t)priority) {
+		return;
+	}
+
+	while (__atomic_load_n(&ctx->inflight, __ATOMIC_ACQUIRE)) {
+		if (ctx->reactor) {    // as in u2_context_fini().
+			u2_context_process_handles(ctx);
+			sched_yield();
+		} else {
+			u2_context_process(ctx);
+		}
+	}
+
+	pthread_mutex_lock(&u2_contexts_lock);
+
+	ctx->prio = priority;
+	if (!ctx->reactor && ctx->ch == &ctx->own) {
+		u2_volume_qpair_free(ctx->own.qpair);
+		ctx->own.qpair = u2_volume_qpair_alloc(&u2_vol, ctx->prio);
+		if (ctx->own.qpair == NULL) {
+			ctx->ch = &u2_shared;
+			u2_qpair_count--;
+		}
+	}
+	for (h = 0; h < ctx->nhandles; h++) {
+		if (ctx->hch[h] == &ctx->hown[h]) {
+			hd = &u2_handles[h];
+			u2_volume_qpair_free(ctx->hown[h].qpair);
+			ctx->hown[h].qpair = u2_volume_qpair_alloc(&hd->vol, ctx->prio);
+			if (ctx->hown[h].qpair == NULL) {
+				ctx->hch[h] = &hd->shared;
+				hd->qpairs--;
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&u2_contexts_lock);
+}
+
+JNIEXPORT void JNICALL nvmeSetBufferPool(JNIEnv *env, jobject thisObj, jlong size)
+{
+	if (size < 0) {
+		fprintf(stderr, "invalid buffer pool size %"PRId64"!\n", (int64_t)size);
+		return;
+	}
+
+	u2_pool_prealloc = size;
+}
+
+JNIEXPORT void JNICALL nvmeInitialize(JNIEnv *env, jobject thisObj)
+{
+	uint32_t dev[U2_DEV_MAX], n, i, ctrlr, nsid;
+
+	printf("\n========================================\n");
+	printf(  "  jni_nvme/jni_u2 - ict.ncic.syssw.ufo"    );
+	printf("\n========================================\n");
+
+	u2_be_opts.io_depth = u2_io_depth;
+	u2_be_opts.queues = u2_qpair_max + u2_reactor_count;    // per device.
+	u2_be_opts.weighted = u2_prio_weighted;
+	if (u2_be->init(&u2_be_opts, &u2_ndev)) {
+		fprintf(stderr, "failed to initialize %s backend!\n", u2_be->name);
+		exit(1);
+	}
+
+	for (i = 0, n = 0; i < u2_ndev; i++) {
+		u2_be->ident(i, &ctrlr, &nsid);
+		if (nsid == U2_NAMESPACE_DEFAULT) {
+			dev[n++] = i;
+		}
+	}
+	if (!n) {
+		fprintf(stderr, "namespace %d is in-active!\n", U2_NAMESPACE_DEFAULT);
+		exit(1);
+	}
+	if (u2_volume_init(&u2_vol, u2_be, dev, n, u2_stripe_bytes)) {
+		fprintf(stderr, "failed to set up volume!\n");
+		exit(1);
+	}
+	u2_ns_sector = u2_vol.sector;
+	u2_ns_size = u2_vol.size;
+
+	if (u2_vol.node >= 0) {
+		printf("devices on NUMA node %d!\n", u2_vol.node);
+	}
+
+	if (u2_pool_init(u2_vol.node)) {
+		fprintf(stderr, "failed to preallocate hugepage buffer pool!\n");
+		exit(1);
+	}
+
+	u2_ra_segs = u2_ra_bytes / U2_RA_CHUNK;    // leave most slots to the caller's own requests.
+	if (u2_ra_segs > U2_RA_SEGS) {
+		u2_ra_segs = U2_RA_SEGS;
+	}
+	if (u2_ra_segs > u2_io_depth / 4) {
+		u2_ra_segs = u2_io_depth / 4;
+	}
+
+	u2_cached = 0;
+	if (u2_cache_bytes) {
+		if (u2_ns_sector > U2_CACHE_BLOCK || u2_cache_init(u2_be, u2_cache_bytes, u2_vol.node)) {
+			fprintf(stderr, "failed to set up block cache!\n");
+			exit(1);
+		}
+		u2_cached = 1;
+	}
+
+	u2_qpair = u2_volume_qpair_alloc(&u2_vol, U2_PRIO_NORMAL);
+	if (!u2_qpair) {
+		fprintf(stderr, "failed to allocate queue pair!\n");
+		exit(1);
+	}
+
+	u2_shared.qpair = u2_qpair;
+	u2_shared.shared = 1;
+	pthread_mutex_init(&u2_shared.lock, NULL);
+
+	u2_qpair_count = 0;
+	u2_prio_low_inflight = 0;
+	u2_hist_init(&u2_lat_retired);
+	memset(u2_io_retired, 0, sizeof(u2_io_retired));
+	u2_cycles_base = u2_cycles();
+	u2_cycles_base_ns = u2_now_ns();
+	if (pthread_key_create(&u2_contexts_key, u2_context_destroy)) {
+		fprintf(stderr, "failed to create thread-local key!\n");
+		exit(1);
+	}
+
+	u2_reactor_next = 0;
+	if (u2_reactor_start()) {
+		fprintf(stderr, "failed to start pollers!\n");
+		exit(1);
+	}
+
+	if (u2_wb_bytes && u2_wb_init()) {
+		fprintf(stderr, "failed to set up write buffer!\n");
+		exit(1);
+	}
+}
+
+JNIEXPORT void JNICALL nvmeFinalize(JNIEnv *env, jobject thisObj)
+{
+	struct u2_context *ctx;
+	uint32_t i;
+
+	u2_telemetry_stop();
+	u2_wal_close_all();
+	u2_kv_close_all();
+	u2_wb_fini();
+
+	pthread_mutex_lock(&u2_contexts_lock);
+	while ((ctx = u2_contexts) != NULL) {
+		u2_contexts = ctx->next;
+		u2_context_fini(ctx);
+	}
+	u2_epoch++;
+	pthread_mutex_unlock(&u2_contexts_lock);
+
+	u2_reactor_stop();
+
+	for (i = 0; i < U2_HANDLE_MAX; i++) {
+		if (u2_handles[i].open) {
+			u2_handle_close(&u2_handles[i]);
+		}
+	}
+
+	if (u2_cached) {
+		u2_cache_fini();
+		u2_cached = 0;
+	}
+
+	pthread_key_delete(u2_contexts_key);
+	pthread_mutex_destroy(&u2_shared.lock);
+
+	u2_pool_fini();
+
+	if (u2_qpair) {
+		u2_volume_qpair_free(u2_qpair);
+		u2_qpair = NULL;
+	}
+
+	u2_be->fini();
+}
+
+JNIEXPORT jlong JNICALL nvmeGetSize(JNIEnv *env, jobject thisObj)
+{
+	return u2_ns_size;
+}
+
+JNIEXPORT jint JNICALL nvmeGetSectorSize(JNIEnv *env, jobject thisObj)
+{
+	return u2_ns_sector;
+}
+
+static jobject
+u2_allocate(JNIEnv *env, jlong size, int zero, int node)
+{
+	void *buf;
+
+	buf = u2_pool_alloc_node(size, zero, node);
+	if (buf == NULL) {
+		fprintf(stderr, "failed to allocate hugepage memory!\n");
+		exit(1);
+	}
+
+	return (*env)->NewDirectByteBuffer(env, buf, (jlong)size);
+}
+
+JNIEXPORT jobject JNICALL allocateHugepageMemory(JNIEnv *env, jobject thisObj, jlong size)
+{
+	return u2_allocate(env, size, 0, -1);
+}
+
+JNIEXPORT jobject JNICALL allocateHugepageMemoryZero(JNIEnv *env, jobject thisObj, jlong size, jboolean zero)
+{
+	return u2_allocate(env, size, zero, -1);
+}
+
+/*
+ * from the pool of that node (-1: the volume's), e.g. nvmeGetNumaNode() of the
+ * controller the buffer goes to.
+ */
+JNIEXPORT jobject JNICALL allocateHugepageMemoryNode(JNIEnv *env, jobject thisObj, jlong size, jboolean zero, jint node)
+{
+	if (node < -1 || node >= U2_NODE_MAX) {
+		fprintf(stderr, "invalid NUMA node %d!\n", node);
+		return NULL;
+	}
+
+	return u2_allocate(env, size, zero, node);
+}
+
+/*
+ * -1 if unknown (or no such controller).
+ */
+JNIEXPORT jint JNICALL nvmeGetNumaNode(JNIEnv *env, jobject thisObj, jint controller)
+{
+	uint32_t dev, ctrlr, nsid;
+
+	for (dev = 0; dev < u2_ndev; dev++) {
+		u2_be->ident(dev, &ctrlr, &nsid);
+		if (ctrlr == (uint32_t)controller) {
+			return u2_be->node(dev);
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * the calling thread on the CPUs of a node, -1 for all of them; returns 0 or
+ * -1 if that didn't work out.
+ */
+JNIEXPORT jint JNICALL nvmeBindNode(JNIEnv *env, jobject thisObj, jint node)
+{
+	if (node < -1 || node >= U2_NODE_MAX) {
+		fprintf(stderr, "invalid NUMA node %d!\n", node);
+		return -1;
+	}
+
+	return u2_bind_node(node);
+}
+
+JNIEXPORT void JNICALL freeHugepageMemory(JNIEnv *env, jobject thisObj, jobject buffer)
+{
+	u2_pool_free((*env)->GetDirectBufferAddress(env, buffer), (*env)->GetDirectBufferCapacity(env, buffer));
+}
+
+JNIEXPORT jlongArray JNICALL getBufferPoolStats(JNIEnv *env, jobject thisObj)
+{
+	jlong stats[U2_POOL_STATS];
+	struct u2_pool_cache *cache;
+	jlongArray array;
+	int i;
+
+	pthread_mutex_lock(&u2_pool_lock);
+	for (i = 0; i < U2_POOL_STAT_RESERVED; i++) {
+		stats[i] = u2_pool_stats[i];
+	}
+	for (cache = u2_pool_caches; cache; cache = cache->next) {    // racy reads of other threads' counters: fine for stats.
+		for (i = 0; i < U2_POOL_STAT_RESERVED; i++) {
+			stats[i] += cache->stats[i];
+		}
+	}
+	stats[U2_POOL_STAT_RESERVED] = u2_pool_reserved;
+	pthread_mutex_unlock(&u2_pool_lock);
+
+	array = (*env)->NewLongArray(env, U2_POOL_STATS);
+	if (array) {
+		(*env)->SetLongArrayRegion(env, array, 0, U2_POOL_STATS, stats);
+	}
+
+	return array;
+}
+
+JNIEXPORT jlong JNICALL getBufferAddress(JNIEnv *env, jobject thisObj, jobject buffer)
+{
+	return (jlong)(uintptr_t)(*env)->GetDirectBufferAddress(env, buffer);
+}
+
+/*
+ * all threads' submit-to-completion latencies (ns) since the last reset.
+ */
+JNIEXPORT jlongArray JNICALL getLatencyStats(JNIEnv *env, jobject thisObj)
+{
+	static struct u2_hist hist;    // too big for the stack, guarded by u2_contexts_lock.
+	jlong stats[U2_LAT_STATS];
+	struct u2_context *ctx;
+	jlongArray array;
+
+	pthread_mutex_lock(&u2_contexts_lock);
+	hist = u2_lat_retired;
+	for (ctx = u2_contexts; ctx; ctx = ctx->next) {    // racy reads of other threads' counters: fine for stats.
+		u2_hist_merge(&hist, &ctx->lat);
+	}
+
+	stats[U2_LAT_STAT_COUNT] = hist.count;
+	stats[U2_LAT_STAT_MIN]   = hist.count ? hist.min : 0;
+	stats[U2_LAT_STAT_MAX]   = hist.max;
+	stats[U2_LAT_STAT_MEAN]  = u2_hist_mean(&hist);
+	stats[U2_LAT_STAT_P50]   = u2_hist_value_at(&hist, 50.0);
+	stats[U2_LAT_STAT_P90]   = u2_hist_value_at(&hist, 90.0);
+	stats[U2_LAT_STAT_P99]   = u2_hist_value_at(&hist, 99.0);
+	stats[U2_LAT_STAT_P999]  = u2_hist_value_at(&hist, 99.9);
+	stats[U2_LAT_STAT_P9999] = u2_hist_value_at(&hist, 99.99);
+	pthread_mutex_unlock(&u2_contexts_lock);
+
+	array = (*env)->NewLongArray(env, U2_LAT_STATS);
+	if (array) {
+		(*env)->SetLongArrayRegion(env, array, 0, U2_LAT_STATS, stats);
+	}
+
+	return array;
+}
+
+JNIEXPORT jlongArray JNICALL getCacheStats(JNIEnv *env, jobject thisObj)
+{
+	int64_t stats[U2_CACHE_STATS];
+	jlongArray array;
+
+	u2_cache_stats(stats);
+
+	array = (*env)->NewLongArray(env, U2_CACHE_STATS);
+	if (array) {
+		(*env)->SetLongArrayRegion(env, array, 0, U2_CACHE_STATS, (jlong *)stats);
+	}
+
+	return array;
+}
+
+JNIEXPORT void JNICALL resetLatencyStats(JNIEnv *env, jobject thisObj)
+{
+	struct u2_context *ctx;
+
+	pthread_mutex_lock(&u2_contexts_lock);
+	u2_hist_init(&u2_lat_retired);
+	for (ctx = u2_contexts; ctx; ctx = ctx->next) {    // races with in-flight recording lose a sample or two.
+		u2_hist_init(&ctx->lat);
+	}
+	pthread_mutex_unlock(&u2_contexts_lock);
+}
+
+/*
+ * all threads' (and shared rings') I/O counters since the last reset, summed
+ * up; in-flight requests as of now.
+ */
+JNIEXPORT jlongArray JNICALL getIoStats(JNIEnv *env, jobject thisObj)
+{
+	int64_t stats[U2_IO_STATS];
+	struct u2_context *ctx;
+	jlongArray array;
+	uint64_t ns;
+
+	memset(stats, 0, sizeof(stats));
+
+	pthread_mutex_lock(&u2_contexts_lock);
+	u2_io_merge(stats, u2_io_retired);
+	for (ctx = u2_contexts; ctx; ctx = ctx->next) {    // racy reads of other threads' counters: fine for stats.
+		u2_io_merge(stats, ctx->io.c);
+		stats[U2_IO_STAT_INFLIGHT] += __atomic_load_n(&ctx->inflight, __ATOMIC_RELAXED);
+		stats[U2_IO_STAT_CONTEXTS]++;
+	}
+	pthread_mutex_unlock(&u2_contexts_lock);
+
+	ns = u2_now_ns() - u2_cycles_base_ns;
+	stats[U2_IO_STAT_CYCLES_HZ] = ns ? (int64_t)((double)(u2_cycles() - u2_cycles_base) * 1e9 / ns) : 0;
+
+	array = (*env)->NewLongArray(env, U2_IO_STATS);
+	if (array) {
+		(*env)->SetLongArrayRegion(env, array, 0, U2_IO_STATS, (jlong *)stats);
+	}
+
+	return array;
+}
+
+JNIEXPORT void JNICALL resetIoStats(JNIEnv *env, jobject thisObj)
+{
+	struct u2_context *ctx;
+
+	pthread_mutex_lock(&u2_contexts_lock);
+	memset(u2_io_retired, 0, sizeof(u2_io_retired));
+	for (ctx = u2_contexts; ctx; ctx = ctx->next) {    // races with in-flight counting lose an update or two.
+		memset(ctx->io.c, 0, sizeof(ctx->io.c));
+	}
+	pthread_mutex_unlock(&u2_contexts_lock);
+}
+
+static inline uint32_t *
+u2_ra_gen(uint64_t offset)
+{
+	return &u2_ra_gens[(offset >> U2_RA_GEN_SHIFT) & (U2_RA_GENS - 1)];
+}
+
+/*
+ * on write completion: a segment whose read was submitted before that has to
+ * go, one submitted after sees the new data.
+ */
+static void
+u2_ra_written(uint64_t offset, uint64_t size)
+{
+	uint64_t region, last = (offset + size - 1) >> U2_RA_GEN_SHIFT;
+	uint32_t n;
+
+	for (region = offset >> U2_RA_GEN_SHIFT, n = 0; region <= last && n < U2_RA_GENS; region++, n++) {
+		__atomic_fetch_add(&u2_ra_gens[region & (U2_RA_GENS - 1)], 1, __ATOMIC_RELEASE);
+	}
+}
+
+/*
+ * called by the backend from process(), i.e. under the channel lock or on the
+ * context's poller.
+ */
+void
+u2_request_complete(struct u2_request *req, int32_t status)
+{
+	struct u2_context *ctx = req->ctx;
+	struct u2_request *parent = req->parent;
+
+	if (parent) {    // a part of a striped request: the last one completes the request.
+		if (status && !parent->part_status) {
+			parent->part_status = status;
+		}
+		if (--parent->pending == 0) {
+			u2_request_complete(parent, parent->part_status);
+		}
+		return;
+	}
+
+	u2_hist_record(&ctx->lat, u2_now_ns() - req->submit_ns);
+	if (u2_cached && req->is_write && req->vol == &u2_vol) {    // again: a miss may have read the old data meanwhile.
+		u2_cache_invalidate(req->lba * u2_ns_sector, req->bytes);
+	}
+	if (u2_ra_segs && req->is_write && req->vol == &u2_vol) {
+		u2_ra_written(req->lba * u2_ns_sector, req->bytes);
+	}
+
+	req->status = status;
+	if (req->is_async) {
+		ctx->cpl_ring[ctx->cpl_tail % ctx->depth] = req->slot;
+		__atomic_store_n(&ctx->cpl_tail, ctx->cpl_tail + 1, __ATOMIC_RELEASE);
+	}
+	if (req->prio_held) {
+		__atomic_fetch_sub(&u2_prio_low_inflight, 1, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&req->done, 1, __ATOMIC_RELEASE);
+	if (ctx->reactor && !ctx->shm) {
+		__atomic_fetch_add(&ctx->wake_seq, 1, __ATOMIC_SEQ_CST);
+	}
+	__atomic_fetch_sub(&ctx->inflight, 1, __ATOMIC_RELEASE);    // last: ctx may be gone right after.
+}
+
+/*
+ * hands a filled-in request to the backend, or stages it for the poller in
+ * reactor mode (where submission errors show up as its completion status).
+ */
+static int
+u2_dispatch(struct u2_context *ctx, struct u2_request *req)
+{
+	uint64_t start;
+	int rc;
+
+	u2_prio_admit(ctx, req, !ctx->reactor && ctx->ch == &ctx->own && u2_vol.weighted);
+	start = u2_cycles();
+
+	if (u2_cached && req->is_write) {
+		u2_cache_invalidate(req->lba * u2_ns_sector, req->bytes);
+	}
+	req->submit_ns = u2_now_ns();
+
+	if (ctx->reactor) {
+		__atomic_fetch_add(&ctx->inflight, 1, __ATOMIC_RELAXED);
+		ctx->sq_ring[ctx->sq_tail % ctx->depth] = req->slot;
+		__atomic_store_n(&ctx->sq_tail, ctx->sq_tail + 1, __ATOMIC_RELEASE);
+		u2_io_count(ctx, req, 0, start);
+		return 0;
+	}
+
+	u2_channel_lock(ctx->ch);
+	rc = u2_volume_submit(ctx->ch->qpair, req);
+	if (!rc) {
+		__atomic_fetch_add(&ctx->inflight, 1, __ATOMIC_RELAXED);
+	}
+	u2_channel_unlock(ctx->ch);
+
+	if (rc) {
+		u2_prio_release(req);
+	}
+	u2_io_count(ctx, req, rc, start);
+
+	return rc;
+}
+
+static int
+u2_submit(struct u2_context *ctx, struct u2_request *req, int is_write, void *buf, uint64_t offset, uint64_t size)
+{
+	req->is_write = is_write;
+	req->buf = buf;
+	req->lba = offset / u2_ns_sector;    // truncates unless aligned: see u2_io_unaligned().
+	req->nlb = size / u2_ns_sector;
+	req->bytes = (uint64_t)req->nlb * u2_ns_sector;
+
+	return u2_dispatch(ctx, req);
+}
+
+static struct u2_request *
+u2_request_get_wait(struct u2_context *ctx)
+{
+	struct u2_request *req;
+	uint64_t start;
+
+	if ((req = u2_request_get(ctx, 0)) != NULL) {
+		return req;
+	}
+
+	start = u2_cycles();
+	while ((req = u2_request_get(ctx, 0)) == NULL) {    // all slots taken by our other requests.
+		u2_context_wait(ctx);
+	}
+	u2_io_count_wait(ctx, start);
+
+	return req;
+}
+
+static void
+u2_request_wait(struct u2_context *ctx, struct u2_request *req)
+{
+	uint64_t start = u2_cycles();
+
+	while (!__atomic_load_n(&req->done, __ATOMIC_ACQUIRE)) {
+		u2_context_wait(ctx);
+	}
+	u2_io_count_wait(ctx, start);
+
+	u2_request_put(ctx, req);
+}
+
+struct u2_part {
+	uint8_t *buf;
+	uint64_t offset;
+	uint64_t size;
+};
+
+/*
+ * the parts go out together if there are slots for all of them, else one at a
+ * time: the others may be held by async I/O or readahead until later.
+ */
+static int32_t
+u2_io_parts(struct u2_context *ctx, int is_write, struct u2_part *part, int n)
+{
+	struct u2_request *req[3];
+	int i, batch = ctx->free_count >= (uint32_t)n;
+	int32_t status = 0;
+
+	for (i = 0; i < n; i++) {
+		req[i] = u2_request_get_wait(ctx);
+		if (u2_submit(ctx, req[i], is_write, part[i].buf, part[i].offset, part[i].size)) {
+			fprintf(stderr, "failed to submit request!\n");
+			exit(1);
+		}
+		if (!batch) {
+			u2_request_wait(ctx, req[i]);
+			status = status ? status : req[i]->status;
+		}
+	}
+
+	for (i = 0; batch && i < n; i++) {
+		u2_request_wait(ctx, req[i]);
+		status = status ? status : req[i]->status;
+	}
+
+	return status;    // of the first part that failed.
+}
+
+static inline pthread_mutex_t *
+u2_rmw_lock(uint64_t lba)
+{
+	return &u2_rmw_locks[(lba ^ lba >> 16) & (U2_RMW_LOCKS - 1)];
+}
+
+/*
+ * byte-granular I/O: a partial head and/or tail sector goes through a pooled
+ * bounce sector (read-modify-write for writes), the aligned middle goes to the
+ * device straight from the caller's buffer unless that is not dword-aligned
+ * there. unaligned writes hold the locks of their partial sectors from the read
+ * to the write, and give up with the read's status if that fails. returns the
+ * status of the first failed command.
+ */
+static int32_t
+u2_io_unaligned(struct u2_context *ctx, int is_write, uint8_t *buf, uint64_t offset, uint64_t size)
+{
+	uint64_t sector = u2_ns_sector;
+	uint64_t end = offset + size;
+	uint64_t head_lba = offset / sector, tail_lba = (end - 1) / sector;
+	uint64_t head_len = 0, tail_start = 0, first, last;
+	struct u2_part part[3];
+	struct u2_part *head = NULL, *tail = NULL, *mid = NULL;
+	pthread_mutex_t *lock[2] = { NULL, NULL };
+	uint8_t *bounce, *mid_bounce = NULL;
+	int32_t status = 0;
+	int n = 0;
+
+	bounce = u2_pool_alloc(2 * sector, 0);
+	if (bounce == NULL) {
+		fprintf(stderr, "failed to allocate bounce sectors!\n");
+		exit(1);
+	}
+
+	if (offset % sector) {
+		head = &part[n++];
+		head->buf = bounce;
+		head->offset = head_lba * sector;
+		head->size = sector;
+		head_len = (end < head->offset + sector ? end : head->offset + sector) - offset;
+	}
+	if (end % sector && !(head && tail_lba == head_lba)) {
+		tail = &part[n++];
+		tail->buf = bounce + sector;
+		tail->offset = tail_lba * sector;
+		tail->size = sector;
+		tail_start = offset > tail->offset ? offset : tail->offset;
+	}
+
+	first = head ? head_lba + 1 : head_lba;
+	last = tail ? tail_lba : tail_lba + 1;    // exclusive.
+	if (first < last) {
+		mid = &part[n++];
+		mid->buf = buf + (first * sector - offset);
+		mid->offset = first * sector;
+		mid->size = (last - first) * sector;
+
+		if ((uintptr_t)mid->buf & (u2_be->buf_align - 1)) {    // e.g. PRPs need dword-aligned buffers.
+			mid_bounce = u2_pool_alloc(mid->size, 0);
+			if (mid_bounce == NULL) {
+				fprintf(stderr, "failed to allocate bounce buffer!\n");
+				exit(1);
+			}
+			if (is_write) {
+				memcpy(mid_bounce, mid->buf, mid->size);
+			}
+			mid->buf = mid_bounce;
+		}
+	}
+
+	if (is_write && (head || tail)) {    // read-modify-write: fetch the partial sectors first.
+		lock[0] = u2_rmw_lock(head ? head_lba : tail_lba);
+		lock[1] = head && tail ? u2_rmw_lock(tail_lba) : NULL;
+		if (lock[1] == lock[0]) {
+			lock[1] = NULL;
+		} else if (lock[1] && lock[1] < lock[0]) {    // in address order, against deadlocks.
+			lock[1] = lock[0];
+			lock[0] = u2_rmw_lock(tail_lba);
+		}
+		pthread_mutex_lock(lock[0]);
+		if (lock[1]) {
+			pthread_mutex_lock(lock[1]);
+		}
+
+		status = u2_io_parts(ctx, 0, part, (head != NULL) + (tail != NULL));
+		if (head) {
+			memcpy(bounce + offset % sector, buf, head_len);
+		}
+		if (tail) {
+			memcpy(bounce + sector + (tail_start - tail->offset), buf + (tail_start - offset), end - tail_start);
+		}
+	}
+
+	if (!status) {
+		status = u2_io_parts(ctx, is_write, part, n);
+	}
+
+	if (lock[1]) {
+		pthread_mutex_unlock(lock[1]);
+	}
+	if (lock[0]) {
+		pthread_mutex_unlock(lock[0]);
+	}
+
+	if (!is_write) {
+		if (head) {
+			memcpy(buf, bounce + offset % sector, head_len);
+		}
+		if (tail) {
+			memcpy(buf + (tail_start - offset), bounce + sector + (tail_start - tail->offset), end - tail_start);
+		}
+		if (mid_bounce) {
+			memcpy(buf + (mid->offset - offset), mid_bounce, mid->size);
+		}
+	}
+
+	if (mid_bounce) {
+		u2_pool_free(mid_bounce, mid->size);
+	}
+	u2_pool_free(bounce, 2 * sector);
+
+	return status;
+}
+
+static int32_t
+u2_io_one(struct u2_context *ctx, int is_write, void *buf, uint64_t offset, uint64_t size)
+{
+	struct u2_request *req = u2_request_get_wait(ctx);
+
+	if (u2_submit(ctx, req, is_write, buf, offset, size)) {
+		fprintf(stderr, "failed to submit request!\n");
+		exit(1);
+	}
+	u2_request_wait(ctx, req);    // the slot is ours until the next get: status stays put.
+
+	return req->status;
+}
+
+/*
+ * write-back staging for small sector-aligned nvmeWrite()s: adjacent and
+ * overlapping ones are merged into at most U2_WB_EXTENTS disjoint extents of
+ * up to u2_wb_bytes, each written back with one command once full, once
+ * older than u2_wb_age_ns (by the flusher thread), when its slot is needed,
+ * or on nvmeFlush(). anything else touching a staged range writes it back
+ * first, except for reads it fully covers, which are served from it. write
+ * back is synchronous and under u2_wb_lock, so nothing is ever half-flushed.
+ * a failed one is reported by every later nvmeFlush()/nvmeBarrier().
+ */
+static void
+u2_wb_writeback(struct u2_context *ctx, struct u2_wb_extent *e)
+{
+	int32_t status = u2_io_one(ctx, 1, e->buf, e->start, e->end - e->start);
+
+	if (status && !u2_wb_error) {
+		__atomic_store_n(&u2_wb_error, status, __ATOMIC_RELEASE);
+	}
+
+	e->start = e->end = 0;
+	__atomic_store_n(&u2_wb_used, u2_wb_used - 1, __ATOMIC_RELEASE);
+}
+
+static inline int
+u2_wb_overlaps(struct u2_wb_extent *e, uint64_t offset, uint64_t size)
+{
+	return e->start != e->end && offset < e->end && e->start < offset + size;
+}
+
+/*
+ * writes back whatever is staged in [offset, offset + size).
+ */
+static void
+u2_wb_fence(struct u2_context *ctx, uint64_t offset, uint64_t size)
+{
+	uint32_t i;
+
+	if (!__atomic_load_n(&u2_wb_used, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+
+	pthread_mutex_lock(&u2_wb_lock);
+	for (i = 0; i < U2_WB_EXTENTS; i++) {
+		if (u2_wb_overlaps(&u2_wb[i], offset, size)) {
+			u2_wb_writeback(ctx, &u2_wb[i]);
+		}
+	}
+	pthread_mutex_unlock(&u2_wb_lock);
+}
+
+/*
+ * 1 if the read was served from an extent; else the ones it overlaps are
+ * written back and the caller goes to the device.
+ */
+static int
+u2_wb_read(struct u2_context *ctx, uint8_t *buf, uint64_t offset, uint64_t size)
+{
+	struct u2_wb_extent *e;
+	uint32_t i;
+
+	if (!__atomic_load_n(&u2_wb_used, __ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&u2_wb_lock);
+	for (i = 0; i < U2_WB_EXTENTS; i++) {
+		e = &u2_wb[i];
+		if (e->start != e->end && e->start <= offset && offset + size <= e->end) {
+			memcpy(buf, e->buf + (offset - e->start), size);
+			pthread_mutex_unlock(&u2_wb_lock);
+			return 1;
+		}
+		if (u2_wb_overlaps(e, offset, size)) {
+			u2_wb_writeback(ctx, e);
+		}
+	}
+	pthread_mutex_unlock(&u2_wb_lock);
+
+	return 0;
+}
+
+/*
+ * stages a write: merged into the first extent it overlaps or touches if the
+ * union still fits, else into a free (or the oldest, written back) extent.
+ * other extents it overlaps or touches are written back first: they are older
+ * and, being next to a full one, will not grow much further anyway.
+ */
+static void
+u2_wb_write(struct u2_context *ctx, const uint8_t *buf, uint64_t offset, uint64_t size)
+{
+	struct u2_wb_extent *e, *target = NULL, *victim = NULL;
+	uint64_t lo, hi;
+	uint32_t i;
+
+	pthread_mutex_lock(&u2_wb_lock);
+
+	for (i = 0; i < U2_WB_EXTENTS; i++) {
+		e = &u2_wb[i];
+		if (e->start == e->end || offset > e->end || e->start > offset + size) {
+			continue;
+		}
+
+		lo = e->start < offset ? e->start : offset;
+		hi = e->end > offset + size ? e->end : offset + size;
+		if (target == NULL && hi - lo <= u2_wb_bytes) {
+			target = e;
+		} else {
+			u2_wb_writeback(ctx, e);
+		}
+	}
+
+	if (target == NULL) {
+		for (i = 0; i < U2_WB_EXTENTS; i++) {
+			e = &u2_wb[i];
+			if (e->start == e->end) {
+				target = e;
+				break;
+			}
+			if (victim == NULL || e->born_ns < victim->born_ns) {
+				victim = e;
+			}
+		}
+		if (target == NULL) {
+			u2_wb_writeback(ctx, victim);
+			target = victim;
+		}
+
+		target->start = target->end = offset;
+		target->born_ns = u2_now_ns();
+		__atomic_store_n(&u2_wb_used, u2_wb_used + 1, __ATOMIC_RELEASE);
+	}
+
+	if (offset < target->start) {
+		memmove(target->buf + (target->start - offset), target->buf, target->end - target->start);
+		target->start = offset;
+	}
+	memcpy(target->buf + (offset - target->start), buf, size);
+	if (offset + size > target->end) {
+		target->end = offset + size;
+	}
+
+	if (target->end - target->start == u2_wb_bytes) {
+		u2_wb_writeback(ctx, target);
+	}
+
+	pthread_mutex_unlock(&u2_wb_lock);
+}
+
+static void
+u2_wb_flush(struct u2_context *ctx, uint64_t age_ns)
+{
+	uint64_t now = u2_now_ns();
+	uint32_t i;
+
+	if (!__atomic_load_n(&u2_wb_used, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+
+	pthread_mutex_lock(&u2_wb_lock);
+	for (i = 0; i < U2_WB_EXTENTS; i++) {
+		if (u2_wb[i].start != u2_wb[i].end && now - u2_wb[i].born_ns >= age_ns) {
+			u2_wb_writeback(ctx, &u2_wb[i]);
+		}
+	}
+	pthread_mutex_unlock(&u2_wb_lock);
+}
+
+static void *
+u2_wb_run(void *arg)
+{
+	struct u2_context *ctx = u2_context_get();
+	struct timespec ts;
+
+	ts.tv_sec = u2_wb_age_ns / 2 / 1000000000;
+	ts.tv_nsec = u2_wb_age_ns / 2 % 1000000000;
+
+	while (!__atomic_load_n(&u2_wb_stop, __ATOMIC_ACQUIRE)) {
+		nanosleep(&ts, NULL);
+		u2_wb_flush(ctx, u2_wb_age_ns);
+	}
+
+	return NULL;
+}
+
+static int
+u2_wb_init(void)
+{
+	uint32_t i;
+
+	if (u2_wb_bytes % u2_ns_sector || u2_wb_bytes > UINT32_MAX) {
+		return -1;
+	}
+
+	for (i = 0; i < U2_WB_EXTENTS; i++) {
+		u2_wb[i].buf = u2_be->dma_alloc(u2_wb_bytes, U2_POOL_PAGE_SIZE, u2_vol.node);
+		u2_wb[i].start = u2_wb[i].end = 0;
+		if (u2_wb[i].buf == NULL) {
+			return -1;
+		}
+	}
+	u2_wb_used = 0;
+	u2_wb_error = 0;
+	u2_wb_on = 1;
+
+	u2_wb_stop = 0;
+	if (u2_wb_age_ns && pthread_create(&u2_wb_thread, NULL, u2_wb_run, NULL)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * stops the flusher and writes back everything still staged.
+ */
+static void
+u2_wb_fini(void)
+{
+	uint32_t i;
+
+	if (!u2_wb_on) {
+		return;
+	}
+
+	if (u2_wb_age_ns) {
+		__atomic_store_n(&u2_wb_stop, 1, __ATOMIC_RELEASE);
+		pthread_join(u2_wb_thread, NULL);
+	}
+
+	u2_wb_flush(u2_context_get(), 0);
+	for (i = 0; i < U2_WB_EXTENTS; i++) {
+		u2_be->dma_free(u2_wb[i].buf);
+		u2_wb[i].buf = NULL;
+	}
+	u2_wb_on = 0;
+}
+
+/*
+ * writes back whatever is staged. returns 0, or the status of the first write
+ * back that failed since nvmeInitialize(), whenever that was.
+ */
+JNIEXPORT jint JNICALL nvmeFlush(JNIEnv *env, jobject thisObj)
+{
+	if (!u2_wb_on) {
+		return 0;
+	}
+
+	u2_wb_flush(u2_context_get(), 0);
+
+	return __atomic_load_n(&u2_wb_error, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * a device cache flush: whatever was written (and had completed) before is
+ * durable once this returns.
+ */
+int
+u2_io_flush(void)
+{
+	struct u2_context *ctx = u2_context_get();
+	struct u2_request *req;
+
+	req = u2_request_get_wait(ctx);
+	req->is_flush = 1;
+	req->is_write = 0;
+	req->buf = NULL;
+	req->lba = 0;
+	req->nlb = 0;
+	req->bytes = 0;
+	if (u2_dispatch(ctx, req)) {
+		fprintf(stderr, "failed to submit flush!\n");
+		exit(1);
+	}
+	u2_request_wait(ctx, req);
+
+	return req->status;
+}
+
+/*
+ * nvmeFlush(), then a device cache flush; returns the first error of the two.
+ */
+JNIEXPORT jint JNICALL nvmeBarrier(JNIEnv *env, jobject thisObj)
+{
+	jint rc = nvmeFlush(env, thisObj);
+	int status = u2_io_flush();
+
+	return rc ? rc : status;
+}
+
+int
+u2_io(int is_write, void *buf, uint64_t offset, uint64_t size)
+{
+	struct u2_context *ctx = u2_context_get();
+
+	if (u2_wb_on) {
+		u2_wb_fence(ctx, offset, size);
+	}
+
+	return u2_io_one(ctx, is_write, buf, offset, size);
+}
+
+/*
+ * block-aligned reads through the cache: hits are copied out, every run of
+ * missing blocks is one device read straight into the caller's buffer and is
+ * then added to the cache unless the read failed.
+ */
+static void
+u2_io_cached(struct u2_context *ctx, uint8_t *buf, uint64_t offset, uint64_t size)
+{
+	uint64_t gen[U2_CACHE_IO_MAX / U2_CACHE_BLOCK];
+	uint64_t blk = offset / U2_CACHE_BLOCK;
+	uint32_t n = size / U2_CACHE_BLOCK, i, j, start = 0, run = 0;
+
+	for (i = 0; i <= n; i++) {
+		if (i < n && u2_cache_lookup(blk + i, buf + (uint64_t)i * U2_CACHE_BLOCK, &gen[i])) {
+			if (!run++) {
+				start = i;
+			}
+			continue;
+		}
+		if (!run) {
+			continue;
+		}
+
+		if (!u2_io_one(ctx, 0, buf + (uint64_t)start * U2_CACHE_BLOCK,
+		               offset + (uint64_t)start * U2_CACHE_BLOCK, (uint64_t)run * U2_CACHE_BLOCK)) {
+			for (j = start; j < start + run; j++) {
+				u2_cache_insert(blk + j, buf + (uint64_t)j * U2_CACHE_BLOCK, gen[j]);
+			}
+		}
+		run = 0;
+	}
+}
+
+static void
+u2_ra_issue(struct u2_context *ctx)
+{
+	struct u2_ra *ra = &ctx->ra;
+	struct u2_ra_seg *seg;
+	struct u2_request *req;
+	uint64_t size;
+
+	while (ra->tail - ra->head < ra->window && ra->issue < u2_ns_size) {
+		req = u2_request_hold(ctx, 0);
+		if (req == NULL) {    // the caller's async requests come first.
+			break;
+		}
+
+		seg = &ra->seg[ra->tail % U2_RA_SEGS];
+		size = u2_ns_size - ra->issue < U2_RA_CHUNK ? u2_ns_size - ra->issue : U2_RA_CHUNK;
+		seg->req = req;
+		seg->offset = ra->issue;
+		seg->size = size;
+		seg->gen[0] = __atomic_load_n(u2_ra_gen(seg->offset), __ATOMIC_ACQUIRE);
+		seg->gen[1] = __atomic_load_n(u2_ra_gen(seg->offset + size - 1), __ATOMIC_ACQUIRE);
+
+		if (u2_submit(ctx, req, 0, ra->buf + (uint64_t)(ra->tail % U2_RA_SEGS) * U2_RA_CHUNK, seg->offset, size)) {
+			fprintf(stderr, "failed to submit readahead!\n");
+			exit(1);
+		}
+		ra->issue += size;
+		ra->tail++;
+	}
+}
+
+static void
+u2_ra_wait(struct u2_context *ctx, struct u2_ra_seg *seg)
+{
+	uint64_t start = u2_cycles();
+
+	while (!__atomic_load_n(&seg->req->done, __ATOMIC_ACQUIRE)) {
+		u2_context_wait(ctx);
+	}
+	u2_io_count_wait(ctx, start);
+}
+
+static void
+u2_ra_drop(struct u2_context *ctx)
+{
+	struct u2_ra *ra = &ctx->ra;
+
+	for (; ra->head != ra->tail; ra->head++) {
+		u2_request_wait(ctx, ra->seg[ra->head % U2_RA_SEGS].req);
+	}
+}
+
+static inline int
+u2_ra_ahead(struct u2_ra *ra, uint64_t offset)
+{
+	return ra->head != ra->tail && offset >= ra->seg[ra->head % U2_RA_SEGS].offset && offset < ra->issue;
+}
+
+/*
+ * serves what it can of a read continuing the stream from the segments,
+ * oldest first, and returns how far it got. a segment is retired once read
+ * past; a failed or overwritten one throws away the rest of the window.
+ */
+static uint64_t
+u2_ra_read(struct u2_context *ctx, uint8_t *buf, uint64_t offset, uint64_t size)
+{
+	struct u2_ra *ra = &ctx->ra;
+	struct u2_ra_seg *seg;
+	uint64_t pos = offset, end = offset + size, n;
+
+	while (pos < end && ra->head != ra->tail) {
+		seg = &ra->seg[ra->head % U2_RA_SEGS];
+		if (pos < seg->offset) {
+			break;
+		}
+
+		u2_ra_wait(ctx, seg);
+		if (seg->req->status ||
+		    seg->gen[0] != __atomic_load_n(u2_ra_gen(seg->offset), __ATOMIC_ACQUIRE) ||
+		    seg->gen[1] != __atomic_load_n(u2_ra_gen(seg->offset + seg->size - 1), __ATOMIC_ACQUIRE)) {
+			u2_ra_drop(ctx);
+			ra->issue = pos;
+			ra->window = 1;
+			break;
+		}
+
+		n = 0;
+		if (pos < seg->offset + seg->size) {
+			n = (end < seg->offset + seg->size ? end : seg->offset + seg->size) - pos;
+			memcpy(buf + (pos - offset), ra->buf + (uint64_t)(ra->head % U2_RA_SEGS) * U2_RA_CHUNK + (pos - seg->offset), n);
+			pos += n;
+		}
+		if (pos < seg->offset + seg->size) {
+			break;
+		}
+
+		u2_request_put(ctx, seg->req);
+		ra->head++;
+		if (n && ra->window < u2_ra_segs) {    // used up: worth twice as much next time.
+			ra->window = 2 * ra->window < u2_ra_segs ? 2 * ra->window : u2_ra_segs;
+		}
+	}
+
+	return pos - offset;
+}
+
+/*
+ * sector-aligned reads of up to U2_RA_CHUNK bytes: U2_RA_TRIGGER of them in a
+ * row make a stream, whose next segments are then read ahead asynchronously.
+ * the window doubles whenever a segment is used up and halves whenever the
+ * caller goes elsewhere; segments left behind stay until a new stream starts.
+ */
+static void
+u2_io_readahead(struct u2_context *ctx, uint8_t *buf, uint64_t offset, uint64_t size)
+{
+	struct u2_ra *ra = &ctx->ra;
+	uint64_t done = 0;
+
+	if (offset == ra->next || u2_ra_ahead(ra, offset)) {
+		ra->seq++;
+	} else {
+		ra->seq = 1;
+		ra->window = ra->window > 1 ? ra->window / 2 : 1;
+	}
+	ra->next = offset + size;
+
+	if (ra->seq >= U2_RA_TRIGGER) {
+		if (ra->buf == NULL) {
+			ra->buf = u2_be->dma_alloc((uint64_t)U2_RA_SEGS * U2_RA_CHUNK, U2_POOL_PAGE_SIZE, u2_vol.node);
+			if (ra->buf == NULL) {
+				fprintf(stderr, "failed to allocate readahead buffer!\n");
+				exit(1);
+			}
+		}
+		if (ra->seq == U2_RA_TRIGGER && !u2_ra_ahead(ra, offset)) {
+			u2_ra_drop(ctx);    // a new stream: whatever is left is stale by now.
+			ra->issue = ra->next;
+			if (ra->window < 2) {
+				ra->window = u2_ra_segs < 2 ? u2_ra_segs : 2;
+			}
+		}
+
+		done = u2_ra_read(ctx, buf, offset, size);
+		if (ra->issue < ra->next) {
+			ra->issue = ra->next;
+		}
+		u2_ra_issue(ctx);
+	}
+
+	offset += done;
+	size -= done;
+	if (u2_cached && size && !((offset | size) & (U2_CACHE_BLOCK - 1))) {
+		u2_io_cached(ctx, buf + done, offset, size);
+	} else if (size) {
+		u2_io_one(ctx, 0, buf + done, offset, size);
+	}
+}
+
+static void
+u2_io_sync(int is_write, void *buf, jlong offset, jlong size)
+{
+	struct u2_context *ctx = u2_context_get();
+	struct u2_request *req;
+
+	if (u2_ns_size < size) {
+		fprintf(stderr, "invalid I/O size %"PRId64"!\n", (int64_t)size);
+		exit(1);
+	}
+
+	if (u2_wb_on) {
+		if (size > 0 && offset >= 0 && (uint64_t)(offset + size) <= u2_ns_size && !((offset | size) & (u2_ns_sector - 1))) {
+			if (is_write && (uint64_t)size < u2_wb_bytes) {
+				u2_wb_write(ctx, buf, offset, size);
+				return;
+			}
+			if (!is_write && u2_wb_read(ctx, buf, offset, size)) {
+				return;
+			}
+		}
+		u2_wb_fence(ctx, offset, size);    // no-op for reads that went through u2_wb_read().
+	}
+
+	if (u2_unaligned && ((offset | size) & (u2_ns_sector - 1))) {
+		if (size <= 0 || offset < 0 || (uint64_t)(offset + size) > u2_ns_size) {
+			fprintf(stderr, "invalid I/O range %"PRId64"+%"PRId64"!\n", (int64_t)offset, (int64_t)size);
+			exit(1);
+		}
+		u2_io_unaligned(ctx, is_write, buf, offset, size);
+		return;
+	}
+
+	if (u2_ra_segs && !is_write && size > 0 && size <= U2_RA_CHUNK &&
+	    !((offset | size) & (u2_ns_sector - 1)) && (uint64_t)(offset + size) <= u2_ns_size) {
+		u2_io_readahead(ctx, buf, offset, size);
+		return;
+	}
+
+	if (u2_cached && !is_write && size > 0 && size <= U2_CACHE_IO_MAX &&
+	    !((offset | size) & (U2_CACHE_BLOCK - 1)) && (uint64_t)(offset + size) <= u2_ns_size) {
+		u2_io_cached(ctx, buf, offset, size);
+		return;
+	}
+
+	req = u2_request_get_wait(ctx);
+
+	if (u2_submit(ctx, req, is_write, buf, offset, size)) {
+		fprintf(stderr, "failed to submit request!\n");
+		exit(1);
+	}
+
+	u2_request_wait(ctx, req);
+}
+
+JNIEXPORT void JNICALL nvmeWrite(JNIEnv *env, jobject thisObj, jobject buffer, jlong offset, jlong size)
+{
+	u2_io_sync(1, (*env)->GetDirectBufferAddress(env, buffer), offset, size);
+}
+
+JNIEXPORT void JNICALL nvmeRead(JNIEnv *env, jobject thisObj, jobject buffer, jlong offset, jlong size)
+{
+	u2_io_sync(0, (*env)->GetDirectBufferAddress(env, buffer), offset, size);
+}
+
+/*
+ * one command straight from/into several hugepage buffers. alignment rules
+ * for the elements are the backend's (page-aligned joints for SPDK PRPs).
+ */
+static void
+u2_io_sync_v(JNIEnv *env, int is_write, jobjectArray buffers, jlongArray sizes, jlong offset)
+{
+	struct u2_context *ctx = u2_context_get();
+	struct u2_request *req;
+	struct u2_sgl sgl;
+	jlong size[U2_SGE_MAX], cap;
+	uint64_t total;
+	jobject buffer;
+	jsize i, n;
+	int rc;
+
+	n = (*env)->GetArrayLength(env, buffers);
+	if (n < 1 || n > U2_SGE_MAX || (*env)->GetArrayLength(env, sizes) < n) {
+		fprintf(stderr, "invalid number of I/O vectors %d!\n", n);
+		exit(1);
+	}
+	(*env)->GetLongArrayRegion(env, sizes, 0, n, size);
+
+	total = 0;
+	for (i = 0; i < n; i++) {
+		buffer = (*env)->GetObjectArrayElement(env, buffers, i);
+		sgl.sge[i].iov_base = (*env)->GetDirectBufferAddress(env, buffer);
+		sgl.sge[i].iov_len = size[i];
+		cap = (*env)->GetDirectBufferCapacity(env, buffer);
+		(*env)->DeleteLocalRef(env, buffer);
+
+		if (sgl.sge[i].iov_base == NULL || size[i] <= 0 || size[i] > UINT32_MAX || size[i] > cap) {
+			fprintf(stderr, "invalid I/O vector %d!\n", i);
+			exit(1);
+		}
+		total += size[i];
+	}
+	sgl.count = n;
+
+	if (u2_ns_size < total) {
+		fprintf(stderr, "invalid I/O size %"PRIu64"!\n", total);
+		exit(1);
+	}
+
+	if (u2_wb_on) {
+		u2_wb_fence(ctx, offset, total);
+	}
+
+	req = u2_request_get_wait(ctx);
+	req->sgl = &sgl;
+	req->is_write = is_write;
+	req->lba = offset / u2_ns_sector;
+	req->nlb = total / u2_ns_sector;
+	req->bytes = total;
+
+	rc = u2_dispatch(ctx, req);
+	if (rc) {
+		fprintf(stderr, "failed to submit request!\n");
+		exit(1);
+	}
+
+	u2_request_wait(ctx, req);
+}
+
+JNIEXPORT void JNICALL nvmeWritev(JNIEnv *env, jobject thisObj, jobjectArray buffers, jlongArray sizes, jlong offset)
+{
+	u2_io_sync_v(env, 1, buffers, sizes, offset);
+}
+
+JNIEXPORT void JNICALL nvmeReadv(JNIEnv *env, jobject thisObj, jobjectArray buffers, jlongArray sizes, jlong offset)
+{
+	u2_io_sync_v(env, 0, buffers, sizes, offset);
+}
+
+static jlong
+u2_io_async(int is_write, void *buf, jlong offset, jlong size)
+{
+	struct u2_context *ctx = u2_context_get();
+	struct u2_request *req;
+
+	if (u2_ns_size < size) {
+		fprintf(stderr, "invalid I/O size %"PRId64"!\n", (int64_t)size);
+		return -1;
+	}
+
+	if (u2_wb_on) {
+		u2_wb_fence(ctx, offset, size);
+	}
+
+	req = u2_request_hold(ctx, 1);
+	if (req == NULL) {    // queue full: caller has to nvmePoll() first.
+		return -1;
+	}
+
+	if (u2_submit(ctx, req, is_write, buf, offset, size)) {
+		fprintf(stderr, "failed to submit request!\n");
+		u2_request_put(ctx, req);
+		return -1;
+	}
+
+	return (jlong)U2_TOKEN(req->gen, req->slot);
+}
+
+JNIEXPORT jlong JNICALL nvmeWriteAsync(JNIEnv *env, jobject thisObj, jlong buffer, jlong offset, jlong size)
+{
+	return u2_io_async(1, (void *)(uintptr_t)buffer, offset, size);
+}
+
+JNIEXPORT jlong JNICALL nvmeReadAsync(JNIEnv *env, jobject thisObj, jlong buffer, jlong offset, jlong size)
+{
+	return u2_io_async(0, (void *)(uintptr_t)buffer, offset, size);
+}
+
+JNIEXPORT jint JNICALL nvmePoll(JNIEnv *env, jobject thisObj, jlongArray tokens, jintArray status)
+{
+	struct u2_context *ctx = u2_context_get();
+	struct u2_request *req;
+	jlong *tok;
+	jint *sts;
+	jsize max, n;
+	uint32_t tail;
+
+	max = (*env)->GetArrayLength(env, tokens);
+	if (status && (*env)->GetArrayLength(env, status) < max) {
+		max = (*env)->GetArrayLength(env, status);
+	}
+
+	if (!ctx->reactor) {    // else the poller is on it.
+		u2_context_process(ctx);
+	} else if (ctx->nhandles) {
+		u2_context_process_handles(ctx);
+	}
+
+	tail = __atomic_load_n(&ctx->cpl_tail, __ATOMIC_ACQUIRE);
+	if (ctx->cpl_head == tail || max == 0) {
+		return 0;
+	}
+
+	tok = (*env)->GetPrimitiveArrayCritical(env, tokens, NULL);
+	sts = status ? (*env)->GetPrimitiveArrayCritical(env, status, NULL) : NULL;
+
+	for (n = 0; n < max && ctx->cpl_head != tail; n++) {
+		req = &ctx->reqs[ctx->cpl_ring[ctx->cpl_head++ % ctx->depth]];
+
+		tok[n] = (jlong)U2_TOKEN(req->gen, req->slot);
+		if (sts) {
+			sts[n] = req->status;
+		}
+		u2_request_put(ctx, req);
+	}
+
+	if (sts) {
+		(*env)->ReleasePrimitiveArrayCritical(env, status, sts, 0);
+	}
+	(*env)->ReleasePrimitiveArrayCritical(env, tokens, tok, 0);
+
+	return n;
+}
+
+/*
+ * a handle on namespace nsid of the given controller, -1 if there is no such
+ * active namespace or no handle left.
+ */
+JNIEXPORT jlong JNICALL nvmeOpen(JNIEnv *env, jobject thisObj, jint controller, jint namespace)
+{
+	struct u2_handle *hd;
+	uint32_t dev, ctrlr, nsid, h;
+
+	for (dev = 0; dev < u2_ndev; dev++) {
+		u2_be->ident(dev, &ctrlr, &nsid);
+		if (ctrlr == (uint32_t)controller && nsid == (uint32_t)namespace) {
+			break;
+		}
+	}
+	if (dev == u2_ndev) {
+		fprintf(stderr, "no namespace %d on controller %d!\n", namespace, controller);
+		return -1;
+	}
+
+	pthread_mutex_lock(&u2_contexts_lock);
+
+	for (h = 0; h < U2_HANDLE_MAX && u2_handles[h].open; h++);
+	if (h == U2_HANDLE_MAX) {
+		pthread_mutex_unlock(&u2_contexts_lock);
+		fprintf(stderr, "too many open namespaces!\n");
+		return -1;
+	}
+
+	hd = &u2_handles[h];
+	if (u2_volume_init(&hd->vol, u2_be, &dev, 1, 0)) {
+		pthread_mutex_unlock(&u2_contexts_lock);
+		return -1;
+	}
+	hd->shared.qpair = u2_volume_qpair_alloc(&hd->vol, U2_PRIO_NORMAL);
+	if (hd->shared.qpair == NULL) {
+		pthread_mutex_unlock(&u2_contexts_lock);
+		fprintf(stderr, "failed to allocate queue pair!\n");
+		return -1;
+	}
+	hd->shared.shared = 1;
+	pthread_mutex_init(&hd->shared.lock, NULL);
+	hd->qpairs = 0;
+	hd->open = 1;
+
+	pthread_mutex_unlock(&u2_contexts_lock);
+
+	return h;
+}
+
+/*
+ * only with no I/O in flight on the handle, from any thread.
+ */
+JNIEXPORT void JNICALL nvmeClose(JNIEnv *env, jobject thisObj, jlong handle)
+{
+	struct u2_handle *hd;
+
+	pthread_mutex_lock(&u2_contexts_lock);
+	hd = u2_handle_get(handle);
+	if (hd) {
+		u2_handle_close(hd);
+	}
+	pthread_mutex_unlock(&u2_contexts_lock);
+}
+
+JNIEXPORT jlong JNICALL nvmeGetSizeNs(JNIEnv *env, jobject thisObj, jlong handle)
+{
+	struct u2_handle *hd = u2_handle_get(handle);
+
+	return hd ? (jlong)hd->vol.size : -1;
+}
+
+JNIEXPORT jint JNICALL nvmeGetSectorSizeNs(JNIEnv *env, jobject thisObj, jlong handle)
+{
+	struct u2_handle *hd = u2_handle_get(handle);
+
+	return hd ? (jint)hd->vol.sector : -1;
+}
+
+static void
+u2_handle_io_sync(jlong handle, int is_write, void *buf, jlong offset, jlong size)
+{
+	struct u2_context *ctx = u2_context_get();
+	struct u2_handle *hd = u2_handle_get(handle);
+	struct u2_channel *ch;
+	struct u2_request *req;
+
+	if (hd == NULL || !u2_handle_range(hd, offset, size)) {
+		fprintf(stderr, "invalid I/O %"PRId64"+%"PRId64" on handle %"PRId64"!\n", (int64_t)offset, (int64_t)size, (int64_t)handle);
+		exit(1);
+	}
+	ch = u2_handle_channel(ctx, handle);
+
+	req = u2_request_get_wait(ctx);
+	if (u2_handle_submit(ctx, ch, hd, req, is_write, buf, offset, size)) {
+		fprintf(stderr, "failed to submit request!\n");
+		exit(1);
+	}
+	u2_handle_wait(ctx, ch, req);
+	u2_request_put(ctx, req);
+}
+
+static jlong
+u2_handle_io_async(jlong handle, int is_write, void *buf, jlong offset, jlong size)
+{
+	struct u2_context *ctx = u2_context_get();
+	struct u2_handle *hd = u2_handle_get(handle);
+	struct u2_request *req;
+
+	if (hd == NULL || !u2_handle_range(hd, offset, size)) {
+		fprintf(stderr, "invalid I/O %"PRId64"+%"PRId64" on handle %"PRId64"!\n", (int64_t)offset, (int64_t)size, (int64_t)handle);
+		return -1;
+	}
+
+	req = u2_request_hold(ctx, 1);
+	if (req == NULL) {    // queue full: caller has to nvmePoll() first.
+		return -1;
+	}
+
+	if (u2_handle_submit(ctx, u2_handle_channel(ctx, handle), hd, req, is_write, buf, offset, size)) {
+		fprintf(stderr, "failed to submit request!\n");
+		u2_request_put(ctx, req);
+		return -1;
+	}
+
+	return (jlong)U2_TOKEN(req->gen, req->slot);
+}
+
+JNIEXPORT void JNICALL nvmeWriteNs(JNIEnv *env, jobject thisObj, jlong handle, jobject buffer, jlong offset, jlong size)
+{
+	u2_handle_io_sync(handle, 1, (*env)->GetDirectBufferAddress(env, buffer), offset, size);
+}
+
+JNIEXPORT void JNICALL nvmeReadNs(JNIEnv *env, jobject thisObj, jlong handle, jobject buffer, jlong offset, jlong size)
+{
+	u2_handle_io_sync(handle, 0, (*env)->GetDirectBufferAddress(env, buffer), offset, size);
+}
+
+JNIEXPORT jlong JNICALL nvmeWriteAsyncNs(JNIEnv *env, jobject thisObj, jlong handle, jlong buffer, jlong offset, jlong size)
+{
+	return u2_handle_io_async(handle, 1, (void *)(uintptr_t)buffer, offset, size);
+}
+
+JNIEXPORT jlong JNICALL nvmeReadAsyncNs(JNIEnv *env, jobject thisObj, jlong handle, jlong buffer, jlong offset, jlong size)
+{
+	return u2_handle_io_async(handle, 0, (void *)(uintptr_t)buffer, offset, size);
+}
+
+JNIEXPORT jint JNICALL nvmeBarrierNs(JNIEnv *env, jobject thisObj, jlong handle)
+{
+	struct u2_context *ctx = u2_context_get();
+	struct u2_handle *hd = u2_handle_get(handle);
+	struct u2_channel *ch;
+	struct u2_request *req;
+	jint status;
+
+	if (hd == NULL) {
+		fprintf(stderr, "invalid handle %"PRId64"!\n", (int64_t)handle);
+		exit(1);
+	}
+	ch = u2_handle_channel(ctx, handle);
+
+	req = u2_request_get_wait(ctx);
+	req->is_flush = 1;
+	if (u2_handle_submit(ctx, ch, hd, req, 0, NULL, 0, 0)) {
+		fprintf(stderr, "failed to submit flush!\n");
+		exit(1);
+	}
+	u2_handle_wait(ctx, ch, req);
+	status = req->status;
+	u2_request_put(ctx, req);
+
+	return status;
+}
+
+/*
+ * per handle, from any thread at any time; 0 lifts a limit. changing them
+ * starts over with full buckets.
+ */
+JNIEXPORT void JNICALL nvmeSetRateLimit(JNIEnv *env, jobject thisObj, jlong handle, jlong iops, jlong bytesPerSec)
+{
+	struct u2_handle *hd = u2_handle_get(handle);
+
+	if (hd == NULL || iops < 0 || bytesPerSec < 0) {
+		fprintf(stderr, "invalid rate limit %"PRId64"/%"PRId64" on handle %"PRId64"!\n", (int64_t)iops, (int64_t)bytesPerSec, (int64_t)handle);
+		return;
+	}
+
+	__atomic_store_n(&hd->rate.tat[0], 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&hd->rate.tat[1], 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&hd->rate.iops, iops, __ATOMIC_RELAXED);
+	__atomic_store_n(&hd->rate.bps, bytesPerSec, __ATOMIC_RELAXED);
+}
+
+JNIEXPORT jlongArray JNICALL getRateStats(JNIEnv *env, jobject thisObj, jlong handle)
+{
+	struct u2_handle *hd = u2_handle_get(handle);
+	int64_t stats[U2_RATE_STATS];
+	jlongArray array;
+	uint64_t now, t;
+	int i;
+
+	if (hd == NULL) {
+		return NULL;
+	}
+
+	stats[U2_RATE_STAT_IOPS]        = __atomic_load_n(&hd->rate.iops, __ATOMIC_RELAXED);
+	stats[U2_RATE_STAT_BPS]         = __atomic_load_n(&hd->rate.bps, __ATOMIC_RELAXED);
+	stats[U2_RATE_STAT_IOS]         = __atomic_load_n(&hd->rate.ios, __ATOMIC_RELAXED);
+	stats[U2_RATE_STAT_BYTES]       = __atomic_load_n(&hd->rate.bytes, __ATOMIC_RELAXED);
+	stats[U2_RATE_STAT_THROTTLED]   = __atomic_load_n(&hd->rate.throttled, __ATOMIC_RELAXED);
+	stats[U2_RATE_STAT_THROTTLE_NS] = __atomic_load_n(&hd->rate.throttle_ns, __ATOMIC_RELAXED);
+	stats[U2_RATE_STAT_BACKLOG_NS]  = 0;
+	now = u2_now_ns();
+	for (i = 0; i < 2; i++) {
+		t = __atomic_load_n(&hd->rate.tat[i], __ATOMIC_RELAXED);
+		if (t > now && (int64_t)(t - now) > stats[U2_RATE_STAT_BACKLOG_NS]) {
+			stats[U2_RATE_STAT_BACKLOG_NS] = t - now;
+		}
+	}
+
+	array = (*env)->NewLongArray(env, U2_RATE_STATS);
+	if (array) {
+		(*env)->SetLongArrayRegion(env, array, 0, U2_RATE_STATS, (jlong *)stats);
+	}
+
+	return array;
+}
+
+static void
+u2_batch_retire(struct u2_context *ctx, struct u2_batch_desc *desc, jint *head, jint tail, jint *failed)
+{
+	struct u2_request *req;
+	jint i;
+
+	for (i = *head; i < tail; i++) {
+		if (desc[i].status != U2_STATUS_PENDING) {
+			continue;
+		}
+
+		req = &ctx->reqs[desc[i].tag];
+		if (!__atomic_load_n(&req->done, __ATOMIC_ACQUIRE)) {
+			continue;
+		}
+
+		desc[i].status = req->status;
+		if (req->status) {
+			(*failed)++;
+		}
+		u2_request_put(ctx, req);
+	}
+
+	while (*head < tail && desc[*head].status != U2_STATUS_PENDING) {
+		(*head)++;
+	}
+}
+
+/*
+ * submits count packed descriptors through the calling thread's qpair, keeping
+ * up to the configured I/O depth in flight, and waits for all of them. returns
+ * the number of failed entries; per-entry status is written back in place,
+ * -EAGAIN for those that found no request slot free.
+ */
+JNIEXPORT jint JNICALL nvmeSubmitBatch(JNIEnv *env, jobject thisObj, jobject descs, jint count)
+{
+	struct u2_context *ctx = u2_context_get();
+	struct u2_batch_desc *desc;
+	struct u2_request *req;
+	jint head, tail, failed;
+	uint64_t start;
+	int rc;
+
+	desc = (*env)->GetDirectBufferAddress(env, descs);
+	if (desc == NULL || count < 0 ||
+	    (*env)->GetDirectBufferCapacity(env, descs) < (jlong)count * (jlong)sizeof(*desc)) {
+		fprintf(stderr, "invalid batch descriptor buffer!\n");
+		return -1;
+	}
+
+	if (u2_wb_on) {    // up front: write back needs a request slot of its own.
+		for (tail = 0; tail < count; tail++) {
+			u2_wb_fence(ctx, desc[tail].offset, desc[tail].size);
+		}
+	}
+
+	head = tail = failed = 0;
+	while (head < count) {
+		while (tail < count) {
+			if (desc[tail].size == 0 || desc[tail].size > u2_ns_size || desc[tail].opcode > U2_OP_WRITE) {
+				desc[tail++].status = -EINVAL;
+				failed++;
+				continue;
+			}
+
+			if ((req = u2_request_get(ctx, 0)) == NULL) {
+				break;
+			}
+
+			rc = u2_submit(ctx, req, desc[tail].opcode == U2_OP_WRITE,
+			               (void *)(uintptr_t)desc[tail].buf, desc[tail].offset, desc[tail].size);
+			if (rc) {
+				u2_request_put(ctx, req);
+				desc[tail++].status = rc < 0 ? rc : -EIO;
+				failed++;
+				continue;
+			}
+
+			desc[tail].tag = req->slot;
+			desc[tail++].status = U2_STATUS_PENDING;
+		}
+
+		u2_batch_retire(ctx, desc, &head, tail, &failed);
+		if (head < tail) {    // else go submit the rest first.
+			start = u2_cycles();
+			u2_context_wait(ctx);
+			u2_io_count_wait(ctx, start);
+		} else if (tail < count && !ctx->free_count) {    // no slot, and none of ours to wait for.
+			for (; tail < count; tail++) {
+				desc[tail].status = -EAGAIN;
+				failed++;
+			}
+			head = tail;
+		}
+	}
+
+	return failed;
+}
+
+/*
+ * hands a shared submission/completion ring pair (see NvmeRing) to a poller;
+ * entries has to be a power of two. returns a handle, -1 without reactor mode.
+ */
+JNIEXPORT jlong JNICALL nvmeRingAttach(JNIEnv *env, jobject thisObj, jobject ring, jint entries)
+{
+	struct u2_context *ctx;
+	uint8_t *shm;
+
+	if (!u2_reactor_count) {
+		fprintf(stderr, "shared rings need reactor mode!\n");
+		return -1;
+	}
+
+	shm = (*env)->GetDirectBufferAddress(env, ring);
+	if (shm == NULL || entries < 1 || entries > U2_IO_DEPTH_MAX || (entries & (entries - 1)) ||
+	    (*env)->GetDirectBufferCapacity(env, ring) <
+	    U2_SHM_HEADER + (jlong)entries * (sizeof(struct u2_shm_sqe) + sizeof(struct u2_shm_cqe))) {
+		fprintf(stderr, "invalid shared ring buffer!\n");
+		return -1;
+	}
+
+	ctx = u2_context_alloc();
+	if (ctx == NULL || u2_context_init(ctx, entries) ||
+	    (ctx->shm_user = calloc(entries, sizeof(*ctx->shm_user))) == NULL) {
+		fprintf(stderr, "failed to allocate request table!\n");
+		exit(1);
+	}
+	ctx->shm = shm;
+	ctx->shm_cq_tail = *U2_SHM_INDEX(ctx, U2_SHM_CQ_TAIL);
+	ctx->sq_head = *U2_SHM_INDEX(ctx, U2_SHM_SQ_HEAD);
+	ctx->ch = &ctx->own;
+
+	pthread_mutex_lock(&u2_contexts_lock);
+	if (u2_reactor_attach(ctx)) {
+		pthread_mutex_unlock(&u2_contexts_lock);
+		fprintf(stderr, "all pollers are full!\n");
+		free(ctx->shm_user);
+		free(ctx->reqs);
+		free(ctx->parts);
+		free(ctx->part_sgls);
+		free(ctx->free_slots);
+		free(ctx->cpl_ring);
+		free(ctx->sq_ring);
+		free(ctx);
+		return -1;
+	}
+	ctx->next = u2_contexts;
+	u2_contexts = ctx;
+	pthread_mutex_unlock(&u2_contexts_lock);
+
+	return (jlong)(uintptr_t)ctx;
+}
+
+/*
+ * waits for what the poller already took off the SQ, then lets go of the ring.
+ */
+JNIEXPORT void JNICALL nvmeRingDetach(JNIEnv *env, jobject thisObj, jlong ring)
+{
+	struct u2_context *ctx = (struct u2_context *)(uintptr_t)ring, **pp;
+
+	pthread_mutex_lock(&u2_contexts_lock);
+	for (pp = &u2_contexts; *pp; pp = &(*pp)->next) {
+		if (*pp == ctx) {
+			*pp = ctx->next;
+			u2_context_fini(ctx);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&u2_contexts_lock);
+}
+
+/*
+ * parks the caller until the ring's CQ has something to reap.
+ */
+JNIEXPORT void JNICALL nvmeRingWait(JNIEnv *env, jobject thisObj, jlong ring)
+{
+	struct u2_context *ctx = (struct u2_context *)(uintptr_t)ring;
+	uint64_t start = u2_cycles();
+
+	while (__atomic_load_n(U2_SHM_INDEX(ctx, U2_SHM_CQ_TAIL), __ATOMIC_ACQUIRE) ==
+	       __atomic_load_n(U2_SHM_INDEX(ctx, U2_SHM_CQ_HEAD), __ATOMIC_ACQUIRE)) {
+		u2_reactor_wait(ctx);
+	}
+	u2_io_count_wait(ctx, start);    // the poller counts the rest.
+}
+
+/*
+ * key-value stores (u2_kv.c) in regions of the volume, keys and values in
+ * direct buffers of any kind: they are copied. the handle is the store.
+ */
+JNIEXPORT jlong JNICALL nvmeKvOpen(JNIEnv *env, jobject thisObj, jlong offset, jlong size, jboolean format)
+{
+	struct u2_kv *kv;
+
+	if (offset < 0 || size <= 0 || (uint64_t)(offset + size) > u2_ns_size) {
+		fprintf(stderr, "invalid key-value region %"PRId64"+%"PRId64"!\n", (int64_t)offset, (int64_t)size);
+		return -1;
+	}
+
+	kv = u2_kv_open(offset, size, u2_ns_sector, format);
+
+	return kv ? (jlong)(uintptr_t)kv : -1;
+}
+
+JNIEXPORT void JNICALL nvmeKvClose(JNIEnv *env, jobject thisObj, jlong kv)
+{
+	u2_kv_close((struct u2_kv *)(uintptr_t)kv);
+}
+
+static void *
+u2_kv_buffer(JNIEnv *env, jobject buffer, jint len)
+{
+	if (buffer == NULL || len < 0 || (*env)->GetDirectBufferCapacity(env, buffer) < len) {
+		return NULL;
+	}
+
+	return (*env)->GetDirectBufferAddress(env, buffer);
+}
+
+JNIEXPORT jint JNICALL nvmeKvPut(JNIEnv *env, jobject thisObj, jlong kv, jobject key, jint keyLength, jobject value,
+                                 jint valueLength)
+{
+	void *k = u2_kv_buffer(env, key, keyLength), *v = valueLength ? u2_kv_buffer(env, value, valueLength) : NULL;
+
+	if (k == NULL || (valueLength && v == NULL)) {
+		return -EINVAL;
+	}
+
+	return u2_kv_put((struct u2_kv *)(uintptr_t)kv, k, keyLength, v, valueLength);
+}
+
+JNIEXPORT jint JNICALL nvmeKvGet(JNIEnv *env, jobject thisObj, jlong kv, jobject key, jint keyLength, jobject value)
+{
+	void *k = u2_kv_buffer(env, key, keyLength), *v = NULL;
+	jlong cap = 0;
+
+	if (k == NULL) {
+		return -EINVAL;
+	}
+	if (value) {
+		v = (*env)->GetDirectBufferAddress(env, value);
+		cap = v ? (*env)->GetDirectBufferCapacity(env, value) : 0;
+	}
+
+	return u2_kv_get((struct u2_kv *)(uintptr_t)kv, k, keyLength, v, cap < INT32_MAX ? cap : INT32_MAX);
+}
+
+JNIEXPORT jint JNICALL nvmeKvDelete(JNIEnv *env, jobject thisObj, jlong kv, jobject key, jint keyLength)
+{
+	void *k = u2_kv_buffer(env, key, keyLength);
+
+	if (k == NULL) {
+		return -EINVAL;
+	}
+
+	return u2_kv_delete((struct u2_kv *)(uintptr_t)kv, k, keyLength);
+}
+
+JNIEXPORT jint JNICALL nvmeKvSync(JNIEnv *env, jobject thisObj, jlong kv)
+{
+	return u2_kv_sync((struct u2_kv *)(uintptr_t)kv);
+}
+
+JNIEXPORT jlongArray JNICALL getKvStats(JNIEnv *env, jobject thisObj, jlong kv)
+{
+	int64_t stats[U2_KV_STATS];
+	jlongArray array;
+
+	u2_kv_stats((struct u2_kv *)(uintptr_t)kv, stats);
+
+	array = (*env)->NewLongArray(env, U2_KV_STATS);
+	if (array) {
+		(*env)->SetLongArrayRegion(env, array, 0, U2_KV_STATS, (jlong *)stats);
+	}
+
+	return array;
+}
+
+/*
+ * write-ahead logs (u2_wal.c) in regions of the volume. records are copied
+ * out of direct buffers of any kind; the handle is the log.
+ */
+JNIEXPORT jlong JNICALL nvmeWalOpen(JNIEnv *env, jobject thisObj, jlong offset, jlong size, jboolean format)
+{
+	struct u2_wal *wal;
+
+	if (offset < 0 || size <= 0 || (uint64_t)(offset + size) > u2_ns_size) {
+		fprintf(stderr, "invalid log region %"PRId64"+%"PRId64"!\n", (int64_t)offset, (int64_t)size);
+		return -1;
+	}
+
+	wal = u2_wal_open(offset, size, u2_ns_sector, format);
+
+	return wal ? (jlong)(uintptr_t)wal : -1;
+}
+
+JNIEXPORT void JNICALL nvmeWalClose(JNIEnv *env, jobject thisObj, jlong wal)
+{
+	u2_wal_close((struct u2_wal *)(uintptr_t)wal);
+}
+
+JNIEXPORT jlong JNICALL nvmeWalAppend(JNIEnv *env, jobject thisObj, jlong wal, jobject record, jint length)
+{
+	void *p = length ? u2_kv_buffer(env, record, length) : NULL;
+
+	if (length < 0 || (length && p == NULL)) {
+		return -EINVAL;
+	}
+
+	return u2_wal_append((struct u2_wal *)(uintptr_t)wal, p, length);
+}
+
+JNIEXPORT jlong JNICALL nvmeWalAwait(JNIEnv *env, jobject thisObj, jlong wal, jlong lsn, jlong timeoutNanos)
+{
+	return u2_wal_await((struct u2_wal *)(uintptr_t)wal, lsn, timeoutNanos);
+}
+
+JNIEXPORT jint JNICALL nvmeWalTruncate(JNIEnv *env, jobject thisObj, jlong wal, jlong lsn)
+{
+	return lsn < 0 ? -EINVAL : u2_wal_truncate((struct u2_wal *)(uintptr_t)wal, lsn);
+}
+
+JNIEXPORT jint JNICALL nvmeWalReplay(JNIEnv *env, jobject thisObj, jlong wal, jobject buffer)
+{
+	void *p = (*env)->GetDirectBufferAddress(env, buffer);
+	jlong cap = p ? (*env)->GetDirectBufferCapacity(env, buffer) : 0;
+
+	if (p == NULL) {
+		return -EINVAL;
+	}
+
+	return u2_wal_replay((struct u2_wal *)(uintptr_t)wal, p, cap < INT32_MAX ? cap : INT32_MAX);
+}
+
+JNIEXPORT jlongArray JNICALL getWalStats(JNIEnv *env, jobject thisObj, jlong wal)
+{
+	int64_t stats[U2_WAL_STATS];
+	jlongArray array;
+
+	u2_wal_stats((struct u2_wal *)(uintptr_t)wal, stats);
+
+	array = (*env)->NewLongArray(env, U2_WAL_STATS);
+	if (array) {
+		(*env)->SetLongArrayRegion(env, array, 0, U2_WAL_STATS, (jlong *)stats);
+	}
+
+	return array;
+}
+
+/*
+ * SMART/health telemetry (u2_telemetry.c) of the controllers behind the
+ * backend's devices, every namespace included.
+ */
+JNIEXPORT jint JNICALL nvmeTelemetryStart(JNIEnv *env, jobject thisObj, jint intervalMs, jstring path)
+{
+	const char *str = NULL;
+	int rc;
+
+	if (intervalMs <= 0) {
+		return -EINVAL;
+	}
+	if (path) {
+		str = (*env)->GetStringUTFChars(env, path, NULL);
+		if (str == NULL) {
+			return -ENOMEM;
+		}
+	}
+
+	rc = u2_telemetry_start(u2_be, u2_ndev, intervalMs, str);
+
+	if (str) {
+		(*env)->ReleaseStringUTFChars(env, path, str);
+	}
+
+	return rc;
+}
+
+JNIEXPORT void JNICALL nvmeTelemetryStop(JNIEnv *env, jobject thisObj)
+{
+	u2_telemetry_stop();
+}
+
+JNIEXPORT jlongArray JNICALL getTelemetry(JNIEnv *env, jobject thisObj, jint controller)
+{
+	int64_t stats[U2_TELEM_STATS];
+	jlongArray array;
+
+	if (controller < 0 || u2_telemetry_stats(controller, stats)) {
+		return NULL;
+	}
+
+	array = (*env)->NewLongArray(env, U2_TELEM_STATS);
+	if (array) {
+		(*env)->SetLongArrayRegion(env, array, 0, U2_TELEM_STATS, (jlong *)stats);
+	}
+
+	return array;
+}
+
+JNIEXPORT jstring JNICALL getTelemetryJson(JNIEnv *env, jobject thisObj, jint controller)
+{
+	char line[U2_TELEM_JSON_MAX];
+
+	if (controller < 0 || u2_telemetry_json(controller, line, sizeof(line)) < 0) {
+		return NULL;
+	}
+
+	return (*env)->NewStringUTF(env, line);
+}
@@ -0,0 +1,276 @@
+/*
+ * libjninvme: internals shared by the JNI layer and the I/O backends.
+ *
+ * Author(s)
+ *   azq    @qzan9    anzhongqi@ncic.ac.cn
+ */
+
+#ifndef __JNINVME_H__
+#define __JNINVME_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <pthread.h>
+#include <sys/uio.h>
+
+#define U2_SGE_MAX              (32)
+#define U2_DEV_MAX              (64)    // devices (namespaces, files) per backend.
+#define U2_NODE_MAX             (8)     // NUMA nodes memory is placed on.
+
+struct u2_context;
+struct u2_volume;
+
+/*
+ * scatter-gather list of a vectored request. backends walk it either as a
+ * plain iovec array or through the index/offset iterator.
+ */
+struct u2_sgl {
+	struct iovec sge[U2_SGE_MAX];
+	uint32_t count;
+
+	uint32_t index;    // iterator: current element and offset into it.
+	uint64_t offset;
+};
+
+/*
+ * one slot of the preallocated request table. async requests are handed back
+ * to Java as a token (generation << 32 | slot) and reaped by nvmePoll(); sync
+ * requests are waited for in place and never show up in the completion ring.
+ */
+struct u2_request {
+	struct u2_context *ctx;
+	struct u2_sgl *sgl;
+	void *buf;             // the command, as handed to submit()/submitv().
+	uint64_t lba;
+	uint32_t nlb;
+	uint32_t is_write;
+	uint64_t bytes;
+	uint64_t submit_ns;    // CLOCK_MONOTONIC, for the latency histogram.
+	uint32_t slot;
+	uint32_t gen;
+	uint32_t is_async;
+	uint32_t is_flush;     // a device cache flush, no data.
+	struct u2_volume *vol; // the volume it goes to.
+	uint32_t prio_held;    // counted against the host-side low-priority limit.
+	volatile uint32_t done;
+	int32_t status;
+
+	struct u2_request *parts;     // striped volumes: per-device sub-requests ...
+	struct u2_request *parent;    // ... and, for those, the request they belong to,
+	uint32_t dev;                 // the volume device they go to
+	struct u2_request *next;      // and the next one waiting in the qset for backend request slots.
+	uint32_t pending;             // parts not completed yet.
+	int32_t part_status;          // first failure among them.
+};
+
+/*
+ * I/O priority classes, per queue: where the device arbitrates between queues
+ * by weight, they map to its queue priorities, otherwise the JNI layer holds
+ * back low-priority requests while there is other I/O around.
+ */
+#define U2_PRIO_HIGH            (0)    // latency-sensitive foreground I/O.
+#define U2_PRIO_NORMAL          (1)
+#define U2_PRIO_LOW             (2)    // background bulk I/O.
+#define U2_PRIOS                (3)
+
+struct u2_backend_opts {
+	const char *path;        // device(s) or file(s), backend-specific.
+	uint32_t flags;
+	uint32_t io_depth;       // max. requests in flight per queue.
+	uint32_t queues;         // max. private queues (+1 shared).
+	uint32_t weighted;       // ask for weighted round robin arbitration where the device has it.
+};
+
+/*
+ * an I/O engine driving up to U2_DEV_MAX devices, each one namespace nsid of
+ * controller ctrlr (files: ctrlr is the position in the path list, nsid 1).
+ * a queue ("qpair") belongs to one device and is only ever used by one thread
+ * at a time; submit() may just stage the command, process() pushes staged
+ * commands to the device and completes finished ones through
+ * u2_request_complete(). status is 0, an NVMe (SCT << 8 | SC) code, or -errno.
+ */
+struct u2_backend {
+	const char *name;
+	uint64_t buf_align;    // min. alignment of I/O buffers.
+
+	int   (*init)(const struct u2_backend_opts *opts, uint32_t *ndev);
+	void  (*fini)(void);
+	void  (*geometry)(uint32_t dev, uint32_t *sector, uint64_t *size);
+	void  (*ident)   (uint32_t dev, uint32_t *ctrlr, uint32_t *nsid);
+
+	void *(*qpair_alloc)(uint32_t dev, uint32_t prio);
+	void  (*qpair_free)(void *qpair);
+
+	int   (*submit) (void *qpair, struct u2_request *req, int is_write, void *buf, uint64_t lba, uint32_t nlb);
+	int   (*submitv)(void *qpair, struct u2_request *req, int is_write, uint64_t lba, uint32_t nlb);
+	int   (*flush)  (void *qpair, struct u2_request *req);
+	int   (*process)(void *qpair);
+
+	void *(*dma_alloc)(uint64_t size, uint64_t align, int node);    // node -1: anywhere.
+	void  (*dma_free)(void *buf);
+
+	// NUMA node of dev, -1 if unknown.
+	int   (*node)(uint32_t dev);
+
+	// whether dev arbitrates between its queues by their U2_PRIO_* class.
+	int   (*weighted)(uint32_t dev);
+
+	// the SMART/health log page (U2_HEALTH_PAGE bytes of DMA memory) of dev's controller, off the I/O queues.
+	int   (*health)(uint32_t dev, void *page);
+};
+
+#define U2_HEALTH_PAGE          (512)
+
+extern const struct u2_backend u2_spdk_backend;
+extern const struct u2_backend u2_uring_backend;
+
+#define U2_URING_SQPOLL         (0x1)
+
+void u2_request_complete(struct u2_request *req, int32_t status);
+
+int   u2_pool_regions(struct iovec *iov, int max);
+void *u2_pool_alloc(uint64_t size, int zero);
+void  u2_pool_free(void *buf, uint64_t size);
+
+/*
+ * sync I/O on the global volume for what is built on top of it: past the
+ * write buffer, cache and readahead, which stay coherent with it. buffers
+ * from the pool, ranges sector-aligned; both return the command's status.
+ */
+int u2_io(int is_write, void *buf, uint64_t offset, uint64_t size);
+int u2_io_flush(void);
+
+uint32_t u2_crc32c(uint32_t crc, const void *buf, size_t len);    // u2_crc.c
+
+int u2_numa_node(const char *sysfs);            // u2_numa.c: -1 if unknown.
+int u2_numa_cpus(int node, int *cpus, int max);
+
+/*
+ * logical volume (u2_volume.c): the backend's devices striped RAID-0 style in
+ * stripe-sized units, or just the one device. its queues ("qsets") hold one
+ * qpair per device and take the place of backend qpairs.
+ */
+struct u2_volume {
+	const struct u2_backend *be;
+	uint32_t ndev;
+	uint32_t dev[U2_DEV_MAX];
+	uint64_t stripe;     // bytes, multiple of the sector size.
+	uint32_t sector;
+	uint64_t size;
+	uint32_t weighted;   // every device arbitrates by queue priority.
+	int node;            // NUMA node of all its devices, -1 if unknown or not just one.
+};
+
+int   u2_volume_init(struct u2_volume *vol, const struct u2_backend *be, const uint32_t *dev, uint32_t ndev, uint64_t stripe);
+void *u2_volume_qpair_alloc(struct u2_volume *vol, uint32_t prio);
+void  u2_volume_qpair_free(void *qset);
+int   u2_volume_submit(void *qset, struct u2_request *req);
+int   u2_volume_process(void *qset);
+
+/*
+ * block cache (u2_cache.c), U2_CACHE_BLOCK-sized and -aligned blocks.
+ */
+#define U2_CACHE_BLOCK          (4096)
+#define U2_CACHE_IO_MAX         (256 << 10)    // larger reads bypass the cache.
+
+#define U2_CACHE_STAT_HITS          (0)
+#define U2_CACHE_STAT_MISSES        (1)
+#define U2_CACHE_STAT_INSERTS       (2)
+#define U2_CACHE_STAT_EVICTIONS     (3)
+#define U2_CACHE_STAT_INVALIDATIONS (4)
+#define U2_CACHE_STAT_USED          (5)
+#define U2_CACHE_STAT_CAPACITY      (6)
+#define U2_CACHE_STATS              (7)
+
+int  u2_cache_init(const struct u2_backend *be, uint64_t bytes, int node);
+void u2_cache_fini(void);
+int  u2_cache_lookup(uint64_t blk, void *dst, uint64_t *gen);
+void u2_cache_insert(uint64_t blk, const void *src, uint64_t gen);
+void u2_cache_invalidate(uint64_t offset, uint64_t size);
+void u2_cache_stats(int64_t *stats);
+
+/*
+ * log-structured key-value store (u2_kv.c) in a region of the global volume.
+ */
+#define U2_KV_KEY_MAX           (1024)
+#define U2_KV_VALUE_MAX         (1 << 20)
+
+#define U2_KV_STAT_KEYS         (0)
+#define U2_KV_STAT_LIVE         (1)    // bytes of records the index points to.
+#define U2_KV_STAT_SEGMENTS     (2)
+#define U2_KV_STAT_FREE         (3)
+#define U2_KV_STAT_PUTS         (4)
+#define U2_KV_STAT_GETS         (5)
+#define U2_KV_STAT_DELETES      (6)
+#define U2_KV_STAT_FLUSHES      (7)    // segment writes.
+#define U2_KV_STAT_COMPACTIONS  (8)
+#define U2_KV_STAT_RELOCATED    (9)    // bytes moved by compaction.
+#define U2_KV_STATS             (10)
+
+struct u2_kv;
+
+struct u2_kv *u2_kv_open(uint64_t offset, uint64_t size, uint32_t sector, int format);
+void u2_kv_close(struct u2_kv *kv);
+void u2_kv_close_all(void);
+int  u2_kv_put(struct u2_kv *kv, const void *key, uint32_t klen, const void *val, uint32_t vlen);
+int  u2_kv_get(struct u2_kv *kv, const void *key, uint32_t klen, void *val, uint32_t cap);
+int  u2_kv_delete(struct u2_kv *kv, const void *key, uint32_t klen);
+int  u2_kv_sync(struct u2_kv *kv);
+void u2_kv_stats(struct u2_kv *kv, int64_t *stats);
+
+/*
+ * write-ahead log with group commit (u2_wal.c) in a region of the global volume.
+ */
+#define U2_WAL_RECORD_MAX       (1 << 19)
+
+#define U2_WAL_STAT_APPENDS     (0)
+#define U2_WAL_STAT_BYTES       (1)    // of payload appended.
+#define U2_WAL_STAT_GROUPS      (2)    // writes, each with a flush.
+#define U2_WAL_STAT_START       (3)    // oldest LSN kept.
+#define U2_WAL_STAT_DURABLE     (4)    // LSN everything before which is durable.
+#define U2_WAL_STAT_FREE        (5)    // bytes left for appends.
+#define U2_WAL_STATS            (6)
+
+struct u2_wal;
+
+struct u2_wal *u2_wal_open(uint64_t offset, uint64_t size, uint32_t sector, int format);
+void    u2_wal_close(struct u2_wal *wal);
+void    u2_wal_close_all(void);
+int64_t u2_wal_append(struct u2_wal *wal, const void *data, uint32_t len);
+int64_t u2_wal_await(struct u2_wal *wal, int64_t lsn, int64_t timeout_ns);
+int     u2_wal_truncate(struct u2_wal *wal, uint64_t lsn);
+int64_t u2_wal_replay(struct u2_wal *wal, void *buf, uint64_t cap);
+void    u2_wal_stats(struct u2_wal *wal, int64_t *stats);
+
+/*
+ * SMART/health telemetry (u2_telemetry.c), per controller.
+ */
+#define U2_TELEM_STAT_TIME_MS          (0)     // wall clock of the sample.
+#define U2_TELEM_STAT_TEMPERATURE      (1)     // celsius.
+#define U2_TELEM_STAT_TEMP_TREND       (2)     // millidegrees per minute, smoothed.
+#define U2_TELEM_STAT_CRITICAL_WARNING (3)     // bits as in the log page.
+#define U2_TELEM_STAT_AVAILABLE_SPARE  (4)     // percent.
+#define U2_TELEM_STAT_PERCENTAGE_USED  (5)
+#define U2_TELEM_STAT_READ_BPS         (6)     // since the previous sample.
+#define U2_TELEM_STAT_WRITE_BPS        (7)
+#define U2_TELEM_STAT_READ_IOPS        (8)
+#define U2_TELEM_STAT_WRITE_IOPS       (9)
+#define U2_TELEM_STAT_DATA_READ        (10)    // bytes, lifetime (1000-sector units).
+#define U2_TELEM_STAT_DATA_WRITTEN     (11)
+#define U2_TELEM_STAT_MEDIA_ERRORS     (12)
+#define U2_TELEM_STAT_MEDIA_ERRORS_NEW (13)    // since the previous sample.
+#define U2_TELEM_STAT_UNSAFE_SHUTDOWNS (14)
+#define U2_TELEM_STAT_POWER_ON_HOURS   (15)
+#define U2_TELEM_STAT_SAMPLES          (16)
+#define U2_TELEM_STAT_FAILURES         (17)    // log page reads that failed.
+#define U2_TELEM_STATS                 (18)
+
+#define U2_TELEM_JSON_MAX              (1024)
+
+int  u2_telemetry_start(const struct u2_backend *be, uint32_t ndev, uint32_t interval_ms, const char *path);
+void u2_telemetry_stop(void);
+int  u2_telemetry_stats(uint32_t ctrlr, int64_t *stats);
+int  u2_telemetry_json(uint32_t ctrlr, char *buf, size_t cap);
+
+#endif /* __JNINVME_H__ */
@@ -0,0 +1,328 @@
+/*
+ * libjninvme: DRAM block cache in front of nvmeRead().
+ *
+ * a fixed budget of U2_CACHE_BLOCK frames in one backend (hugepage) chunk,
+ * indexed by a hash over block numbers whose buckets are guarded by striped
+ * spinlocks. eviction is CLOCK: hits set a frame's reference bit, the hand
+ * clears it and takes the first frame that is still clear. no per-entry
+ * allocation anywhere.
+ *
+ * frames go FREE -> BUSY (claimed by the hand, private to the inserter) ->
+ * VALID (linked into its bucket) and back to FREE on invalidation. every
+ * invalidation bumps its stripe's generation, so a miss that raced with a
+ * write does not put stale data back in.
+ *
+ * Author(s)
+ *   azq    @qzan9    anzhongqi@ncic.ac.cn
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <pthread.h>
+
+#include "jninvme.h"
+
+#define U2_CACHE_STRIPES        (64)
+#define U2_CACHE_NIL            (UINT32_MAX)
+
+#define U2_CACHE_FREE           (0)
+#define U2_CACHE_BUSY           (1)
+#define U2_CACHE_VALID          (2)
+
+struct u2_cache_frame {
+	uint64_t blk;
+	uint32_t next;     // bucket chain.
+	uint8_t state;
+	uint8_t ref;
+};
+
+struct u2_cache_stripe {
+	pthread_spinlock_t lock;
+	uint64_t gen;
+	int64_t hits;
+	int64_t misses;
+	int64_t inserts;
+	int64_t invalidations;
+	int64_t valid;
+} __attribute__((aligned(64)));
+
+static const struct u2_backend *u2_cache_be;
+
+static uint8_t *u2_cache_data;
+static struct u2_cache_frame *u2_cache_frames;
+static uint32_t u2_cache_nframes;
+static uint32_t *u2_cache_buckets;
+static uint32_t u2_cache_bucket_bits;
+
+static struct u2_cache_stripe u2_cache_stripes[U2_CACHE_STRIPES];
+
+static pthread_spinlock_t u2_cache_clock;    // the hand; taken before any stripe lock.
+static uint32_t u2_cache_hand;
+static int64_t u2_cache_evictions;
+
+static inline uint32_t
+u2_cache_bucket(uint64_t blk)
+{
+	return (blk * 0x9e3779b97f4a7c15ULL) >> (64 - u2_cache_bucket_bits);
+}
+
+static inline struct u2_cache_stripe *
+u2_cache_stripe(uint32_t bucket)
+{
+	return &u2_cache_stripes[bucket & (U2_CACHE_STRIPES - 1)];
+}
+
+/*
+ * with the bucket's stripe held.
+ */
+static uint32_t
+u2_cache_find(uint32_t bucket, uint64_t blk)
+{
+	uint32_t idx;
+
+	for (idx = u2_cache_buckets[bucket]; idx != U2_CACHE_NIL; idx = u2_cache_frames[idx].next) {
+		if (u2_cache_frames[idx].blk == blk) {
+			break;
+		}
+	}
+
+	return idx;
+}
+
+static void
+u2_cache_unlink(uint32_t bucket, uint32_t idx)
+{
+	uint32_t *pp;
+
+	for (pp = &u2_cache_buckets[bucket]; *pp != U2_CACHE_NIL; pp = &u2_cache_frames[*pp].next) {
+		if (*pp == idx) {
+			*pp = u2_cache_frames[idx].next;
+			break;
+		}
+	}
+}
+
+/*
+ * advances the hand to a frame the caller may fill, evicting a cold one if
+ * need be. two sweeps clear every reference bit, so it only comes back empty
+ * handed if all frames are being filled right now.
+ */
+static uint32_t
+u2_cache_claim(void)
+{
+	struct u2_cache_frame *f;
+	struct u2_cache_stripe *st;
+	uint32_t idx, bucket, n;
+
+	pthread_spin_lock(&u2_cache_clock);
+	for (n = 0; n < 2 * u2_cache_nframes + 1; n++) {
+		idx = u2_cache_hand;
+		u2_cache_hand = (u2_cache_hand + 1) % u2_cache_nframes;
+		f = &u2_cache_frames[idx];
+
+		switch (__atomic_load_n(&f->state, __ATOMIC_ACQUIRE)) {
+		case U2_CACHE_BUSY:
+			continue;
+		case U2_CACHE_FREE:
+			break;
+		default:
+			if (f->ref) {
+				f->ref = 0;
+				continue;
+			}
+
+			bucket = u2_cache_bucket(f->blk);    // blk only changes while BUSY, i.e. under this lock.
+			st = u2_cache_stripe(bucket);
+			pthread_spin_lock(&st->lock);
+			if (f->state == U2_CACHE_VALID) {    // else invalidated meanwhile.
+				u2_cache_unlink(bucket, idx);
+				st->valid--;
+				u2_cache_evictions++;
+			}
+			f->state = U2_CACHE_BUSY;
+			pthread_spin_unlock(&st->lock);
+			pthread_spin_unlock(&u2_cache_clock);
+			return idx;
+		}
+
+		f->state = U2_CACHE_BUSY;
+		pthread_spin_unlock(&u2_cache_clock);
+		return idx;
+	}
+	pthread_spin_unlock(&u2_cache_clock);
+
+	return U2_CACHE_NIL;
+}
+
+int
+u2_cache_init(const struct u2_backend *be, uint64_t bytes, int node)
+{
+	uint64_t nbuckets;
+	uint32_t i;
+
+	if (bytes / U2_CACHE_BLOCK < 1 || bytes / U2_CACHE_BLOCK >= U2_CACHE_NIL) {
+		return -1;
+	}
+
+	u2_cache_be = be;
+	u2_cache_nframes = bytes / U2_CACHE_BLOCK;
+	for (u2_cache_bucket_bits = 1, nbuckets = 2; nbuckets < u2_cache_nframes; u2_cache_bucket_bits++) {
+		nbuckets <<= 1;
+	}
+
+	u2_cache_data = be->dma_alloc((uint64_t)u2_cache_nframes * U2_CACHE_BLOCK, U2_CACHE_BLOCK, node);
+	u2_cache_frames = calloc(u2_cache_nframes, sizeof(*u2_cache_frames));
+	u2_cache_buckets = malloc(nbuckets * sizeof(*u2_cache_buckets));
+	if (!u2_cache_data || !u2_cache_frames || !u2_cache_buckets) {
+		u2_cache_fini();
+		return -1;
+	}
+
+	memset(u2_cache_buckets, 0xff, nbuckets * sizeof(*u2_cache_buckets));    // U2_CACHE_NIL.
+	for (i = 0; i < U2_CACHE_STRIPES; i++) {
+		memset(&u2_cache_stripes[i], 0, sizeof(u2_cache_stripes[i]));
+		pthread_spin_init(&u2_cache_stripes[i].lock, PTHREAD_PROCESS_PRIVATE);
+	}
+	pthread_spin_init(&u2_cache_clock, PTHREAD_PROCESS_PRIVATE);
+	u2_cache_hand = 0;
+	u2_cache_evictions = 0;
+
+	return 0;
+}
+
+void
+u2_cache_fini(void)
+{
+	uint32_t i;
+
+	if (u2_cache_data) {
+		u2_cache_be->dma_free(u2_cache_data);
+		u2_cache_data = NULL;
+
+		for (i = 0; i < U2_CACHE_STRIPES; i++) {
+			pthread_spin_destroy(&u2_cache_stripes[i].lock);
+		}
+		pthread_spin_destroy(&u2_cache_clock);
+	}
+
+	free(u2_cache_frames);
+	free(u2_cache_buckets);
+	u2_cache_frames = NULL;
+	u2_cache_buckets = NULL;
+	u2_cache_nframes = 0;
+}
+
+/*
+ * copies block blk out on a hit and returns 0; on a miss, returns -1 and the
+ * generation to hand to u2_cache_insert() once the block is read.
+ */
+int
+u2_cache_lookup(uint64_t blk, void *dst, uint64_t *gen)
+{
+	uint32_t bucket = u2_cache_bucket(blk), idx;
+	struct u2_cache_stripe *st = u2_cache_stripe(bucket);
+
+	pthread_spin_lock(&st->lock);
+	idx = u2_cache_find(bucket, blk);
+	if (idx != U2_CACHE_NIL) {
+		memcpy(dst, u2_cache_data + (uint64_t)idx * U2_CACHE_BLOCK, U2_CACHE_BLOCK);
+		u2_cache_frames[idx].ref = 1;
+		st->hits++;
+		pthread_spin_unlock(&st->lock);
+		return 0;
+	}
+	*gen = st->gen;
+	st->misses++;
+	pthread_spin_unlock(&st->lock);
+
+	return -1;
+}
+
+void
+u2_cache_insert(uint64_t blk, const void *src, uint64_t gen)
+{
+	uint32_t bucket = u2_cache_bucket(blk), idx;
+	struct u2_cache_stripe *st = u2_cache_stripe(bucket);
+	struct u2_cache_frame *f;
+
+	idx = u2_cache_claim();
+	if (idx == U2_CACHE_NIL) {
+		return;
+	}
+
+	f = &u2_cache_frames[idx];
+	memcpy(u2_cache_data + (uint64_t)idx * U2_CACHE_BLOCK, src, U2_CACHE_BLOCK);
+	f->blk = blk;
+	f->ref = 0;    // earns its reference bit with the first hit: one-off scans go first.
+
+	pthread_spin_lock(&st->lock);
+	if (st->gen != gen || u2_cache_find(bucket, blk) != U2_CACHE_NIL) {    // raced with a write or a twin miss.
+		pthread_spin_unlock(&st->lock);
+		__atomic_store_n(&f->state, U2_CACHE_FREE, __ATOMIC_RELEASE);
+		return;
+	}
+	f->next = u2_cache_buckets[bucket];
+	u2_cache_buckets[bucket] = idx;
+	__atomic_store_n(&f->state, U2_CACHE_VALID, __ATOMIC_RELEASE);
+	st->valid++;
+	st->inserts++;
+	pthread_spin_unlock(&st->lock);
+}
+
+/*
+ * drops every block overlapping [offset, offset + size), on writes.
+ */
+void
+u2_cache_invalidate(uint64_t offset, uint64_t size)
+{
+	uint64_t blk, last;
+	uint32_t bucket, idx;
+	struct u2_cache_stripe *st;
+
+	if (!size) {
+		return;
+	}
+
+	last = (offset + size - 1) / U2_CACHE_BLOCK;
+	for (blk = offset / U2_CACHE_BLOCK; blk <= last; blk++) {
+		bucket = u2_cache_bucket(blk);
+		st = u2_cache_stripe(bucket);
+
+		pthread_spin_lock(&st->lock);
+		st->gen++;
+		idx = u2_cache_find(bucket, blk);
+		if (idx != U2_CACHE_NIL) {
+			u2_cache_unlink(bucket, idx);
+			__atomic_store_n(&u2_cache_frames[idx].state, U2_CACHE_FREE, __ATOMIC_RELEASE);
+			st->valid--;
+			st->invalidations++;
+		}
+		pthread_spin_unlock(&st->lock);
+	}
+}
+
+void
+u2_cache_stats(int64_t *stats)
+{
+	struct u2_cache_stripe *st;
+	uint32_t i;
+
+	memset(stats, 0, U2_CACHE_STATS * sizeof(*stats));
+	if (!u2_cache_nframes) {
+		return;
+	}
+
+	for (i = 0; i < U2_CACHE_STRIPES; i++) {    // racy reads: fine for stats.
+		st = &u2_cache_stripes[i];
+		stats[U2_CACHE_STAT_HITS]          += st->hits;
+		stats[U2_CACHE_STAT_MISSES]        += st->misses;
+		stats[U2_CACHE_STAT_INSERTS]       += st->inserts;
+		stats[U2_CACHE_STAT_INVALIDATIONS] += st->invalidations;
+		stats[U2_CACHE_STAT_USED]          += st->valid * U2_CACHE_BLOCK;
+	}
+	stats[U2_CACHE_STAT_EVICTIONS] = u2_cache_evictions;
+	stats[U2_CACHE_STAT_CAPACITY]  = (int64_t)u2_cache_nframes * U2_CACHE_BLOCK;
+}
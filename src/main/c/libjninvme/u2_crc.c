@@ -0,0 +1,97 @@
+/*
+ * libjninvme: CRC-32C (Castagnoli), for what goes to the device with a
+ * checksum of its own.
+ *
+ * slicing-by-8 over tables built at load time, or the SSE4.2 instruction when
+ * the build targets it (-msse4.2 or a -march that has it).
+ *
+ * Author(s)
+ *   azq    @qzan9    anzhongqi@ncic.ac.cn
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifdef __SSE4_2__
+#	include <nmmintrin.h>
+#endif
+
+#include "jninvme.h"
+
+#define U2_CRC32C_POLY          (0x82f63b78)    // reflected.
+
+#ifdef __SSE4_2__
+
+uint32_t
+u2_crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	uint64_t c = ~crc, w;
+
+	for (; len && ((uintptr_t)p & 7); len--) {
+		c = _mm_crc32_u8(c, *p++);
+	}
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&w, p, 8);
+		c = _mm_crc32_u64(c, w);
+	}
+	for (; len; len--) {
+		c = _mm_crc32_u8(c, *p++);
+	}
+
+	return ~(uint32_t)c;
+}
+
+#else
+
+static uint32_t u2_crc32c_table[8][256];
+
+static void __attribute__((constructor))
+u2_crc32c_init(void)
+{
+	uint32_t i, j, c;
+
+	for (i = 0; i < 256; i++) {
+		for (c = i, j = 0; j < 8; j++) {
+			c = c & 1 ? (c >> 1) ^ U2_CRC32C_POLY : c >> 1;
+		}
+		u2_crc32c_table[0][i] = c;
+	}
+	for (i = 0; i < 256; i++) {
+		for (j = 1; j < 8; j++) {
+			c = u2_crc32c_table[j - 1][i];
+			u2_crc32c_table[j][i] = (c >> 8) ^ u2_crc32c_table[0][c & 0xff];
+		}
+	}
+}
+
+/*
+ * crc of buf, continuing from crc (0 to start); little-endian hosts only.
+ */
+uint32_t
+u2_crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	uint32_t c = ~crc, lo, hi;
+
+	for (; len && ((uintptr_t)p & 7); len--) {
+		c = (c >> 8) ^ u2_crc32c_table[0][(c ^ *p++) & 0xff];
+	}
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + 4, 4);
+		lo ^= c;
+		c = u2_crc32c_table[7][lo & 0xff] ^ u2_crc32c_table[6][(lo >> 8) & 0xff] ^
+		    u2_crc32c_table[5][(lo >> 16) & 0xff] ^ u2_crc32c_table[4][lo >> 24] ^
+		    u2_crc32c_table[3][hi & 0xff] ^ u2_crc32c_table[2][(hi >> 8) & 0xff] ^
+		    u2_crc32c_table[1][(hi >> 16) & 0xff] ^ u2_crc32c_table[0][hi >> 24];
+	}
+	for (; len; len--) {
+		c = (c >> 8) ^ u2_crc32c_table[0][(c ^ *p++) & 0xff];
+	}
+
+	return ~c;
+}
+
+#endif /* __SSE4_2__ */
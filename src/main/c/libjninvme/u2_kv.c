@@ -0,0 +1,1116 @@
+/*
+ * libjninvme: log-structured key-value store in a region of the global volume.
+ *
+ * the region is a superblock and then U2_KV_SEG-sized segments. records
+ * (header, key, value) are appended to the active segment's image in memory,
+ * which goes to the device in sector-aligned writes of U2_KV_BATCH, when the
+ * segment is full, on sync or after a tick of the background thread; a write
+ * may repeat the last, partial sector, i.e. this relies on single-sector
+ * writes being atomic, as they are with NVMe.
+ *
+ * the index is an open-addressing hash table of (key hash, record position)
+ * entries, 16 bytes per key: keys stay on the device and are compared there
+ * (or in the active image) on a hash match. segments are freed by copying
+ * what the index still points to over to the active one, greedily from the
+ * one with the least live data, in the background or once puts run out of
+ * segments. every segment starts with a header whose checksum seeds its
+ * records', so recovery replays segments in sequence order and stops at the
+ * first record that is torn or left over from a previous use.
+ *
+ * one reader-writer lock: gets share it, anything touching the index or the
+ * active segment takes it exclusively.
+ *
+ * Author(s)
+ *   azq    @qzan9    anzhongqi@ncic.ac.cn
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#include <pthread.h>
+#include <time.h>
+
+#include "jninvme.h"
+
+#define U2_KV_SUPER             (4096)         // superblock, then the segments.
+#define U2_KV_SEG               (4 << 20)      // unit of allocation and compaction.
+#define U2_KV_BATCH             (256 << 10)    // unwritten bytes that make a write; also the max. command.
+#define U2_KV_RESERVE           (2)            // free segments left to compaction (and to the next open).
+#define U2_KV_FREE_LOW          (4)            // background compaction below that many free segments ...
+#define U2_KV_GARBAGE_MIN       (U2_KV_SEG / 4)    // ... of ones with at least that much garbage.
+#define U2_KV_TICK_MS           (100)
+#define U2_KV_INDEX_MIN         (1024)
+
+#define U2_KV_LEN_BITS          (21)           // index entries: position << 21 | record length.
+#define U2_KV_POS_MAX           (1ULL << (64 - U2_KV_LEN_BITS))
+#define U2_KV_LOC(pos, len)     ((uint64_t)(pos) << U2_KV_LEN_BITS | (len))
+#define U2_KV_LOC_POS(loc)      ((loc) >> U2_KV_LEN_BITS)
+#define U2_KV_LOC_LEN(loc)      ((uint32_t)((loc) & ((1 << U2_KV_LEN_BITS) - 1)))
+
+#define U2_KV_SUPER_MAGIC       (0x7532766b76737570ULL)    // "u2kvsup"
+#define U2_KV_SEG_MAGIC         (0x7532766b76736567ULL)    // "u2kvseg"
+#define U2_KV_TOMBSTONE         (0x1)
+
+#define U2_KV_NONE              (UINT32_MAX)
+
+struct u2_kv_super {
+	uint64_t magic;
+	uint64_t epoch;    // new with every format: segments of older ones are void.
+	uint64_t seg_size;
+	uint64_t nseg;
+	uint32_t crc;
+};
+
+struct u2_kv_seg_hdr {
+	uint64_t magic;
+	uint64_t epoch;
+	uint64_t seq;
+	uint32_t crc;      // also the seed of the segment's record checksums.
+};
+
+struct u2_kv_rec {
+	uint32_t crc;      // of the rest, the key and the value.
+	uint16_t klen;
+	uint16_t flags;
+	uint32_t vlen;
+};
+
+#define U2_KV_REC               (sizeof(struct u2_kv_rec))
+
+struct u2_kv_seg {
+	uint64_t seq;      // 0: free.
+	uint32_t seed;
+	uint64_t used;     // bytes, header included; sealed segments only.
+	uint64_t live;     // bytes of records the index points to ...
+	uint64_t tomb;     // ... and of tombstones.
+};
+
+struct u2_kv_entry {
+	uint64_t hash;     // 0: empty.
+	uint64_t loc;
+};
+
+/*
+ * a record being looked at: in the active image, or read into buf.
+ */
+struct u2_kv_ref {
+	const uint8_t *rec;
+	void *buf;
+	uint64_t size;
+};
+
+struct u2_kv {
+	uint64_t offset;   // of the region on the volume.
+	uint32_t sector;
+	uint64_t epoch;
+
+	struct u2_kv_seg *segs;
+	uint32_t nseg;
+	uint32_t nfree;
+	uint32_t next_free;    // where the search for one starts.
+	uint64_t seq;
+
+	uint8_t *image;        // the active segment.
+	uint32_t active;
+	uint64_t head;         // bytes appended ...
+	uint64_t written;      // ... and written out.
+
+	struct u2_kv_entry *index;
+	uint64_t mask;
+	uint64_t count;
+
+	pthread_rwlock_t lock;
+	pthread_mutex_t compact_lock;    // one compaction at a time; before lock.
+
+	pthread_t thread;
+	pthread_mutex_t tick_lock;
+	pthread_cond_t tick;
+	uint32_t stop;
+
+	int64_t stats[U2_KV_STATS];
+
+	struct u2_kv *next;
+};
+
+static struct u2_kv *u2_kvs;    // open stores, for nvmeFinalize().
+static pthread_mutex_t u2_kvs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline uint64_t
+u2_kv_hash(const void *key, uint32_t klen)
+{
+	const uint8_t *p = key;
+	uint64_t h = 0xcbf29ce484222325ULL;    // FNV-1a, then a murmur3 finalizer for the low bits.
+	uint32_t i;
+
+	for (i = 0; i < klen; i++) {
+		h = (h ^ p[i]) * 0x100000001b3ULL;
+	}
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return h ? h : 1;
+}
+
+static inline uint64_t
+u2_kv_seg_pos(uint32_t seg)
+{
+	return U2_KV_SUPER + (uint64_t)seg * U2_KV_SEG;
+}
+
+static inline uint32_t
+u2_kv_seg_of(uint64_t loc)
+{
+	return (U2_KV_LOC_POS(loc) - U2_KV_SUPER) / U2_KV_SEG;
+}
+
+static inline int
+u2_kv_status(int rc)
+{
+	return rc > 0 ? -EIO : rc;    // NVMe status codes.
+}
+
+/*
+ * sector-aligned transfers of any size, U2_KV_BATCH at a time.
+ */
+static int
+u2_kv_io(struct u2_kv *kv, int is_write, uint8_t *buf, uint64_t pos, uint64_t size)
+{
+	uint64_t n;
+	int rc;
+
+	for (; size; size -= n, pos += n, buf += n) {
+		n = size < U2_KV_BATCH ? size : U2_KV_BATCH;
+		rc = u2_io(is_write, buf, kv->offset + pos, n);
+		if (rc) {
+			return u2_kv_status(rc);
+		}
+	}
+
+	return 0;
+}
+
+static int
+u2_kv_load(struct u2_kv *kv, uint64_t loc, struct u2_kv_ref *ref)
+{
+	uint64_t pos = U2_KV_LOC_POS(loc), start, end;
+	int rc;
+
+	ref->buf = NULL;
+	if (u2_kv_seg_of(loc) == kv->active) {
+		ref->rec = kv->image + (pos - u2_kv_seg_pos(kv->active));
+		return 0;
+	}
+
+	start = pos / kv->sector * kv->sector;
+	end = (pos + U2_KV_LOC_LEN(loc) + kv->sector - 1) / kv->sector * kv->sector;
+	ref->size = end - start;
+	ref->buf = u2_pool_alloc(ref->size, 0);
+	if (ref->buf == NULL) {
+		return -ENOMEM;
+	}
+
+	rc = u2_kv_io(kv, 0, ref->buf, start, ref->size);
+	if (rc) {
+		u2_pool_free(ref->buf, ref->size);
+		ref->buf = NULL;
+		return rc;
+	}
+	ref->rec = (uint8_t *)ref->buf + (pos - start);
+
+	return 0;
+}
+
+static inline void
+u2_kv_unload(struct u2_kv_ref *ref)
+{
+	if (ref->buf) {
+		u2_pool_free(ref->buf, ref->size);
+		ref->buf = NULL;
+	}
+}
+
+/*
+ * the index slot of key, with its record loaded into ref, or -ENOENT (or an
+ * I/O error, negative). with the lock held.
+ */
+static int64_t
+u2_kv_find(struct u2_kv *kv, uint64_t hash, const void *key, uint32_t klen, struct u2_kv_ref *ref)
+{
+	struct u2_kv_entry *e;
+	struct u2_kv_rec rec;
+	uint64_t i;
+	int rc;
+
+	for (i = hash & kv->mask; (e = &kv->index[i])->hash; i = (i + 1) & kv->mask) {
+		if (e->hash != hash) {
+			continue;
+		}
+
+		rc = u2_kv_load(kv, e->loc, ref);
+		if (rc) {
+			return rc;
+		}
+		memcpy(&rec, ref->rec, U2_KV_REC);
+		if (rec.klen == klen && !memcmp(ref->rec + U2_KV_REC, key, klen)) {
+			return i;
+		}
+		u2_kv_unload(ref);    // a hash twin.
+	}
+
+	return -ENOENT;
+}
+
+/*
+ * the slot pointing at exactly loc, or -1: compaction knows which record it
+ * means without looking at the key.
+ */
+static int64_t
+u2_kv_index_at(struct u2_kv *kv, uint64_t hash, uint64_t loc)
+{
+	struct u2_kv_entry *e;
+	uint64_t i;
+
+	for (i = hash & kv->mask; (e = &kv->index[i])->hash; i = (i + 1) & kv->mask) {
+		if (e->hash == hash && e->loc == loc) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static void
+u2_kv_index_put(struct u2_kv_entry *index, uint64_t mask, uint64_t hash, uint64_t loc)
+{
+	uint64_t i;
+
+	for (i = hash & mask; index[i].hash; i = (i + 1) & mask);
+	index[i].hash = hash;
+	index[i].loc = loc;
+}
+
+/*
+ * makes room for one more entry, doubling the table past a load of 0.7.
+ */
+static int
+u2_kv_index_grow(struct u2_kv *kv)
+{
+	struct u2_kv_entry *index;
+	uint64_t size = kv->mask + 1, i;
+
+	if ((kv->count + 1) * 10 <= size * 7) {
+		return 0;
+	}
+
+	index = calloc(size * 2, sizeof(*index));
+	if (index == NULL) {
+		return -ENOMEM;
+	}
+	for (i = 0; i < size; i++) {
+		if (kv->index[i].hash) {
+			u2_kv_index_put(index, size * 2 - 1, kv->index[i].hash, kv->index[i].loc);
+		}
+	}
+	free(kv->index);
+	kv->index = index;
+	kv->mask = size * 2 - 1;
+
+	return 0;
+}
+
+/*
+ * backward-shift deletion: entries after the hole that may live there move
+ * up, so lookups never need tombstones of their own.
+ */
+static void
+u2_kv_index_del(struct u2_kv *kv, uint64_t i)
+{
+	uint64_t j = i, home;
+
+	for (;;) {
+		j = (j + 1) & kv->mask;
+		if (!kv->index[j].hash) {
+			break;
+		}
+		home = kv->index[j].hash & kv->mask;
+		if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) {
+			continue;    // still reachable from its home slot.
+		}
+		kv->index[i] = kv->index[j];
+		i = j;
+	}
+	kv->index[i].hash = 0;
+	kv->count--;
+}
+
+/*
+ * the length of a well-formed record at off within a segment image of end
+ * bytes, or 0: padding, torn, or left over from an earlier use.
+ */
+static uint32_t
+u2_kv_parse(const uint8_t *image, uint64_t off, uint64_t end, uint32_t seed, struct u2_kv_rec *rec)
+{
+	uint32_t len, crc;
+
+	if (off + U2_KV_REC > end) {
+		return 0;
+	}
+	memcpy(rec, image + off, U2_KV_REC);
+	if (!rec->klen || rec->klen > U2_KV_KEY_MAX || rec->vlen > U2_KV_VALUE_MAX || (rec->flags & ~U2_KV_TOMBSTONE)) {
+		return 0;
+	}
+	len = U2_KV_REC + rec->klen + rec->vlen;
+	if (off + len > end) {
+		return 0;
+	}
+	crc = u2_crc32c(seed, image + off + sizeof(rec->crc), len - sizeof(rec->crc));
+
+	return crc == rec->crc ? len : 0;
+}
+
+/*
+ * copies a record into the active image, which the caller made room in.
+ */
+static uint64_t
+u2_kv_append(struct u2_kv *kv, const void *key, uint32_t klen, const void *val, uint32_t vlen, uint32_t flags)
+{
+	struct u2_kv_rec rec;
+	uint8_t *p = kv->image + kv->head;
+	uint32_t len = U2_KV_REC + klen + vlen;
+	uint64_t loc = U2_KV_LOC(u2_kv_seg_pos(kv->active) + kv->head, len);
+
+	rec.klen = klen;
+	rec.flags = flags;
+	rec.vlen = vlen;
+	memcpy(p, &rec, U2_KV_REC);
+	memcpy(p + U2_KV_REC, key, klen);
+	if (vlen) {
+		memcpy(p + U2_KV_REC + klen, val, vlen);
+	}
+	rec.crc = u2_crc32c(kv->segs[kv->active].seed, p + sizeof(rec.crc), len - sizeof(rec.crc));
+	memcpy(p, &rec.crc, sizeof(rec.crc));
+
+	kv->head += len;
+	if (flags & U2_KV_TOMBSTONE) {
+		kv->segs[kv->active].tomb += len;
+	} else {
+		kv->segs[kv->active].live += len;
+	}
+
+	return loc;
+}
+
+/*
+ * writes out the active image from the sector the last write ended in.
+ */
+static int
+u2_kv_write(struct u2_kv *kv)
+{
+	uint64_t from = kv->written / kv->sector * kv->sector;
+	uint64_t to = (kv->head + kv->sector - 1) / kv->sector * kv->sector;
+	int rc;
+
+	if (kv->active == U2_KV_NONE || kv->written == kv->head) {
+		return 0;
+	}
+
+	rc = u2_kv_io(kv, 1, kv->image + from, u2_kv_seg_pos(kv->active) + from, to - from);
+	if (rc) {
+		return rc;
+	}
+	kv->written = kv->head;
+	kv->stats[U2_KV_STAT_FLUSHES]++;
+
+	return 0;
+}
+
+static inline int
+u2_kv_write_batch(struct u2_kv *kv)
+{
+	return kv->head - kv->written >= U2_KV_BATCH ? u2_kv_write(kv) : 0;
+}
+
+/*
+ * seals the active segment and starts the next free one; -ENOSPC if there
+ * is none.
+ */
+static int
+u2_kv_roll(struct u2_kv *kv)
+{
+	struct u2_kv_seg_hdr hdr;
+	struct u2_kv_seg *seg;
+	uint32_t i, n;
+	int rc;
+
+	if (kv->active != U2_KV_NONE) {
+		rc = u2_kv_write(kv);
+		if (rc) {
+			return rc;
+		}
+		kv->segs[kv->active].used = kv->head;
+		kv->active = U2_KV_NONE;
+	}
+
+	for (n = 0, i = kv->next_free; n < kv->nseg && kv->segs[i].seq; n++, i = (i + 1) % kv->nseg);
+	if (n == kv->nseg) {
+		return -ENOSPC;
+	}
+	kv->next_free = (i + 1) % kv->nseg;
+	kv->nfree--;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = U2_KV_SEG_MAGIC;
+	hdr.epoch = kv->epoch;
+	hdr.seq = ++kv->seq;
+	hdr.crc = u2_crc32c(0, &hdr, offsetof(struct u2_kv_seg_hdr, crc));
+
+	seg = &kv->segs[i];
+	seg->seq = hdr.seq;
+	seg->seed = hdr.crc;
+	seg->used = seg->live = seg->tomb = 0;
+
+	memset(kv->image, 0, U2_KV_SEG);    // zero padding after the last record.
+	memcpy(kv->image, &hdr, sizeof(hdr));
+	kv->active = i;
+	kv->head = kv->sector;
+	kv->written = 0;
+
+	return 0;
+}
+
+static inline uint64_t
+u2_kv_cost(struct u2_kv *kv, uint32_t i, uint64_t oldest)
+{
+	return kv->segs[i].live + (kv->segs[i].seq == oldest ? 0 : kv->segs[i].tomb);
+}
+
+/*
+ * frees the sealed segment with the least data left to copy (live records,
+ * and tombstones unless nothing older is left for them to hide) if that
+ * gains at least min_gain bytes: 0 when done, -ENOSPC if no segment would.
+ * the victim is read without the lock, as sealed segments do not change and
+ * only compaction frees them; what moved meanwhile is not copied.
+ */
+static int
+u2_kv_compact(struct u2_kv *kv, uint64_t min_gain)
+{
+	struct u2_kv_seg *seg;
+	struct u2_kv_rec rec;
+	struct u2_kv_ref ref;
+	uint64_t oldest = UINT64_MAX, best = UINT64_MAX, off, hash, loc;
+	uint32_t i, victim = U2_KV_NONE, len;
+	int64_t slot;
+	uint8_t *image;
+	int rc;
+
+	pthread_mutex_lock(&kv->compact_lock);
+
+	pthread_rwlock_rdlock(&kv->lock);
+	for (i = 0; i < kv->nseg; i++) {
+		if (kv->segs[i].seq && kv->segs[i].seq < oldest) {
+			oldest = kv->segs[i].seq;
+		}
+	}
+	for (i = 0; i < kv->nseg; i++) {
+		if (kv->segs[i].seq && i != kv->active && u2_kv_cost(kv, i, oldest) < best) {
+			best = u2_kv_cost(kv, i, oldest);
+			victim = i;
+		}
+	}
+	pthread_rwlock_unlock(&kv->lock);
+
+	if (victim == U2_KV_NONE || U2_KV_SEG - kv->sector - best < min_gain) {
+		pthread_mutex_unlock(&kv->compact_lock);
+		return -ENOSPC;
+	}
+	seg = &kv->segs[victim];
+
+	image = u2_pool_alloc(U2_KV_SEG, 0);
+	if (image == NULL) {
+		pthread_mutex_unlock(&kv->compact_lock);
+		return -ENOMEM;
+	}
+	rc = u2_kv_io(kv, 0, image, u2_kv_seg_pos(victim), (seg->used + kv->sector - 1) / kv->sector * kv->sector);
+	if (rc) {
+		goto out;
+	}
+
+	pthread_rwlock_wrlock(&kv->lock);
+
+	if (best > U2_KV_SEG - kv->head && kv->nfree == 0) {    // may spill over into one more segment.
+		rc = -ENOSPC;
+		goto out_unlock;
+	}
+
+	for (off = kv->sector; off < seg->used; off += len) {
+		len = u2_kv_parse(image, off, seg->used, seg->seed, &rec);
+		if (!len) {
+			fprintf(stderr, "corrupt record in key-value segment %u!\n", victim);
+			rc = -EIO;
+			goto out_unlock;
+		}
+		hash = u2_kv_hash(image + off + U2_KV_REC, rec.klen);
+		loc = U2_KV_LOC(u2_kv_seg_pos(victim) + off, len);
+
+		if (rec.flags & U2_KV_TOMBSTONE) {
+			if (seg->seq == oldest) {
+				continue;
+			}
+			slot = u2_kv_find(kv, hash, image + off + U2_KV_REC, rec.klen, &ref);
+			if (slot >= 0) {    // put again since: the tombstone has nothing left to hide.
+				u2_kv_unload(&ref);
+				continue;
+			}
+			if (slot != -ENOENT) {
+				rc = slot;
+				goto out_unlock;
+			}
+		} else {
+			slot = u2_kv_index_at(kv, hash, loc);
+			if (slot < 0) {
+				continue;    // overwritten or deleted.
+			}
+		}
+
+		if (kv->head + len > U2_KV_SEG && (rc = u2_kv_roll(kv)) != 0) {
+			goto out_unlock;
+		}
+		loc = u2_kv_append(kv, image + off + U2_KV_REC, rec.klen, image + off + U2_KV_REC + rec.klen, rec.vlen,
+		                   rec.flags);
+		if (rec.flags & U2_KV_TOMBSTONE) {
+			seg->tomb -= len;
+		} else {
+			kv->index[slot].loc = loc;
+			seg->live -= len;
+		}
+		kv->stats[U2_KV_STAT_RELOCATED] += len;
+
+		rc = u2_kv_write_batch(kv);
+		if (rc) {
+			goto out_unlock;
+		}
+	}
+
+	// the copies are durable before the victim's header goes, which takes the old ones with it.
+	rc = u2_kv_write(kv);
+	if (!rc) {
+		rc = u2_kv_status(u2_io_flush());
+	}
+	if (!rc) {
+		memset(image, 0, kv->sector);
+		rc = u2_kv_io(kv, 1, image, u2_kv_seg_pos(victim), kv->sector);
+	}
+	if (!rc) {
+		memset(seg, 0, sizeof(*seg));
+		kv->nfree++;
+		kv->stats[U2_KV_STAT_COMPACTIONS]++;
+	}
+
+out_unlock:
+	pthread_rwlock_unlock(&kv->lock);
+out:
+	u2_pool_free(image, U2_KV_SEG);
+	pthread_mutex_unlock(&kv->compact_lock);
+
+	return rc;
+}
+
+/*
+ * makes room for len bytes in the active segment, with the lock held: rolls
+ * over to a free segment while more than U2_KV_RESERVE are left, else drops
+ * the lock to compact.
+ */
+static int
+u2_kv_room(struct u2_kv *kv, uint32_t len)
+{
+	int rc;
+
+	while (kv->head + len > U2_KV_SEG) {
+		if (kv->nfree > U2_KV_RESERVE) {
+			return u2_kv_roll(kv);
+		}
+
+		pthread_rwlock_unlock(&kv->lock);
+		rc = u2_kv_compact(kv, len);
+		pthread_rwlock_wrlock(&kv->lock);
+
+		if (rc && kv->nfree <= U2_KV_RESERVE && kv->head + len > U2_KV_SEG) {
+			return rc;
+		}
+	}
+
+	return 0;
+}
+
+int
+u2_kv_put(struct u2_kv *kv, const void *key, uint32_t klen, const void *val, uint32_t vlen)
+{
+	struct u2_kv_ref ref;
+	uint64_t hash, loc;
+	int64_t slot;
+	int rc;
+
+	if (!klen || klen > U2_KV_KEY_MAX || vlen > U2_KV_VALUE_MAX) {
+		return -EINVAL;
+	}
+	hash = u2_kv_hash(key, klen);
+
+	pthread_rwlock_wrlock(&kv->lock);
+
+	rc = u2_kv_room(kv, U2_KV_REC + klen + vlen);
+	if (!rc) {
+		rc = u2_kv_index_grow(kv);
+	}
+	if (rc) {
+		goto out;
+	}
+
+	slot = u2_kv_find(kv, hash, key, klen, &ref);
+	if (slot < 0 && slot != -ENOENT) {
+		rc = slot;
+		goto out;
+	}
+
+	loc = u2_kv_append(kv, key, klen, val, vlen, 0);
+	if (slot >= 0) {
+		u2_kv_unload(&ref);
+		kv->segs[u2_kv_seg_of(kv->index[slot].loc)].live -= U2_KV_LOC_LEN(kv->index[slot].loc);
+		kv->index[slot].loc = loc;
+	} else {
+		u2_kv_index_put(kv->index, kv->mask, hash, loc);
+		kv->count++;
+	}
+	kv->stats[U2_KV_STAT_PUTS]++;
+
+	rc = u2_kv_write_batch(kv);
+
+out:
+	pthread_rwlock_unlock(&kv->lock);
+
+	return rc;
+}
+
+/*
+ * the value's length, copied to val if that fits in cap; -ENOENT if there is
+ * no such key.
+ */
+int
+u2_kv_get(struct u2_kv *kv, const void *key, uint32_t klen, void *val, uint32_t cap)
+{
+	struct u2_kv_ref ref;
+	struct u2_kv_rec rec;
+	int64_t slot;
+	int rc;
+
+	if (!klen || klen > U2_KV_KEY_MAX) {
+		return -EINVAL;
+	}
+
+	pthread_rwlock_rdlock(&kv->lock);
+	slot = u2_kv_find(kv, u2_kv_hash(key, klen), key, klen, &ref);
+	if (slot >= 0) {
+		memcpy(&rec, ref.rec, U2_KV_REC);
+		if (rec.vlen && rec.vlen <= cap) {
+			memcpy(val, ref.rec + U2_KV_REC + klen, rec.vlen);
+		}
+		u2_kv_unload(&ref);
+		rc = rec.vlen;
+	} else {
+		rc = slot;
+	}
+	pthread_rwlock_unlock(&kv->lock);
+
+	__atomic_fetch_add(&kv->stats[U2_KV_STAT_GETS], 1, __ATOMIC_RELAXED);
+
+	return rc;
+}
+
+int
+u2_kv_delete(struct u2_kv *kv, const void *key, uint32_t klen)
+{
+	struct u2_kv_ref ref;
+	uint64_t hash;
+	int64_t slot;
+	int rc;
+
+	if (!klen || klen > U2_KV_KEY_MAX) {
+		return -EINVAL;
+	}
+	hash = u2_kv_hash(key, klen);
+
+	pthread_rwlock_wrlock(&kv->lock);
+
+	rc = u2_kv_room(kv, U2_KV_REC + klen);
+	if (rc) {
+		goto out;
+	}
+
+	slot = u2_kv_find(kv, hash, key, klen, &ref);
+	if (slot < 0) {
+		rc = slot;
+		goto out;
+	}
+	u2_kv_unload(&ref);
+
+	u2_kv_append(kv, key, klen, NULL, 0, U2_KV_TOMBSTONE);
+	kv->segs[u2_kv_seg_of(kv->index[slot].loc)].live -= U2_KV_LOC_LEN(kv->index[slot].loc);
+	u2_kv_index_del(kv, slot);
+	kv->stats[U2_KV_STAT_DELETES]++;
+
+	rc = u2_kv_write_batch(kv);
+
+out:
+	pthread_rwlock_unlock(&kv->lock);
+
+	return rc;
+}
+
+/*
+ * everything put or deleted before is durable once this returns 0.
+ */
+int
+u2_kv_sync(struct u2_kv *kv)
+{
+	int rc;
+
+	pthread_rwlock_wrlock(&kv->lock);
+	rc = u2_kv_write(kv);
+	pthread_rwlock_unlock(&kv->lock);
+
+	return rc ? rc : u2_kv_status(u2_io_flush());
+}
+
+void
+u2_kv_stats(struct u2_kv *kv, int64_t *stats)
+{
+	uint32_t i;
+
+	pthread_rwlock_rdlock(&kv->lock);
+	memcpy(stats, kv->stats, sizeof(kv->stats));
+	stats[U2_KV_STAT_GETS] = __atomic_load_n(&kv->stats[U2_KV_STAT_GETS], __ATOMIC_RELAXED);
+	stats[U2_KV_STAT_KEYS] = kv->count;
+	stats[U2_KV_STAT_LIVE] = 0;
+	for (i = 0; i < kv->nseg; i++) {
+		stats[U2_KV_STAT_LIVE] += kv->segs[i].live;
+	}
+	stats[U2_KV_STAT_SEGMENTS] = kv->nseg;
+	stats[U2_KV_STAT_FREE] = kv->nfree;
+	pthread_rwlock_unlock(&kv->lock);
+}
+
+/*
+ * writes out what sat in the active image for a tick, and compacts while
+ * free segments run low and some are worth it.
+ */
+static void *
+u2_kv_run(void *arg)
+{
+	struct u2_kv *kv = arg;
+	struct timespec ts;
+	uint32_t nfree;
+
+	pthread_mutex_lock(&kv->tick_lock);
+	while (!kv->stop) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += U2_KV_TICK_MS * 1000000;
+		ts.tv_sec += ts.tv_nsec / 1000000000;
+		ts.tv_nsec %= 1000000000;
+		pthread_cond_timedwait(&kv->tick, &kv->tick_lock, &ts);
+		if (kv->stop) {
+			break;
+		}
+		pthread_mutex_unlock(&kv->tick_lock);
+
+		pthread_rwlock_wrlock(&kv->lock);
+		u2_kv_write(kv);    // errors show up with the next put or sync.
+		nfree = kv->nfree;
+		pthread_rwlock_unlock(&kv->lock);
+
+		while (nfree < U2_KV_FREE_LOW && !u2_kv_compact(kv, U2_KV_GARBAGE_MIN)) {
+			pthread_rwlock_rdlock(&kv->lock);
+			nfree = kv->nfree;
+			pthread_rwlock_unlock(&kv->lock);
+		}
+
+		pthread_mutex_lock(&kv->tick_lock);
+	}
+	pthread_mutex_unlock(&kv->tick_lock);
+
+	return NULL;
+}
+
+struct u2_kv_order {
+	uint64_t seq;
+	uint32_t seg;
+};
+
+static int
+u2_kv_order_cmp(const void *a, const void *b)
+{
+	const struct u2_kv_order *x = a, *y = b;
+
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+/*
+ * rebuilds the index by replaying every segment of this epoch, oldest first,
+ * up to its first bad record. each one is replayed in the active image, so
+ * updates within it compare keys in memory; the last one is appended to.
+ */
+static int
+u2_kv_recover(struct u2_kv *kv)
+{
+	struct u2_kv_order *order;
+	struct u2_kv_seg_hdr hdr;
+	struct u2_kv_seg *seg;
+	struct u2_kv_rec rec;
+	struct u2_kv_ref ref;
+	uint64_t off = 0, hash;
+	uint32_t i, n = 0, len;
+	int64_t slot;
+	int rc = 0;
+
+	order = malloc(kv->nseg * sizeof(*order));
+	if (order == NULL) {
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < kv->nseg; i++) {
+		rc = u2_kv_io(kv, 0, kv->image, u2_kv_seg_pos(i), kv->sector);
+		if (rc) {
+			goto out;
+		}
+		memcpy(&hdr, kv->image, sizeof(hdr));
+		if (hdr.magic == U2_KV_SEG_MAGIC && hdr.epoch == kv->epoch && hdr.seq &&
+		    hdr.crc == u2_crc32c(0, &hdr, offsetof(struct u2_kv_seg_hdr, crc))) {
+			kv->segs[i].seq = hdr.seq;
+			kv->segs[i].seed = hdr.crc;
+			order[n].seq = hdr.seq;
+			order[n++].seg = i;
+			kv->nfree--;
+		}
+	}
+	qsort(order, n, sizeof(*order), u2_kv_order_cmp);
+
+	for (i = 0; i < n; i++) {
+		seg = &kv->segs[order[i].seg];
+		rc = u2_kv_io(kv, 0, kv->image, u2_kv_seg_pos(order[i].seg), U2_KV_SEG);
+		if (rc) {
+			goto out;
+		}
+		kv->active = order[i].seg;
+
+		for (off = kv->sector; (len = u2_kv_parse(kv->image, off, U2_KV_SEG, seg->seed, &rec)) != 0; off += len) {
+			rc = u2_kv_index_grow(kv);
+			if (rc) {
+				goto out;
+			}
+			hash = u2_kv_hash(kv->image + off + U2_KV_REC, rec.klen);
+			slot = u2_kv_find(kv, hash, kv->image + off + U2_KV_REC, rec.klen, &ref);
+			if (slot < 0 && slot != -ENOENT) {
+				rc = slot;
+				goto out;
+			}
+			if (slot >= 0) {
+				u2_kv_unload(&ref);
+				kv->segs[u2_kv_seg_of(kv->index[slot].loc)].live -= U2_KV_LOC_LEN(kv->index[slot].loc);
+			}
+
+			if (rec.flags & U2_KV_TOMBSTONE) {
+				seg->tomb += len;
+				if (slot >= 0) {
+					u2_kv_index_del(kv, slot);
+				}
+			} else {
+				seg->live += len;
+				if (slot >= 0) {
+					kv->index[slot].loc = U2_KV_LOC(u2_kv_seg_pos(kv->active) + off, len);
+				} else {
+					u2_kv_index_put(kv->index, kv->mask, hash, U2_KV_LOC(u2_kv_seg_pos(kv->active) + off, len));
+					kv->count++;
+				}
+			}
+		}
+		seg->used = off;
+		kv->seq = seg->seq;
+	}
+
+	if (n) {    // the newest stays active, its tail zeroed: appends could otherwise line up with stale records.
+		memset(kv->image + off, 0, U2_KV_SEG - off);
+		kv->head = kv->written = off;
+		off = off / kv->sector * kv->sector;
+		rc = u2_kv_io(kv, 1, kv->image + off, u2_kv_seg_pos(kv->active) + off, U2_KV_SEG - off);
+		if (!rc) {
+			free(order);
+			return 0;
+		}
+	}
+
+out:
+	kv->active = U2_KV_NONE;
+	free(order);
+
+	return rc;
+}
+
+/*
+ * opens the store in [offset, offset + size) of the volume, formatting it
+ * first if asked to; NULL if there is none (or it does not fit the region).
+ */
+struct u2_kv *
+u2_kv_open(uint64_t offset, uint64_t size, uint32_t sector, int format)
+{
+	struct u2_kv_super *sb;
+	struct u2_kv *kv;
+	uint64_t nseg;
+	int valid;
+
+	nseg = size > U2_KV_SUPER ? (size - U2_KV_SUPER) / U2_KV_SEG : 0;
+	if (offset % sector || sector > U2_KV_SUPER || nseg < U2_KV_RESERVE + 2 || size >= U2_KV_POS_MAX) {
+		fprintf(stderr, "invalid key-value region %"PRIu64"+%"PRIu64"!\n", offset, size);
+		return NULL;
+	}
+
+	kv = calloc(1, sizeof(*kv));
+	if (kv == NULL) {
+		return NULL;
+	}
+	kv->offset = offset;
+	kv->sector = sector;
+	kv->nseg = nseg;
+	kv->nfree = nseg;
+	kv->active = U2_KV_NONE;
+	kv->mask = U2_KV_INDEX_MIN - 1;
+
+	kv->segs = calloc(nseg, sizeof(*kv->segs));
+	kv->index = calloc(U2_KV_INDEX_MIN, sizeof(*kv->index));
+	kv->image = u2_pool_alloc(U2_KV_SEG, 1);
+	if (!kv->segs || !kv->index || !kv->image) {
+		goto fail;
+	}
+
+	sb = (struct u2_kv_super *)kv->image;
+	if (u2_kv_io(kv, 0, kv->image, 0, U2_KV_SUPER)) {
+		goto fail;
+	}
+	valid = sb->magic == U2_KV_SUPER_MAGIC && sb->seg_size == U2_KV_SEG && sb->nseg == nseg &&
+	        sb->crc == u2_crc32c(0, sb, offsetof(struct u2_kv_super, crc));
+
+	if (format) {
+		kv->epoch = valid ? sb->epoch + 1 : (uint64_t)time(NULL) << 20;
+		memset(kv->image, 0, U2_KV_SUPER);
+		sb->magic = U2_KV_SUPER_MAGIC;
+		sb->epoch = kv->epoch;
+		sb->seg_size = U2_KV_SEG;
+		sb->nseg = nseg;
+		sb->crc = u2_crc32c(0, sb, offsetof(struct u2_kv_super, crc));
+		if (u2_kv_io(kv, 1, kv->image, 0, U2_KV_SUPER) || u2_io_flush()) {
+			goto fail;
+		}
+	} else if (!valid) {
+		fprintf(stderr, "no key-value store at %"PRIu64"!\n", offset);
+		goto fail;
+	} else {
+		kv->epoch = sb->epoch;
+		if (u2_kv_recover(kv)) {
+			fprintf(stderr, "failed to recover key-value store!\n");
+			goto fail;
+		}
+	}
+
+	if (kv->active == U2_KV_NONE && u2_kv_roll(kv)) {
+		goto fail;
+	}
+
+	pthread_rwlock_init(&kv->lock, NULL);
+	pthread_mutex_init(&kv->compact_lock, NULL);
+	pthread_mutex_init(&kv->tick_lock, NULL);
+	pthread_cond_init(&kv->tick, NULL);
+	if (pthread_create(&kv->thread, NULL, u2_kv_run, kv)) {
+		pthread_cond_destroy(&kv->tick);
+		pthread_mutex_destroy(&kv->tick_lock);
+		pthread_mutex_destroy(&kv->compact_lock);
+		pthread_rwlock_destroy(&kv->lock);
+		goto fail;
+	}
+
+	pthread_mutex_lock(&u2_kvs_lock);
+	kv->next = u2_kvs;
+	u2_kvs = kv;
+	pthread_mutex_unlock(&u2_kvs_lock);
+
+	return kv;
+
+fail:
+	if (kv->image) {
+		u2_pool_free(kv->image, U2_KV_SEG);
+	}
+	free(kv->index);
+	free(kv->segs);
+	free(kv);
+
+	return NULL;
+}
+
+static void
+u2_kv_free(struct u2_kv *kv)
+{
+	pthread_mutex_lock(&kv->tick_lock);
+	kv->stop = 1;
+	pthread_cond_signal(&kv->tick);
+	pthread_mutex_unlock(&kv->tick_lock);
+	pthread_join(kv->thread, NULL);
+
+	if (u2_kv_sync(kv)) {
+		fprintf(stderr, "failed to write out key-value store!\n");
+	}
+
+	pthread_cond_destroy(&kv->tick);
+	pthread_mutex_destroy(&kv->tick_lock);
+	pthread_mutex_destroy(&kv->compact_lock);
+	pthread_rwlock_destroy(&kv->lock);
+
+	u2_pool_free(kv->image, U2_KV_SEG);
+	free(kv->index);
+	free(kv->segs);
+	free(kv);
+}
+
+/*
+ * writes out and lets go of a store; no calls on it may be in progress.
+ */
+void
+u2_kv_close(struct u2_kv *kv)
+{
+	struct u2_kv **pp;
+
+	pthread_mutex_lock(&u2_kvs_lock);
+	for (pp = &u2_kvs; *pp; pp = &(*pp)->next) {
+		if (*pp == kv) {
+			*pp = kv->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&u2_kvs_lock);
+
+	u2_kv_free(kv);
+}
+
+void
+u2_kv_close_all(void)
+{
+	struct u2_kv *kv;
+
+	pthread_mutex_lock(&u2_kvs_lock);
+	while ((kv = u2_kvs) != NULL) {
+		u2_kvs = kv->next;
+		u2_kv_free(kv);
+	}
+	pthread_mutex_unlock(&u2_kvs_lock);
+}
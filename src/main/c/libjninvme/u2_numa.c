@@ -0,0 +1,102 @@
+/*
+ * libjninvme: NUMA topology as sysfs has it, for placing memory and threads
+ * next to the devices they work with.
+ *
+ * Author(s)
+ *   azq    @qzan9    anzhongqi@ncic.ac.cn
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "jninvme.h"
+
+static int
+u2_numa_read(const char *dir)
+{
+	char path[PATH_MAX];
+	FILE *f;
+	int node;
+
+	snprintf(path, sizeof(path), "%s/numa_node", dir);
+	f = fopen(path, "r");
+	if (f == NULL) {
+		return -2;
+	}
+	if (fscanf(f, "%d", &node) != 1) {
+		node = -1;
+	}
+	fclose(f);
+
+	return node;
+}
+
+/*
+ * the closest ancestor of a sysfs device (a PCI function, a block device)
+ * that says: for a namespace, the PCI function of its controller.
+ */
+int
+u2_numa_node(const char *sysfs)
+{
+	char path[PATH_MAX], *p;
+	int node;
+
+	if (realpath(sysfs, path) == NULL) {
+		return -1;
+	}
+
+	while (strncmp(path, "/sys/devices/", strlen("/sys/devices/")) == 0) {
+		node = u2_numa_read(path);
+		if (node != -2) {
+			return node < U2_NODE_MAX ? node : -1;    // -1 from the kernel: no affinity.
+		}
+		p = strrchr(path, '/');
+		*p = '\0';
+	}
+
+	return -1;
+}
+
+/*
+ * the CPUs of a node, from its cpulist ("0-7,16-23"), up to max of them;
+ * returns their count.
+ */
+int
+u2_numa_cpus(int node, int *cpus, int max)
+{
+	char path[PATH_MAX], list[4096], *p, *end;
+	long lo, hi;
+	FILE *f;
+	int n = 0;
+
+	if (node < 0) {
+		return 0;
+	}
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	f = fopen(path, "r");
+	if (f == NULL) {
+		return 0;
+	}
+	p = fgets(list, sizeof(list), f);
+	fclose(f);
+
+	while (p && *p && *p != '\n') {
+		lo = hi = strtol(p, &end, 10);
+		if (end == p) {
+			break;
+		}
+		if (*end == '-') {
+			p = end + 1;
+			hi = strtol(p, &end, 10);
+		}
+		for (; lo <= hi && n < max; lo++) {
+			cpus[n++] = lo;
+		}
+		p = *end == ',' ? end + 1 : end;
+	}
+
+	return n;
+}
@@ -0,0 +1,521 @@
+/*
+ * libjninvme: SPDK backend, user-level NVMe through a UIO/VFIO-bound device.
+ *
+ * Author(s)
+ *   azq    @qzan9    anzhongqi@ncic.ac.cn
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <limits.h>
+#include <dirent.h>
+
+#include <rte_config.h>
+#include <rte_malloc.h>
+#include <rte_mempool.h>
+
+#include <spdk/nvme.h>
+#include <spdk/vtophys.h>
+
+#include "jninvme.h"
+
+#define U2_REQUEST_POOL_SIZE    (1024)
+#define U2_REQUEST_CACHE_SIZE   (0)
+#define U2_REQUEST_PRIVATE_SIZE (0)
+#define U2_REQUEST_POOL_DEVS    (16)    // devices the request pool is sized for.
+
+#define U2_WRR_HIGH             (16)    // weighted round robin: commands per round ...
+#define U2_WRR_MEDIUM           (4)
+#define U2_WRR_LOW              (1)
+#define U2_WRR_BURST            (3)     // ... fetched 2^3 at a time.
+
+#define U2_PCI_CLASS_NVME       (0x010802)
+#define U2_PCI_SYSFS            "/sys/bus/pci/devices"
+
+#define U2_PCI_ADDR(dev)        ((uint64_t)spdk_pci_device_get_domain(dev) << 24 | spdk_pci_device_get_bus(dev) << 16 | \
+                                 spdk_pci_device_get_dev(dev) << 8 | spdk_pci_device_get_func(dev))
+
+/*
+ * a qpair is bound to one controller's namespace.
+ */
+struct u2_spdk_qpair {
+	struct spdk_nvme_qpair *qpair;
+	struct spdk_nvme_ns *ns;
+};
+
+static struct spdk_nvme_ctrlr *u2_ctrlrs[U2_DEV_MAX];
+static uint64_t u2_ctrlr_addr[U2_DEV_MAX];
+static uint32_t u2_ctrlr_wrr[U2_DEV_MAX];    // enabled with weighted round robin arbitration.
+static int u2_ctrlr_node[U2_DEV_MAX];
+static uint32_t u2_nctrlr;
+static uint32_t u2_probe_wrr;                 // this probe asks for it ...
+static uint32_t u2_probed;                    // ... of that many controllers.
+static uint32_t u2_probe_retry;               // the second probe, for those that refused.
+
+static struct spdk_nvme_ns *u2_nss[U2_DEV_MAX];
+static uint32_t u2_ndev;
+static uint32_t u2_dev_ctrlr[U2_DEV_MAX];
+static uint32_t u2_dev_nsid[U2_DEV_MAX];
+
+struct rte_mempool *request_mempool;
+static char u2_eal_cores[32] = "-c 0x100";
+static char *ealargs[] = { "jninvme", u2_eal_cores, "-n 1", };
+
+static const enum spdk_nvme_qprio u2_qprio[U2_PRIOS] = {
+	[U2_PRIO_HIGH]   = SPDK_NVME_QPRIO_HIGH,
+	[U2_PRIO_NORMAL] = SPDK_NVME_QPRIO_MEDIUM,
+	[U2_PRIO_LOW]    = SPDK_NVME_QPRIO_LOW,
+};
+
+static bool
+probe_cb(void *cb_ctx, struct spdk_pci_device *dev, struct spdk_nvme_ctrlr_opts *opts)
+{
+	uint32_t i;
+
+	if (u2_nctrlr == U2_DEV_MAX) {
+		return false;
+	}
+
+	for (i = 0; u2_probe_retry && i < u2_nctrlr; i++) {    // attached by the first probe.
+		if (u2_ctrlr_addr[i] == U2_PCI_ADDR(dev)) {
+			return false;
+		}
+	}
+
+	if (spdk_pci_device_has_non_uio_driver(dev)) {
+		fprintf(stderr, "%04x:%02x:%02x.%02x: non-UIO/kernel driver detected!\n",
+		                spdk_pci_device_get_domain(dev),
+		                spdk_pci_device_get_bus(dev),
+		                spdk_pci_device_get_dev(dev),
+		                spdk_pci_device_get_func(dev));
+		return false;
+	}
+
+	if (u2_probe_wrr) {
+		opts->arb_mechanism = SPDK_NVME_CC_AMS_WRR;
+	}
+	u2_probed++;
+
+	return true;
+}
+
+static void
+u2_spdk_admin_complete(void *cb_args, const struct spdk_nvme_cpl *completion)
+{
+	*(volatile int *)cb_args = spdk_nvme_cpl_is_error(completion) ?
+	                           (completion->status.sct << 8 | completion->status.sc) : 0;
+}
+
+/*
+ * the weights of the high, medium and low priority queues; urgent ones always
+ * go first.
+ */
+static int
+u2_spdk_set_weights(struct spdk_nvme_ctrlr *ctrlr)
+{
+	volatile int status = -EINPROGRESS;
+	uint32_t cdw11 = (U2_WRR_HIGH - 1) << 24 | (U2_WRR_MEDIUM - 1) << 16 | (U2_WRR_LOW - 1) << 8 | U2_WRR_BURST;
+
+	if (spdk_nvme_ctrlr_cmd_set_feature(ctrlr, SPDK_NVME_FEAT_ARBITRATION, cdw11, 0, NULL, 0,
+	                                    u2_spdk_admin_complete, (void *)&status)) {
+		return -EIO;
+	}
+	while (status == -EINPROGRESS) {
+		spdk_nvme_ctrlr_process_admin_completions(ctrlr);
+	}
+
+	return status;
+}
+
+static void
+attach_cb(void *cb_ctx, struct spdk_pci_device *dev, struct spdk_nvme_ctrlr *ctrlr, const struct spdk_nvme_ctrlr_opts *opts)
+{
+	struct spdk_nvme_ns *ns;
+	uint32_t nsid, num_ns;
+	char path[PATH_MAX];
+
+	u2_ctrlr_addr[u2_nctrlr] = U2_PCI_ADDR(dev);
+	u2_ctrlr_wrr[u2_nctrlr] = opts->arb_mechanism == SPDK_NVME_CC_AMS_WRR;
+	snprintf(path, sizeof(path), U2_PCI_SYSFS "/%04x:%02x:%02x.%x", spdk_pci_device_get_domain(dev),
+	         spdk_pci_device_get_bus(dev), spdk_pci_device_get_dev(dev), spdk_pci_device_get_func(dev));
+	u2_ctrlr_node[u2_nctrlr] = u2_numa_node(path);
+	u2_ctrlrs[u2_nctrlr++] = ctrlr;
+
+	printf("attached to %04x:%02x:%02x.%02x%s!\n",
+	       spdk_pci_device_get_domain(dev),
+	       spdk_pci_device_get_bus(dev),
+	       spdk_pci_device_get_dev(dev),
+	       spdk_pci_device_get_func(dev),
+	       u2_ctrlr_wrr[u2_nctrlr - 1] ? " (weighted round robin)" : "");
+
+	if (u2_ctrlr_wrr[u2_nctrlr - 1] && u2_spdk_set_weights(ctrlr)) {
+		fprintf(stderr, "failed to set arbitration weights, keeping the controller's!\n");
+	}
+
+	num_ns = spdk_nvme_ctrlr_get_num_ns(ctrlr);
+	for (nsid = 1; nsid <= num_ns && u2_ndev < U2_DEV_MAX; nsid++) {
+		ns = spdk_nvme_ctrlr_get_ns(ctrlr, nsid);
+		if (ns == NULL || !spdk_nvme_ns_is_active(ns)) {
+			continue;
+		}
+
+		u2_dev_ctrlr[u2_ndev] = u2_nctrlr - 1;
+		u2_dev_nsid[u2_ndev] = nsid;
+		u2_nss[u2_ndev++] = ns;
+	}
+}
+
+/*
+ * NUMA node of the first NVMe controller bound to a user-level driver, before
+ * the EAL is up: where its core and the request pool go.
+ */
+static int
+u2_spdk_scan_node(void)
+{
+	char path[PATH_MAX], link[PATH_MAX], *drv;
+	struct dirent *de;
+	unsigned class;
+	ssize_t len;
+	DIR *dir;
+	FILE *f;
+	int node = -1;
+
+	dir = opendir(U2_PCI_SYSFS);
+	if (dir == NULL) {
+		return -1;
+	}
+
+	while (node < 0 && (de = readdir(dir)) != NULL) {
+		snprintf(path, sizeof(path), U2_PCI_SYSFS "/%s/class", de->d_name);
+		f = fopen(path, "r");
+		if (f == NULL) {
+			continue;
+		}
+		if (fscanf(f, "%x", &class) != 1) {
+			class = 0;
+		}
+		fclose(f);
+		if (class != U2_PCI_CLASS_NVME) {
+			continue;
+		}
+
+		snprintf(path, sizeof(path), U2_PCI_SYSFS "/%s/driver", de->d_name);
+		len = readlink(path, link, sizeof(link) - 1);
+		if (len < 0) {
+			continue;
+		}
+		link[len] = '\0';
+		drv = strrchr(link, '/') ? strrchr(link, '/') + 1 : link;
+		if (strcmp(drv, "uio_pci_generic") && strcmp(drv, "igb_uio") && strcmp(drv, "vfio-pci")) {
+			continue;
+		}
+
+		snprintf(path, sizeof(path), U2_PCI_SYSFS "/%s", de->d_name);
+		node = u2_numa_node(path);
+	}
+	closedir(dir);
+
+	return node;
+}
+
+/*
+ * attaches every controller SPDK can get at (up to U2_DEV_MAX); each of their
+ * active namespaces is a device. SPDK won't enable a controller with weighted
+ * round robin unless CAP.AMS has it, so when asked for, a first probe tries
+ * that and a second one picks up what is left with plain round robin.
+ */
+static int
+u2_spdk_init(const struct u2_backend_opts *opts, uint32_t *ndev)
+{
+	uint32_t pool_size;
+	int node, cpus[2];
+
+	node = u2_spdk_scan_node();    // the EAL core on its node, but off CPU 0 where it can be.
+	switch (u2_numa_cpus(node, cpus, 2)) {
+	case 0:
+		break;
+	case 1:
+		snprintf(u2_eal_cores, sizeof(u2_eal_cores), "-l %d", cpus[0]);
+		break;
+	default:
+		snprintf(u2_eal_cores, sizeof(u2_eal_cores), "-l %d", cpus[0] ? cpus[0] : cpus[1]);
+		break;
+	}
+
+	if (rte_eal_init(sizeof(ealargs) / sizeof(ealargs[0]), ealargs) < 0) {
+		fprintf(stderr, "failed to initialize EAL!\n");
+		return 1;
+	}
+
+	u2_nctrlr = 0;
+	u2_ndev = 0;
+
+	pool_size = 4 * opts->io_depth * (opts->queues + 1) * U2_REQUEST_POOL_DEVS;    // SPDK 16.06: one pool for all controllers.
+	if (pool_size < U2_REQUEST_POOL_SIZE) {
+		pool_size = U2_REQUEST_POOL_SIZE;
+	}
+
+	request_mempool = rte_mempool_create("nvme_request",
+	                                     pool_size, spdk_nvme_request_size(),
+	                                     U2_REQUEST_CACHE_SIZE, U2_REQUEST_PRIVATE_SIZE,
+	                                     NULL, NULL, NULL, NULL,
+	                                     node < 0 ? SOCKET_ID_ANY : node, 0);
+	if (request_mempool == NULL && node >= 0) {    // no hugepages left there.
+		request_mempool = rte_mempool_create("nvme_request",
+		                                     pool_size, spdk_nvme_request_size(),
+		                                     U2_REQUEST_CACHE_SIZE, U2_REQUEST_PRIVATE_SIZE,
+		                                     NULL, NULL, NULL, NULL,
+		                                     SOCKET_ID_ANY, 0);
+	}
+	if (request_mempool == NULL) {
+		fprintf(stderr, "failed to create request pool!\n");
+		return 1;
+	}
+
+	u2_probe_wrr = opts->weighted;
+	u2_probe_retry = 0;
+	u2_probed = 0;
+	if (spdk_nvme_probe(NULL, probe_cb, attach_cb)) {
+		fprintf(stderr, "failed to probe and attach to NVMe device!\n");
+		return 1;
+	}
+	if (u2_probe_wrr && u2_nctrlr < u2_probed) {
+		u2_probe_wrr = 0;
+		u2_probe_retry = 1;
+		if (spdk_nvme_probe(NULL, probe_cb, attach_cb)) {
+			fprintf(stderr, "failed to probe and attach to NVMe device!\n");
+			return 1;
+		}
+	}
+
+	if (!u2_ndev) {
+		fprintf(stderr, "failed to probe a controller with an active namespace!\n");
+		while (u2_nctrlr) {
+			spdk_nvme_detach(u2_ctrlrs[--u2_nctrlr]);
+		}
+		return 1;
+	}
+
+	*ndev = u2_ndev;
+
+	return 0;
+}
+
+static void
+u2_spdk_fini(void)
+{
+	while (u2_nctrlr) {
+		spdk_nvme_detach(u2_ctrlrs[--u2_nctrlr]);
+		u2_ctrlrs[u2_nctrlr] = NULL;
+	}
+	u2_ndev = 0;
+}
+
+static void
+u2_spdk_geometry(uint32_t dev, uint32_t *sector, uint64_t *size)
+{
+	*sector = spdk_nvme_ns_get_sector_size(u2_nss[dev]);
+	*size = spdk_nvme_ns_get_size(u2_nss[dev]);
+}
+
+static void
+u2_spdk_ident(uint32_t dev, uint32_t *ctrlr, uint32_t *nsid)
+{
+	*ctrlr = u2_dev_ctrlr[dev];
+	*nsid = u2_dev_nsid[dev];
+}
+
+/*
+ * prio only counts on controllers enabled with weighted round robin: under
+ * plain round robin, SPDK takes nothing but the default (urgent) class.
+ */
+static void *
+u2_spdk_qpair_alloc(uint32_t dev, uint32_t prio)
+{
+	struct u2_spdk_qpair *qp;
+
+	qp = malloc(sizeof(*qp));
+	if (qp == NULL) {
+		return NULL;
+	}
+
+	qp->qpair = spdk_nvme_ctrlr_alloc_io_qpair(u2_ctrlrs[u2_dev_ctrlr[dev]],
+	                                           u2_ctrlr_wrr[u2_dev_ctrlr[dev]] ? u2_qprio[prio] : 0);
+	if (qp->qpair == NULL) {
+		free(qp);
+		return NULL;
+	}
+	qp->ns = u2_nss[dev];
+
+	return qp;
+}
+
+static int
+u2_spdk_weighted(uint32_t dev)
+{
+	return u2_ctrlr_wrr[u2_dev_ctrlr[dev]];
+}
+
+static int
+u2_spdk_node(uint32_t dev)
+{
+	return u2_ctrlr_node[u2_dev_ctrlr[dev]];
+}
+
+static void
+u2_spdk_qpair_free(void *qpair)
+{
+	struct u2_spdk_qpair *qp = qpair;
+
+	spdk_nvme_ctrlr_free_io_qpair(qp->qpair);
+	free(qp);
+}
+
+static void
+u2_spdk_complete(void *cb_args, const struct spdk_nvme_cpl *completion)
+{
+	u2_request_complete(cb_args, spdk_nvme_cpl_is_error(completion) ?
+	                             (completion->status.sct << 8 | completion->status.sc) : 0);
+}
+
+static int
+u2_spdk_submit(void *qpair, struct u2_request *req, int is_write, void *buf, uint64_t lba, uint32_t nlb)
+{
+	struct u2_spdk_qpair *qp = qpair;
+
+	if (is_write) {
+		return spdk_nvme_ns_cmd_write(qp->ns, qp->qpair, buf, lba, nlb, u2_spdk_complete, req, 0);
+	} else {
+		return spdk_nvme_ns_cmd_read (qp->ns, qp->qpair, buf, lba, nlb, u2_spdk_complete, req, 0);
+	}
+}
+
+static void
+u2_sgl_reset(void *cb_args, uint32_t offset)
+{
+	struct u2_sgl *sgl = ((struct u2_request *)cb_args)->sgl;
+	uint32_t i;
+
+	for (i = 0; i < sgl->count && offset >= sgl->sge[i].iov_len; i++) {
+		offset -= sgl->sge[i].iov_len;
+	}
+
+	sgl->index = i;
+	sgl->offset = offset;
+}
+
+static int
+u2_sgl_next(void *cb_args, uint64_t *address, uint32_t *length)
+{
+	struct u2_sgl *sgl = ((struct u2_request *)cb_args)->sgl;
+
+	if (sgl->index >= sgl->count) {
+		return -1;
+	}
+
+	*address = spdk_vtophys((uint8_t *)sgl->sge[sgl->index].iov_base + sgl->offset);
+	if (*address == SPDK_VTOPHYS_ERROR) {
+		return -1;
+	}
+	*length = sgl->sge[sgl->index].iov_len - sgl->offset;
+
+	sgl->index++;
+	sgl->offset = 0;
+
+	return 0;
+}
+
+/*
+ * unless the controller supports SGLs, SPDK maps the list to PRPs: every
+ * element but the first must then start, and every element but the last must
+ * end, on a page.
+ */
+static int
+u2_spdk_submitv(void *qpair, struct u2_request *req, int is_write, uint64_t lba, uint32_t nlb)
+{
+	struct u2_spdk_qpair *qp = qpair;
+
+	if (is_write) {
+		return spdk_nvme_ns_cmd_writev(qp->ns, qp->qpair, lba, nlb, u2_spdk_complete, req, 0, u2_sgl_reset, u2_sgl_next);
+	} else {
+		return spdk_nvme_ns_cmd_readv (qp->ns, qp->qpair, lba, nlb, u2_spdk_complete, req, 0, u2_sgl_reset, u2_sgl_next);
+	}
+}
+
+static int
+u2_spdk_flush(void *qpair, struct u2_request *req)
+{
+	struct u2_spdk_qpair *qp = qpair;
+
+	return spdk_nvme_ns_cmd_flush(qp->ns, qp->qpair, u2_spdk_complete, req);
+}
+
+static int
+u2_spdk_process(void *qpair)
+{
+	return spdk_nvme_qpair_process_completions(((struct u2_spdk_qpair *)qpair)->qpair, 0);
+}
+
+/*
+ * through the admin queue, which SPDK locks on its own: I/O qpairs go on.
+ */
+static int
+u2_spdk_health(uint32_t dev, void *page)
+{
+	struct spdk_nvme_ctrlr *ctrlr = u2_ctrlrs[u2_dev_ctrlr[dev]];
+	volatile int status = -EINPROGRESS;
+
+	if (spdk_nvme_ctrlr_cmd_get_log_page(ctrlr, SPDK_NVME_LOG_HEALTH_INFORMATION, SPDK_NVME_GLOBAL_NS_TAG,
+	                                     page, U2_HEALTH_PAGE, u2_spdk_admin_complete, (void *)&status)) {
+		return -EIO;
+	}
+	while (status == -EINPROGRESS) {
+		spdk_nvme_ctrlr_process_admin_completions(ctrlr);
+	}
+
+	return status;
+}
+
+static void *
+u2_spdk_dma_alloc(uint64_t size, uint64_t align, int node)
+{
+	void *buf = NULL;
+
+	if (node >= 0) {
+		buf = rte_malloc_socket(NULL, size, align, node);
+	}
+
+	return buf ? buf : rte_malloc(NULL, size, align);
+}
+
+static void
+u2_spdk_dma_free(void *buf)
+{
+	rte_free(buf);
+}
+
+const struct u2_backend u2_spdk_backend = {
+	.name        = "spdk",
+	.buf_align   = 4,
+	.init        = u2_spdk_init,
+	.fini        = u2_spdk_fini,
+	.geometry    = u2_spdk_geometry,
+	.ident       = u2_spdk_ident,
+	.qpair_alloc = u2_spdk_qpair_alloc,
+	.qpair_free  = u2_spdk_qpair_free,
+	.submit      = u2_spdk_submit,
+	.submitv     = u2_spdk_submitv,
+	.flush       = u2_spdk_flush,
+	.process     = u2_spdk_process,
+	.dma_alloc   = u2_spdk_dma_alloc,
+	.dma_free    = u2_spdk_dma_free,
+	.node        = u2_spdk_node,
+	.weighted    = u2_spdk_weighted,
+	.health      = u2_spdk_health,
+};
@@ -0,0 +1,388 @@
+/*
+ * libjninvme: SMART/health telemetry, sampled in the background.
+ *
+ * a thread reads every controller's health log page through the backend's
+ * admin path at a fixed interval, so the I/O queues never wait on it, and
+ * turns consecutive samples into rates: bytes and commands per second, new
+ * media errors, and the temperature trend (a smoothed slope). the latest
+ * sample of each controller is kept for the stats calls and, if asked to,
+ * appended as one line of JSON to a file.
+ *
+ * Author(s)
+ *   azq    @qzan9    anzhongqi@ncic.ac.cn
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#include <pthread.h>
+#include <time.h>
+
+#include "jninvme.h"
+
+#define U2_TELEM_UNIT           (512000)    // bytes per data unit (1000 sectors of 512).
+#define U2_TELEM_TREND_SHIFT    (2)         // EWMA weight of a new slope: 1/4.
+
+/*
+ * the health log page (NVMe 1.2, figure 93), byte offsets; the 16-byte
+ * counters are read as their low 64 bits.
+ */
+#define U2_HEALTH_CRITICAL      (0)
+#define U2_HEALTH_TEMPERATURE   (1)      // 2 bytes, kelvin.
+#define U2_HEALTH_SPARE         (3)
+#define U2_HEALTH_USED          (5)
+#define U2_HEALTH_UNITS_READ    (32)
+#define U2_HEALTH_UNITS_WRITTEN (48)
+#define U2_HEALTH_READS         (64)
+#define U2_HEALTH_WRITES        (80)
+#define U2_HEALTH_POWER_ON      (128)
+#define U2_HEALTH_UNSAFE        (144)
+#define U2_HEALTH_MEDIA_ERRORS  (160)
+
+struct u2_telem_ctrlr {
+	uint32_t dev;              // any of its namespaces.
+	uint32_t sampled;          // there is a sample ...
+	uint64_t mono_ns;          // ... taken then,
+	uint64_t units_read, units_written, reads, writes;    // with those raw counters.
+	int64_t stats[U2_TELEM_STATS];
+};
+
+static struct {
+	const struct u2_backend *be;
+	struct u2_telem_ctrlr ctrlrs[U2_DEV_MAX];
+	uint32_t nctrlr;
+	uint32_t interval_ms;
+	uint8_t *page;
+	FILE *out;
+
+	pthread_mutex_t lock;    // samples, stop.
+	pthread_cond_t kick;
+	pthread_t thread;
+	uint32_t running;
+	uint32_t stop;
+} u2_telem = { .lock = PTHREAD_MUTEX_INITIALIZER, .kick = PTHREAD_COND_INITIALIZER, };
+
+static pthread_mutex_t u2_telem_ctl = PTHREAD_MUTEX_INITIALIZER;    // start/stop.
+
+static inline uint64_t
+u2_telem_le(const uint8_t *page, uint32_t off, uint32_t len)
+{
+	uint64_t v = 0;
+
+	while (len--) {
+		v = v << 8 | page[off + len];
+	}
+
+	return v;
+}
+
+static uint64_t
+u2_telem_mono_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * per second over dt_ns, 0 if a counter went backwards (e.g. a reset).
+ */
+static inline int64_t
+u2_telem_rate(uint64_t now, uint64_t then, uint64_t scale, uint64_t dt_ns)
+{
+	return now < then ? 0 : (int64_t)((double)(now - then) * scale * 1e9 / dt_ns);
+}
+
+static void
+u2_telem_update(struct u2_telem_ctrlr *c, const uint8_t *page, uint64_t mono_ns, int64_t time_ms)
+{
+	int64_t *s = c->stats;
+	uint64_t units_read, units_written, reads, writes, media, dt;
+	int64_t temp, slope;
+
+	units_read    = u2_telem_le(page, U2_HEALTH_UNITS_READ, 8);
+	units_written = u2_telem_le(page, U2_HEALTH_UNITS_WRITTEN, 8);
+	reads         = u2_telem_le(page, U2_HEALTH_READS, 8);
+	writes        = u2_telem_le(page, U2_HEALTH_WRITES, 8);
+	media         = u2_telem_le(page, U2_HEALTH_MEDIA_ERRORS, 8);
+	temp          = (int64_t)u2_telem_le(page, U2_HEALTH_TEMPERATURE, 2) - 273;
+
+	if (c->sampled && mono_ns > c->mono_ns) {
+		dt = mono_ns - c->mono_ns;
+		s[U2_TELEM_STAT_READ_BPS]   = u2_telem_rate(units_read, c->units_read, U2_TELEM_UNIT, dt);
+		s[U2_TELEM_STAT_WRITE_BPS]  = u2_telem_rate(units_written, c->units_written, U2_TELEM_UNIT, dt);
+		s[U2_TELEM_STAT_READ_IOPS]  = u2_telem_rate(reads, c->reads, 1, dt);
+		s[U2_TELEM_STAT_WRITE_IOPS] = u2_telem_rate(writes, c->writes, 1, dt);
+		s[U2_TELEM_STAT_MEDIA_ERRORS_NEW] = (uint64_t)s[U2_TELEM_STAT_MEDIA_ERRORS] < media ?
+		                                    (int64_t)(media - s[U2_TELEM_STAT_MEDIA_ERRORS]) : 0;
+
+		slope = (temp - s[U2_TELEM_STAT_TEMPERATURE]) * 60000000000000LL / (int64_t)dt;    // m°C per minute.
+		s[U2_TELEM_STAT_TEMP_TREND] += (slope - s[U2_TELEM_STAT_TEMP_TREND]) / (1 << U2_TELEM_TREND_SHIFT);
+	}
+
+	s[U2_TELEM_STAT_TIME_MS]          = time_ms;
+	s[U2_TELEM_STAT_TEMPERATURE]      = temp;
+	s[U2_TELEM_STAT_CRITICAL_WARNING] = page[U2_HEALTH_CRITICAL];
+	s[U2_TELEM_STAT_AVAILABLE_SPARE]  = page[U2_HEALTH_SPARE];
+	s[U2_TELEM_STAT_PERCENTAGE_USED]  = page[U2_HEALTH_USED];
+	s[U2_TELEM_STAT_DATA_READ]        = units_read * U2_TELEM_UNIT;
+	s[U2_TELEM_STAT_DATA_WRITTEN]     = units_written * U2_TELEM_UNIT;
+	s[U2_TELEM_STAT_MEDIA_ERRORS]     = media;
+	s[U2_TELEM_STAT_UNSAFE_SHUTDOWNS] = u2_telem_le(page, U2_HEALTH_UNSAFE, 8);
+	s[U2_TELEM_STAT_POWER_ON_HOURS]   = u2_telem_le(page, U2_HEALTH_POWER_ON, 8);
+	s[U2_TELEM_STAT_SAMPLES]++;
+
+	c->units_read = units_read;
+	c->units_written = units_written;
+	c->reads = reads;
+	c->writes = writes;
+	c->mono_ns = mono_ns;
+	c->sampled = 1;
+}
+
+static int
+u2_telem_format(uint32_t ctrlr, const int64_t *s, char *buf, size_t cap)
+{
+	return snprintf(buf, cap,
+	                "{\"time_ms\":%"PRId64",\"controller\":%"PRIu32",\"temperature_c\":%"PRId64
+	                ",\"temperature_trend_mc_per_min\":%"PRId64",\"critical_warning\":%"PRId64
+	                ",\"available_spare\":%"PRId64",\"percentage_used\":%"PRId64
+	                ",\"read_bytes_per_sec\":%"PRId64",\"write_bytes_per_sec\":%"PRId64
+	                ",\"read_cmds_per_sec\":%"PRId64",\"write_cmds_per_sec\":%"PRId64
+	                ",\"data_read_bytes\":%"PRId64",\"data_written_bytes\":%"PRId64
+	                ",\"media_errors\":%"PRId64",\"media_errors_new\":%"PRId64
+	                ",\"unsafe_shutdowns\":%"PRId64",\"power_on_hours\":%"PRId64
+	                ",\"samples\":%"PRId64",\"failures\":%"PRId64"}",
+	                s[U2_TELEM_STAT_TIME_MS], ctrlr, s[U2_TELEM_STAT_TEMPERATURE],
+	                s[U2_TELEM_STAT_TEMP_TREND], s[U2_TELEM_STAT_CRITICAL_WARNING],
+	                s[U2_TELEM_STAT_AVAILABLE_SPARE], s[U2_TELEM_STAT_PERCENTAGE_USED],
+	                s[U2_TELEM_STAT_READ_BPS], s[U2_TELEM_STAT_WRITE_BPS],
+	                s[U2_TELEM_STAT_READ_IOPS], s[U2_TELEM_STAT_WRITE_IOPS],
+	                s[U2_TELEM_STAT_DATA_READ], s[U2_TELEM_STAT_DATA_WRITTEN],
+	                s[U2_TELEM_STAT_MEDIA_ERRORS], s[U2_TELEM_STAT_MEDIA_ERRORS_NEW],
+	                s[U2_TELEM_STAT_UNSAFE_SHUTDOWNS], s[U2_TELEM_STAT_POWER_ON_HOURS],
+	                s[U2_TELEM_STAT_SAMPLES], s[U2_TELEM_STAT_FAILURES]);
+}
+
+/*
+ * one round over the controllers. the admin command is issued without the
+ * lock, so readers of the latest sample never wait on the device. returns 0
+ * if any controller answered, the last error otherwise.
+ */
+static int
+u2_telem_sample(void)
+{
+	struct u2_telem_ctrlr *c;
+	struct timespec ts;
+	char line[U2_TELEM_JSON_MAX];
+	uint64_t mono_ns;
+	uint32_t i;
+	int rc, last = -ENODEV;
+
+	for (i = 0; i < u2_telem.nctrlr; i++) {
+		c = &u2_telem.ctrlrs[i];
+		if (c->dev == UINT32_MAX) {    // no active namespace.
+			continue;
+		}
+
+		memset(u2_telem.page, 0, U2_HEALTH_PAGE);
+		rc = u2_telem.be->health(c->dev, u2_telem.page);
+		mono_ns = u2_telem_mono_ns();
+		clock_gettime(CLOCK_REALTIME, &ts);
+
+		pthread_mutex_lock(&u2_telem.lock);
+		if (rc) {
+			c->stats[U2_TELEM_STAT_FAILURES]++;
+			pthread_mutex_unlock(&u2_telem.lock);
+			last = last ? (rc < 0 ? rc : -EIO) : 0;
+			continue;
+		}
+		last = 0;
+		u2_telem_update(c, u2_telem.page, mono_ns, (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+		u2_telem_format(i, c->stats, line, sizeof(line));
+		pthread_mutex_unlock(&u2_telem.lock);
+
+		if (u2_telem.out) {
+			fprintf(u2_telem.out, "%s\n", line);
+			fflush(u2_telem.out);
+		}
+	}
+
+	return last;
+}
+
+static void *
+u2_telem_thread(void *arg)
+{
+	struct timespec ts;
+
+	pthread_mutex_lock(&u2_telem.lock);
+	while (!u2_telem.stop) {
+		pthread_mutex_unlock(&u2_telem.lock);
+		u2_telem_sample();
+		pthread_mutex_lock(&u2_telem.lock);
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += u2_telem.interval_ms / 1000;
+		ts.tv_nsec += (long)(u2_telem.interval_ms % 1000) * 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		while (!u2_telem.stop && pthread_cond_timedwait(&u2_telem.kick, &u2_telem.lock, &ts) != ETIMEDOUT) {
+			;
+		}
+	}
+	pthread_mutex_unlock(&u2_telem.lock);
+
+	return NULL;
+}
+
+/*
+ * samples every controller behind be's ndev devices each interval_ms, and
+ * appends the samples to path unless it is NULL. -EBUSY if already running.
+ */
+int
+u2_telemetry_start(const struct u2_backend *be, uint32_t ndev, uint32_t interval_ms, const char *path)
+{
+	uint32_t i, j, ctrlr, nsid;
+	int rc = 0;
+
+	if (!interval_ms) {
+		return -EINVAL;
+	}
+	if (be->health == NULL) {
+		return -ENOTSUP;
+	}
+
+	pthread_mutex_lock(&u2_telem_ctl);
+	if (u2_telem.running) {
+		rc = -EBUSY;
+		goto out;
+	}
+
+	pthread_mutex_lock(&u2_telem.lock);
+	memset(u2_telem.ctrlrs, 0, sizeof(u2_telem.ctrlrs));
+	u2_telem.nctrlr = 0;
+	for (i = 0; i < ndev; i++) {
+		be->ident(i, &ctrlr, &nsid);
+		if (ctrlr >= U2_DEV_MAX) {
+			continue;
+		}
+		for (j = u2_telem.nctrlr; j <= ctrlr; j++) {
+			u2_telem.ctrlrs[j].dev = UINT32_MAX;
+		}
+		if (u2_telem.ctrlrs[ctrlr].dev == UINT32_MAX) {
+			u2_telem.ctrlrs[ctrlr].dev = i;
+		}
+		if (u2_telem.nctrlr <= ctrlr) {
+			u2_telem.nctrlr = ctrlr + 1;
+		}
+	}
+	pthread_mutex_unlock(&u2_telem.lock);
+
+	u2_telem.page = be->dma_alloc(U2_HEALTH_PAGE, 4096, -1);
+	if (u2_telem.page == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	u2_telem.out = NULL;
+	if (path != NULL && (u2_telem.out = fopen(path, "a")) == NULL) {
+		rc = -errno;
+		be->dma_free(u2_telem.page);
+		goto out;
+	}
+
+	u2_telem.be = be;
+	u2_telem.interval_ms = interval_ms;
+
+	rc = u2_telem_sample();    // right away: health logs no controller gives out are an error now.
+	if (rc) {
+		goto fail;
+	}
+
+	u2_telem.stop = 0;
+	if (pthread_create(&u2_telem.thread, NULL, u2_telem_thread, NULL)) {
+		rc = -EAGAIN;
+		goto fail;
+	}
+	u2_telem.running = 1;
+
+	goto out;
+
+fail:
+	if (u2_telem.out) {
+		fclose(u2_telem.out);
+		u2_telem.out = NULL;
+	}
+	be->dma_free(u2_telem.page);
+	u2_telem.page = NULL;
+out:
+	pthread_mutex_unlock(&u2_telem_ctl);
+	return rc;
+}
+
+void
+u2_telemetry_stop(void)
+{
+	pthread_mutex_lock(&u2_telem_ctl);
+	if (!u2_telem.running) {
+		pthread_mutex_unlock(&u2_telem_ctl);
+		return;
+	}
+
+	pthread_mutex_lock(&u2_telem.lock);
+	u2_telem.stop = 1;
+	pthread_cond_signal(&u2_telem.kick);
+	pthread_mutex_unlock(&u2_telem.lock);
+	pthread_join(u2_telem.thread, NULL);
+
+	if (u2_telem.out) {
+		fclose(u2_telem.out);
+		u2_telem.out = NULL;
+	}
+	u2_telem.be->dma_free(u2_telem.page);
+	u2_telem.page = NULL;
+	u2_telem.running = 0;
+	pthread_mutex_unlock(&u2_telem_ctl);
+}
+
+/*
+ * the latest sample of controller ctrlr; -ENOENT if there is none (yet).
+ */
+int
+u2_telemetry_stats(uint32_t ctrlr, int64_t *stats)
+{
+	int rc = -ENOENT;
+
+	pthread_mutex_lock(&u2_telem.lock);
+	if (ctrlr < u2_telem.nctrlr && u2_telem.ctrlrs[ctrlr].sampled) {
+		memcpy(stats, u2_telem.ctrlrs[ctrlr].stats, sizeof(u2_telem.ctrlrs[ctrlr].stats));
+		rc = 0;
+	}
+	pthread_mutex_unlock(&u2_telem.lock);
+
+	return rc;
+}
+
+/*
+ * ... and as a line of JSON (no newline), the same as in the file.
+ */
+int
+u2_telemetry_json(uint32_t ctrlr, char *buf, size_t cap)
+{
+	int rc = -ENOENT;
+
+	pthread_mutex_lock(&u2_telem.lock);
+	if (ctrlr < u2_telem.nctrlr && u2_telem.ctrlrs[ctrlr].sampled) {
+		rc = u2_telem_format(ctrlr, u2_telem.ctrlrs[ctrlr].stats, buf, cap);
+	}
+	pthread_mutex_unlock(&u2_telem.lock);
+
+	return rc;
+}
@@ -0,0 +1,598 @@
+/*
+ * libjninvme: io_uring backend, O_DIRECT on kernel block devices or files.
+ *
+ * talks to the kernel through <linux/io_uring.h> directly, so there is no
+ * build or run-time dependency on liburing.
+ *
+ * Author(s)
+ *   azq    @qzan9    anzhongqi@ncic.ac.cn
+ */
+
+#if defined(__GNUC__) && !defined(_GNU_SOURCE)
+#	define _GNU_SOURCE
+#endif /* __GNUC__ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <linux/fs.h>
+#include <linux/mempolicy.h>
+#include <linux/io_uring.h>
+#include <linux/nvme_ioctl.h>
+
+#include "jninvme.h"
+
+#define U2_URING_BUFS           (64)    // max. registered pool slabs per ring.
+#define U2_URING_SQ_IDLE        (1000)  // ms before the SQPOLL thread sleeps.
+#define U2_URING_HUGE_ALIGN     (2 << 20)
+#define U2_URING_FILE_SECTOR    (512)
+#define U2_URING_IOPRIO_BE      (2 << 13)    // ioprio classes: best effort (level 0, the highest) ...
+#define U2_URING_IOPRIO_IDLE    (3 << 13)    // ... and idle, neither of which needs privileges.
+#define U2_URING_LOG_PAGE       (0x02)  // admin opcode Get Log Page ...
+#define U2_URING_LOG_HEALTH     (0x02)  // ... and the SMART/health log identifier.
+
+/*
+ * one ring per queue. SQ slots are mapped 1:1 to SQEs once at setup, so
+ * staging a command is just filling in the SQE and bumping the tail; the
+ * kernel sees it on the next process() (or right away with SQPOLL).
+ */
+struct u2_ring {
+	int fd;
+	int fd_dev;          // the device this queue talks to ...
+	uint32_t sector;     // ... and its sector size.
+	uint16_t ioprio;     // of reads and writes, for the kernel's I/O scheduler.
+
+	uint32_t *sq_head, *sq_tail, *sq_mask, *sq_flags;
+	uint32_t *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	uint32_t sq_entries;
+
+	void *sq_ptr, *cq_ptr;
+	size_t sq_len, cq_len, sqes_len;
+
+	uint32_t fixed_file;
+	struct iovec bufs[U2_URING_BUFS];    // registered buffers, buf_index = position.
+	int nbufs;
+};
+
+static int u2_uring_devs[U2_DEV_MAX];
+static uint32_t u2_uring_sectors[U2_DEV_MAX];
+static uint64_t u2_uring_sizes[U2_DEV_MAX];
+static int u2_uring_nodes[U2_DEV_MAX];
+static uint32_t u2_uring_ndev;
+static uint32_t u2_uring_flags;
+static uint32_t u2_uring_depth;
+
+static inline int
+io_uring_setup(uint32_t entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int
+io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static inline int
+io_uring_register(int fd, uint32_t opcode, const void *arg, uint32_t nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static int
+u2_uring_open(const char *path, uint32_t dev)
+{
+	char sysfs[64];
+	struct stat st;
+	uint64_t bytes;
+	int fd, ssz;
+
+	fd = open(path, O_RDWR | O_DIRECT);
+	if (fd < 0) {
+		fprintf(stderr, "failed to open %s: %s!\n", path, strerror(errno));
+		return 1;
+	}
+
+	if (fstat(fd, &st)) {
+		goto fail;
+	}
+
+	if (S_ISBLK(st.st_mode)) {
+		if (ioctl(fd, BLKGETSIZE64, &bytes) || ioctl(fd, BLKSSZGET, &ssz)) {
+			goto fail;
+		}
+		u2_uring_sectors[dev] = ssz;
+	} else {
+		bytes = st.st_size;
+		u2_uring_sectors[dev] = U2_URING_FILE_SECTOR;
+	}
+
+	bytes -= bytes % u2_uring_sectors[dev];
+	if (bytes == 0) {
+		fprintf(stderr, "%s is empty!\n", path);
+		goto fail;
+	}
+
+	u2_uring_devs[dev] = fd;
+	u2_uring_sizes[dev] = bytes;
+
+	// a file is as close as the device its file system is on.
+	snprintf(sysfs, sizeof(sysfs), "/sys/dev/block/%u:%u", major(S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev),
+	                                                       minor(S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev));
+	u2_uring_nodes[dev] = u2_numa_node(sysfs);
+
+	printf("opened %s for O_DIRECT I/O%s!\n", path, u2_uring_flags & U2_URING_SQPOLL ? " (SQPOLL)" : "");
+
+	return 0;
+
+fail:
+	close(fd);
+	return 1;
+}
+
+static void
+u2_uring_fini(void)
+{
+	while (u2_uring_ndev) {
+		close(u2_uring_devs[--u2_uring_ndev]);
+	}
+}
+
+/*
+ * path is one device or file, or a comma-separated list of them.
+ */
+static int
+u2_uring_init(const struct u2_backend_opts *opts, uint32_t *ndev)
+{
+	char *paths, *path, *save;
+
+	if (opts->path == NULL) {
+		fprintf(stderr, "no device or file given for uring backend!\n");
+		return 1;
+	}
+
+	paths = strdup(opts->path);
+	if (paths == NULL) {
+		return 1;
+	}
+
+	u2_uring_flags = opts->flags;
+	u2_uring_depth = opts->io_depth;
+	u2_uring_ndev = 0;
+
+	for (path = strtok_r(paths, ",", &save); path; path = strtok_r(NULL, ",", &save)) {
+		if (u2_uring_ndev == U2_DEV_MAX) {
+			fprintf(stderr, "too many devices, max. %d!\n", U2_DEV_MAX);
+			goto fail;
+		}
+		if (u2_uring_open(path, u2_uring_ndev)) {
+			goto fail;
+		}
+		u2_uring_ndev++;
+	}
+	free(paths);
+
+	if (!u2_uring_ndev) {
+		fprintf(stderr, "no device or file given for uring backend!\n");
+		return 1;
+	}
+
+	*ndev = u2_uring_ndev;
+
+	return 0;
+
+fail:
+	free(paths);
+	u2_uring_fini();
+	return 1;
+}
+
+static void
+u2_uring_geometry(uint32_t dev, uint32_t *sector, uint64_t *size)
+{
+	*sector = u2_uring_sectors[dev];
+	*size = u2_uring_sizes[dev];
+}
+
+static void
+u2_uring_ident(uint32_t dev, uint32_t *ctrlr, uint32_t *nsid)
+{
+	*ctrlr = dev;
+	*nsid = 1;
+}
+
+static void
+u2_uring_unmap(struct u2_ring *ring)
+{
+	if (ring->sqes && ring->sqes != MAP_FAILED) {
+		munmap(ring->sqes, ring->sqes_len);
+	}
+	if (ring->cq_ptr && ring->cq_ptr != MAP_FAILED && ring->cq_ptr != ring->sq_ptr) {
+		munmap(ring->cq_ptr, ring->cq_len);
+	}
+	if (ring->sq_ptr && ring->sq_ptr != MAP_FAILED) {
+		munmap(ring->sq_ptr, ring->sq_len);
+	}
+}
+
+/*
+ * registered file and buffers are best-effort: without them the ring falls
+ * back to the plain fd and to non-fixed reads/writes. only pool slabs that
+ * exist when the ring is created get registered.
+ */
+static void
+u2_uring_register(struct u2_ring *ring)
+{
+	int n;
+
+	if (!io_uring_register(ring->fd, IORING_REGISTER_FILES, &ring->fd_dev, 1)) {
+		ring->fixed_file = 1;
+	}
+
+	n = u2_pool_regions(ring->bufs, U2_URING_BUFS);
+	if (n > 0 && !io_uring_register(ring->fd, IORING_REGISTER_BUFFERS, ring->bufs, n)) {
+		ring->nbufs = n;
+	}
+}
+
+/*
+ * the kernel hides the device's queues, so prio becomes the commands' ioprio:
+ * only schedulers such as BFQ or mq-deadline act on it.
+ */
+static void *
+u2_uring_qpair_alloc(uint32_t dev, uint32_t prio)
+{
+	struct io_uring_params p;
+	struct u2_ring *ring;
+	uint32_t i, *sq_array;
+
+	ring = calloc(1, sizeof(*ring));
+	if (ring == NULL) {
+		return NULL;
+	}
+
+	memset(&p, 0, sizeof(p));
+	if (u2_uring_flags & U2_URING_SQPOLL) {
+		p.flags |= IORING_SETUP_SQPOLL;
+		p.sq_thread_idle = U2_URING_SQ_IDLE;
+	}
+
+	ring->fd = io_uring_setup(u2_uring_depth, &p);
+	if (ring->fd < 0) {
+		fprintf(stderr, "failed to set up io_uring: %s!\n", strerror(errno));
+		free(ring);
+		return NULL;
+	}
+	ring->fd_dev = u2_uring_devs[dev];
+	ring->sector = u2_uring_sectors[dev];
+	ring->ioprio = prio == U2_PRIO_HIGH ? U2_URING_IOPRIO_BE : prio == U2_PRIO_LOW ? U2_URING_IOPRIO_IDLE : 0;
+
+	ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_len > ring->sq_len) {
+			ring->sq_len = ring->cq_len;
+		}
+		ring->cq_len = ring->sq_len;
+	}
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED) {
+		goto fail;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ptr = ring->sq_ptr;
+	} else {
+		ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED) {
+			goto fail;
+		}
+	}
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		goto fail;
+	}
+
+	ring->sq_head  = (uint32_t *)((uint8_t *)ring->sq_ptr + p.sq_off.head);
+	ring->sq_tail  = (uint32_t *)((uint8_t *)ring->sq_ptr + p.sq_off.tail);
+	ring->sq_mask  = (uint32_t *)((uint8_t *)ring->sq_ptr + p.sq_off.ring_mask);
+	ring->sq_flags = (uint32_t *)((uint8_t *)ring->sq_ptr + p.sq_off.flags);
+	ring->cq_head  = (uint32_t *)((uint8_t *)ring->cq_ptr + p.cq_off.head);
+	ring->cq_tail  = (uint32_t *)((uint8_t *)ring->cq_ptr + p.cq_off.tail);
+	ring->cq_mask  = (uint32_t *)((uint8_t *)ring->cq_ptr + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)((uint8_t *)ring->cq_ptr + p.cq_off.cqes);
+	ring->sq_entries = p.sq_entries;
+
+	sq_array = (uint32_t *)((uint8_t *)ring->sq_ptr + p.sq_off.array);
+	for (i = 0; i < p.sq_entries; i++) {
+		sq_array[i] = i;
+	}
+
+	u2_uring_register(ring);
+
+	return ring;
+
+fail:
+	fprintf(stderr, "failed to map io_uring: %s!\n", strerror(errno));
+	u2_uring_unmap(ring);
+	close(ring->fd);
+	free(ring);
+	return NULL;
+}
+
+static void
+u2_uring_qpair_free(void *qpair)
+{
+	struct u2_ring *ring = qpair;
+
+	u2_uring_unmap(ring);
+	close(ring->fd);    // drops the registered file and buffers as well.
+	free(ring);
+}
+
+static inline void
+u2_uring_kick(struct u2_ring *ring)
+{
+	uint32_t pending;
+
+	if (u2_uring_flags & U2_URING_SQPOLL) {
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);    // tail store vs. flags load, pairs with the poller.
+		if (__atomic_load_n(ring->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP) {
+			io_uring_enter(ring->fd, 0, 0, IORING_ENTER_SQ_WAKEUP);
+		} else if (*ring->sq_tail != __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE)) {
+			sched_yield();    // let the poller run if it shares our CPU.
+		}
+		return;
+	}
+
+	pending = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	if (pending) {
+		io_uring_enter(ring->fd, pending, 0, 0);    // EAGAIN/EBUSY: left staged for the next round.
+	}
+}
+
+/*
+ * a free SQE. once the SQ is full, staged commands are pushed to the kernel
+ * (or, with SQPOLL, we wait for the poller) to make room.
+ */
+static struct io_uring_sqe *
+u2_uring_sqe(struct u2_ring *ring)
+{
+	struct io_uring_sqe *sqe;
+	uint32_t tail = *ring->sq_tail;
+
+	while (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+		u2_uring_kick(ring);
+		sched_yield();
+	}
+
+	sqe = &ring->sqes[tail & *ring->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+
+	return sqe;
+}
+
+static inline void
+u2_uring_stage(struct u2_ring *ring, struct io_uring_sqe *sqe, struct u2_request *req, uint64_t lba)
+{
+	if (ring->fixed_file) {
+		sqe->fd = 0;
+		sqe->flags |= IOSQE_FIXED_FILE;
+	} else {
+		sqe->fd = ring->fd_dev;
+	}
+	sqe->off = lba * ring->sector;
+	sqe->user_data = (uint64_t)(uintptr_t)req;
+
+	__atomic_store_n(ring->sq_tail, *ring->sq_tail + 1, __ATOMIC_RELEASE);
+	if (u2_uring_flags & U2_URING_SQPOLL) {
+		u2_uring_kick(ring);
+	}
+}
+
+static int
+u2_uring_submit(void *qpair, struct u2_request *req, int is_write, void *buf, uint64_t lba, uint32_t nlb)
+{
+	struct u2_ring *ring = qpair;
+	struct io_uring_sqe *sqe;
+	uint64_t len = (uint64_t)nlb * ring->sector;
+	int i;
+
+	sqe = u2_uring_sqe(ring);
+	sqe->opcode = is_write ? IORING_OP_WRITE : IORING_OP_READ;
+	for (i = 0; i < ring->nbufs; i++) {
+		if ((uint8_t *)buf >= (uint8_t *)ring->bufs[i].iov_base &&
+		    (uint8_t *)buf + len <= (uint8_t *)ring->bufs[i].iov_base + ring->bufs[i].iov_len) {
+			sqe->opcode = is_write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+			sqe->buf_index = i;
+			break;
+		}
+	}
+	sqe->addr = (uint64_t)(uintptr_t)buf;
+	sqe->len = len;
+	sqe->ioprio = ring->ioprio;
+
+	u2_uring_stage(ring, sqe, req, lba);
+
+	return 0;
+}
+
+/*
+ * the iovec array has to stay put until the command completes: the kernel
+ * may only read it when the request actually gets issued.
+ */
+static int
+u2_uring_submitv(void *qpair, struct u2_request *req, int is_write, uint64_t lba, uint32_t nlb)
+{
+	struct u2_ring *ring = qpair;
+	struct io_uring_sqe *sqe;
+
+	sqe = u2_uring_sqe(ring);
+	sqe->opcode = is_write ? IORING_OP_WRITEV : IORING_OP_READV;
+	sqe->addr = (uint64_t)(uintptr_t)req->sgl->sge;
+	sqe->len = req->sgl->count;
+	sqe->ioprio = ring->ioprio;
+
+	u2_uring_stage(ring, sqe, req, lba);
+
+	return 0;
+}
+
+/*
+ * no ioprio: older kernels reject it on fsync.
+ */
+static int
+u2_uring_flush(void *qpair, struct u2_request *req)
+{
+	struct u2_ring *ring = qpair;
+	struct io_uring_sqe *sqe;
+
+	sqe = u2_uring_sqe(ring);
+	sqe->opcode = IORING_OP_FSYNC;
+	sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+
+	u2_uring_stage(ring, sqe, req, 0);
+
+	return 0;
+}
+
+static int
+u2_uring_process(void *qpair)
+{
+	struct u2_ring *ring = qpair;
+	struct io_uring_cqe *cqe;
+	struct u2_request *req;
+	uint32_t head, tail;
+	int n = 0;
+
+	u2_uring_kick(ring);
+
+	if (__atomic_load_n(ring->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW) {
+		io_uring_enter(ring->fd, 0, 0, IORING_ENTER_GETEVENTS);    // flush the kernel's overflow list.
+	}
+
+	head = *ring->cq_head;
+	tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++, n++) {
+		cqe = &ring->cqes[head & *ring->cq_mask];
+		req = (struct u2_request *)(uintptr_t)cqe->user_data;
+
+		u2_request_complete(req, cqe->res < 0 ? cqe->res : ((uint64_t)cqe->res != req->bytes ? -EIO : 0));
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+static int
+u2_uring_node(uint32_t dev)
+{
+	return u2_uring_nodes[dev];
+}
+
+static int
+u2_uring_weighted(uint32_t dev)
+{
+	return 0;
+}
+
+/*
+ * an admin passthrough on the block device, which the kernel puts on the
+ * controller's admin queue next to our rings; files have no health log.
+ */
+static int
+u2_uring_health(uint32_t dev, void *page)
+{
+	struct nvme_admin_cmd cmd;
+	int rc;
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.opcode = U2_URING_LOG_PAGE;
+	cmd.nsid = 0xffffffff;
+	cmd.addr = (uintptr_t)page;
+	cmd.data_len = U2_HEALTH_PAGE;
+	cmd.cdw10 = (U2_HEALTH_PAGE / 4 - 1) << 16 | U2_URING_LOG_HEALTH;
+
+	rc = ioctl(u2_uring_devs[dev], NVME_IOCTL_ADMIN_CMD, &cmd);
+	if (rc < 0) {
+		return errno == ENOTTY ? -ENOTSUP : -errno;
+	}
+
+	return rc;    // 0 or the NVMe status.
+}
+
+/*
+ * page-aligned anonymous memory; big chunks are 2MB-aligned and advised to
+ * use transparent hugepages. on a node, the pages are preferably taken (or
+ * moved, if the allocator had them already) from there.
+ */
+static void *
+u2_uring_dma_alloc(uint64_t size, uint64_t align, int node)
+{
+	unsigned long mask;
+	long page = sysconf(_SC_PAGESIZE);
+	void *buf;
+
+	if (size >= U2_URING_HUGE_ALIGN && align < U2_URING_HUGE_ALIGN) {
+		align = U2_URING_HUGE_ALIGN;
+	}
+	if (node >= 0 && align < (uint64_t)page) {
+		align = page;
+	}
+
+	if (posix_memalign(&buf, align < sizeof(void *) ? sizeof(void *) : align, size)) {
+		return NULL;
+	}
+
+	if (size >= U2_URING_HUGE_ALIGN) {
+		madvise(buf, size, MADV_HUGEPAGE);
+	}
+	if (node >= 0) {    // best effort: without NUMA support, the buffer is just somewhere.
+		mask = 1UL << node;
+		syscall(__NR_mbind, buf, (size + page - 1) & ~(page - 1), MPOL_PREFERRED, &mask, sizeof(mask) * 8, MPOL_MF_MOVE);
+	}
+
+	return buf;
+}
+
+static void
+u2_uring_dma_free(void *buf)
+{
+	free(buf);
+}
+
+const struct u2_backend u2_uring_backend = {
+	.name        = "uring",
+	.buf_align   = U2_URING_FILE_SECTOR,
+	.init        = u2_uring_init,
+	.fini        = u2_uring_fini,
+	.geometry    = u2_uring_geometry,
+	.ident       = u2_uring_ident,
+	.qpair_alloc = u2_uring_qpair_alloc,
+	.qpair_free  = u2_uring_qpair_free,
+	.submit      = u2_uring_submit,
+	.submitv     = u2_uring_submitv,
+	.flush       = u2_uring_flush,
+	.process     = u2_uring_process,
+	.dma_alloc   = u2_uring_dma_alloc,
+	.dma_free    = u2_uring_dma_free,
+	.node        = u2_uring_node,
+	.weighted    = u2_uring_weighted,
+	.health      = u2_uring_health,
+};
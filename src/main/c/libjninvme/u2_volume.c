@@ -0,0 +1,357 @@
+/*
+ * libjninvme: logical volume over the backend's devices.
+ *
+ * with more than one device, the volume is striped RAID-0 style: stripe unit
+ * s of the volume lives on device s % ndev, at unit s / ndev there. a request
+ * gets split into at most one sub-request ("part") per device, each covering
+ * a contiguous range on its device and scattered over the request's memory
+ * through its own sgl, so there is neither a copy nor more than ndev commands.
+ * the parts go out back to back and the request completes with the last one;
+ * parts the backend has no request slots for wait in the qset and go out as
+ * completions free some.
+ *
+ * Author(s)
+ *   azq    @qzan9    anzhongqi@ncic.ac.cn
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#include "jninvme.h"
+
+/*
+ * a volume's queue: one backend qpair per device.
+ */
+struct u2_qset {
+	struct u2_volume *vol;
+	struct u2_request *defer_head;    // parts of split requests still to go out, in order.
+	struct u2_request *defer_tail;
+	void *q[];
+};
+
+int
+u2_volume_init(struct u2_volume *vol, const struct u2_backend *be, const uint32_t *dev, uint32_t ndev, uint64_t stripe)
+{
+	uint32_t i, sector;
+	uint64_t size, min = UINT64_MAX;
+
+	if (ndev < 1 || ndev > U2_DEV_MAX) {
+		return -1;
+	}
+
+	memset(vol, 0, sizeof(*vol));
+	vol->be = be;
+	vol->ndev = ndev;
+	vol->weighted = 1;
+	vol->node = be->node(dev[0]);
+
+	for (i = 0; i < ndev; i++) {
+		vol->dev[i] = dev[i];
+		be->geometry(dev[i], &sector, &size);
+		if (i && sector != vol->sector) {
+			fprintf(stderr, "sector sizes differ across devices (%u vs. %u)!\n", vol->sector, sector);
+			return -1;
+		}
+		vol->sector = sector;
+		vol->weighted &= !!be->weighted(dev[i]);
+		if (be->node(dev[i]) != vol->node) {
+			vol->node = -1;
+		}
+		if (size < min) {
+			min = size;
+		}
+	}
+
+	if (ndev == 1) {
+		vol->stripe = min;
+		vol->size = min;
+		return 0;
+	}
+
+	if (stripe < vol->sector || stripe % vol->sector || stripe > UINT32_MAX) {
+		fprintf(stderr, "invalid stripe size %"PRIu64"!\n", stripe);
+		return -1;
+	}
+
+	vol->stripe = stripe;
+	vol->size = min / stripe * stripe * ndev;    // the smallest device bounds them all.
+	if (vol->size == 0) {
+		fprintf(stderr, "devices smaller than one stripe!\n");
+		return -1;
+	}
+
+	printf("striping %u devices in %"PRIu64"-byte units, %"PRIu64" bytes!\n", ndev, stripe, vol->size);
+
+	return 0;
+}
+
+void *
+u2_volume_qpair_alloc(struct u2_volume *vol, uint32_t prio)
+{
+	struct u2_qset *qs;
+	uint32_t i;
+
+	qs = calloc(1, sizeof(*qs) + vol->ndev * sizeof(qs->q[0]));
+	if (qs == NULL) {
+		return NULL;
+	}
+	qs->vol = vol;
+
+	for (i = 0; i < vol->ndev; i++) {
+		qs->q[i] = vol->be->qpair_alloc(vol->dev[i], prio);
+		if (qs->q[i] == NULL) {
+			u2_volume_qpair_free(qs);
+			return NULL;
+		}
+	}
+
+	return qs;
+}
+
+void
+u2_volume_qpair_free(void *qset)
+{
+	struct u2_qset *qs = qset;
+	uint32_t i;
+
+	for (i = 0; i < qs->vol->ndev && qs->q[i]; i++) {
+		qs->vol->be->qpair_free(qs->q[i]);
+	}
+	free(qs);
+}
+
+/*
+ * appends bytes [offset, offset + len) of req's memory to sgl, merging with
+ * the last element where they touch.
+ */
+static int
+u2_volume_sgl_add(struct u2_sgl *sgl, const struct u2_request *req, uint64_t offset, uint64_t len)
+{
+	const struct u2_sgl *src = req->sgl;
+	struct iovec *last;
+	uint8_t *base;
+	uint64_t n;
+	uint32_t i = 0;
+
+	while (len) {
+		if (src) {
+			for (; i < src->count && offset >= src->sge[i].iov_len; i++) {
+				offset -= src->sge[i].iov_len;
+			}
+			if (i == src->count) {
+				return -EINVAL;
+			}
+			base = (uint8_t *)src->sge[i].iov_base + offset;
+			n = src->sge[i].iov_len - offset < len ? src->sge[i].iov_len - offset : len;
+		} else {
+			base = (uint8_t *)req->buf + offset;
+			n = len;
+		}
+
+		last = sgl->count ? &sgl->sge[sgl->count - 1] : NULL;
+		if (last && (uint8_t *)last->iov_base + last->iov_len == base) {
+			last->iov_len += n;
+		} else if (sgl->count == U2_SGE_MAX) {
+			return -EINVAL;
+		} else {
+			sgl->sge[sgl->count].iov_base = base;
+			sgl->sge[sgl->count].iov_len = n;
+			sgl->count++;
+		}
+
+		offset += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int
+u2_volume_part_submit(struct u2_qset *qs, struct u2_request *part)
+{
+	const struct u2_backend *be = qs->vol->be;
+	void *qpair = qs->q[part->dev];
+
+	if (part->is_flush) {
+		return be->flush(qpair, part);
+	} else if (part->sgl->count == 1) {
+		return be->submit(qpair, part, part->is_write, part->sgl->sge[0].iov_base, part->lba, part->nlb);
+	} else {
+		return be->submitv(qpair, part, part->is_write, part->lba, part->nlb);
+	}
+}
+
+/*
+ * submits the parked parts in order, up to the first the backend still has no
+ * slot for; a part failing otherwise completes with its error.
+ */
+static void
+u2_volume_resubmit(struct u2_qset *qs)
+{
+	struct u2_request *part;
+	int rc;
+
+	while ((part = qs->defer_head) != NULL) {
+		rc = u2_volume_part_submit(qs, part);
+		if (rc == -ENOMEM || rc == ENOMEM) {
+			return;
+		}
+		qs->defer_head = part->next;
+		if (rc) {
+			u2_request_complete(part, rc < 0 ? rc : -EIO);
+		}
+	}
+	qs->defer_tail = NULL;
+}
+
+/*
+ * lays req out over the devices in req->parts[], one per device touched.
+ */
+static int
+u2_volume_split(struct u2_volume *vol, struct u2_request *req)
+{
+	struct u2_request *part;
+	uint64_t pos = req->lba * vol->sector, end = pos + req->bytes;
+	uint64_t unit, in, len, dev_off;
+	uint32_t map[U2_DEV_MAX], dev, nparts = 0;
+	int rc;
+
+	for (dev = 0; dev < vol->ndev; dev++) {
+		map[dev] = U2_DEV_MAX;
+	}
+
+	for (; pos < end; pos += len) {
+		unit = pos / vol->stripe;
+		in = pos % vol->stripe;
+		len = vol->stripe - in < end - pos ? vol->stripe - in : end - pos;
+		dev = unit % vol->ndev;
+
+		if (map[dev] == U2_DEV_MAX) {    // the first unit on a device: where its range starts.
+			map[dev] = nparts;
+			part = &req->parts[nparts++];
+			part->dev = dev;
+			dev_off = unit / vol->ndev * vol->stripe + in;
+			part->lba = dev_off / vol->sector;
+			part->nlb = 0;
+			part->bytes = 0;
+			part->is_write = req->is_write;
+			part->is_flush = 0;
+			part->sgl->count = 0;
+		}
+		part = &req->parts[map[dev]];
+
+		rc = u2_volume_sgl_add(part->sgl, req, pos - req->lba * vol->sector, len);
+		if (rc) {
+			return rc;
+		}
+		part->nlb += len / vol->sector;
+		part->bytes += len;
+	}
+
+	return nparts;
+}
+
+/*
+ * like a backend's submit()/submitv()/flush(), as told by req. a request
+ * within one stripe unit goes to its device as is; others are split. once
+ * the first part is out, the rest are the qset's: those without a backend
+ * slot are parked for u2_volume_process(), and parts failing otherwise
+ * complete with their error right away.
+ */
+int
+u2_volume_submit(void *qset, struct u2_request *req)
+{
+	struct u2_qset *qs = qset;
+	struct u2_volume *vol = qs->vol;
+	const struct u2_backend *be = vol->be;
+	uint32_t i, dev, nparts;
+	uint64_t pos, unit;
+	int rc;
+
+	if (vol->ndev == 1 || (!req->is_flush && (!req->nlb || req->lba * vol->sector / vol->stripe ==
+	                                         ((req->lba + req->nlb) * vol->sector - 1) / vol->stripe))) {
+		dev = 0;
+		pos = req->lba * vol->sector;
+		if (vol->ndev > 1) {
+			unit = pos / vol->stripe;
+			dev = unit % vol->ndev;
+			pos = unit / vol->ndev * vol->stripe + pos % vol->stripe;
+		}
+
+		if (req->is_flush) {
+			return be->flush(qs->q[dev], req);
+		} else if (req->sgl) {
+			return be->submitv(qs->q[dev], req, req->is_write, pos / vol->sector, req->nlb);
+		} else {
+			return be->submit(qs->q[dev], req, req->is_write, req->buf, pos / vol->sector, req->nlb);
+		}
+	}
+
+	if (req->is_flush) {
+		for (i = 0; i < vol->ndev; i++) {
+			req->parts[i].is_flush = 1;
+			req->parts[i].is_write = 0;
+			req->parts[i].bytes = 0;
+			req->parts[i].dev = i;
+		}
+		nparts = vol->ndev;
+	} else {
+		rc = u2_volume_split(vol, req);
+		if (rc < 0) {
+			return rc;    // e.g. more than U2_SGE_MAX stripe units on one device.
+		}
+		nparts = rc;
+	}
+
+	req->pending = nparts;
+	req->part_status = 0;
+
+	for (i = 0; i < nparts; i++) {
+		rc = qs->defer_head ? -ENOMEM : u2_volume_part_submit(qs, &req->parts[i]);
+		if (rc && i == 0) {
+			return rc;    // nothing out yet: the caller may retry.
+		}
+		if (rc == -ENOMEM || rc == ENOMEM) {
+			for (; i < nparts; i++) {    // behind any parked before, so they go out in order.
+				req->parts[i].next = NULL;
+				if (qs->defer_tail) {
+					qs->defer_tail->next = &req->parts[i];
+				} else {
+					qs->defer_head = &req->parts[i];
+				}
+				qs->defer_tail = &req->parts[i];
+			}
+			break;
+		}
+		if (rc) {
+			req->pending -= nparts - i - 1;    // the parts after it never go out.
+			u2_request_complete(&req->parts[i], rc < 0 ? rc : -EIO);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+int
+u2_volume_process(void *qset)
+{
+	struct u2_qset *qs = qset;
+	uint32_t i;
+	int rc, n = 0;
+
+	for (i = 0; i < qs->vol->ndev; i++) {
+		rc = qs->vol->be->process(qs->q[i]);
+		if (rc > 0) {
+			n += rc;
+		}
+	}
+	if (qs->defer_head) {
+		u2_volume_resubmit(qs);
+	}
+
+	return n;
+}
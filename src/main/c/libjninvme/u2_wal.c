@@ -0,0 +1,668 @@
+/*
+ * libjninvme: write-ahead log with group commit in a region of the volume.
+ *
+ * the region is a superblock and then a circular log addressed by LSN, the
+ * byte position in an endless log: LSN l lives at l % capacity. appenders
+ * reserve space in the current group buffer under the lock and fill in their
+ * records outside of it; a writer thread takes the buffer as soon as it is
+ * not empty, ends it with a filler record up to the next sector, writes it
+ * with one command and flushes the device. whatever gets appended meanwhile
+ * goes into the other buffer and forms the next group, so the more appenders
+ * there are, the more records share a write and a flush.
+ *
+ * every record header has its LSN and a CRC-32C over itself and the payload:
+ * recovery follows the chain from the oldest LSN kept to the first record that
+ * does not check out, which takes care of torn groups and of what is left of
+ * earlier laps around the region alike.
+ *
+ * Author(s)
+ *   azq    @qzan9    anzhongqi@ncic.ac.cn
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#include <pthread.h>
+#include <time.h>
+
+#include "jninvme.h"
+
+#define U2_WAL_SUPER            (4096)         // superblock, then the log.
+#define U2_WAL_GROUP            (1 << 20)      // group buffer, i.e. the largest write ...
+#define U2_WAL_WINDOW           (2 * U2_WAL_GROUP)    // ... and what recovery reads at a time.
+#define U2_WAL_IO               (256 << 10)    // max. command.
+
+#define U2_WAL_FILL             (0x80000000)   // len flag: filler up to the end of a group.
+#define U2_WAL_LEN_MASK         (0x7fffffff)
+
+#define U2_WAL_MAGIC            (0x753277616c737570ULL)    // "u2walsup"
+
+struct u2_wal_super {
+	uint64_t magic;
+	uint64_t capacity;
+	uint64_t start;    // oldest LSN kept.
+	uint32_t crc;
+};
+
+struct u2_wal_hdr {
+	uint64_t lsn;
+	uint32_t len;      // payload bytes, and flags.
+	uint32_t crc;      // of lsn, len and the payload.
+};
+
+#define U2_WAL_HDR              (sizeof(struct u2_wal_hdr))
+#define U2_WAL_SIZE(len)        ((U2_WAL_HDR + (len) + 7) & ~7ULL)    // records are 8-byte aligned.
+
+struct u2_wal_group {
+	uint8_t *buf;
+	uint64_t lsn;       // of buf[0], sector-aligned.
+	uint64_t used;      // bytes reserved.
+	uint32_t copying;   // appenders still filling in their records.
+};
+
+struct u2_wal {
+	uint64_t offset;    // of the region on the volume.
+	uint32_t sector;
+	uint64_t capacity;
+
+	uint64_t start;     // as in the superblock.
+	uint64_t durable;   // everything before is durable.
+	uint64_t end;       // of what recovery found ...
+	uint64_t cursor;    // ... and how far replay got.
+	int error;          // of the last group write, sticky.
+
+	struct u2_wal_group groups[2];
+	uint32_t cur;       // appends go there; the other one is idle or being written.
+
+	uint8_t *window;    // recovery and replay reads.
+	uint64_t win_lsn;
+	uint64_t win_len;
+
+	pthread_mutex_t lock;
+	pthread_cond_t kick;    // the writer: something to write, or stop.
+	pthread_cond_t done;    // appenders waiting for a buffer, awaiters.
+	pthread_mutex_t super_lock;
+	pthread_t thread;
+	uint32_t stop;
+
+	int64_t stats[U2_WAL_STATS];
+
+	struct u2_wal *next;
+};
+
+static struct u2_wal *u2_wals;    // open logs, for nvmeFinalize().
+static pthread_mutex_t u2_wals_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline uint64_t
+u2_wal_align(struct u2_wal *wal, uint64_t n)
+{
+	return (n + wal->sector - 1) / wal->sector * wal->sector;
+}
+
+static inline uint32_t
+u2_wal_crc(const struct u2_wal_hdr *hdr, const void *payload)
+{
+	return u2_crc32c(u2_crc32c(0, hdr, offsetof(struct u2_wal_hdr, crc)), payload, hdr->len & U2_WAL_LEN_MASK);
+}
+
+/*
+ * sector-aligned transfers at an LSN, wrapping around the end of the region.
+ */
+static int
+u2_wal_io(struct u2_wal *wal, int is_write, uint8_t *buf, uint64_t lsn, uint64_t size)
+{
+	uint64_t pos, n;
+	int rc;
+
+	for (; size; size -= n, lsn += n, buf += n) {
+		pos = lsn % wal->capacity;
+		n = wal->capacity - pos;
+		if (n > size) {
+			n = size;
+		}
+		if (n > U2_WAL_IO) {
+			n = U2_WAL_IO;
+		}
+		rc = u2_io(is_write, buf, wal->offset + U2_WAL_SUPER + pos, n);
+		if (rc) {
+			return rc > 0 ? -EIO : rc;
+		}
+	}
+
+	return 0;
+}
+
+static int
+u2_wal_super_write(struct u2_wal *wal, uint64_t start)
+{
+	struct u2_wal_super *sb;
+	int rc;
+
+	sb = u2_pool_alloc(U2_WAL_SUPER, 1);
+	if (sb == NULL) {
+		return -ENOMEM;
+	}
+	sb->magic = U2_WAL_MAGIC;
+	sb->capacity = wal->capacity;
+	sb->start = start;
+	sb->crc = u2_crc32c(0, sb, offsetof(struct u2_wal_super, crc));
+
+	rc = u2_io(1, sb, wal->offset, U2_WAL_SUPER);
+	if (!rc) {
+		rc = u2_io_flush();
+	}
+	u2_pool_free(sb, U2_WAL_SUPER);
+
+	return rc > 0 ? -EIO : rc;
+}
+
+/*
+ * ends a group whose records take up buf[0, off): a filler record up to the
+ * next sector (or the one after, if that leaves no room for its header).
+ * returns the group's size.
+ */
+static uint64_t
+u2_wal_fill(struct u2_wal *wal, uint8_t *buf, uint64_t lsn, uint64_t off)
+{
+	struct u2_wal_hdr hdr;
+	uint64_t end = u2_wal_align(wal, off + U2_WAL_HDR);
+
+	memset(buf + off, 0, end - off);
+	hdr.lsn = lsn + off;
+	hdr.len = (end - off - U2_WAL_HDR) | U2_WAL_FILL;
+	hdr.crc = u2_wal_crc(&hdr, buf + off + U2_WAL_HDR);
+	memcpy(buf + off, &hdr, U2_WAL_HDR);
+
+	return end;
+}
+
+/*
+ * the LSN of the record, or -errno: -ENOSPC if the log is full up to the
+ * oldest LSN kept, the error of a failed group write from then on.
+ */
+int64_t
+u2_wal_append(struct u2_wal *wal, const void *data, uint32_t len)
+{
+	struct u2_wal_group *g;
+	struct u2_wal_hdr hdr;
+	uint64_t size = U2_WAL_SIZE(len), off;
+	uint8_t *p;
+
+	if (len > U2_WAL_RECORD_MAX) {
+		return -EINVAL;
+	}
+
+	pthread_mutex_lock(&wal->lock);
+	for (;;) {
+		g = &wal->groups[wal->cur];
+		if (wal->error || wal->stop) {
+			pthread_mutex_unlock(&wal->lock);
+			return wal->error ? wal->error : -ESHUTDOWN;
+		}
+		if (g->lsn + g->used + size + U2_WAL_HDR + wal->sector > wal->start + wal->capacity) {
+			pthread_mutex_unlock(&wal->lock);
+			return -ENOSPC;
+		}
+		if (g->used + size + U2_WAL_HDR + wal->sector <= U2_WAL_GROUP) {    // room for the filler, too.
+			break;
+		}
+		pthread_cond_wait(&wal->done, &wal->lock);    // both buffers full: wait for the write.
+	}
+	off = g->used;
+	g->used += size;
+	g->copying++;
+	if (off == 0) {
+		pthread_cond_signal(&wal->kick);
+	}
+	wal->stats[U2_WAL_STAT_APPENDS]++;
+	wal->stats[U2_WAL_STAT_BYTES] += len;
+	pthread_mutex_unlock(&wal->lock);
+
+	p = g->buf + off;
+	hdr.lsn = g->lsn + off;
+	hdr.len = len;
+	hdr.crc = u2_wal_crc(&hdr, data);
+	memcpy(p, &hdr, U2_WAL_HDR);
+	memcpy(p + U2_WAL_HDR, data, len);
+	memset(p + U2_WAL_HDR + len, 0, size - U2_WAL_HDR - len);
+
+	pthread_mutex_lock(&wal->lock);
+	if (--g->copying == 0) {
+		pthread_cond_signal(&wal->kick);
+	}
+	pthread_mutex_unlock(&wal->lock);
+
+	return hdr.lsn;
+}
+
+static void *
+u2_wal_run(void *arg)
+{
+	struct u2_wal *wal = arg;
+	struct u2_wal_group *g;
+	uint64_t size;
+	int rc;
+
+	pthread_mutex_lock(&wal->lock);
+	for (;;) {
+		g = &wal->groups[wal->cur];
+		while (!g->used && !wal->stop) {
+			pthread_cond_wait(&wal->kick, &wal->lock);
+		}
+		if (!g->used) {
+			break;
+		}
+
+		// seal it: later appends start the next group right after.
+		size = u2_wal_fill(wal, g->buf, g->lsn, g->used);
+		wal->cur ^= 1;
+		wal->groups[wal->cur].lsn = g->lsn + size;
+		wal->groups[wal->cur].used = 0;
+		pthread_cond_broadcast(&wal->done);
+
+		while (g->copying) {
+			pthread_cond_wait(&wal->kick, &wal->lock);
+		}
+		pthread_mutex_unlock(&wal->lock);
+
+		rc = wal->error ? wal->error : u2_wal_io(wal, 1, g->buf, g->lsn, size);
+		if (!rc) {
+			rc = u2_io_flush();
+			rc = rc > 0 ? -EIO : rc;
+		}
+
+		pthread_mutex_lock(&wal->lock);
+		if (rc) {
+			if (!wal->error) {
+				fprintf(stderr, "failed to write log at %"PRIu64"!\n", g->lsn);
+			}
+			wal->error = rc;
+		} else {
+			wal->durable = g->lsn + size;
+			wal->stats[U2_WAL_STAT_GROUPS]++;
+		}
+		g->used = 0;
+		pthread_cond_broadcast(&wal->done);
+	}
+	pthread_mutex_unlock(&wal->lock);
+
+	return NULL;
+}
+
+/*
+ * waits for the record at lsn to be durable, for timeout_ns at most (< 0:
+ * for good). returns the LSN everything before which is durable, or -errno.
+ */
+int64_t
+u2_wal_await(struct u2_wal *wal, int64_t lsn, int64_t timeout_ns)
+{
+	struct timespec ts;
+	int64_t rc;
+
+	if (timeout_ns >= 0) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += timeout_ns / 1000000000;
+		ts.tv_nsec += timeout_ns % 1000000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+	}
+
+	pthread_mutex_lock(&wal->lock);
+	while ((int64_t)wal->durable <= lsn && !wal->error && !wal->stop) {
+		if (timeout_ns < 0) {
+			pthread_cond_wait(&wal->done, &wal->lock);
+		} else if (pthread_cond_timedwait(&wal->done, &wal->lock, &ts) == ETIMEDOUT) {
+			break;
+		}
+	}
+	rc = wal->error ? wal->error : (int64_t)wal->durable;
+	pthread_mutex_unlock(&wal->lock);
+
+	return rc;
+}
+
+/*
+ * drops the records before lsn, which has to be durable and one returned by
+ * append or replay; their space is reused once the superblock says so.
+ */
+int
+u2_wal_truncate(struct u2_wal *wal, uint64_t lsn)
+{
+	int rc;
+
+	pthread_mutex_lock(&wal->super_lock);
+
+	pthread_mutex_lock(&wal->lock);
+	rc = lsn < wal->start || lsn > wal->durable ? -EINVAL : 0;
+	pthread_mutex_unlock(&wal->lock);
+
+	if (!rc && lsn > wal->start) {
+		rc = u2_wal_super_write(wal, lsn);
+		if (!rc) {
+			pthread_mutex_lock(&wal->lock);
+			wal->start = lsn;
+			pthread_mutex_unlock(&wal->lock);
+		}
+	}
+
+	pthread_mutex_unlock(&wal->super_lock);
+
+	return rc;
+}
+
+/*
+ * [lsn, lsn + len) of the log in the window, read in if need be.
+ */
+static const uint8_t *
+u2_wal_fetch(struct u2_wal *wal, uint64_t lsn, uint64_t len, int *rc)
+{
+	*rc = 0;
+	if (lsn < wal->win_lsn || lsn + len > wal->win_lsn + wal->win_len) {
+		wal->win_lsn = lsn / wal->sector * wal->sector;
+		wal->win_len = 0;
+		*rc = u2_wal_io(wal, 0, wal->window, wal->win_lsn, U2_WAL_WINDOW);
+		if (*rc) {
+			return NULL;
+		}
+		wal->win_len = U2_WAL_WINDOW;
+	}
+
+	return wal->window + (lsn - wal->win_lsn);
+}
+
+/*
+ * the size of the well-formed record at lsn, or 0 (or -errno).
+ */
+static int64_t
+u2_wal_check(struct u2_wal *wal, uint64_t lsn, const uint8_t **rec)
+{
+	struct u2_wal_hdr hdr;
+	uint32_t len;
+	int rc;
+
+	*rec = u2_wal_fetch(wal, lsn, U2_WAL_HDR, &rc);
+	if (*rec == NULL) {
+		return rc;
+	}
+	memcpy(&hdr, *rec, U2_WAL_HDR);
+	len = hdr.len & U2_WAL_LEN_MASK;
+	if (hdr.lsn != lsn || len > U2_WAL_RECORD_MAX) {
+		return 0;
+	}
+
+	*rec = u2_wal_fetch(wal, lsn, U2_WAL_HDR + len, &rc);
+	if (*rec == NULL) {
+		return rc;
+	}
+
+	return u2_wal_crc(&hdr, *rec + U2_WAL_HDR) == hdr.crc ? (int64_t)U2_WAL_SIZE(len) : 0;
+}
+
+/*
+ * follows the chain from the oldest LSN kept. a torn group gets a filler
+ * after its last good record, and what follows is zeroed: the torn part of
+ * a group must not turn up again behind the next one.
+ */
+static int
+u2_wal_recover(struct u2_wal *wal)
+{
+	const uint8_t *rec;
+	uint8_t *buf;
+	uint64_t lsn = wal->start, base, size, zero;
+	int64_t n;
+	int rc;
+
+	while ((n = u2_wal_check(wal, lsn, &rec)) > 0) {
+		lsn += n;
+	}
+	if (n < 0) {
+		return n;
+	}
+	wal->end = lsn;
+	wal->cursor = wal->start;
+
+	buf = u2_pool_alloc(U2_WAL_GROUP, 1);
+	if (buf == NULL) {
+		return -ENOMEM;
+	}
+
+	base = lsn / wal->sector * wal->sector;
+	if (lsn != base) {
+		memcpy(buf, u2_wal_fetch(wal, base, lsn - base, &rc), lsn - base);    // within the window: just checked.
+		size = u2_wal_fill(wal, buf, base, lsn - base);
+		rc = u2_wal_io(wal, 1, buf, base, size);
+		if (rc) {
+			goto out;
+		}
+		lsn = base + size;
+		memset(buf, 0, size);
+	}
+
+	zero = wal->start + wal->capacity - lsn;
+	if (zero > U2_WAL_GROUP) {
+		zero = U2_WAL_GROUP;
+	}
+	zero = zero / wal->sector * wal->sector;
+	rc = u2_wal_io(wal, 1, buf, lsn, zero);
+	if (!rc) {
+		rc = u2_io_flush();
+		rc = rc > 0 ? -EIO : rc;
+	}
+	wal->durable = lsn;
+
+out:
+	u2_pool_free(buf, U2_WAL_GROUP);
+
+	return rc;
+}
+
+/*
+ * copies the records recovery found, from where the last call stopped, into
+ * buf as they are on the device (header, payload, padding to 8 bytes), as
+ * many as fit. returns the bytes copied, 0 at the end, -ENOBUFS if the next
+ * record alone does not fit.
+ */
+int64_t
+u2_wal_replay(struct u2_wal *wal, void *buf, uint64_t cap)
+{
+	const uint8_t *rec;
+	struct u2_wal_hdr hdr;
+	uint64_t n = 0;
+	int64_t size;
+
+	pthread_mutex_lock(&wal->super_lock);    // the window is shared with nothing else by now.
+	while (wal->cursor < wal->end) {
+		size = u2_wal_check(wal, wal->cursor, &rec);
+		if (size <= 0) {
+			n = size < 0 ? (uint64_t)size : n;
+			break;
+		}
+		memcpy(&hdr, rec, U2_WAL_HDR);
+		if (!(hdr.len & U2_WAL_FILL)) {
+			if (n + size > cap) {
+				if (n == 0) {
+					n = (uint64_t)-ENOBUFS;
+				}
+				break;
+			}
+			memcpy((uint8_t *)buf + n, rec, size);
+			n += size;
+		}
+		wal->cursor += size;
+	}
+	pthread_mutex_unlock(&wal->super_lock);
+
+	return (int64_t)n;
+}
+
+void
+u2_wal_stats(struct u2_wal *wal, int64_t *stats)
+{
+	pthread_mutex_lock(&wal->lock);
+	memcpy(stats, wal->stats, sizeof(wal->stats));
+	stats[U2_WAL_STAT_START] = wal->start;
+	stats[U2_WAL_STAT_DURABLE] = wal->durable;
+	stats[U2_WAL_STAT_FREE] = wal->start + wal->capacity - (wal->groups[wal->cur].lsn + wal->groups[wal->cur].used);
+	pthread_mutex_unlock(&wal->lock);
+}
+
+/*
+ * opens the log in [offset, offset + size) of the volume, formatting it
+ * first if asked to; NULL if there is none (or it does not fit the region).
+ */
+struct u2_wal *
+u2_wal_open(uint64_t offset, uint64_t size, uint32_t sector, int format)
+{
+	struct u2_wal_super *sb;
+	struct u2_wal *wal;
+	struct timespec ts;
+	int valid, rc;
+
+	if (offset % sector || sector > U2_WAL_SUPER || size < U2_WAL_SUPER + 2 * U2_WAL_WINDOW) {
+		fprintf(stderr, "invalid log region %"PRIu64"+%"PRIu64"!\n", offset, size);
+		return NULL;
+	}
+
+	wal = calloc(1, sizeof(*wal));
+	if (wal == NULL) {
+		return NULL;
+	}
+	wal->offset = offset;
+	wal->sector = sector;
+	wal->capacity = (size - U2_WAL_SUPER) / sector * sector;
+
+	wal->window = u2_pool_alloc(U2_WAL_WINDOW, 0);
+	wal->groups[0].buf = u2_pool_alloc(U2_WAL_GROUP, 0);
+	wal->groups[1].buf = u2_pool_alloc(U2_WAL_GROUP, 0);
+	if (!wal->window || !wal->groups[0].buf || !wal->groups[1].buf) {
+		goto fail;
+	}
+	wal->win_len = 0;
+
+	sb = (struct u2_wal_super *)wal->window;
+	if (u2_io(0, sb, offset, U2_WAL_SUPER)) {
+		goto fail;
+	}
+	valid = sb->magic == U2_WAL_MAGIC && sb->capacity == wal->capacity &&
+	        sb->crc == u2_crc32c(0, sb, offsetof(struct u2_wal_super, crc));
+
+	if (format) {
+		if (valid) {    // past anything an old record could claim to be.
+			wal->start = u2_wal_align(wal, sb->start + 2 * wal->capacity);
+		} else {    // nanoseconds: ahead of any log that wrote less than 1GB/s, and within int64 until 2262.
+			clock_gettime(CLOCK_REALTIME, &ts);
+			wal->start = u2_wal_align(wal, (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+		}
+		if (u2_wal_super_write(wal, wal->start)) {
+			goto fail;
+		}
+	} else if (!valid) {
+		fprintf(stderr, "no log at %"PRIu64"!\n", offset);
+		goto fail;
+	} else {
+		wal->start = sb->start;
+	}
+
+	rc = u2_wal_recover(wal);
+	if (rc) {
+		fprintf(stderr, "failed to recover log (%d)!\n", rc);
+		goto fail;
+	}
+	wal->groups[0].lsn = wal->durable;
+
+	pthread_mutex_init(&wal->lock, NULL);
+	pthread_mutex_init(&wal->super_lock, NULL);
+	pthread_cond_init(&wal->kick, NULL);
+	pthread_cond_init(&wal->done, NULL);
+	if (pthread_create(&wal->thread, NULL, u2_wal_run, wal)) {
+		pthread_cond_destroy(&wal->done);
+		pthread_cond_destroy(&wal->kick);
+		pthread_mutex_destroy(&wal->super_lock);
+		pthread_mutex_destroy(&wal->lock);
+		goto fail;
+	}
+
+	pthread_mutex_lock(&u2_wals_lock);
+	wal->next = u2_wals;
+	u2_wals = wal;
+	pthread_mutex_unlock(&u2_wals_lock);
+
+	return wal;
+
+fail:
+	if (wal->window) {
+		u2_pool_free(wal->window, U2_WAL_WINDOW);
+	}
+	if (wal->groups[0].buf) {
+		u2_pool_free(wal->groups[0].buf, U2_WAL_GROUP);
+	}
+	if (wal->groups[1].buf) {
+		u2_pool_free(wal->groups[1].buf, U2_WAL_GROUP);
+	}
+	free(wal);
+
+	return NULL;
+}
+
+/*
+ * the writer gets out what was appended; appends after that fail, awaits
+ * return right away.
+ */
+static void
+u2_wal_free(struct u2_wal *wal)
+{
+	pthread_mutex_lock(&wal->lock);
+	wal->stop = 1;
+	pthread_cond_signal(&wal->kick);
+	pthread_mutex_unlock(&wal->lock);
+	pthread_join(wal->thread, NULL);
+
+	pthread_cond_destroy(&wal->done);
+	pthread_cond_destroy(&wal->kick);
+	pthread_mutex_destroy(&wal->super_lock);
+	pthread_mutex_destroy(&wal->lock);
+
+	u2_pool_free(wal->window, U2_WAL_WINDOW);
+	u2_pool_free(wal->groups[0].buf, U2_WAL_GROUP);
+	u2_pool_free(wal->groups[1].buf, U2_WAL_GROUP);
+	free(wal);
+}
+
+/*
+ * no calls on the log may be in progress.
+ */
+void
+u2_wal_close(struct u2_wal *wal)
+{
+	struct u2_wal **pp;
+
+	pthread_mutex_lock(&u2_wals_lock);
+	for (pp = &u2_wals; *pp; pp = &(*pp)->next) {
+		if (*pp == wal) {
+			*pp = wal->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&u2_wals_lock);
+
+	u2_wal_free(wal);
+}
+
+void
+u2_wal_close_all(void)
+{
+	struct u2_wal *wal;
+
+	pthread_mutex_lock(&u2_wals_lock);
+	while ((wal = u2_wals) != NULL) {
+		u2_wals = wal->next;
+		u2_wal_free(wal);
+	}
+	pthread_mutex_unlock(&u2_wals_lock);
+}
@@ -1,7 +1,8 @@
 /*
- * nvme_lat/u2_lat: simple latency benchmarking.
+ * nvme_lat/u2_lat: simple latency/throughput benchmarking.
  *
- * NOTE: RESTRICTED to just ONE thread and ONE controller and ONE namespace.
+ * NOTE: RESTRICTED to just ONE controller and ONE namespace; one worker (and
+ *       one qpair) per lcore in the core mask.
  */
 
 #include <stdio.h>
@@ -9,6 +10,8 @@
 #include <string.h>
 #include <inttypes.h>
 #include <stddef.h>
+#include <errno.h>
+#include <math.h>
 
 #include <unistd.h>
 
@@ -16,10 +19,16 @@
 #include <rte_malloc.h>
 #include <rte_mempool.h>
 #include <rte_cycles.h>
+#include <rte_lcore.h>
+#include <rte_launch.h>
 
 #include <spdk/nvme.h>
 
+#include <u2_hist.h>
+
 #define U2_REQUEST_POOL_SIZE    (1024)
+#define U2_REQUEST_POOL_XFER    (128 << 10)    // max. transfer size the pool is sized for: SPDK takes a request
+                                               // per chunk of that, plus the parent, for larger I/Os.
 #define U2_REQUEST_CACHE_SIZE   (0)
 #define U2_REQUEST_PRIVATE_SIZE (0)
 
@@ -43,13 +52,61 @@
 #define U2_BUFFER_ALIGN         (0x200)
 
 #define U2_IO_NUM               (8192)
+#define U2_IO_DEPTH_MAX         (1024)
 
 #define U2_RANDOM               (1)
 #define U2_SEQUENTIAL           (0)
 #define U2_READ                 (1)
 #define U2_WRITE                (0)
+#define U2_MIXED                (2)
+
+#define U2_DIST_UNIFORM         (0)
+#define U2_DIST_ZIPF            (1)
+#define U2_DIST_HOT             (2)
+
+#define U2_ZETA_EXACT           (1000000)    // zeta terms summed exactly, the tail is integrated.
+#define U2_SIZE_CLASSES         (16)
+
+struct u2_worker;
+
+/*
+ * one in-flight command: submit timestamp for the latency histogram.
+ */
+struct u2_task {
+	struct u2_worker *w;
+	uint64_t tsc_submit;
+	uint64_t lba;
+	uint32_t size;
+	uint8_t is_read;
+};
+
+/*
+ * per-lcore benchmarking state. all in-flight commands of a worker share one
+ * buffer: the data is never looked at.
+ */
+struct u2_worker {
+	struct spdk_nvme_qpair *qpair;
+	void *buf;
+
+	struct u2_task *tasks;
+	struct u2_task **free_tasks;
+	uint32_t free_count;
+	struct u2_task *retry;     // found the request pool empty: goes out again as it is.
+
+	struct u2_hist hist[2];    // submit-to-completion, timer cycles; [U2_WRITE], [U2_READ].
+
+	uint32_t index;
+	uint64_t seed;             // xorshift64* state.
+	uint64_t offset_in_ios;    // sequential cursor, starts at the worker's stripe.
 
-//#define U2_TIME_SEC             (4)
+	uint32_t inflight;
+	uint32_t draining;         // past the end of the run: completions are no longer counted.
+	uint64_t submitted;
+	uint64_t completed;
+	uint64_t failed;           // completed with an error, not in completed or the histograms.
+	uint64_t bytes;
+	uint64_t tsc_elapsed;
+} __attribute__((aligned(64)));
 
 static struct spdk_nvme_ctrlr *u2_ctrlr;
 
@@ -58,7 +115,8 @@ static struct spdk_nvme_ns *u2_ns;
 static uint32_t u2_ns_sector;
 static uint64_t u2_ns_size;
 
-static struct spdk_nvme_qpair *u2_qpair;
+static struct u2_worker u2_workers[RTE_MAX_LCORE];    // indexed by lcore id.
+static uint32_t u2_worker_num;
 
 static uint32_t io_size;
 static uint64_t io_num;
@@ -66,21 +124,125 @@ static uint32_t io_depth;
 
 static uint8_t is_random;
 static uint8_t is_rw;
+static uint32_t rw_mix;    // % reads if is_rw is U2_MIXED.
+
+/*
+ * YCSB-style zipfian over [0, n), see Gray et al., "Quickly Generating
+ * Billion-Record Synthetic Databases". precomputed once per run; drawing is
+ * a pow() plus a hash to scatter the hot ranks over the namespace.
+ */
+static struct {
+	uint64_t n;
+	double theta;
+	double alpha;
+	double zetan;
+	double eta;
+	double half_pow_theta;
+} zipf;
+
+static uint8_t dist;
+static double hot_space;    // fraction of the namespace ...
+static double hot_prob;     // ... that gets this fraction of the I/Os.
+
+static struct {
+	uint32_t size;
+	uint32_t weight;        // cumulative.
+} io_sizes[U2_SIZE_CLASSES];
+static uint32_t io_size_count;
+static uint32_t io_size_unit;    // offset granularity.
+static uint64_t size_in_ios;     // offsets, in io_size_unit.
 
 static char *core_mask;
 static uint8_t mem_chn;
-//static uint32_t time_in_sec;
+static uint32_t time_in_sec;
 
 struct rte_mempool *request_mempool;
 static char *ealargs[] = { "nvme_lat", "-c 0x1", "-n 1", };
 
-static unsigned int seed = 0;
+/*
+ * uniform (default), zipf:THETA with 0 < THETA < 1, or hot:SPACE:IO, i.e.
+ * SPACE% of the namespace gets IO% of the I/Os.
+ */
+static int
+parse_distribution(const char *str)
+{
+	double a, b;
+
+	dist = U2_DIST_UNIFORM;
+	if (str == NULL || !strcmp(str, "uniform")) {
+		return 0;
+	}
+
+	if (sscanf(str, "zipf:%lf", &a) == 1) {
+		if (a <= 0 || a >= 1) {
+			return 1;
+		}
+		dist = U2_DIST_ZIPF;
+		zipf.theta = a;
+		return 0;
+	}
+
+	if (sscanf(str, "hot:%lf:%lf", &a, &b) == 2) {
+		if (a <= 0 || a >= 100 || b < 0 || b > 100) {
+			return 1;
+		}
+		dist = U2_DIST_HOT;
+		hot_space = a / 100;
+		hot_prob = b / 100;
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * SIZE:WEIGHT[,SIZE:WEIGHT]..., SIZE in bytes with an optional k/m suffix.
+ */
+static int
+parse_sizes(char *str)
+{
+	char *tok, *save, *end;
+	uint64_t size, weight, total;
+
+	io_size_count = 0;
+	if (str == NULL) {
+		return 0;
+	}
+
+	total = 0;
+	for (tok = strtok_r(str, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		size = strtoull(tok, &end, 0);
+		if (*end == 'k' || *end == 'K') {
+			size <<= 10;
+			end++;
+		} else if (*end == 'm' || *end == 'M') {
+			size <<= 20;
+			end++;
+		}
+		if (*end != ':' || io_size_count == U2_SIZE_CLASSES) {
+			return 1;
+		}
+		weight = strtoull(end + 1, &end, 0);
+		if (*end != '\0' || size < U2_IO_SIZE_MIN || size > U2_IO_SIZE_MAX || size % U2_IO_SIZE_MIN || !weight) {
+			return 1;
+		}
+
+		total += weight;
+		io_sizes[io_size_count].size = size;
+		io_sizes[io_size_count].weight = total;
+		io_size_count++;
+	}
+
+	return io_size_count == 0;
+}
 
 static int
 parse_args(int argc, char **argv)
 {
 	int op;
-	char *workload;
+	char *workload = NULL;
+	char *distribution = NULL;
+	char *sizes = NULL;
 
 	u2_ctrlr = NULL;
 	u2_ns_id = U2_NAMESPACE_ID;
@@ -88,24 +250,36 @@ parse_args(int argc, char **argv)
 
 	io_size = U2_IO_SIZE_MIN;
 
-	while ((op = getopt(argc, argv, "q:w:c:n:")) != -1) {
-	//while ((op = getopt(argc, argv, "w:c:n:t:")) != -1) {
+	while ((op = getopt(argc, argv, "q:d:w:M:D:s:c:n:t:")) != -1) {
 		switch (op) {
 		case 'q':
 			io_num = atoi(optarg);
 			break;
+		case 'd':
+			io_depth = atoi(optarg);
+			break;
 		case 'w':
 			workload = optarg;
 			break;
+		case 'M':
+			is_rw = U2_MIXED;
+			rw_mix = atoi(optarg);
+			break;
+		case 'D':
+			distribution = optarg;
+			break;
+		case 's':
+			sizes = optarg;
+			break;
 		case 'c':
 			core_mask = optarg;
 			break;
 		case 'n':
 			mem_chn = atoi(optarg);
 			break;
-		//case 't':
-		//	time_in_sec = atoi(optarg);
-		//	break;
+		case 't':
+			time_in_sec = atoi(optarg);
+			break;
 		default:
 			return 1;
 		}
@@ -115,25 +289,56 @@ parse_args(int argc, char **argv)
 		io_num = U2_IO_NUM;
 	}
 
-	io_depth = 0;
+	if (!io_depth) {
+		io_depth = 1;
+	}
+	if (io_depth > U2_IO_DEPTH_MAX) {
+		fprintf(stderr, "invalid queue depth %"PRIu32"!\n", io_depth);
+		return 1;
+	}
 
 	is_random = U2_RANDOM;
-	is_rw = U2_READ;
+	if (is_rw != U2_MIXED) {
+		is_rw = U2_READ;
+	}
 	if (workload) {
 		if (!strcmp(workload, "read")) {
 			is_random = U2_SEQUENTIAL;
-			is_rw = U2_READ;
-		//} else if (!strcmp(workload, "randread")) {
-		//	is_random = U2_RANDOM;
-		//	is_rw = U2_READ;
+			is_rw = is_rw == U2_MIXED ? U2_MIXED : U2_READ;
+		} else if (!strcmp(workload, "randread")) {
+			is_random = U2_RANDOM;
+			is_rw = is_rw == U2_MIXED ? U2_MIXED : U2_READ;
 		} else if (!strcmp(workload, "write")) {
 			is_random = U2_SEQUENTIAL;
-			is_rw = U2_WRITE;
+			is_rw = is_rw == U2_MIXED ? U2_MIXED : U2_WRITE;
 		} else if (!strcmp(workload, "randwrite")) {
 			is_random = U2_RANDOM;
-			is_rw = U2_WRITE;
+			is_rw = is_rw == U2_MIXED ? U2_MIXED : U2_WRITE;
+		} else if (!strcmp(workload, "rw") || !strcmp(workload, "randrw")) {
+			is_random = strcmp(workload, "rw") ? U2_RANDOM : U2_SEQUENTIAL;
+			if (is_rw != U2_MIXED) {
+				is_rw = U2_MIXED;
+				rw_mix = 50;
+			}
+		} else {
+			fprintf(stderr, "invalid workload type %s!\n", workload);
+			return 1;
 		}
 	}
+	if (is_rw == U2_MIXED && rw_mix > 100) {
+		fprintf(stderr, "invalid read percentage %"PRIu32"!\n", rw_mix);
+		return 1;
+	}
+
+	if (parse_distribution(distribution)) {
+		fprintf(stderr, "invalid distribution %s!\n", distribution);
+		return 1;
+	}
+
+	if (parse_sizes(sizes)) {
+		fprintf(stderr, "invalid I/O size distribution %s!\n", sizes);
+		return 1;
+	}
 
 	if (core_mask) {
 		ealargs[1] = malloc(sizeof("-c ") + strlen(core_mask));
@@ -155,10 +360,6 @@ parse_args(int argc, char **argv)
 		mem_chn = 1;
 	}
 
-	//if (!time_in_sec) {
-	//	time_in_sec = U2_TIME_SEC;
-	//}
-
 	return 0;
 }
 
@@ -188,7 +389,6 @@ attach_cb(void *cb_ctx, struct spdk_pci_device *dev, struct spdk_nvme_ctrlr *ctr
 	u2_ns = spdk_nvme_ctrlr_get_ns(u2_ctrlr, u2_ns_id);
 	u2_ns_sector = spdk_nvme_ns_get_sector_size(u2_ns);
 	u2_ns_size = spdk_nvme_ns_get_size(u2_ns);
-	u2_qpair = spdk_nvme_ctrlr_alloc_io_qpair(u2_ctrlr, 0);
 
 	printf("attached to %04x:%02x:%02x.%02x!\n",
 	       spdk_pci_device_get_domain(dev),
@@ -200,6 +400,9 @@ attach_cb(void *cb_ctx, struct spdk_pci_device *dev, struct spdk_nvme_ctrlr *ctr
 static int
 u2_init(void)
 {
+	uint32_t pool_size;
+	unsigned lcore;
+
 	if (rte_eal_init(sizeof(ealargs) / sizeof(ealargs[0]),ealargs) < 0) {
 		fprintf(stderr, "failed to initialize DPDK EAL!\n");
 		return 1;
@@ -209,8 +412,13 @@ u2_init(void)
 	printf(  "  nvme_lat/u2_lat - ict.ncic.syssw.ufo"    );
 	printf("\n========================================\n");
 
+	pool_size = io_depth * (U2_IO_SIZE_MAX / U2_REQUEST_POOL_XFER + 1) * rte_lcore_count();
+	if (pool_size < U2_REQUEST_POOL_SIZE) {
+		pool_size = U2_REQUEST_POOL_SIZE;
+	}
+
 	request_mempool = rte_mempool_create("nvme_request",
-	                                     U2_REQUEST_POOL_SIZE, spdk_nvme_request_size(),
+	                                     pool_size, spdk_nvme_request_size(),
 	                                     U2_REQUEST_CACHE_SIZE, U2_REQUEST_PRIVATE_SIZE,
 	                                     NULL, NULL, NULL, NULL,
 	                                     SOCKET_ID_ANY, 0);
@@ -239,94 +447,378 @@ u2_init(void)
 		return 1;
 	}
 
-	if (!u2_qpair) {
-		fprintf(stderr, "failed to allocate queue pair!\n");
-		return 1;
+	u2_worker_num = 0;
+	RTE_LCORE_FOREACH(lcore) {
+		u2_workers[lcore].qpair = spdk_nvme_ctrlr_alloc_io_qpair(u2_ctrlr, 0);
+		if (!u2_workers[lcore].qpair) {
+			fprintf(stderr, "failed to allocate queue pair for lcore %u!\n", lcore);
+			return 1;
+		}
+		u2_workers[lcore].index = u2_worker_num++;
+
+		u2_workers[lcore].tasks = calloc(io_depth, sizeof(struct u2_task));
+		u2_workers[lcore].free_tasks = calloc(io_depth, sizeof(struct u2_task *));
+		if (!u2_workers[lcore].tasks || !u2_workers[lcore].free_tasks) {
+			fprintf(stderr, "failed to allocate tasks for lcore %u!\n", lcore);
+			return 1;
+		}
 	}
 
 	return 0;
 }
 
+static double
+u2_zeta(uint64_t n, double theta)
+{
+	uint64_t i, exact = n < U2_ZETA_EXACT ? n : U2_ZETA_EXACT;
+	double sum = 0;
+
+	for (i = 1; i <= exact; i++) {
+		sum += pow(i, -theta);
+	}
+	if (n > exact) {
+		sum += (pow(n + 0.5, 1 - theta) - pow(exact + 0.5, 1 - theta)) / (1 - theta);
+	}
+
+	return sum;
+}
+
+static void
+u2_zipf_init(uint64_t n)
+{
+	if (zipf.n == n) {
+		return;
+	}
+
+	zipf.n = n;
+	zipf.alpha = 1 / (1 - zipf.theta);
+	zipf.zetan = u2_zeta(n, zipf.theta);
+	zipf.eta = (1 - pow(2.0 / n, 1 - zipf.theta)) / (1 - u2_zeta(2, zipf.theta) / zipf.zetan);
+	zipf.half_pow_theta = 1 + pow(0.5, zipf.theta);
+}
+
+static inline uint64_t
+u2_rand(struct u2_worker *w)
+{
+	w->seed ^= w->seed >> 12;
+	w->seed ^= w->seed << 25;
+	w->seed ^= w->seed >> 27;
+	return w->seed * 0x2545f4914f6cdd1dULL;
+}
+
+static inline double
+u2_rand_double(struct u2_worker *w)
+{
+	return (u2_rand(w) >> 11) * (1.0 / (1ULL << 53));
+}
+
+static inline uint64_t
+u2_hash(uint64_t v)
+{
+	v ^= v >> 33;
+	v *= 0xff51afd7ed558ccdULL;
+	v ^= v >> 33;
+	v *= 0xc4ceb9fe1a85ec53ULL;
+	v ^= v >> 33;
+	return v;
+}
+
+static inline uint64_t
+u2_zipf_next(struct u2_worker *w)
+{
+	double u = u2_rand_double(w), uz = u * zipf.zetan;
+	uint64_t rank;
+
+	if (uz < 1) {
+		rank = 0;
+	} else if (uz < zipf.half_pow_theta) {
+		rank = 1;
+	} else {
+		rank = zipf.n * pow(zipf.eta * u - zipf.eta + 1, zipf.alpha);
+	}
+
+	return u2_hash(rank) % zipf.n;
+}
+
+static inline uint64_t
+u2_offset_next(struct u2_worker *w, uint32_t units)
+{
+	uint64_t hot;
+
+	if (!is_random) {
+		w->offset_in_ios += units;
+		if (w->offset_in_ios >= size_in_ios) {
+			w->offset_in_ios = 0;
+		}
+		return w->offset_in_ios;
+	}
+
+	switch (dist) {
+	case U2_DIST_ZIPF:
+		return u2_zipf_next(w);
+	case U2_DIST_HOT:
+		hot = size_in_ios * hot_space;
+		if (hot == 0) {
+			hot = 1;
+		}
+		if (u2_rand_double(w) < hot_prob || hot == size_in_ios) {
+			return u2_rand(w) % hot;
+		}
+		return hot + u2_rand(w) % (size_in_ios - hot);
+	default:
+		return u2_rand(w) % size_in_ios;
+	}
+}
+
+static inline uint32_t
+u2_size_next(struct u2_worker *w)
+{
+	uint32_t pick, i;
+
+	if (!io_size_count) {
+		return io_size;
+	}
+
+	pick = u2_rand(w) % io_sizes[io_size_count - 1].weight;
+	for (i = 0; pick >= io_sizes[i].weight; i++) {
+		;
+	}
+
+	return io_sizes[i].size;
+}
+
 static void
 u2_io_complete(void *cb_args, const struct spdk_nvme_cpl *completion)
 {
-	//io_num++;
-	io_depth--;
+	struct u2_task *task = cb_args;
+	struct u2_worker *w = task->w;
+
+	w->free_tasks[w->free_count++] = task;
+	w->inflight--;
+
+	if (w->draining) {
+		return;
+	}
+	if (spdk_nvme_cpl_is_error(completion)) {
+		w->failed++;
+		return;
+	}
+
+	u2_hist_record(&w->hist[task->is_read], rte_get_timer_cycles() - task->tsc_submit);
+	w->completed++;
+	w->bytes += task->size;
 }
 
 static int
-u2_lat_bench(void)
+u2_io_submit(struct u2_worker *w)
 {
-	int i, rc;
-	//int rc;
+	struct u2_task *task;
+	uint32_t nlb;
+	int rc;
 
-	void *buf;
+	if (w->retry) {
+		task = w->retry;
+		w->retry = NULL;
+	} else {
+		task = w->free_tasks[--w->free_count];
+		task->size = u2_size_next(w);
+		task->is_read = is_rw == U2_MIXED ? u2_rand(w) % 100 < rw_mix : is_rw;
+		task->lba = u2_offset_next(w, task->size / io_size_unit) * (io_size_unit / u2_ns_sector);
+	}
+	nlb = task->size / u2_ns_sector;
 
-	uint32_t io_size_blocks;
-	uint64_t offset_in_ios, size_in_ios;
+	task->tsc_submit = rte_get_timer_cycles();
+	if (task->is_read) {
+		rc = spdk_nvme_ns_cmd_read (u2_ns, w->qpair, w->buf, task->lba, nlb, u2_io_complete, task, 0);
+	} else {
+		rc = spdk_nvme_ns_cmd_write(u2_ns, w->qpair, w->buf, task->lba, nlb, u2_io_complete, task, 0);
+	}
+	if (rc == -ENOMEM || rc == ENOMEM) {    // not the mix's fault: keep it, or large I/Os get skipped.
+		w->retry = task;
+	} else if (rc) {
+		w->free_tasks[w->free_count++] = task;
+	}
 
-	uint64_t tsc_rate;
-	uint64_t tsc_start, tsc_elapsed;
-	//uint64_t tsc_end;
+	return rc;
+}
 
-	buf = rte_malloc(NULL, io_size, U2_BUFFER_ALIGN);
-	if (buf == NULL) {
-		fprintf(stderr, "failed to rte_malloc buffer!\n");
-		return 1;
+/*
+ * keeps io_depth commands in flight on the worker's own qpair until io_num
+ * I/Os are done, or until time_in_sec is up if that is given.
+ */
+static int
+u2_worker_run(void *arg)
+{
+	struct u2_worker *w = &u2_workers[rte_lcore_id()];
+	uint64_t tsc_start, tsc_end;
+	int rc;
+
+	w->seed = u2_hash(w->index + 1);
+	w->offset_in_ios = w->index * (size_in_ios / u2_worker_num);
+	w->inflight = 0;
+	w->retry = NULL;
+	w->draining = 0;
+	w->submitted = 0;
+	w->completed = 0;
+	w->failed = 0;
+	w->bytes = 0;
+	u2_hist_init(&w->hist[U2_WRITE]);
+	u2_hist_init(&w->hist[U2_READ]);
+
+	tsc_start = rte_get_timer_cycles();
+	tsc_end = tsc_start + time_in_sec * rte_get_timer_hz();
+	while (1) {
+		while (w->inflight < io_depth && (time_in_sec || w->submitted < io_num)) {
+			rc = u2_io_submit(w);
+			if (rc == -ENOMEM || rc == ENOMEM) {    // request pool drained, by us or other workers: reap first.
+				break;
+			}
+			if (rc) {
+				fprintf(stderr, "failed to submit request %"PRIu64" on lcore %u!\n", w->submitted, rte_lcore_id());
+				while (w->inflight > 0) {
+					spdk_nvme_qpair_process_completions(w->qpair, 0);
+				}
+				return rc;
+			}
+			w->inflight++;
+			w->submitted++;
+		}
+
+		spdk_nvme_qpair_process_completions(w->qpair, 0);
+
+		if (time_in_sec) {
+			if (rte_get_timer_cycles() >= tsc_end) {
+				break;
+			}
+		} else if (w->completed + w->failed >= io_num) {
+			break;
+		}
 	}
-	memset(buf, 0xff, io_size);
+	w->tsc_elapsed = rte_get_timer_cycles() - tsc_start;
 
-	//io_num = 0;
-	//io_depth = 0;
+	if (w->retry) {
+		w->free_tasks[w->free_count++] = w->retry;
+		w->retry = NULL;
+	}
+	w->draining = 1;
+	while (w->inflight > 0) {    // drain, not counted.
+		spdk_nvme_qpair_process_completions(w->qpair, 0);
+	}
 
-	io_size_blocks = io_size / u2_ns_sector;
-	offset_in_ios = -1;
-	size_in_ios = u2_ns_size / io_size;
+	return 0;
+}
 
-	tsc_rate = rte_get_tsc_hz();
-	tsc_elapsed = 0;
-	tsc_start = rte_get_timer_cycles();
-	//tsc_end = rte_get_timer_cycles() + time_in_sec * tsc_rate;
-	for (i = 0; i < io_num; i++) {
-	//while (1) {
-		if (is_random) {
-			offset_in_ios = rand_r(&seed) % size_in_ios;
-		} else {
-			if (++offset_in_ios >= size_in_ios) {
-				offset_in_ios = 0;
+static int
+u2_lat_bench(void)
+{
+	struct u2_worker *w;
+	unsigned lcore;
+	int rc;
+
+	uint64_t tsc_rate;
+	uint64_t tsc_elapsed, tsc_total;
+	uint64_t ios, bytes, failed;
+	double secs, iops;
+	uint32_t i;
+	int op;
+
+	static struct u2_hist hist[2];
+
+	io_size_unit = io_size;
+	if (io_size_count) {
+		io_size_unit = U2_IO_SIZE_MAX;
+		for (i = 0; i < io_size_count; i++) {
+			if (io_sizes[i].size < io_size_unit) {
+				io_size_unit = io_sizes[i].size;
 			}
 		}
+	}
+	size_in_ios = (u2_ns_size - io_size) / io_size_unit + 1;    // io_size is the largest one.
 
-		if (is_rw) {
-			rc = spdk_nvme_ns_cmd_read (u2_ns, u2_qpair, buf, offset_in_ios * io_size_blocks, io_size_blocks, u2_io_complete, NULL, 0);
-		} else {
-			rc = spdk_nvme_ns_cmd_write(u2_ns, u2_qpair, buf, offset_in_ios * io_size_blocks, io_size_blocks, u2_io_complete, NULL, 0);
+	if (dist == U2_DIST_ZIPF) {
+		u2_zipf_init(size_in_ios);
+	}
+
+	RTE_LCORE_FOREACH(lcore) {
+		w = &u2_workers[lcore];
+		w->buf = rte_malloc(NULL, io_size, U2_BUFFER_ALIGN);
+		if (w->buf == NULL) {
+			fprintf(stderr, "failed to rte_malloc buffer!\n");
+			return 1;
+		}
+		memset(w->buf, 0xff, io_size);
+
+		for (w->free_count = 0; w->free_count < io_depth; w->free_count++) {
+			w->tasks[w->free_count].w = w;
+			w->free_tasks[w->free_count] = &w->tasks[w->free_count];
 		}
-		if (rc) {
-			fprintf(stderr, "failed to submit request %d!\n", i);
-			//fprintf(stderr, "failed to submit request %d!\n", io_num);
-			return rc;
+	}
+
+	RTE_LCORE_FOREACH_SLAVE(lcore) {
+		rte_eal_remote_launch(u2_worker_run, NULL, lcore);
+	}
+	rc = u2_worker_run(NULL);
+	RTE_LCORE_FOREACH_SLAVE(lcore) {
+		if (rte_eal_wait_lcore(lcore)) {
+			rc = 1;
 		}
-		io_depth++;    // for latency benchmarking, queue depth stays at 1.
+	}
 
-		while (io_depth > 0) {
-			spdk_nvme_qpair_process_completions(u2_qpair, 0);
+	tsc_rate = rte_get_timer_hz();
+	tsc_elapsed = 0;
+	tsc_total = 0;
+	ios = 0;
+	bytes = 0;
+	failed = 0;
+	u2_hist_init(&hist[U2_WRITE]);
+	u2_hist_init(&hist[U2_READ]);
+	RTE_LCORE_FOREACH(lcore) {
+		w = &u2_workers[lcore];
+		u2_hist_merge(&hist[U2_WRITE], &w->hist[U2_WRITE]);
+		u2_hist_merge(&hist[U2_READ], &w->hist[U2_READ]);
+		bytes += w->bytes;
+		if (w->tsc_elapsed > tsc_elapsed) {
+			tsc_elapsed = w->tsc_elapsed;
 		}
+		tsc_total += w->tsc_elapsed;
+		ios += w->completed;
+		failed += w->failed;
 
-		//if (rte_get_timer_cycles() > tsc_end) {
-		//	break;
-		//}
+		rte_free(w->buf);
+		w->buf = NULL;
 	}
-	tsc_elapsed = rte_get_timer_cycles() - tsc_start;
 
-	printf("\t\t%9.1f us", (float) (tsc_elapsed * 1000000) / (io_num * tsc_rate));
-	printf("\t\t%10.1f s", (float) tsc_elapsed / tsc_rate);
-	printf("\n");
+	if (failed) {
+		fprintf(stderr, "%"PRIu64" I/Os failed, not counted!\n", failed);
+	}
+	if (rc || !ios) {
+		return 1;
+	}
 
-	//printf("\t\t%9.1f us", (float) (time_in_sec * 1000000) / io_num);
-	//printf("\t\t%12"PRIu64"\n", io_num);
+	// polled-mode workers are always busy: cycles/IO is total worker time over I/Os.
+	secs = (double)tsc_elapsed / tsc_rate;
+	iops = ios / secs;
+	printf("\t%12.0f", iops);
+	printf("\t%10.1f", bytes / secs / 1000000);
+	printf("\t%9.1f us", (double)(tsc_total * 1000000) / tsc_rate / ios * io_depth);
+	printf("\t%10.0f", (double)tsc_total * rte_get_tsc_hz() / tsc_rate / ios);
+	printf("\t%8.1f s", secs);
+	printf("\n");
 
-	rte_free(buf);
+	for (op = U2_READ; op >= U2_WRITE; op--) {
+		if (!hist[op].count) {
+			continue;
+		}
+		printf("\t%8s", op == U2_READ ? "read" : "write");
+		printf("\t%9.1f us", (double)hist[op].min * 1000000 / tsc_rate);
+		printf("\t%9.1f us", (double)u2_hist_value_at(&hist[op], 50.0) * 1000000 / tsc_rate);
+		printf("\t%9.1f us", (double)u2_hist_value_at(&hist[op], 90.0) * 1000000 / tsc_rate);
+		printf("\t%9.1f us", (double)u2_hist_value_at(&hist[op], 99.0) * 1000000 / tsc_rate);
+		printf("\t%9.1f us", (double)u2_hist_value_at(&hist[op], 99.9) * 1000000 / tsc_rate);
+		printf("\t%9.1f us", (double)u2_hist_value_at(&hist[op], 99.99) * 1000000 / tsc_rate);
+		printf("\t%9.1f us", (double)hist[op].max * 1000000 / tsc_rate);
+		printf("\n");
+	}
 
 	return 0;
 }
@@ -334,8 +826,14 @@ u2_lat_bench(void)
 static void
 u2_cleanup(void)
 {
-	if (u2_qpair) {
-		spdk_nvme_ctrlr_free_io_qpair(u2_qpair);
+	unsigned lcore;
+
+	RTE_LCORE_FOREACH(lcore) {
+		if (u2_workers[lcore].qpair) {
+			spdk_nvme_ctrlr_free_io_qpair(u2_workers[lcore].qpair);
+		}
+		free(u2_workers[lcore].tasks);
+		free(u2_workers[lcore].free_tasks);
 	}
 
 	if (u2_ctrlr) {
@@ -353,13 +851,20 @@ u2_cleanup(void)
 
 int main(int argc, char *argv[])
 {
+	char rw_type[32], dist_type[64];
+	uint32_t i;
+
 	if (parse_args(argc, argv)) {
 		printf("usage: %s [OPTION]...\n", argv[0]);
-		printf("\t-q [IO number]\n");
-		printf("\t-w [workload type (read, randread, write, randwrite)]\n");
+		printf("\t-q [IO number per worker]\n");
+		printf("\t-d [queue depth per worker]\n");
+		printf("\t-w [workload type (read, randread, write, randwrite, rw, randrw)]\n");
+		printf("\t-M [read percentage of a mixed workload]\n");
+		printf("\t-D [random offset distribution (uniform, zipf:THETA, hot:SPACE%%:IO%%)]\n");
+		printf("\t-s [I/O size distribution (SIZE:WEIGHT,...), instead of 512B-4MB steps]\n");
 		printf("\t-c [core mask]\n");
 		printf("\t-n [memory channels]\n");
-		//printf("\t-t [time in seconds]\n");
+		printf("\t-t [time in seconds, overrides -q]\n");
 		goto FAIL;
 	}
 
@@ -368,12 +873,42 @@ int main(int argc, char *argv[])
 		goto FAIL;
 	}
 
-	printf("u2 latency benchmarking ... RW type: %s %s, IOs: %"PRIu64"\n",
-	       is_random ? "random" : "sequential", is_rw ? "read" : "write", io_num);
-	printf("\t%8s\t\t%12s\t\t%12s\n", "I/O size", "latency", "elapsed time");
-	//printf("u2 latency benchmarking ... RW type: %s %s, Time (s): %"PRIu32"\n",
-	//       is_random ? "random" : "sequential", is_rw ? "read" : "write", time_in_sec);
-	//printf("\t%8s\t\t%12s\t\t%12s\n", "I/O size", "latency", "I/O count");
+	if (is_rw == U2_MIXED) {
+		snprintf(rw_type, sizeof(rw_type), "%"PRIu32"/%"PRIu32" read/write", rw_mix, 100 - rw_mix);
+	} else {
+		snprintf(rw_type, sizeof(rw_type), "%s", is_rw ? "read" : "write");
+	}
+	if (is_random && dist == U2_DIST_ZIPF) {
+		snprintf(dist_type, sizeof(dist_type), ", zipf(%.2f)", zipf.theta);
+	} else if (is_random && dist == U2_DIST_HOT) {
+		snprintf(dist_type, sizeof(dist_type), ", %.0f%% I/Os on %.0f%% space", hot_prob * 100, hot_space * 100);
+	} else {
+		dist_type[0] = '\0';
+	}
+
+	if (time_in_sec) {
+		printf("u2 benchmarking ... RW type: %s %s%s, Time (s): %"PRIu32", QD: %"PRIu32", workers: %"PRIu32"\n",
+		       is_random ? "random" : "sequential", rw_type, dist_type, time_in_sec, io_depth, u2_worker_num);
+	} else {
+		printf("u2 benchmarking ... RW type: %s %s%s, IOs: %"PRIu64", QD: %"PRIu32", workers: %"PRIu32"\n",
+		       is_random ? "random" : "sequential", rw_type, dist_type, io_num, io_depth, u2_worker_num);
+	}
+	printf("\t%8s\t%12s\t%10s\t%12s\t%10s\t%10s\n", "I/O size", "IOPS", "MB/s", "latency", "cycles/IO", "elapsed");
+	printf("\t%8s\t%12s\t%12s\t%12s\t%12s\t%12s\t%12s\t%12s\n", "", "min", "p50", "p90", "p99", "p99.9", "p99.99", "max");
+	if (io_size_count) {    // one run with the mixed sizes.
+		for (i = 0; i < io_size_count; i++) {
+			if (io_sizes[i].size > io_size) {
+				io_size = io_sizes[i].size;
+			}
+		}
+		printf("\t%8s", "mixed");
+		if (u2_lat_bench()) {
+			fprintf(stderr, "failed to benchmark latency - mixed IO sizes!\n");
+			goto FAIL;
+		}
+		goto DONE;
+	}
+
 	while (1) {
 		printf("\t%8d", io_size);
 
@@ -387,6 +922,7 @@ int main(int argc, char *argv[])
 		}
 	}
 
+DONE:
 	u2_cleanup();
 	return 0;
 
@@ -11,16 +11,265 @@ public final class JniNvme {
 		System.loadLibrary("jninvme");
 	}
 
+	public static final int OP_READ  = 0;
+	public static final int OP_WRITE = 1;
+
+	// getBufferPoolStats() indices.
+	public static final int POOL_STAT_HITS     = 0;
+	public static final int POOL_STAT_MISSES   = 1;
+	public static final int POOL_STAT_OVERSIZE = 2;
+	public static final int POOL_STAT_IN_USE   = 3;
+	public static final int POOL_STAT_RESERVED = 4;
+
+	// getLatencyStats() indices; latencies in ns.
+	public static final int LAT_STAT_COUNT = 0;
+	public static final int LAT_STAT_MIN   = 1;
+	public static final int LAT_STAT_MAX   = 2;
+	public static final int LAT_STAT_MEAN  = 3;
+	public static final int LAT_STAT_P50   = 4;
+	public static final int LAT_STAT_P90   = 5;
+	public static final int LAT_STAT_P99   = 6;
+	public static final int LAT_STAT_P999  = 7;
+	public static final int LAT_STAT_P9999 = 8;
+
+	// getIoStats() indices; counters over all threads, INFLIGHT as of now. SUBMIT_CYCLES is time spent submitting (or
+	// staging for a poller in reactor mode), WAIT_CYCLES waiting for completions, PRIO_CYCLES low-priority requests
+	// held back by host-side arbitration, all in CYCLES_HZ units (the TSC).
+	public static final int IO_STAT_READS         = 0;
+	public static final int IO_STAT_WRITES        = 1;
+	public static final int IO_STAT_FLUSHES       = 2;
+	public static final int IO_STAT_READ_BYTES    = 3;
+	public static final int IO_STAT_WRITE_BYTES   = 4;
+	public static final int IO_STAT_SUBMIT_FAILS  = 5;
+	public static final int IO_STAT_SUBMIT_CYCLES = 6;
+	public static final int IO_STAT_WAIT_CYCLES   = 7;
+	public static final int IO_STAT_WAITS         = 8;
+	public static final int IO_STAT_INFLIGHT_MAX  = 9;
+	public static final int IO_STAT_PRIO_CYCLES   = 10;
+	public static final int IO_STAT_INFLIGHT      = 11;
+	public static final int IO_STAT_CONTEXTS      = 12;
+	public static final int IO_STAT_CYCLES_HZ     = 13;
+
+	// getCacheStats() indices; USED and CAPACITY in bytes.
+	public static final int CACHE_STAT_HITS          = 0;
+	public static final int CACHE_STAT_MISSES        = 1;
+	public static final int CACHE_STAT_INSERTS       = 2;
+	public static final int CACHE_STAT_EVICTIONS     = 3;
+	public static final int CACHE_STAT_INVALIDATIONS = 4;
+	public static final int CACHE_STAT_USED          = 5;
+	public static final int CACHE_STAT_CAPACITY      = 6;
+
+	// getKvStats() indices; LIVE in bytes, FLUSHES counts segment writes.
+	public static final int KV_STAT_KEYS        = 0;
+	public static final int KV_STAT_LIVE        = 1;
+	public static final int KV_STAT_SEGMENTS    = 2;
+	public static final int KV_STAT_FREE        = 3;
+	public static final int KV_STAT_PUTS        = 4;
+	public static final int KV_STAT_GETS        = 5;
+	public static final int KV_STAT_DELETES     = 6;
+	public static final int KV_STAT_FLUSHES     = 7;
+	public static final int KV_STAT_COMPACTIONS = 8;
+	public static final int KV_STAT_RELOCATED   = 9;
+
+	// getWalStats() indices; BYTES of payload, GROUPS counts writes (each with a flush), START, DURABLE are LSNs.
+	public static final int WAL_STAT_APPENDS = 0;
+	public static final int WAL_STAT_BYTES   = 1;
+	public static final int WAL_STAT_GROUPS  = 2;
+	public static final int WAL_STAT_START   = 3;
+	public static final int WAL_STAT_DURABLE = 4;
+	public static final int WAL_STAT_FREE    = 5;
+
+	// getRateStats() indices; limits as set (0: none), IOS and BYTES that went through the buckets, THROTTLED of them
+	// held back, for THROTTLE_NS in all; BACKLOG_NS is how far ahead the budget is committed right now.
+	public static final int RATE_STAT_IOPS        = 0;
+	public static final int RATE_STAT_BPS         = 1;
+	public static final int RATE_STAT_IOS         = 2;
+	public static final int RATE_STAT_BYTES       = 3;
+	public static final int RATE_STAT_THROTTLED   = 4;
+	public static final int RATE_STAT_THROTTLE_NS = 5;
+	public static final int RATE_STAT_BACKLOG_NS  = 6;
+
+	// getTelemetry() indices, as of the latest sample. TIME_MS is wall clock, TEMPERATURE in celsius, TEMP_TREND in
+	// millidegrees per minute (smoothed), *_BPS/*_IOPS and MEDIA_ERRORS_NEW since the previous sample, DATA_* in bytes.
+	public static final int TELEM_STAT_TIME_MS          = 0;
+	public static final int TELEM_STAT_TEMPERATURE      = 1;
+	public static final int TELEM_STAT_TEMP_TREND       = 2;
+	public static final int TELEM_STAT_CRITICAL_WARNING = 3;
+	public static final int TELEM_STAT_AVAILABLE_SPARE  = 4;
+	public static final int TELEM_STAT_PERCENTAGE_USED  = 5;
+	public static final int TELEM_STAT_READ_BPS         = 6;
+	public static final int TELEM_STAT_WRITE_BPS        = 7;
+	public static final int TELEM_STAT_READ_IOPS        = 8;
+	public static final int TELEM_STAT_WRITE_IOPS       = 9;
+	public static final int TELEM_STAT_DATA_READ        = 10;
+	public static final int TELEM_STAT_DATA_WRITTEN     = 11;
+	public static final int TELEM_STAT_MEDIA_ERRORS     = 12;
+	public static final int TELEM_STAT_MEDIA_ERRORS_NEW = 13;
+	public static final int TELEM_STAT_UNSAFE_SHUTDOWNS = 14;
+	public static final int TELEM_STAT_POWER_ON_HOURS   = 15;
+	public static final int TELEM_STAT_SAMPLES          = 16;
+	public static final int TELEM_STAT_FAILURES         = 17;
+
+	// nvmeSetPriority() classes.
+	public static final int PRIO_HIGH   = 0;
+	public static final int PRIO_NORMAL = 1;
+	public static final int PRIO_LOW    = 2;
+
+	// nvmeSetBackend() flags for "uring".
+	public static final int URING_SQPOLL = 0x1;
+
 	public static native void nvmeInitialize();
 	public static native void nvmeFinalize();
 
+	// "spdk" (default, path ignored) or "uring" (O_DIRECT on a block device or file); takes effect on nvmeInitialize().
+	public static native void nvmeSetBackend(String backend, String path, int flags);
+	// bytes and sector size of the namespace/device; valid after nvmeInitialize().
+	public static native long nvmeGetSize();
+	public static native int nvmeGetSectorSize();
+
+	// max. requests in flight on the queue pair (at least 2); takes effect on nvmeInitialize().
+	public static native void nvmeSetIoDepth(int depth);
+	// max. per-thread queue pairs; threads beyond that share one (serialized) queue pair.
+	public static native void nvmeSetQueuePairs(int num);
+	// byte-granular nvmeRead()/nvmeWrite(): unaligned heads and tails are bounced (read-modify-write).
+	public static native void nvmeSetUnaligned(boolean enable);
+	// reactor mode: pollers native threads (pinned to core, core + 1, ...; -1 leaves them floating) own the queue
+	// pairs, callers hand requests over lock-free and spin for spinNs before parking. 0 pollers (default) makes
+	// every caller poll for itself; takes effect on nvmeInitialize().
+	public static native void nvmeSetReactor(int pollers, int core, long spinNs);
+	// with several devices attached (SPDK: every controller, uring: a comma-separated path list), they are striped in
+	// units of size bytes (default 128KB, a multiple of the sector size and of 4KB for SPDK); one request may span at
+	// most 32 units per device. takes effect on nvmeInitialize().
+	public static native void nvmeSetStripe(long size);
+	// I/O priorities: with weighted, SPDK enables controllers that support it with weighted round robin arbitration,
+	// and each thread's queue pairs get its priority class (uring sets the class as ioprio). where that is not the
+	// case (or in reactor mode, on the shared queue pair), PRIO_LOW requests wait while lowInflight of them are in
+	// flight and other I/O went out within the last 1ms, 10ms at most; 0 turns that off. takes effect on
+	// nvmeInitialize(), default off/4.
+	public static native void nvmeSetArbitration(boolean weighted, int lowInflight);
+	// PRIO_* of the calling thread's I/O (NvmeRing aside), PRIO_NORMAL by default; waits for its requests in flight.
+	public static native void nvmeSetPriority(int priority);
+
+	// bytes of hugepage memory the buffer pool reserves up front; takes effect on nvmeInitialize().
+	public static native void nvmeSetBufferPool(long size);
+	// bytes of DRAM block cache (4KB blocks, CLOCK eviction) in front of 4KB-aligned nvmeRead()s of up to 256KB; every
+	// write invalidates what it covers. 0 (default) turns it off; takes effect on nvmeInitialize().
+	public static native void nvmeSetCache(long size);
+	public static native long[] getCacheStats();
+	// max. bytes each thread reads ahead of a sequential stream of small (up to 128KB) sector-aligned nvmeRead()s;
+	// the window grows while the prefetched data gets used and shrinks on random reads. 0 (default) turns it off;
+	// takes effect on nvmeInitialize().
+	public static native void nvmeSetReadahead(long size);
+	// write-back staging: sector-aligned nvmeWrite()s smaller than size are merged with adjacent/overlapping ones into
+	// commands of up to size bytes, written back once full, after maxAgeUs (0: only when needed) or on nvmeFlush().
+	// reads (and async/batched I/O) see staged data. 0 (default) turns it off; takes effect on nvmeInitialize().
+	public static native void nvmeSetWriteBuffer(long size, long maxAgeUs);
+
+	// pooled hugepage buffers (power-of-two size classes up to 4MB); not zeroed unless asked for.
 	public static native ByteBuffer allocateHugepageMemory(long size);
+	public static native ByteBuffer allocateHugepageMemory(long size, boolean zero);
+	// the same on a NUMA node, e.g. nvmeGetNumaNode(controller) for a buffer local to that device; -1 is the node of
+	// the volume's devices, which is where the others come from (when known).
+	public static native ByteBuffer allocateHugepageMemory(long size, boolean zero, int node);
 	public static native void freeHugepageMemory(ByteBuffer buffer);
+	public static native long[] getBufferPoolStats();
+
+	// NUMA node of a controller (numbered as for nvmeOpen()), -1 if unknown.
+	public static native int nvmeGetNumaNode(int controller);
+	// the calling thread on the CPUs of a node, -1 for all of them again; 0 or -1 if that failed.
+	public static native int nvmeBindNode(int node);
+	public static native long getBufferAddress(ByteBuffer buffer);
+
+	// per-command submit-to-completion latency histogram over all threads, since the last reset.
+	public static native long[] getLatencyStats();
+	public static native void resetLatencyStats();
+	// per-thread I/O counters (see IO_STAT_*) summed up, since the last reset; NvmeStats has them as an MXBean.
+	public static native long[] getIoStats();
+	public static native void resetIoStats();
 
 	public static native void nvmeWrite(ByteBuffer buffer, long offset, long size);
 	public static native void nvmeRead(ByteBuffer buffer, long offset, long size);
+	// writes back everything staged by nvmeSetWriteBuffer(); nvmeBarrier() also flushes the device's volatile cache, so
+	// every write completed before it is durable. both return 0, (SCT << 8 | SC) or -errno; a failed write back lost
+	// its data, so its status is returned by every call after it.
+	public static native int nvmeFlush();
+	public static native int nvmeBarrier();
+
+	// one command over several hugepage buffers: buffers[i] contributes sizes[i] bytes.
+	public static native void nvmeWritev(ByteBuffer[] buffers, long[] sizes, long offset);
+	public static native void nvmeReadv (ByteBuffer[] buffers, long[] sizes, long offset);
+
+	// async I/O: returns a request token, or -1 if the queue is full (nvmePoll() and retry); one slot of the
+	// I/O depth is kept for the thread's synchronous calls.
+	public static native long nvmeWriteAsync(long buffer, long offset, long size);
+	public static native long nvmeReadAsync (long buffer, long offset, long size);
+	// reaps up to tokens.length completions; status (may be null) gets 0, (SCT << 8 | SC) or -errno.
+	public static native int nvmePoll(long[] tokens, int[] status);
+
+	// submits count packed descriptors (see NvmeBatch) in one call and waits for all; returns # failed.
+	public static native int nvmeSubmitBatch(ByteBuffer descs, int count);
+
+	// shared-memory rings driven by a poller in reactor mode, see NvmeRing; attach returns a handle or -1.
+	public static native long nvmeRingAttach(ByteBuffer ring, int entries);
+	public static native void nvmeRingDetach(long ring);
+	public static native void nvmeRingWait(long ring);
+
+	// a namespace of its own: a handle on namespace nsid of a controller (SPDK: probe order from 0; uring: position in
+	// the path list, nsid 1), or -1. the calls taking a handle go straight to that namespace through per-thread queue
+	// pairs of its own, around cache, readahead, write-back and pollers; their async completions show up in nvmePoll().
+	// close only with nothing in flight on it.
+	public static native long nvmeOpen(int controller, int nsid);
+	public static native void nvmeClose(long handle);
+	public static native long nvmeGetSize(long handle);
+	public static native int nvmeGetSectorSize(long handle);
+	public static native void nvmeWrite(long handle, ByteBuffer buffer, long offset, long size);
+	public static native void nvmeRead(long handle, ByteBuffer buffer, long offset, long size);
+	public static native long nvmeWriteAsync(long handle, long buffer, long offset, long size);
+	public static native long nvmeReadAsync (long handle, long buffer, long offset, long size);
+	public static native int nvmeBarrier(long handle);
+	// per-handle limits (0: none), e.g. one handle per tenant; from any thread at any time. reads and writes over
+	// budget wait in the calling thread for their turn (async ones too), in the order they came in, with up to 10ms
+	// worth of either budget usable at once.
+	public static native void nvmeSetRateLimit(long handle, long iops, long bytesPerSec);
+	public static native long[] getRateStats(long handle);
+
+	// log-structured key-value store in [offset, offset + size) of the volume (4MB segments, at least 4 of them),
+	// formatted first if asked to; returns a handle or -1. keys of 1 to 1024 bytes, values of up to 1MB, both in
+	// direct buffers of any kind (copied, from index 0); length arguments are the bytes to use. calls return 0 or
+	// -errno (-ENOENT for no such key, -ENOSPC once compaction cannot free a segment); get returns the value's length
+	// and only copies it if the buffer (may be null) holds that many bytes. puts and deletes are durable after sync;
+	// close writes everything out.
+	public static native long nvmeKvOpen(long offset, long size, boolean format);
+	public static native void nvmeKvClose(long kv);
+	public static native int nvmeKvPut(long kv, ByteBuffer key, int keyLength, ByteBuffer value, int valueLength);
+	public static native int nvmeKvGet(long kv, ByteBuffer key, int keyLength, ByteBuffer value);
+	public static native int nvmeKvDelete(long kv, ByteBuffer key, int keyLength);
+	public static native int nvmeKvSync(long kv);
+	public static native long[] getKvStats(long kv);
+
+	// write-ahead log in [offset, offset + size) of the volume (at least 5MB), formatted first if asked to; returns a
+	// handle or -1 (see NvmeWal for futures). append copies up to 512KB from a direct buffer of any kind (from index
+	// 0) and returns the record's LSN or -errno (-ENOSPC until truncated); concurrent appends are written and flushed
+	// together. await blocks until the record at lsn is durable or timeoutNanos (< 0: no limit) passes, and returns
+	// the LSN everything before which is durable, or -errno. truncate drops the records before a durable LSN.
+	// replay fills buffer with the records found on open, as LSN (8), length (4), CRC-32C (4), payload padded to 8
+	// bytes, native byte order; returns the bytes filled, 0 at the end. close writes out what was appended; no call
+	// on the log may be in progress.
+	public static native long nvmeWalOpen(long offset, long size, boolean format);
+	public static native void nvmeWalClose(long wal);
+	public static native long nvmeWalAppend(long wal, ByteBuffer record, int length);
+	public static native long nvmeWalAwait(long wal, long lsn, long timeoutNanos);
+	public static native int nvmeWalTruncate(long wal, long lsn);
+	public static native int nvmeWalReplay(long wal, ByteBuffer buffer);
+	public static native long[] getWalStats(long wal);
 
-	//public static native void nvmeWriteAsync(long buffer, long offset, long size);
-	//public static native void nvmeReadAsync (long buffer, long offset, long size);
-	//public static native void nvmePoll();
+	// SMART/health telemetry: a native thread reads every controller's health log through the admin queue each
+	// intervalMs (I/O goes on meanwhile) and, unless path is null, appends each sample to it as a line of JSON. start
+	// returns 0 or -errno (-EBUSY if running, -ENOTSUP if no controller hands out the log, e.g. uring on a file);
+	// nvmeFinalize() stops it. getTelemetry() (see TELEM_STAT_*) and getTelemetryJson() return the latest sample of a
+	// controller (SPDK: probe order from 0; uring: position in the path list), or null before the first one.
+	public static native int nvmeTelemetryStart(int intervalMs, String path);
+	public static native void nvmeTelemetryStop();
+	public static native long[] getTelemetry(int controller);
+	public static native String getTelemetryJson(int controller);
 }
@@ -0,0 +1,73 @@
+/*
+ * Copyleft 2016, AZQ. All rites reversed.
+ */
+
+package ac.ncic.syssw.jni;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
+/**
+ * packs I/O descriptors for JniNvme.nvmeSubmitBatch(); layout (native byte order, 32 bytes each):
+ * buffer address (8), device offset (8), size (4), opcode (2), flags (2), status (4), tag (4).
+ */
+public final class NvmeBatch {
+
+	public static final int DESC_SIZE = 32;
+
+	private static final int BUF    = 0;
+	private static final int OFFSET = 8;
+	private static final int SIZE   = 16;
+	private static final int OPCODE = 20;
+	private static final int STATUS = 24;
+
+	private final ByteBuffer descs;
+	private final int capacity;
+	private int count;
+
+	public NvmeBatch(int capacity) {
+		this.descs = ByteBuffer.allocateDirect(capacity * DESC_SIZE).order(ByteOrder.nativeOrder());
+		this.capacity = capacity;
+	}
+
+	public int add(long buffer, long offset, int size, int opcode) {
+		if (count == capacity) {
+			throw new IllegalStateException("batch full");
+		}
+
+		int base = count * DESC_SIZE;
+		descs.putLong (base + BUF,    buffer);
+		descs.putLong (base + OFFSET, offset);
+		descs.putInt  (base + SIZE,   size);
+		descs.putShort(base + OPCODE, (short) opcode);
+		descs.putInt  (base + STATUS, 0);
+
+		return count++;
+	}
+
+	public int read(long buffer, long offset, int size) {
+		return add(buffer, offset, size, JniNvme.OP_READ);
+	}
+
+	public int write(long buffer, long offset, int size) {
+		return add(buffer, offset, size, JniNvme.OP_WRITE);
+	}
+
+	// submits all queued descriptors; returns the number of failed entries.
+	public int submit() {
+		return JniNvme.nvmeSubmitBatch(descs, count);
+	}
+
+	// 0 on success, NVMe (SCT << 8 | SC) on device error, -errno if never submitted.
+	public int status(int index) {
+		return descs.getInt(index * DESC_SIZE + STATUS);
+	}
+
+	public int size() {
+		return count;
+	}
+
+	public void clear() {
+		count = 0;
+	}
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyleft 2016, AZQ. All rites reversed.
+ */
+
+package ac.ncic.syssw.jni;
+
+import java.lang.reflect.Field;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
+import sun.misc.Unsafe;
+
+/**
+ * io_uring-style submission/completion rings shared with a native poller (reactor mode, see
+ * JniNvme.nvmeSetReactor()): offer() and poll() only touch memory, no JNI on the hot path. single producer and
+ * single consumer on the Java side, i.e. one thread at a time.
+ *
+ * layout (native byte order): SQ tail, SQ head, CQ tail, CQ head on their own 64-byte lines, then entries
+ * submission entries of buffer address (8), device offset (8), size (4), opcode (2), flags (2), user data (8),
+ * then entries completion entries of user data (8), status (4), reserved (4).
+ */
+public final class NvmeRing {
+
+	public static final int SQE_SIZE = 32;
+	public static final int CQE_SIZE = 16;
+
+	private static final int SQ_TAIL = 0;
+	private static final int SQ_HEAD = 64;
+	private static final int CQ_TAIL = 128;
+	private static final int CQ_HEAD = 192;
+	private static final int HEADER  = 256;
+
+	private static final int SQE_BUF    = 0;
+	private static final int SQE_OFFSET = 8;
+	private static final int SQE_LEN    = 16;
+	private static final int SQE_OPCODE = 20;
+	private static final int SQE_USER   = 24;
+
+	private static final int CQE_USER   = 0;
+	private static final int CQE_STATUS = 8;
+
+	private static final Unsafe UNSAFE;
+	static {
+		try {
+			Field field = Unsafe.class.getDeclaredField("theUnsafe");
+			field.setAccessible(true);
+			UNSAFE = (Unsafe) field.get(null);
+		} catch (Exception e) {
+			throw new ExceptionInInitializerError(e);
+		}
+	}
+
+	private final ByteBuffer ring;
+	private final long address;
+	private final int entries;
+	private final int mask;
+	private final int cqBase;
+	private long handle;
+
+	private int sqTail;
+	private int sqHead;    // last seen native SQ head.
+	private int cqHead;
+
+	// entries: power of two, at most the max. I/O depth.
+	public NvmeRing(int entries) {
+		if (entries < 1 || (entries & (entries - 1)) != 0) {
+			throw new IllegalArgumentException("entries must be a power of two");
+		}
+
+		this.ring = JniNvme.allocateHugepageMemory(HEADER + (long) entries * (SQE_SIZE + CQE_SIZE), true)
+		                   .order(ByteOrder.nativeOrder());
+		this.address = JniNvme.getBufferAddress(ring);
+		this.entries = entries;
+		this.mask = entries - 1;
+		this.cqBase = HEADER + entries * SQE_SIZE;
+
+		this.handle = JniNvme.nvmeRingAttach(ring, entries);
+		if (handle == -1) {
+			JniNvme.freeHugepageMemory(ring);
+			throw new IllegalStateException("failed to attach ring (reactor mode off?)");
+		}
+	}
+
+	// queues one I/O and makes it visible to the poller; false if the SQ is full.
+	public boolean offer(long buffer, long offset, int size, int opcode, long userData) {
+		if (sqTail - sqHead == entries) {
+			sqHead = UNSAFE.getIntVolatile(null, address + SQ_HEAD);
+			if (sqTail - sqHead == entries) {
+				return false;
+			}
+		}
+
+		int base = HEADER + (sqTail & mask) * SQE_SIZE;
+		ring.putLong (base + SQE_BUF,    buffer);
+		ring.putLong (base + SQE_OFFSET, offset);
+		ring.putInt  (base + SQE_LEN,    size);
+		ring.putShort(base + SQE_OPCODE, (short) opcode);
+		ring.putLong (base + SQE_USER,   userData);
+
+		UNSAFE.putOrderedInt(null, address + SQ_TAIL, ++sqTail);
+
+		return true;
+	}
+
+	public boolean read(long buffer, long offset, int size, long userData) {
+		return offer(buffer, offset, size, JniNvme.OP_READ, userData);
+	}
+
+	public boolean write(long buffer, long offset, int size, long userData) {
+		return offer(buffer, offset, size, JniNvme.OP_WRITE, userData);
+	}
+
+	// reaps up to userData.length completions; status gets 0, NVMe (SCT << 8 | SC) or -errno.
+	public int poll(long[] userData, int[] status) {
+		int tail = UNSAFE.getIntVolatile(null, address + CQ_TAIL);
+		int max = Math.min(userData.length, status.length);
+		int n;
+
+		for (n = 0; n < max && cqHead != tail; n++, cqHead++) {
+			int base = cqBase + (cqHead & mask) * CQE_SIZE;
+			userData[n] = ring.getLong(base + CQE_USER);
+			status[n]   = ring.getInt (base + CQE_STATUS);
+		}
+		if (n > 0) {
+			UNSAFE.putOrderedInt(null, address + CQ_HEAD, cqHead);
+		}
+
+		return n;
+	}
+
+	// parks the caller until there is something to poll(); only with I/O outstanding.
+	public void await() {
+		if (cqHead == UNSAFE.getIntVolatile(null, address + CQ_TAIL)) {
+			JniNvme.nvmeRingWait(handle);
+		}
+	}
+
+	public int capacity() {
+		return entries;
+	}
+
+	// waits for what the poller has taken already; completions not polled by then are dropped.
+	public void close() {
+		if (handle != -1) {
+			JniNvme.nvmeRingDetach(handle);
+			JniNvme.freeHugepageMemory(ring);
+			handle = -1;
+		}
+	}
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyleft 2016, AZQ. All rites reversed.
+ */
+
+package ac.ncic.syssw.jni;
+
+import java.lang.management.ManagementFactory;
+
+import javax.management.JMException;
+import javax.management.ObjectName;
+
+/**
+ * JniNvme.getIoStats() and getLatencyStats() as an MXBean. a JMX client reads attributes one by one, so both are
+ * fetched at most every SNAPSHOT_NANOS and the attributes of one read come from the same snapshot.
+ */
+public final class NvmeStats implements NvmeStatsMXBean {
+
+	public static final String NAME = "ac.ncic.syssw.jni:type=NvmeStats";
+
+	private static final long SNAPSHOT_NANOS = 100_000_000L;
+
+	private long[] io;
+	private long[] lat;
+	private long taken;
+
+	private static final int RATE_OPS   = 0;
+	private static final int RATE_BYTES = 1;
+
+	private final long[] rateValue = new long[2];      // as of the previous read of each rate ...
+	private final long[] rateTaken = new long[2];
+	private final double[] rate = new double[2];       // ... and what it returned.
+
+	// registers an instance with the platform MBean server; idempotent.
+	public static synchronized ObjectName register() throws JMException {
+		ObjectName name = new ObjectName(NAME);
+
+		if (!ManagementFactory.getPlatformMBeanServer().isRegistered(name)) {
+			ManagementFactory.getPlatformMBeanServer().registerMBean(new NvmeStats(), name);
+		}
+		return name;
+	}
+
+	public static synchronized void unregister() throws JMException {
+		ObjectName name = new ObjectName(NAME);
+
+		if (ManagementFactory.getPlatformMBeanServer().isRegistered(name)) {
+			ManagementFactory.getPlatformMBeanServer().unregisterMBean(name);
+		}
+	}
+
+	private synchronized long[] io() {
+		long now = System.nanoTime();
+
+		if (io == null || now - taken > SNAPSHOT_NANOS) {
+			io = JniNvme.getIoStats();
+			lat = JniNvme.getLatencyStats();
+			taken = now;
+		}
+		return io;
+	}
+
+	private synchronized long[] lat() {
+		io();
+		return lat;
+	}
+
+	private long nanos(long cycles) {
+		long hz = io()[JniNvme.IO_STAT_CYCLES_HZ];
+		return hz > 0 ? (long) (cycles * 1e9 / hz) : 0;
+	}
+
+	private long ops() {
+		long[] s = io();
+		return s[JniNvme.IO_STAT_READS] + s[JniNvme.IO_STAT_WRITES] + s[JniNvme.IO_STAT_FLUSHES];
+	}
+
+	@Override public long getReads()          { return io()[JniNvme.IO_STAT_READS]; }
+	@Override public long getWrites()         { return io()[JniNvme.IO_STAT_WRITES]; }
+	@Override public long getFlushes()        { return io()[JniNvme.IO_STAT_FLUSHES]; }
+	@Override public long getReadBytes()      { return io()[JniNvme.IO_STAT_READ_BYTES]; }
+	@Override public long getWriteBytes()     { return io()[JniNvme.IO_STAT_WRITE_BYTES]; }
+	@Override public long getSubmitFailures() { return io()[JniNvme.IO_STAT_SUBMIT_FAILS]; }
+	@Override public long getInflight()       { return io()[JniNvme.IO_STAT_INFLIGHT]; }
+	@Override public long getMaxInflight()    { return io()[JniNvme.IO_STAT_INFLIGHT_MAX]; }
+	@Override public long getThreads()        { return io()[JniNvme.IO_STAT_CONTEXTS]; }
+
+	@Override public long getSubmitNanos() { return nanos(io()[JniNvme.IO_STAT_SUBMIT_CYCLES]); }
+	@Override public long getWaitNanos()   { return nanos(io()[JniNvme.IO_STAT_WAIT_CYCLES]); }
+	@Override public long getPriorityHoldNanos() { return nanos(io()[JniNvme.IO_STAT_PRIO_CYCLES]); }
+
+	@Override
+	public long getSubmitNanosPerOp() {
+		long ops = ops();
+		return ops > 0 ? getSubmitNanos() / ops : 0;
+	}
+
+	@Override
+	public long getWaitNanosPerOp() {
+		long waits = io()[JniNvme.IO_STAT_WAITS];
+		return waits > 0 ? getWaitNanos() / waits : 0;
+	}
+
+	// per second between the snapshot of the previous read and this one; the same again within a snapshot.
+	private synchronized double rate(int which, long value) {
+		if (taken != rateTaken[which]) {
+			rate[which] = rateTaken[which] != 0 ? (value - rateValue[which]) * 1e9 / (taken - rateTaken[which]) : 0;
+			rateValue[which] = value;
+			rateTaken[which] = taken;
+		}
+		return rate[which];
+	}
+
+	@Override public double getOpsPerSecond()   { return rate(RATE_OPS, ops()); }
+	@Override public double getBytesPerSecond() { return rate(RATE_BYTES, getReadBytes() + getWriteBytes()); }
+
+	@Override public long getLatencyP50Nanos()  { return lat()[JniNvme.LAT_STAT_P50]; }
+	@Override public long getLatencyP99Nanos()  { return lat()[JniNvme.LAT_STAT_P99]; }
+	@Override public long getLatencyP999Nanos() { return lat()[JniNvme.LAT_STAT_P999]; }
+	@Override public long getLatencyMaxNanos()  { return lat()[JniNvme.LAT_STAT_MAX]; }
+
+	@Override
+	public synchronized void reset() {
+		JniNvme.resetIoStats();
+		JniNvme.resetLatencyStats();
+		io = null;
+		rateTaken[RATE_OPS] = rateTaken[RATE_BYTES] = 0;
+	}
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyleft 2016, AZQ. All rites reversed.
+ */
+
+package ac.ncic.syssw.jni;
+
+/**
+ * libjninvme I/O counters and latencies over all threads, see NvmeStats.
+ */
+public interface NvmeStatsMXBean {
+
+	long getReads();
+	long getWrites();
+	long getFlushes();
+	long getReadBytes();
+	long getWriteBytes();
+	long getSubmitFailures();
+
+	long getInflight();
+	long getMaxInflight();
+	long getThreads();
+
+	// cumulative time spent submitting and waiting for completions, over all threads.
+	long getSubmitNanos();
+	long getWaitNanos();
+	// mean time per request for each.
+	long getSubmitNanosPerOp();
+	long getWaitNanosPerOp();
+	// low-priority requests held back by host-side arbitration.
+	long getPriorityHoldNanos();
+
+	// since the previous call.
+	double getOpsPerSecond();
+	double getBytesPerSecond();
+
+	long getLatencyP50Nanos();
+	long getLatencyP99Nanos();
+	long getLatencyP999Nanos();
+	long getLatencyMaxNanos();
+
+	void reset();
+}
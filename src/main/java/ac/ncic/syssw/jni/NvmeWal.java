@@ -0,0 +1,142 @@
+/*
+ * Copyleft 2016, AZQ. All rites reversed.
+ */
+
+package ac.ncic.syssw.jni;
+
+import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.util.Map;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.ConcurrentNavigableMap;
+import java.util.concurrent.ConcurrentSkipListMap;
+import java.util.function.ObjLongConsumer;
+
+/**
+ * write-ahead log with group commit (see JniNvme.nvmeWalOpen()): append() from any number of threads returns a
+ * future of the record's LSN that completes once the group it went out with is durable. one completer thread waits
+ * in the native log for groups to become durable and completes the futures up to there.
+ */
+public final class NvmeWal implements AutoCloseable {
+
+	private static final long AWAIT_NANOS = 100_000_000L;    // how often the completer checks for close().
+	private static final int  HEADER      = 16;
+
+	private final long handle;
+	private final ConcurrentSkipListMap<Long, CompletableFuture<Long>> pending = new ConcurrentSkipListMap<>();
+	private final Thread completer;
+
+	private volatile long durable = -1;
+	private volatile boolean closed;
+	private volatile IOException failure;    // sticky: the log is of no use after a write error.
+
+	public NvmeWal(long offset, long size, boolean format) {
+		this.handle = JniNvme.nvmeWalOpen(offset, size, format);
+		if (handle == -1) {
+			throw new IllegalStateException("failed to open log");
+		}
+
+		this.completer = new Thread(this::complete, "nvme-wal-completer");
+		completer.setDaemon(true);
+		completer.start();
+	}
+
+	// length bytes of record, a direct buffer, from index 0; the record is copied before this returns.
+	public CompletableFuture<Long> append(ByteBuffer record, int length) {
+		if (closed) {
+			throw new IllegalStateException("log closed");
+		}
+
+		CompletableFuture<Long> future = new CompletableFuture<>();
+		if (failure != null) {
+			future.completeExceptionally(failure);
+			return future;
+		}
+
+		long lsn = JniNvme.nvmeWalAppend(handle, record, length);
+		if (lsn < 0) {
+			future.completeExceptionally(new IOException("append failed (" + lsn + ")"));
+			return future;
+		}
+
+		pending.put(lsn, future);
+		if (lsn < durable && pending.remove(lsn) != null) {    // the completer was there first.
+			future.complete(lsn);
+		} else if (failure != null && pending.remove(lsn) != null) {    // ... or has given up.
+			future.completeExceptionally(failure);
+		}
+		return future;
+	}
+
+	// drops the records before lsn, which has to be durable.
+	public void truncate(long lsn) throws IOException {
+		int rc = JniNvme.nvmeWalTruncate(handle, lsn);
+		if (rc != 0) {
+			throw new IOException("truncate failed (" + rc + ")");
+		}
+	}
+
+	// hands each record found on open to consumer, oldest first; buffer and LSN are only valid during the call.
+	public void replay(ObjLongConsumer<ByteBuffer> consumer) throws IOException {
+		ByteBuffer buffer = ByteBuffer.allocateDirect(1 << 20).order(ByteOrder.nativeOrder());
+		int n;
+
+		while ((n = JniNvme.nvmeWalReplay(handle, buffer)) > 0) {
+			for (int pos = 0; pos < n; ) {
+				long lsn = buffer.getLong(pos);
+				int length = buffer.getInt(pos + 8);
+
+				buffer.limit(pos + HEADER + length).position(pos + HEADER);
+				consumer.accept(buffer.slice(), lsn);
+				buffer.clear();
+				pos += (HEADER + length + 7) & ~7;
+			}
+		}
+		if (n < 0) {
+			throw new IOException("replay failed (" + n + ")");
+		}
+	}
+
+	public long[] getStats() {
+		return JniNvme.getWalStats(handle);
+	}
+
+	// completes what was appended before, then closes the log; appends must not race with it.
+	@Override
+	public void close() throws InterruptedException {
+		if (closed) {
+			return;
+		}
+		closed = true;
+		completer.join();
+		JniNvme.nvmeWalClose(handle);
+	}
+
+	private void complete() {
+		while (!closed || !pending.isEmpty()) {
+			Map.Entry<Long, CompletableFuture<Long>> first = pending.firstEntry();
+			long rc = JniNvme.nvmeWalAwait(handle, first != null ? first.getKey() : durable, AWAIT_NANOS);
+
+			if (rc < 0) {    // fails what is pending and stops: the error sticks, so awaiting again won't block.
+				failure = new IOException("log write failed (" + rc + ")");
+				for (Long lsn : pending.keySet()) {
+					CompletableFuture<Long> future = pending.remove(lsn);
+					if (future != null) {
+						future.completeExceptionally(failure);
+					}
+				}
+				return;
+			}
+
+			durable = rc;
+			ConcurrentNavigableMap<Long, CompletableFuture<Long>> done = pending.headMap(rc);
+			for (Long lsn : done.keySet()) {
+				CompletableFuture<Long> future = done.remove(lsn);
+				if (future != null) {
+					future.complete(lsn);
+				}
+			}
+		}
+	}
+}
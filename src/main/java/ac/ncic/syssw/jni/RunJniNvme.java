@@ -10,7 +10,6 @@ import java.util.Random;
 public class RunJniNvme {
 
 	public static final int U2_IO_NUMBER = 8192;
-	public static final long U2_NS_SIZE = 400000000000L;
 
 	public static final int U2_IO_SIZE_MIN = 512;
 	public static final int U2_IO_SIZE_MAX = 4194304;
@@ -24,8 +23,47 @@ public class RunJniNvme {
 		return INSTANCE;
 	}
 
-	public void helloWorldJniNvme() {
+	// -Djninvme.backend=uring -Djninvme.path=/dev/nvme0n1 [-Djninvme.sqpoll=true] to go through the kernel,
+	// -Djninvme.stripe=BYTES for the striping unit across devices,
+	// -Djninvme.reactor=N [-Djninvme.reactor.core=8 -Djninvme.reactor.spin=20000] for N poller threads,
+	// -Djninvme.wrr=true for weighted round robin arbitration, -Djninvme.lowInflight=N to limit low-priority I/O,
+	// -Djninvme.cache=BYTES for a block cache, -Djninvme.readahead=BYTES to read ahead of sequential streams,
+	// -Djninvme.wbuf=BYTES [-Djninvme.wbuf.age=1000] to merge small writes.
+	static void initialize() {
+		String backend = System.getProperty("jninvme.backend");
+		if (backend != null) {
+			JniNvme.nvmeSetBackend(backend, System.getProperty("jninvme.path"),
+			                       Boolean.getBoolean("jninvme.sqpoll") ? JniNvme.URING_SQPOLL : 0);
+		}
+		long stripe = Long.getLong("jninvme.stripe", 0);
+		if (stripe > 0) {
+			JniNvme.nvmeSetStripe(stripe);
+		}
+		int pollers = Integer.getInteger("jninvme.reactor", 0);
+		if (pollers > 0) {
+			JniNvme.nvmeSetReactor(pollers, Integer.getInteger("jninvme.reactor.core", -1),
+			                       Long.getLong("jninvme.reactor.spin", 20000));
+		}
+		if (Boolean.getBoolean("jninvme.wrr") || System.getProperty("jninvme.lowInflight") != null) {
+			JniNvme.nvmeSetArbitration(Boolean.getBoolean("jninvme.wrr"), Integer.getInteger("jninvme.lowInflight", 4));
+		}
+		long cache = Long.getLong("jninvme.cache", 0);
+		if (cache > 0) {
+			JniNvme.nvmeSetCache(cache);
+		}
+		long readahead = Long.getLong("jninvme.readahead", 0);
+		if (readahead > 0) {
+			JniNvme.nvmeSetReadahead(readahead);
+		}
+		long wbuf = Long.getLong("jninvme.wbuf", 0);
+		if (wbuf > 0) {
+			JniNvme.nvmeSetWriteBuffer(wbuf, Long.getLong("jninvme.wbuf.age", 1000));
+		}
 		JniNvme.nvmeInitialize();
+	}
+
+	public void helloWorldJniNvme() {
+		initialize();
 
 		System.out.println("[helloWorldJniNvme]");
 
@@ -50,13 +88,14 @@ public class RunJniNvme {
 	}
 
 	public void latencyBenchmarkJniNvme() {
-		JniNvme.nvmeInitialize();
+		initialize();
 
 		System.out.println("[latencyBenchmarkJniNvme]");
 
 		System.out.printf("u2-java latency benchmarking ... RW type: sequential read, IOs: %d\n", U2_IO_NUMBER);
-		System.out.printf("\t%8s\t\t%12s\t\t%12s\n", "I/O size", "latency", "elapsed time");
+		System.out.printf("\t%8s\t\t%12s\t\t%12s\t\t%12s\t%12s\t%12s\n", "I/O size", "latency", "elapsed time", "p50", "p99", "p99.9");
 
+		long nsSize = JniNvme.nvmeGetSize();
 		long offset = 0;
 		long elapsedTime = 0;
 		long startTime = 0;
@@ -65,11 +104,12 @@ public class RunJniNvme {
 
 			ByteBuffer buffer = JniNvme.allocateHugepageMemory(ioSize);
 
+			JniNvme.resetLatencyStats();
 			startTime = System.nanoTime();
 			for (int i = 0; i < U2_IO_NUMBER; i++) {
 				JniNvme.nvmeRead(buffer, offset, ioSize);
 				offset += ioSize;
-				if (offset > U2_NS_SIZE - ioSize) {
+				if (offset > nsSize - ioSize) {
 					offset = 0;
 				}
 			}
@@ -77,6 +117,11 @@ public class RunJniNvme {
 
 			System.out.printf("\t\t%9.1f us", (float) elapsedTime / 1000 / U2_IO_NUMBER);
 			System.out.printf("\t\t%10.1f s", (float) elapsedTime / 1000000000);
+
+			long[] lat = JniNvme.getLatencyStats();
+			System.out.printf("\t\t%9.1f us", (float) lat[JniNvme.LAT_STAT_P50] / 1000);
+			System.out.printf("\t%9.1f us", (float) lat[JniNvme.LAT_STAT_P99] / 1000);
+			System.out.printf("\t%9.1f us", (float) lat[JniNvme.LAT_STAT_P999] / 1000);
 			System.out.printf("\n");
 
 			JniNvme.freeHugepageMemory(buffer);